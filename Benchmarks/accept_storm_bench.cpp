@@ -0,0 +1,229 @@
+// How long a reconnect storm takes, e.g. every client of a restarted server coming back at once.
+//
+// A ReactorEngine runs on its own thread with a handler that queues a welcome for every new connection, like
+// ChatServer does. The clients all start a non-blocking connect at the same moment and a client counts as
+// connected once its welcome arrives. Connections the backlog had no room for are retried by the kernel after
+// a second, so how many clients took longer than that is the number to watch. Each backend runs with an
+// accept budget of 1, one accept per wakeup like the servers used to, and with the default budget.
+//
+// Linux only, build and run from the repository root:
+//   g++ -O2 -std=c++17 -pthread -o accept_storm_bench Benchmarks/accept_storm_bench.cpp
+//   ulimit -n 20000 && ./accept_storm_bench
+//
+// Both ends of every connection are in this process, so it needs two descriptors per client.
+
+#include "../ChatServer/reactor_engine.h"
+#include "../Common/chat_messages.h"
+#include "../Common/latency_histogram.h"
+#include "bench_sockets.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// Queues a welcome for every connection, nothing else
+class WelcomeHandler : public ServerEvents
+{
+public:
+
+	ServerEngine& m_Engine;
+	Buffer m_Welcome;
+	uint32_t m_WelcomeSize;
+
+	WelcomeHandler(ServerEngine& engine)
+		: m_Engine(engine)
+	{
+		ChatMessage welcome;
+		welcome.message = "Welcome to the chat room!";
+		m_WelcomeSize = encodeMessage(welcome, m_Welcome);
+	}
+
+	void OnConnected(SOCKET socket) override
+	{
+		m_Engine.Send(socket, m_Welcome.Data(), (int)m_WelcomeSize);
+	}
+
+	void OnFrame(SOCKET socket, const uint8_t* frame, uint32_t packetSize) override
+	{
+	}
+
+	void OnDisconnected(SOCKET socket) override
+	{
+	}
+};
+
+struct StormResult
+{
+	bool ran;
+	int connected;
+	double seconds;
+	LatencyHistogram latencies;	// connect to welcome, in microseconds
+	int slowerThanRetry;
+};
+
+// Engines run forever, so the server thread is left behind once its run is over
+static bool startServer(const std::string& backend, SOCKET listenSocket, int acceptBudget)
+{
+	std::atomic<int> state(0);	// 1 running, -1 unavailable
+
+	std::thread([&backend, listenSocket, acceptBudget, &state]()
+	{
+		std::unique_ptr<Reactor> reactor = createReactor(backend);
+		if (!reactor)
+		{
+			state = -1;
+			return;
+		}
+
+		ReactorEngine* engine = new ReactorEngine(std::move(reactor));
+		engine->m_AcceptBudget = acceptBudget;
+		WelcomeHandler* handler = new WelcomeHandler(*engine);
+		state = 1;
+
+		engine->Run(listenSocket, *handler);
+	}).detach();
+
+	while (state.load() == 0)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	return state.load() == 1;
+}
+
+static void runStorm(const char* backend, int clients, int acceptBudget, StormResult& stormResult)
+{
+	stormResult.ran = false;
+	stormResult.connected = 0;
+	stormResult.seconds = 0.0;
+	stormResult.latencies.Clear();
+	stormResult.slowerThanRetry = 0;
+
+	sockaddr_in address;
+	SOCKET listenSocket = listenOnLoopback(address);
+	if (listenSocket == INVALID_SOCKET)
+		return;
+
+	if (!startServer(backend, listenSocket, acceptBudget))
+	{
+		closesocket(listenSocket);
+		return;
+	}
+
+	EpollReactor waiting;
+	std::vector<SOCKET> sockets;
+	std::vector<std::chrono::steady_clock::time_point> connectStarts(clients);
+	std::unordered_map<SOCKET, int> clientIndex;
+	sockets.reserve(clients);
+
+	// Everyone at once, the kernel finishes the handshakes while we carry on
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < clients; i++)
+	{
+		SOCKET clientSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+		if (clientSocket == INVALID_SOCKET)
+		{
+			printf("socket failed with error %d after %d clients\n", WSAGetLastError(), i);
+			break;
+		}
+
+		connectStarts[i] = std::chrono::steady_clock::now();
+		if (connect(clientSocket, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR && errno != EINPROGRESS)
+		{
+			printf("connect failed with error %d after %d clients\n", WSAGetLastError(), i);
+			closesocket(clientSocket);
+			break;
+		}
+
+		sockets.push_back(clientSocket);
+		clientIndex[clientSocket] = i;
+		waiting.Add(clientSocket, REACTOR_READ);
+	}
+
+	// A client is in once its welcome arrives. Gives up after a few SYN retries.
+	std::vector<ReactorEvent> readyEvents;
+	char welcome[256];
+	int remaining = (int)sockets.size();
+	while (remaining > 0 && std::chrono::steady_clock::now() - start < std::chrono::seconds(15))
+	{
+		int count = waiting.Wait(readyEvents, 1000);
+		auto now = std::chrono::steady_clock::now();
+		for (int i = 0; i < count; i++)
+		{
+			SOCKET clientSocket = readyEvents[i].socket;
+			if (recv(clientSocket, welcome, sizeof(welcome), RECV_DONTWAIT) <= 0)
+				continue;
+
+			double waited = std::chrono::duration<double>(now - connectStarts[clientIndex[clientSocket]]).count();
+			stormResult.latencies.Record((uint64_t)(waited * 1e6));
+			if (waited > 1.0)
+				stormResult.slowerThanRetry++;
+
+			waiting.Remove(clientSocket);
+			remaining--;
+		}
+	}
+
+	stormResult.ran = true;
+	stormResult.connected = (int)sockets.size() - remaining;
+	stormResult.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// The ports stay in TIME_WAIT, every run listens on a new port so the next storm can use them again
+	for (SOCKET clientSocket : sockets)
+	{
+		closesocket(clientSocket);
+	}
+
+	// Let the server see them go before the next storm needs the descriptors
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+}
+
+int main(int arg, char** argv)
+{
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+	int largest = arg > 1 ? atoi(argv[1]) : 8000;
+
+	int limit = raiseDescriptorLimit();
+	if (largest * 2 + 256 > limit)
+	{
+		largest = (limit - 256) / 2;
+		printf("descriptor limit is %d, storms are at most %d clients, raise ulimit -n for more\n", limit, largest);
+	}
+
+	const char* backends[] = { "select", "epoll" };
+	const int budgets[] = { 1, ACCEPT_BUDGET_PER_TICK };
+	const int clientCounts[] = { 1000, largest };
+
+	printf("%-8s %8s %8s %10s %10s %10s %10s %10s %8s\n", "backend", "clients", "budget", "connected", "seconds", "p50 ms", "p99 ms", "max ms", "> 1 s");
+
+	for (int clients : clientCounts)
+	{
+		for (const char* backend : backends)
+		{
+			// The select reactor takes FD_SETSIZE sockets at most
+			if (strcmp(backend, "select") == 0 && clients > 1000)
+				continue;
+
+			for (int budget : budgets)
+			{
+				StormResult result;
+				runStorm(backend, clients, budget, result);
+				if (!result.ran)
+				{
+					printf("%-8s %8d %8d %10s\n", backend, clients, budget, "unavailable");
+					continue;
+				}
+
+				printf("%-8s %8d %8d %10d %10.3f %10.1f %10.1f %10.1f %8d\n", backend, clients, budget, result.connected, result.seconds,
+					result.latencies.Percentile(50) / 1000.0, result.latencies.Percentile(99) / 1000.0, result.latencies.Max() / 1000.0,
+					result.slowerThanRetry);
+			}
+		}
+	}
+
+	return 0;
+}
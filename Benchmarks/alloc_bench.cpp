@@ -0,0 +1,273 @@
+// Heap allocations per relayed chat message once the server is warm.
+//
+// A server engine runs the same per message work as ChatServer's OnFrame, decoding the frame through a Buffer
+// and broadcasting one FrameRef to every other connection. One client sends 100k chat frames a second while
+// the rest receive. Global operator new is replaced with a counting one, so every heap allocation in the
+// process shows up, not just the ones the BufferPool knows about. After a warm up second we count what
+// the next few seconds allocate and divide by the frames relayed, a pooled hot path should print zero.
+//
+// Linux only, build and run from the repository root:
+//   g++ -O2 -std=c++17 -pthread -o alloc_bench Benchmarks/alloc_bench.cpp
+//   ./alloc_bench
+
+#include "../ChatServer/engine_factory.h"
+#include "../Common/buffer.h"
+#include "bench_sockets.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+static std::atomic<uint64_t> g_HeapAllocations(0);
+
+void* operator new(size_t size)
+{
+	g_HeapAllocations.fetch_add(1, std::memory_order_relaxed);
+	void* memory = malloc(size == 0 ? 1 : size);
+	if (memory == nullptr)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+// Kept out of line, inlined GCC sees a free of what new returned and warns with -Wmismatched-new-delete
+__attribute__((noinline)) void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+
+__attribute__((noinline)) void operator delete(void* memory, size_t) noexcept
+{
+	free(memory);
+}
+
+__attribute__((noinline)) void operator delete[](void* memory) noexcept
+{
+	free(memory);
+}
+
+__attribute__((noinline)) void operator delete[](void* memory, size_t) noexcept
+{
+	free(memory);
+}
+
+// Decodes like ChatServer and relays every chat frame to everyone but its sender
+class DecodingRelayHandler : public ServerEvents
+{
+public:
+
+	ServerEngine& m_Engine;
+	std::vector<SOCKET> m_Connections;
+	std::atomic<int> m_ConnectedCount;
+	std::atomic<uint64_t> m_RelayedFrames;
+	std::atomic<uint64_t> m_PoolReuses;
+
+	DecodingRelayHandler(ServerEngine& engine)
+		: m_Engine(engine)
+	{
+		m_ConnectedCount = 0;
+		m_RelayedFrames = 0;
+		m_PoolReuses = 0;
+	}
+
+	void OnConnected(SOCKET socket) override
+	{
+		m_Connections.push_back(socket);
+		m_ConnectedCount++;
+	}
+
+	void OnFrame(SOCKET socket, const uint8_t* frame, uint32_t packetSize) override
+	{
+		Buffer buffer(frame, packetSize);
+		buffer.ReadUInt32LE();
+		uint32_t messageType = buffer.ReadUInt32LE();
+		uint32_t messageLength = buffer.ReadUInt32LE();
+		std::string_view message = buffer.ReadStringView(messageLength);
+		if (messageType != 1 || message.empty())
+			return;
+
+		FrameRef broadcastFrame(frame, packetSize);
+		for (SOCKET clientSocket : m_Connections)
+		{
+			if (clientSocket != socket)
+			{
+				m_Engine.SendFrame(clientSocket, broadcastFrame);
+			}
+		}
+
+		m_RelayedFrames.fetch_add(1, std::memory_order_relaxed);
+		m_PoolReuses.store(BufferPool::ThreadReuses(), std::memory_order_relaxed);
+	}
+
+	void OnDisconnected(SOCKET socket) override
+	{
+		m_Connections.erase(std::find(m_Connections.begin(), m_Connections.end(), socket));
+		m_ConnectedCount--;
+	}
+};
+
+// Engines run forever, so the server thread is left behind when the process exits
+static DecodingRelayHandler* startServer(const std::string& backend, SOCKET listenSocket)
+{
+	std::atomic<int> state(0);	// 1 running, -1 unavailable
+	DecodingRelayHandler* handler = nullptr;
+
+	std::thread([&backend, listenSocket, &state, &handler]()
+	{
+		std::unique_ptr<ServerEngine> engine = createEngine(backend);
+		if (!engine)
+		{
+			state = -1;
+			return;
+		}
+
+		DecodingRelayHandler* relay = new DecodingRelayHandler(*engine);
+		handler = relay;
+		state = 1;
+
+		ServerEngine* serverEngine = engine.release();
+		serverEngine->Run(listenSocket, *relay);
+	}).detach();
+
+	while (state.load() == 0)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	return state.load() == 1 ? handler : nullptr;
+}
+
+static void runBenchmark(const char* backend, int clients, int messagesPerSecond, int frameSize)
+{
+	sockaddr_in address;
+	SOCKET listenSocket = listenOnLoopback(address);
+	if (listenSocket == INVALID_SOCKET)
+		return;
+
+	DecodingRelayHandler* handler = startServer(backend, listenSocket);
+	if (handler == nullptr)
+	{
+		printf("%-8s %12s\n", backend, "unavailable");
+		closesocket(listenSocket);
+		return;
+	}
+
+	std::vector<SOCKET> sockets(clients);
+	for (int i = 0; i < clients; i++)
+	{
+		sockets[i] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		connect(sockets[i], (sockaddr*)&address, sizeof(address));
+	}
+
+	while (handler->m_ConnectedCount.load() < clients)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	// Receivers just drain, everything they need is allocated before the clock starts
+	std::atomic<bool> running(true);
+	EpollReactor receiver;
+	for (int i = 1; i < clients; i++)
+	{
+		setNonBlocking(sockets[i]);
+		receiver.Add(sockets[i], REACTOR_READ);
+	}
+
+	std::thread receiveThread([&]()
+	{
+		std::vector<ReactorEvent> readyEvents;
+		readyEvents.reserve(clients);
+		std::vector<char> drain(65536);
+		while (running.load(std::memory_order_relaxed))
+		{
+			int count = receiver.Wait(readyEvents, 10);
+			for (int i = 0; i < count; i++)
+			{
+				while (recv(readyEvents[i].socket, drain.data(), (int)drain.size(), RECV_DONTWAIT) > 0)
+				{
+				}
+			}
+		}
+	});
+
+	// One chat frame in the usual wire format, sent in batches of 100 every millisecond
+	const int batchSize = messagesPerSecond / 1000;
+	Buffer frame(frameSize);
+	frame.WriteUInt32LE(frameSize);
+	frame.WriteUInt32LE(1);
+	frame.WriteUInt32LE(frameSize - 12);
+	frame.WriteString(std::string(frameSize - 12, 'x'));
+
+	std::vector<uint8_t> batch;
+	for (int i = 0; i < batchSize; i++)
+	{
+		batch.insert(batch.end(), frame.Data(), frame.Data() + frame.Size());
+	}
+
+	auto sendFor = [&](double seconds)
+	{
+		auto start = std::chrono::steady_clock::now();
+		auto next = start;
+		while (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < seconds)
+		{
+			send(sockets[0], (const char*)batch.data(), (int)batch.size(), MSG_NOSIGNAL);
+			next += std::chrono::milliseconds(1);
+			std::this_thread::sleep_until(next);
+		}
+	};
+
+	sendFor(1.0);
+
+	uint64_t heapBefore = g_HeapAllocations.load();
+	uint64_t poolHeapBefore = BufferPool::HeapAllocations();
+	uint64_t relayedBefore = handler->m_RelayedFrames.load();
+	uint64_t reusesBefore = handler->m_PoolReuses.load();
+	auto start = std::chrono::steady_clock::now();
+
+	sendFor(3.0);
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	uint64_t heapAllocations = g_HeapAllocations.load() - heapBefore;
+	uint64_t poolHeapAllocations = BufferPool::HeapAllocations() - poolHeapBefore;
+	uint64_t relayed = handler->m_RelayedFrames.load() - relayedBefore;
+	uint64_t reuses = handler->m_PoolReuses.load() - reusesBefore;
+
+	printf("%-8s %12.0f %12llu %12llu %12llu %14.4f\n", backend, relayed / seconds, (unsigned long long)heapAllocations,
+		(unsigned long long)poolHeapAllocations, (unsigned long long)reuses, relayed > 0 ? (double)heapAllocations / relayed : 0.0);
+
+	running = false;
+	receiveThread.join();
+
+	// The listener stays open, the old server thread still polls it and would pick up a reused descriptor
+	for (SOCKET clientSocket : sockets)
+	{
+		closesocket(clientSocket);
+	}
+}
+
+int main(int arg, char** argv)
+{
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+	const char* backends[] = { "select", "epoll", "uring" };
+	const int clients = 11;
+	const int messagesPerSecond = 100000;
+	const int frameSize = 64;
+
+	printf("1 sender at %d frames/s of %d bytes, %d receivers\n", messagesPerSecond, frameSize, clients - 1);
+	printf("%-8s %12s %12s %12s %12s %14s\n", "backend", "frames/s", "heap allocs", "pool misses", "pool reuses", "allocs/frame");
+
+	for (const char* backend : backends)
+	{
+		runBenchmark(backend, clients, messagesPerSecond, frameSize);
+	}
+
+	return 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+// Socket setup the benchmarks share, Linux only like they are
+
+#include "../Common/socket_platform.h"
+
+#include <sys/resource.h>
+
+// A listener on 127.0.0.1 at whatever port the kernel picks, address gets it. INVALID_SOCKET on failure.
+inline SOCKET listenOnLoopback(sockaddr_in& address)
+{
+	SOCKET listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+	ZeroMemory(&address, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = 0;
+
+	socklen_t length = sizeof(address);
+	if (bind(listenSocket, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR
+		|| listen(listenSocket, SOMAXCONN) == SOCKET_ERROR
+		|| getsockname(listenSocket, (sockaddr*)&address, &length) == SOCKET_ERROR)
+	{
+		closesocket(listenSocket);
+		return INVALID_SOCKET;
+	}
+
+	return listenSocket;
+}
+
+// Up to the hard limit, returns what we got
+inline int raiseDescriptorLimit()
+{
+	rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+	getrlimit(RLIMIT_NOFILE, &limit);
+	return (int)limit.rlim_cur;
+}
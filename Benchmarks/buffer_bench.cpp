@@ -0,0 +1,264 @@
+// Microbenchmarks for the Buffer serialization primitives every project uses.
+//
+// Each case is timed in batches sized to take about 20 ms, repeated 7 times, and the median is reported as
+// ns per operation, payload bytes per second and heap allocations per operation. Global operator new is
+// replaced with a counting one, so allocations include everything, the BufferPool's misses and any
+// std::string a read creates. Payloads cover chat sized text from 16 B up to a 64 KB frame.
+// Run it before and after a serialization change and compare the tables, --csv prints them for a diff.
+//
+// Headless, build and run from the repository root:
+//   g++ -O2 -std=c++17 -o buffer_bench Benchmarks/buffer_bench.cpp
+//   ./buffer_bench [--csv]
+
+#include "../Common/buffer.h"
+#include "../Common/chat_messages.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+static std::atomic<uint64_t> g_HeapAllocations(0);
+
+void* operator new(size_t size)
+{
+	g_HeapAllocations.fetch_add(1, std::memory_order_relaxed);
+	void* memory = malloc(size == 0 ? 1 : size);
+	if (memory == nullptr)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	free(memory);
+}
+
+// Keeps the compiler from dropping work whose result isn't otherwise used
+template <typename T>
+inline void keep(const T& value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct CaseResult
+{
+	double nsPerOp;
+	double allocationsPerOp;
+};
+
+static bool g_Csv = false;
+
+// body(iterations) runs the operation that many times
+template <typename Body>
+static CaseResult measure(Body body)
+{
+	// Grow the batch until it takes long enough to time
+	uint64_t iterations = 1;
+	while (true)
+	{
+		auto start = std::chrono::steady_clock::now();
+		body(iterations);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (seconds > 0.02 || iterations > (1ull << 34))
+			break;
+		iterations *= seconds < 0.002 ? 8 : 2;
+	}
+
+	std::vector<double> nsPerOp;
+	std::vector<double> allocationsPerOp;
+	for (int run = 0; run < 7; run++)
+	{
+		uint64_t allocationsBefore = g_HeapAllocations.load();
+		auto start = std::chrono::steady_clock::now();
+		body(iterations);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		nsPerOp.push_back(seconds * 1e9 / iterations);
+		allocationsPerOp.push_back((double)(g_HeapAllocations.load() - allocationsBefore) / iterations);
+	}
+
+	std::sort(nsPerOp.begin(), nsPerOp.end());
+	std::sort(allocationsPerOp.begin(), allocationsPerOp.end());
+	return CaseResult{ nsPerOp[nsPerOp.size() / 2], allocationsPerOp[allocationsPerOp.size() / 2] };
+}
+
+static void report(const char* name, size_t bytesPerOp, CaseResult result)
+{
+	double bytesPerSecond = bytesPerOp * 1e9 / result.nsPerOp;
+	if (g_Csv)
+	{
+		printf("%s,%zu,%.3f,%.0f,%.4f\n", name, bytesPerOp, result.nsPerOp, bytesPerSecond, result.allocationsPerOp);
+	}
+	else
+	{
+		printf("%-22s %8zu %12.2f %12.2f %14.4f\n", name, bytesPerOp, result.nsPerOp, bytesPerSecond / 1e9, result.allocationsPerOp);
+	}
+}
+
+// Scalar writes and reads, batched 1024 to a buffer so growth doesn't show up
+static void benchScalars()
+{
+	const int batch = 1024;
+	Buffer buffer(batch * 8);
+
+	report("WriteUInt16LE", 2, measure([&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			if ((i & (batch - 1)) == 0)
+				buffer.Clear();
+			buffer.WriteUInt16LE((uint16_t)i);
+		}
+		keep(buffer.m_BufferData[0]);
+	}));
+
+	report("WriteUInt32LE", 4, measure([&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			if ((i & (batch - 1)) == 0)
+				buffer.Clear();
+			buffer.WriteUInt32LE((uint32_t)i);
+		}
+		keep(buffer.m_BufferData[0]);
+	}));
+
+	buffer.Clear();
+	for (int i = 0; i < batch; i++)
+	{
+		buffer.WriteUInt32LE(i);
+	}
+
+	report("ReadUInt32LE", 4, measure([&](uint64_t iterations)
+	{
+		uint32_t sum = 0;
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			if ((i & (batch - 1)) == 0)
+				buffer.m_ReadIndex = 0;
+			sum += buffer.ReadUInt32LE();
+		}
+		keep(sum);
+	}));
+}
+
+// Everything that scales with the payload
+static void benchPayload(size_t size)
+{
+	std::string text(size, 'x');
+	Buffer buffer(size + 64);
+	char name[64];
+
+	snprintf(name, sizeof(name), "WriteString");
+	report(name, size, measure([&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			buffer.Clear();
+			buffer.WriteString(text);
+			keep(buffer.m_BufferData[0]);
+		}
+	}));
+
+	buffer.Clear();
+	buffer.WriteString(text);
+
+	report("ReadString", size, measure([&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			buffer.m_ReadIndex = 0;
+			std::string read = buffer.ReadString(size);
+			keep(read[0]);
+		}
+	}));
+
+	report("ReadStringView", size, measure([&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			buffer.m_ReadIndex = 0;
+			std::string_view read = buffer.ReadStringView(size);
+			keep(read.data());
+		}
+	}));
+
+	// A fresh small buffer grown to fit the payload, the cost of not guessing the size up front
+	report("GrowIfNeeded", size, measure([&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			Buffer growing(16);
+			growing.GrowIfNeeded(size);
+			keep(growing.m_BufferData[0]);
+		}
+	}));
+
+	// A whole chat frame both ways through the message schema
+	ChatMessage chatMessage;
+	chatMessage.message = text;
+
+	report("encodeMessage", size, measure([&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			buffer.Clear();
+			encodeMessage(chatMessage, buffer);
+			keep(buffer.m_BufferData[0]);
+		}
+	}));
+
+	buffer.Clear();
+	uint32_t packetSize = encodeMessage(chatMessage, buffer);
+
+	report("decodeMessage", size, measure([&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			ChatMessage decoded;
+			bool valid = decodeMessage(buffer.Data(), packetSize, decoded);
+			keep(valid);
+			keep(decoded.message.data());
+		}
+	}));
+}
+
+int main(int arg, char** argv)
+{
+	for (int i = 1; i < arg; i++)
+	{
+		if (strcmp(argv[i], "--csv") == 0)
+		{
+			g_Csv = true;
+		}
+	}
+
+	if (g_Csv)
+	{
+		printf("case,bytes,ns_per_op,bytes_per_second,allocations_per_op\n");
+	}
+	else
+	{
+		printf("%-22s %8s %12s %12s %14s\n", "case", "bytes", "ns/op", "GB/s", "allocs/op");
+	}
+
+	benchScalars();
+
+	const size_t sizes[] = { 16, 64, 256, 1024, 4096, 16384, 65536 };
+	for (size_t size : sizes)
+	{
+		benchPayload(size);
+	}
+
+	return 0;
+}
@@ -0,0 +1,236 @@
+// Compression ratio and CPU cost of the chat frame codec, by message size.
+//
+// Messages are generated chat text, lines of "HH:MM:SS - [user]: words" with words drawn from a skewed
+// vocabulary the way real chat repeats itself, cut to each size. Every size is run with no dictionary, the
+// built in chat dictionary, and a dictionary trained on a separate set of generated lines, since with a few
+// hundred bytes there is little in the message itself to match against. Each case compresses and decompresses
+// 64 different messages in turn, timed in batches sized to take about 20 ms, and reports the median of 7 runs
+// as the ratio, ns per message and MB/s of original text both ways. The server skips frames under
+// COMPRESSION_MIN_BYTES, the small sizes show why.
+//
+// Headless, build and run from the repository root:
+//   g++ -O2 -std=c++17 -o compression_bench Benchmarks/compression_bench.cpp
+//   ./compression_bench [--csv]
+
+#include "../Common/buffer.h"
+#include "../Common/frame_compression.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+// Keeps the compiler from dropping work whose result isn't otherwise used
+template <typename T>
+inline void keep(const T& value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+static bool g_Csv = false;
+
+static const int MESSAGES_PER_CASE = 64;
+
+// body(iterations) runs the operation that many times, returns the median ns per iteration
+template <typename Body>
+static double measure(Body body)
+{
+	uint64_t iterations = 1;
+	while (true)
+	{
+		auto start = std::chrono::steady_clock::now();
+		body(iterations);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (seconds > 0.02 || iterations > (1ull << 34))
+			break;
+		iterations *= seconds < 0.002 ? 8 : 2;
+	}
+
+	std::vector<double> nsPerOp;
+	for (int run = 0; run < 7; run++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		body(iterations);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		nsPerOp.push_back(seconds * 1e9 / iterations);
+	}
+
+	std::sort(nsPerOp.begin(), nsPerOp.end());
+	return nsPerOp[nsPerOp.size() / 2];
+}
+
+// Lines of chat, the vocabulary is Zipf-like so a few words make up most of the text
+class ChatTextGenerator
+{
+public:
+
+	std::mt19937 m_Random;
+	std::vector<std::string> m_Words;
+	std::vector<std::string> m_Users;
+	std::discrete_distribution<int> m_WordChoice;
+
+	ChatTextGenerator(uint32_t seed)
+		: m_Random(seed)
+	{
+		const char* words[] = { "the", "I", "to", "you", "a", "it", "and", "is", "that", "of", "in", "for", "on", "lol",
+			"just", "so", "what", "but", "have", "this", "not", "do", "be", "we", "was", "like", "are", "can", "with",
+			"know", "yeah", "think", "my", "get", "if", "no", "me", "going", "there", "all", "at", "they", "one",
+			"anyone", "server", "build", "works", "now", "tonight", "game", "thanks", "idea", "why", "broken", "again",
+			"update", "patch", "restart", "working", "channel", "message", "lag", "ping", "seriously", "haha",
+			"compile", "error", "line", "file", "branch", "merge", "tomorrow", "meeting", "weekend", "coffee" };
+
+		std::vector<double> weights;
+		for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+		{
+			m_Words.push_back(words[i]);
+			weights.push_back(1.0 / (i + 1));
+		}
+		m_WordChoice = std::discrete_distribution<int>(weights.begin(), weights.end());
+
+		const char* users[] = { "eric", "sam", "alex", "jordan", "taylor", "morgan", "casey", "riley" };
+		m_Users.assign(users, users + sizeof(users) / sizeof(users[0]));
+	}
+
+	std::string Line()
+	{
+		char timestamp[32];
+		snprintf(timestamp, sizeof(timestamp), "%02u:%02u:%02u - ", (unsigned)(m_Random() % 24), (unsigned)(m_Random() % 60), (unsigned)(m_Random() % 60));
+
+		std::string line = timestamp;
+		line += "[" + m_Users[m_Random() % m_Users.size()] + "]: ";
+
+		int count = 3 + m_Random() % 14;
+		for (int i = 0; i < count; i++)
+		{
+			line += m_Words[m_WordChoice(m_Random)];
+			line += i + 1 < count ? " " : "\n";
+		}
+		return line;
+	}
+
+	// Whole lines until it reaches size, then cut
+	std::string Text(size_t size)
+	{
+		std::string text;
+		while (text.size() < size)
+		{
+			text += Line();
+		}
+		text.resize(size);
+		return text;
+	}
+};
+
+static void runCase(const char* dictionaryName, const LzDictionary* dictionary, size_t size, ChatTextGenerator& generator)
+{
+	std::vector<std::string> messages;
+	std::vector<Buffer> compressed(MESSAGES_PER_CASE);
+	size_t totalOriginal = 0;
+	size_t totalCompressed = 0;
+	for (int i = 0; i < MESSAGES_PER_CASE; i++)
+	{
+		messages.push_back(generator.Text(size));
+		LzCodec::Compress((const uint8_t*)messages[i].data(), size, compressed[i], dictionary);
+		totalOriginal += size;
+		totalCompressed += compressed[i].Size();
+	}
+
+	Buffer out(LzCodec::MaxCompressedSize(size));
+	double compressNs = measure([&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			const std::string& message = messages[i % MESSAGES_PER_CASE];
+			out.Clear();
+			LzCodec::Compress((const uint8_t*)message.data(), size, out, dictionary);
+			keep(out.m_BufferData[0]);
+		}
+	});
+
+	std::vector<uint8_t> decompressed(size);
+	bool roundTrips = true;
+	double decompressNs = measure([&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			const Buffer& packed = compressed[i % MESSAGES_PER_CASE];
+			roundTrips &= LzCodec::Decompress(packed.Data(), packed.Size(), decompressed.data(), size, dictionary);
+			keep(decompressed[0]);
+		}
+	});
+
+	for (int i = 0; i < MESSAGES_PER_CASE && roundTrips; i++)
+	{
+		roundTrips = LzCodec::Decompress(compressed[i].Data(), compressed[i].Size(), decompressed.data(), size, dictionary)
+			&& memcmp(decompressed.data(), messages[i].data(), size) == 0;
+	}
+	if (!roundTrips)
+	{
+		printf("%s at %zu bytes didn't decompress to what went in\n", dictionaryName, size);
+		exit(1);
+	}
+
+	double ratio = (double)totalOriginal / totalCompressed;
+	if (g_Csv)
+	{
+		printf("%s,%zu,%.3f,%.1f,%.0f,%.1f,%.0f\n", dictionaryName, size, ratio, compressNs, size * 1e3 / compressNs,
+			decompressNs, size * 1e3 / decompressNs);
+	}
+	else
+	{
+		printf("%-10s %8zu %8.2f %12.1f %10.0f %12.1f %10.0f\n", dictionaryName, size, ratio, compressNs, size * 1e3 / compressNs,
+			decompressNs, size * 1e3 / decompressNs);
+	}
+}
+
+int main(int arg, char** argv)
+{
+	for (int i = 1; i < arg; i++)
+	{
+		if (strcmp(argv[i], "--csv") == 0)
+		{
+			g_Csv = true;
+		}
+	}
+
+	CompressionDictionary builtIn;
+	builtIn.SetBuiltIn();
+
+	// Trained on other lines than the ones measured, as a server would train on yesterday's history
+	ChatTextGenerator trainingGenerator(1);
+	std::vector<std::string> samples;
+	for (int i = 0; i < 20000; i++)
+	{
+		samples.push_back(trainingGenerator.Line());
+	}
+	CompressionDictionary trained;
+	auto trainStart = std::chrono::steady_clock::now();
+	trained.Set(CompressionDictionary::Train(samples, 16 * 1024));
+	double trainMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - trainStart).count();
+
+	if (g_Csv)
+	{
+		printf("dictionary,bytes,ratio,compress_ns,compress_mb_per_s,decompress_ns,decompress_mb_per_s\n");
+	}
+	else
+	{
+		printf("built in dictionary %zu bytes, trained %zu bytes from %zu lines in %.0f ms\n\n", builtIn.m_Text.size(),
+			trained.m_Text.size(), samples.size(), trainMs);
+		printf("%-10s %8s %8s %12s %10s %12s %10s\n", "dictionary", "bytes", "ratio", "compress ns", "MB/s", "decompress ns", "MB/s");
+	}
+
+	const size_t sizes[] = { 64, 128, 256, 512, 1024, 4096, 16384, 65536 };
+	for (size_t size : sizes)
+	{
+		ChatTextGenerator generator(2);
+		runCase("none", nullptr, size, generator);
+		runCase("built-in", builtIn.Lz(), size, generator);
+		runCase("trained", trained.Lz(), size, generator);
+	}
+
+	return 0;
+}
@@ -0,0 +1,126 @@
+// What a mass disconnect costs, e.g. a network blip dropping every client at once, with the connection table
+// as a std::vector<SOCKET> against the SlotMap that ChatServer and TCPServerWithSelect keep their clients in.
+//
+// The vector is run the two ways the servers used it: the select loop erasing each dead client at its index as
+// it walks them, and ChatServer finding the socket and erasing it, in whatever order the disconnects come in.
+// The slot map is run the way ChatServer runs it now, a socket's handle found in a hash map and the record
+// swapped out. Then times one pass over all the clients as a broadcast makes it, for the cost of the layout.
+//
+// Build and run from the repository root:
+//   g++ -O2 -std=c++17 -o connection_table_bench Benchmarks/connection_table_bench.cpp
+//   ./connection_table_bench 20000
+
+#include "../Common/socket_platform.h"
+#include "../Common/slot_map.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+// About what ChatServer keeps per client, less the timer
+struct Client
+{
+	SOCKET socket;
+	uint32_t encoding;
+	bool heartbeats;
+	uint32_t pingsSent;
+	uint64_t lastHeardMs;
+};
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int arg, char** argv)
+{
+	int connections = arg > 1 ? atoi(argv[1]) : 20000;
+	if (connections <= 0)
+	{
+		printf("usage: connection_table_bench [clients]\n");
+		return 1;
+	}
+
+	// Sockets the way they come from accept, and the order they go away in
+	std::vector<SOCKET> sockets(connections);
+	for (int i = 0; i < connections; i++)
+	{
+		sockets[i] = (SOCKET)(i + 4);
+	}
+	std::vector<SOCKET> disconnectOrder = sockets;
+	std::shuffle(disconnectOrder.begin(), disconnectOrder.end(), std::mt19937(12345));
+
+	printf("%d clients dropping at once\n", connections);
+
+	// The select loop: every client turns out dead as it is walked, each erase shifts everyone after it
+	std::vector<SOCKET> active = sockets;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < (int)active.size(); i++)
+	{
+		active.erase(active.begin() + i);
+		i--;
+	}
+	printf("vector, erase at index while walking:  %8.2f ms\n", millisecondsSince(start));
+
+	// ChatServer's OnDisconnected: a search and an erase per socket
+	active.assign(sockets.begin(), sockets.end());
+	start = std::chrono::steady_clock::now();
+	for (SOCKET socket : disconnectOrder)
+	{
+		active.erase(std::find(active.begin(), active.end(), socket));
+	}
+	printf("vector, find and erase per socket:     %8.2f ms\n", millisecondsSince(start));
+
+	SlotMap<Client> clients;
+	std::unordered_map<SOCKET, SlotMap<Client>::Handle> handles;
+	for (SOCKET socket : sockets)
+	{
+		Client client = {};
+		client.socket = socket;
+		handles[socket] = clients.Insert(client);
+	}
+
+	// One pass as a broadcast makes it, before the clients go
+	uint64_t checksum = 0;
+	start = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < 100; pass++)
+	{
+		for (Client& client : clients)
+		{
+			checksum += (uint64_t)client.socket + client.encoding;
+		}
+	}
+	double fanoutMs = millisecondsSince(start) / 100;
+
+	std::vector<SlotMap<Client>::Handle> stale;
+	start = std::chrono::steady_clock::now();
+	for (SOCKET socket : disconnectOrder)
+	{
+		auto it = handles.find(socket);
+		stale.push_back(it->second);
+		clients.Remove(it->second);
+		handles.erase(it);
+	}
+	printf("slot map, handle lookup and swap out:  %8.2f ms\n", millisecondsSince(start));
+
+	// The slots are reused by the next clients, the old handles must not find them
+	for (SOCKET socket : sockets)
+	{
+		Client client = {};
+		client.socket = socket;
+		clients.Insert(client);
+	}
+	size_t found = 0;
+	for (SlotMap<Client>::Handle handle : stale)
+	{
+		found += clients.Get(handle) != nullptr;
+	}
+
+	printf("slot map, one pass over every client:  %8.2f ms (%zu old handles still find a client, checksum %llu)\n", fanoutMs, found, (unsigned long long)checksum);
+
+	return 0;
+}
@@ -0,0 +1,229 @@
+// Loopback fan-out throughput of the readiness engines (select, epoll) against the io_uring engine.
+//
+// A server engine runs on its own thread with a handler that relays every received frame to all other
+// connections, the same fan-out shape as ChatServer's broadcastMessage. One client sends chat sized frames
+// as fast as it can while the rest receive, and we time until every receiver has seen every byte.
+// With the readiness engines each relayed frame is one send() per recipient, with io_uring the whole
+// fan-out of a tick goes to the kernel in one submission.
+//
+// Linux only, build and run from the repository root:
+//   g++ -O2 -std=c++17 -pthread -o engine_bench Benchmarks/engine_bench.cpp
+//   ulimit -n 8192 && ./engine_bench
+
+#include "../ChatServer/engine_factory.h"
+#include "bench_sockets.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// Relays every frame to everyone but its sender
+class RelayHandler : public ServerEvents
+{
+public:
+
+	ServerEngine& m_Engine;
+	std::vector<SOCKET> m_Connections;
+	std::atomic<int> m_ConnectedCount;
+
+	RelayHandler(ServerEngine& engine)
+		: m_Engine(engine)
+	{
+		m_ConnectedCount = 0;
+	}
+
+	void OnConnected(SOCKET socket) override
+	{
+		m_Connections.push_back(socket);
+		m_ConnectedCount++;
+	}
+
+	void OnFrame(SOCKET socket, const uint8_t* frame, uint32_t packetSize) override
+	{
+		FrameRef broadcastFrame(frame, packetSize);
+		for (SOCKET clientSocket : m_Connections)
+		{
+			if (clientSocket != socket)
+			{
+				m_Engine.SendFrame(clientSocket, broadcastFrame);
+			}
+		}
+	}
+
+	void OnDisconnected(SOCKET socket) override
+	{
+		m_Connections.erase(std::find(m_Connections.begin(), m_Connections.end(), socket));
+		m_ConnectedCount--;
+	}
+};
+
+struct BenchResult
+{
+	bool ran;
+	double seconds;
+	double deliveredPerSecond;
+	double megabytesPerSecond;
+};
+
+// Engines run forever, so the server thread is left behind when the process exits.
+// The engine is created on that thread because the io_uring ring only accepts submissions from its creator.
+static RelayHandler* startServer(const std::string& backend, SOCKET listenSocket)
+{
+	std::atomic<int> state(0);	// 1 running, -1 unavailable
+	RelayHandler* handler = nullptr;
+
+	std::thread([&backend, listenSocket, &state, &handler]()
+	{
+		std::unique_ptr<ServerEngine> engine = createEngine(backend);
+		if (!engine)
+		{
+			state = -1;
+			return;
+		}
+
+		// A run only ends once every frame arrived, so none may be dropped however far behind the receivers fall
+		OutboundLimits limits = defaultOutboundLimits();
+		limits.highWatermark = 1u << 30;
+		limits.lowWatermark = 1u << 29;
+		engine->SetOutboundLimits(limits);
+
+		RelayHandler* relay = new RelayHandler(*engine);
+		handler = relay;
+		state = 1;
+
+		ServerEngine* serverEngine = engine.release();
+		serverEngine->Run(listenSocket, *relay);
+	}).detach();
+
+	while (state.load() == 0)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	return state.load() == 1 ? handler : nullptr;
+}
+
+static BenchResult runBenchmark(const char* backend, int clients, int messages, int frameSize)
+{
+	BenchResult benchResult = { false, 0.0, 0.0, 0.0 };
+
+	sockaddr_in address;
+	SOCKET listenSocket = listenOnLoopback(address);
+	if (listenSocket == INVALID_SOCKET)
+		return benchResult;
+
+	RelayHandler* handler = startServer(backend, listenSocket);
+	if (handler == nullptr)
+	{
+		closesocket(listenSocket);
+		return benchResult;
+	}
+
+	std::vector<SOCKET> sockets(clients);
+	for (int i = 0; i < clients; i++)
+	{
+		sockets[i] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (connect(sockets[i], (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR)
+		{
+			printf("connect failed with error %d after %d clients\n", WSAGetLastError(), i);
+			return benchResult;
+		}
+	}
+
+	while (handler->m_ConnectedCount.load() < clients)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	// Receivers drain on one epoll thread so the server never blocks on a full window
+	EpollReactor receivers;
+	for (int i = 1; i < clients; i++)
+	{
+		setNonBlocking(sockets[i]);
+		receivers.Add(sockets[i], REACTOR_READ);
+	}
+
+	long long expectedBytes = (long long)messages * frameSize * (clients - 1);
+	std::atomic<long long> receivedBytes(0);
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::thread receiveThread([&]()
+	{
+		std::vector<ReactorEvent> readyEvents;
+		std::vector<char> drain(65536);
+		while (receivedBytes.load(std::memory_order_relaxed) < expectedBytes)
+		{
+			int count = receivers.Wait(readyEvents, 1000);
+			for (int i = 0; i < count; i++)
+			{
+				int result;
+				while ((result = recv(readyEvents[i].socket, drain.data(), (int)drain.size(), RECV_DONTWAIT)) > 0)
+				{
+					receivedBytes.fetch_add(result, std::memory_order_relaxed);
+				}
+			}
+		}
+	});
+
+	// One chat frame in the usual wire format, sent back to back
+	std::vector<uint8_t> frame(frameSize, 'x');
+	uint32_t header[3] = { (uint32_t)frameSize, 1, (uint32_t)frameSize - 12 };
+	memcpy(frame.data(), header, sizeof(header));
+
+	for (int i = 0; i < messages; i++)
+	{
+		send(sockets[0], (const char*)frame.data(), frameSize, 0);
+	}
+
+	receiveThread.join();
+
+	auto end = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(end - start).count();
+
+	benchResult.ran = true;
+	benchResult.seconds = seconds;
+	benchResult.deliveredPerSecond = (double)messages * (clients - 1) / seconds;
+	benchResult.megabytesPerSecond = expectedBytes / seconds / (1024.0 * 1024.0);
+
+	for (SOCKET clientSocket : sockets)
+	{
+		closesocket(clientSocket);
+	}
+
+	return benchResult;
+}
+
+int main(int arg, char** argv)
+{
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+	const char* backends[] = { "select", "epoll", "uring" };
+	const int clientCounts[] = { 10, 100, 1000 };
+	const int frameSize = 64;
+
+	printf("%-8s %8s %10s %10s %16s %10s\n", "backend", "clients", "messages", "seconds", "delivered/s", "MB/s");
+
+	for (int clients : clientCounts)
+	{
+		// Keep the number of deliveries per run roughly constant
+		int messages = 2000000 / clients;
+
+		for (const char* backend : backends)
+		{
+			BenchResult result = runBenchmark(backend, clients, messages, frameSize);
+			if (!result.ran)
+			{
+				printf("%-8s %8d %10d %10s\n", backend, clients, messages, "unavailable");
+				continue;
+			}
+
+			printf("%-8s %8d %10d %10.3f %16.0f %10.1f\n", backend, clients, messages, result.seconds, result.deliveredPerSecond, result.megabytesPerSecond);
+		}
+	}
+
+	return 0;
+}
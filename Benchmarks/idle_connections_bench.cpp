@@ -0,0 +1,195 @@
+// How much an idle connection costs the coroutine server, and that the handlers still answer once there are many.
+//
+// Opens the connections against a CoroutineServer on the same loop, measures the resident memory they added
+// while every handler waits in ReadFrame, then sends one chat line on each and waits for every reply, then
+// closes them all. Everything runs on one thread, the clients block only where the kernel answers at once.
+//
+// Linux only, build and run from the repository root:
+//   g++ -O2 -std=c++20 -o idle_connections_bench Benchmarks/idle_connections_bench.cpp
+//   ulimit -n 210000 && ./idle_connections_bench 100000
+//
+// Connections are AF_UNIX so 100k of them don't exhaust the loopback port range. Both ends are in this
+// process, so it needs two descriptors per connection and asks for fewer if the limit is lower.
+
+#include "../Common/socket_platform.h"
+#include "../Common/reactor.h"
+#include "../Common/event_loop.h"
+#include "../Common/frame_stream.h"
+#include "../Common/coroutine_server.h"
+#include "../Common/chat_messages.h"
+#include "bench_sockets.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/un.h>
+#include <chrono>
+#include <vector>
+
+static size_t residentBytes()
+{
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (file == nullptr)
+		return 0;
+
+	unsigned long pages = 0;
+	unsigned long residentPages = 0;
+	if (fscanf(file, "%lu %lu", &pages, &residentPages) != 2)
+		residentPages = 0;
+	fclose(file);
+	return residentPages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static size_t g_Handled = 0;
+
+// What TCPServerWithCoroutines does, without the logging
+static Task<> answer(FrameStream& connection)
+{
+	ByteSpan frame;
+	while (co_await connection.ReadFrame(frame))
+	{
+		ChatMessage message;
+		if (!decodeMessage(frame.data, (uint32_t)frame.size, message))
+			continue;
+
+		g_Handled++;
+		ChatMessage reply;
+		reply.message = "Server received message from client";
+		bool sent = co_await connection.WriteFrame(reply);
+		if (!sent)
+			break;
+	}
+}
+
+static Task<> drive(EventLoop& loop, CoroutineServer& server, const sockaddr_un& address, socklen_t addressLength, int connections)
+{
+	std::vector<SOCKET> clients;
+	clients.reserve(connections);
+
+	size_t baseline = residentBytes();
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < connections; i++)
+	{
+		SOCKET client = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (client == INVALID_SOCKET || connect(client, (const sockaddr*)&address, addressLength) != 0)
+		{
+			printf("connect failed with error %d after %d connections\n", errno, i);
+			if (client != INVALID_SOCKET)
+				closesocket(client);
+			break;
+		}
+		clients.push_back(client);
+
+		// A full backlog would block connect with the server on this same thread, so every so often the
+		// server gets to accept everything so far. Each yield lets it take another batch.
+		if (clients.size() % 256 == 0)
+		{
+			while (server.m_ConnectionCount < clients.size())
+			{
+				co_await loop.Yield();
+			}
+		}
+	}
+
+	while (server.m_ConnectionCount < clients.size())
+	{
+		co_await loop.Yield();
+	}
+	double connectSeconds = secondsSince(start);
+	size_t idle = residentBytes();
+
+	printf("%zu connections accepted in %.2f s, %.0f per second\n", clients.size(), connectSeconds, clients.size() / connectSeconds);
+	printf("idle: %.1f MB resident over the baseline, %.0f bytes per connection\n",
+		(idle - baseline) / (1024.0 * 1024.0), (double)(idle - baseline) / clients.size());
+
+	// One line each, every handler wakes, answers and goes back to waiting
+	Buffer line;
+	ChatMessage message;
+	message.message = "hello from an idle client";
+	uint32_t lineSize = encodeMessage(message, line);
+
+	start = std::chrono::steady_clock::now();
+	for (SOCKET client : clients)
+	{
+		send(client, (const char*)line.Data(), lineSize, 0);
+	}
+
+	while (g_Handled < clients.size())
+	{
+		co_await loop.Yield();
+	}
+
+	size_t replies = 0;
+	std::vector<uint8_t> reply(4096);
+	for (SOCKET client : clients)
+	{
+		if (recv(client, (char*)reply.data(), (int)reply.size(), 0) > 0)
+			replies++;
+	}
+	double answerSeconds = secondsSince(start);
+
+	printf("%zu of %zu answered in %.2f s, %.0f per second, %.0f bytes per connection after\n",
+		replies, clients.size(), answerSeconds, clients.size() / answerSeconds, (double)(residentBytes() - baseline) / clients.size());
+
+	start = std::chrono::steady_clock::now();
+	for (SOCKET client : clients)
+	{
+		closesocket(client);
+	}
+
+	while (server.m_ConnectionCount > 0)
+	{
+		co_await loop.Yield();
+	}
+	printf("%zu closed in %.2f s\n", clients.size(), secondsSince(start));
+
+	loop.Stop();
+}
+
+int main(int arg, char** argv)
+{
+	int connections = arg > 1 ? atoi(argv[1]) : 100000;
+
+	int limit = raiseDescriptorLimit();
+	if (connections * 2 + 64 > limit)
+	{
+		connections = (limit - 64) / 2;
+		printf("descriptor limit is %d, running %d connections, raise ulimit -n for more\n", limit, connections);
+	}
+
+	std::unique_ptr<Reactor> reactor = createReactor("epoll");
+	if (!reactor)
+	{
+		printf("epoll isn't available\n");
+		return 1;
+	}
+
+	// An abstract socket name, nothing to clean up on the filesystem
+	sockaddr_un address;
+	ZeroMemory(&address, sizeof(address));
+	address.sun_family = AF_UNIX;
+	int nameLength = snprintf(address.sun_path + 1, sizeof(address.sun_path) - 1, "idle_connections_bench_%d", (int)getpid());
+	socklen_t addressLength = (socklen_t)(offsetof(sockaddr_un, sun_path) + 1 + nameLength);
+
+	SOCKET listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenSocket == INVALID_SOCKET || bind(listenSocket, (const sockaddr*)&address, addressLength) != 0 || listen(listenSocket, SOMAXCONN) != 0)
+	{
+		printf("listen failed with error %d\n", errno);
+		return 1;
+	}
+
+	{
+		EventLoop loop(std::move(reactor));
+		CoroutineServer server(loop, listenSocket, answer);
+		loop.Spawn(server.Serve());
+		loop.Spawn(drive(loop, server, address, addressLength, connections));
+		loop.Run();
+	}
+
+	closesocket(listenSocket);
+	return 0;
+}
@@ -0,0 +1,143 @@
+// Compares the select() rebuild loop against the edge triggered epoll reactor at 1k, 10k and 50k connections.
+//
+// Every connection is registered with the reactor, then each tick a few random peers write one byte and we time
+// how long it takes the reactor to report and drain them. The select path pays for every registered socket on
+// every wakeup, epoll only for the ones that are ready.
+//
+// Linux only, build and run from the repository root:
+//   g++ -O2 -std=c++17 -o reactor_bench Benchmarks/reactor_bench.cpp
+//   ulimit -n 110000 && ./reactor_bench
+//
+// Connections are AF_UNIX socket pairs so 50k of them don't exhaust the loopback port range,
+// the readiness path through the kernel is the same as for TCP.
+
+#include "../Common/reactor.h"
+#include "bench_sockets.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <random>
+
+struct BenchResult
+{
+	bool ran;
+	double nsPerWakeup;
+	double eventsPerSecond;
+};
+
+static BenchResult runBenchmark(const char* backend, int connections, int activePerTick, int ticks)
+{
+	BenchResult benchResult = { false, 0.0, 0.0 };
+
+	std::unique_ptr<Reactor> reactor = createReactor(backend);
+	if (!reactor)
+		return benchResult;
+
+	std::vector<SOCKET> serverSide(connections);
+	std::vector<SOCKET> clientSide(connections);
+
+	for (int i = 0; i < connections; i++)
+	{
+		int pair[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+		{
+			printf("socketpair failed with error %d after %d connections\n", errno, i);
+			for (int j = 0; j < i; j++)
+			{
+				closesocket(serverSide[j]);
+				closesocket(clientSide[j]);
+			}
+			return benchResult;
+		}
+
+		serverSide[i] = pair[0];
+		clientSide[i] = pair[1];
+		setNonBlocking(serverSide[i]);
+		reactor->Add(serverSide[i], REACTOR_READ);
+	}
+
+	std::mt19937 random(1234);
+	std::uniform_int_distribution<int> pick(0, connections - 1);
+	std::vector<ReactorEvent> readyEvents;
+	char byte = 'x';
+	char drain[64];
+
+	long long totalEvents = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	for (int tick = 0; tick < ticks; tick++)
+	{
+		for (int i = 0; i < activePerTick; i++)
+		{
+			send(clientSide[pick(random)], &byte, 1, 0);
+		}
+
+		int count = reactor->Wait(readyEvents, 1000);
+		for (int i = 0; i < count; i++)
+		{
+			// Same drain rule as the server, edge triggered sockets are read until they would block
+			while (recv(readyEvents[i].socket, drain, sizeof(drain), RECV_DONTWAIT) > 0 && reactor->IsEdgeTriggered())
+			{
+			}
+		}
+		totalEvents += count;
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	double elapsedNs = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+	benchResult.ran = true;
+	benchResult.nsPerWakeup = elapsedNs / ticks;
+	benchResult.eventsPerSecond = totalEvents / (elapsedNs / 1e9);
+
+	for (int i = 0; i < connections; i++)
+	{
+		closesocket(serverSide[i]);
+		closesocket(clientSide[i]);
+	}
+
+	return benchResult;
+}
+
+int main(int arg, char** argv)
+{
+	int descriptorLimit = raiseDescriptorLimit();
+	printf("Descriptor limit: %d\n\n", descriptorLimit);
+
+	const char* backends[] = { "select", "epoll" };
+	const int connectionCounts[] = { 1000, 10000, 50000 };
+	const int activeCounts[] = { 1, 64 };
+
+	printf("%-8s %12s %8s %16s %16s\n", "backend", "connections", "active", "ns/wakeup", "events/s");
+
+	for (int connections : connectionCounts)
+	{
+		for (int active : activeCounts)
+		{
+			for (const char* backend : backends)
+			{
+				// Two descriptors per connection plus a little headroom
+				if (connections * 2 + 64 > descriptorLimit)
+				{
+					printf("%-8s %12d %8d %16s (needs ulimit -n %d)\n", backend, connections, active, "skipped", connections * 2 + 64);
+					continue;
+				}
+
+				// Keep total runtime reasonable, the select path gets slow at large sizes
+				int ticks = connections >= 50000 ? 2000 : 20000;
+
+				BenchResult result = runBenchmark(backend, connections, active, ticks);
+				if (!result.ran)
+				{
+					printf("%-8s %12d %8d %16s\n", backend, connections, active, "unavailable");
+					continue;
+				}
+
+				printf("%-8s %12d %8d %16.0f %16.0f\n", backend, connections, active, result.nsPerWakeup, result.eventsPerSecond);
+			}
+		}
+	}
+
+	return 0;
+}
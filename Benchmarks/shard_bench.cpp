@@ -0,0 +1,302 @@
+// Broadcast throughput of the sharded server at 1, 2, 4 and 8 reactor threads.
+//
+// Every shard runs its own engine on its own SO_REUSEPORT listener with a handler that relays each frame to its
+// local connections and publishes it to the other shards through the ShardGroup inboxes, the same path
+// ChatServer takes with --threads. Several clients send at once while the rest receive, and we time until
+// every receiver has seen every byte. The client side uses a fixed number of threads for every run, so any
+// change in throughput is the server's. Scaling needs real cores, run it on a machine with at least 8.
+//
+// Linux only, build and run from the repository root:
+//   g++ -O2 -std=c++17 -pthread -o shard_bench Benchmarks/shard_bench.cpp
+//   ulimit -n 8192 && ./shard_bench
+
+#include "../ChatServer/engine_factory.h"
+#include "../ChatServer/shard_group.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// Relays every frame to the shard's own connections but its sender, then to the other shards
+class ShardRelayHandler : public ServerEvents
+{
+public:
+
+	ServerEngine& m_Engine;
+	ShardGroup& m_Group;
+	int m_ShardIndex;
+	std::vector<SOCKET> m_Connections;
+
+	ShardRelayHandler(ServerEngine& engine, ShardGroup& group, int shardIndex)
+		: m_Engine(engine), m_Group(group)
+	{
+		m_ShardIndex = shardIndex;
+	}
+
+	void OnConnected(SOCKET socket) override
+	{
+		m_Connections.push_back(socket);
+		m_Group.m_TotalConnections++;
+	}
+
+	void OnFrame(SOCKET socket, const uint8_t* frame, uint32_t packetSize) override
+	{
+		FrameRef broadcastFrame(frame, packetSize);
+		for (SOCKET clientSocket : m_Connections)
+		{
+			if (clientSocket != socket)
+			{
+				m_Engine.SendFrame(clientSocket, broadcastFrame);
+			}
+		}
+
+		m_Group.Publish(m_ShardIndex, broadcastFrame);
+	}
+
+	void OnDisconnected(SOCKET socket) override
+	{
+		m_Connections.erase(std::find(m_Connections.begin(), m_Connections.end(), socket));
+		m_Group.m_TotalConnections--;
+	}
+
+	void OnWake() override
+	{
+		m_Group.Receive(m_ShardIndex, [&](ShardGroup::Broadcast& broadcast)
+		{
+			for (SOCKET clientSocket : m_Connections)
+			{
+				m_Engine.SendFrame(clientSocket, broadcast.encodings[ENCODING_V1]);
+			}
+		});
+	}
+};
+
+struct BenchResult
+{
+	bool ran;
+	double seconds;
+	double deliveredPerSecond;
+};
+
+// Binds port 0 for the first listener and the port it got for the rest
+static bool listenOnLoopback(int count, std::vector<SOCKET>& listenSockets, sockaddr_in& address)
+{
+	ZeroMemory(&address, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		SOCKET listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		listenSockets.push_back(listenSocket);
+
+		socklen_t length = sizeof(address);
+		if (!setReusePort(listenSocket)
+			|| bind(listenSocket, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR
+			|| listen(listenSocket, SOMAXCONN) == SOCKET_ERROR
+			|| getsockname(listenSocket, (sockaddr*)&address, &length) == SOCKET_ERROR)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Shard threads run forever, they are left behind when the process exits
+static ShardGroup* startServer(const std::string& backend, const std::vector<SOCKET>& listenSockets)
+{
+	int count = (int)listenSockets.size();
+	ShardGroup* group = new ShardGroup(count);
+
+	for (int i = 0; i < count; i++)
+	{
+		SOCKET listenSocket = listenSockets[i];
+		std::thread([backend, group, i, listenSocket]()
+		{
+			std::unique_ptr<ServerEngine> engine = createEngine(backend);
+			if (!group->Join(i, engine.get()))
+				return;
+
+			ShardRelayHandler* relay = new ShardRelayHandler(*engine, *group, i);
+			ServerEngine* serverEngine = engine.release();
+			serverEngine->Run(listenSocket, *relay);
+		}).detach();
+	}
+
+	while (group->m_JoinedCount.load() < count)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	return group->m_Failed ? nullptr : group;
+}
+
+static BenchResult runBenchmark(const char* backend, int shards, int clients, int senders, int messages, int frameSize)
+{
+	BenchResult benchResult = { false, 0.0, 0.0 };
+	const int receiveThreads = 4;
+
+	sockaddr_in address;
+	std::vector<SOCKET> listenSockets;
+	if (!listenOnLoopback(shards, listenSockets, address))
+		return benchResult;
+
+	ShardGroup* group = startServer(backend, listenSockets);
+	if (group == nullptr)
+		return benchResult;
+
+	std::vector<SOCKET> sockets(clients);
+	for (int i = 0; i < clients; i++)
+	{
+		sockets[i] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (connect(sockets[i], (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR)
+		{
+			printf("connect failed with error %d after %d clients\n", WSAGetLastError(), i);
+			return benchResult;
+		}
+	}
+
+	while (group->m_TotalConnections.load() < clients)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	// Everyone receives what every sender but themselves sends, the relay sends nothing else
+	long long expectedBytes = (long long)senders * messages * frameSize * (clients - 1);
+	std::atomic<long long> receivedBytes(0);
+
+	std::vector<std::unique_ptr<EpollReactor>> receivers;
+	for (int t = 0; t < receiveThreads; t++)
+	{
+		receivers.emplace_back(new EpollReactor());
+	}
+	for (int i = 0; i < clients; i++)
+	{
+		setNonBlocking(sockets[i]);
+		receivers[i % receiveThreads]->Add(sockets[i], REACTOR_READ);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < receiveThreads; t++)
+	{
+		threads.emplace_back([&, t]()
+		{
+			std::vector<ReactorEvent> readyEvents;
+			std::vector<char> drain(65536);
+			while (receivedBytes.load(std::memory_order_relaxed) < expectedBytes)
+			{
+				int count = receivers[t]->Wait(readyEvents, 100);
+				for (int i = 0; i < count; i++)
+				{
+					int result;
+					while ((result = recv(readyEvents[i].socket, drain.data(), (int)drain.size(), RECV_DONTWAIT)) > 0)
+					{
+						receivedBytes.fetch_add(result, std::memory_order_relaxed);
+					}
+				}
+			}
+		});
+	}
+
+	// One chat frame in the usual wire format, each sender blasts it back to back
+	std::vector<uint8_t> frame(frameSize, 'x');
+	uint32_t header[3] = { (uint32_t)frameSize, 1, (uint32_t)frameSize - 12 };
+	memcpy(frame.data(), header, sizeof(header));
+
+	for (int s = 0; s < senders; s++)
+	{
+		threads.emplace_back([&, s]()
+		{
+			SOCKET senderSocket = sockets[s * clients / senders];
+			size_t sentBytes = 0;
+			size_t totalBytes = (size_t)messages * frameSize;
+			std::vector<uint8_t> batch;
+			for (int i = 0; i < 64; i++)
+			{
+				batch.insert(batch.end(), frame.begin(), frame.end());
+			}
+
+			// Non-blocking, so spin on a full window instead of sleeping in send
+			while (sentBytes < totalBytes)
+			{
+				size_t chunk = std::min(batch.size() - sentBytes % batch.size(), totalBytes - sentBytes);
+				int result = send(senderSocket, (const char*)batch.data() + sentBytes % batch.size(), (int)chunk, MSG_NOSIGNAL);
+				if (result > 0)
+				{
+					sentBytes += result;
+				}
+				else
+				{
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(end - start).count();
+
+	benchResult.ran = true;
+	benchResult.seconds = seconds;
+	benchResult.deliveredPerSecond = (double)senders * messages * (clients - 1) / seconds;
+
+	for (SOCKET clientSocket : sockets)
+	{
+		closesocket(clientSocket);
+	}
+
+	return benchResult;
+}
+
+int main(int arg, char** argv)
+{
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+	const char* backends[] = { "epoll", "uring" };
+	const int shardCounts[] = { 1, 2, 4, 8 };
+	const int clients = 200;
+	const int senders = 8;
+	const int frameSize = 64;
+
+	// Keep the number of deliveries per run around 8 million
+	const int messages = 8000000 / senders / (clients - 1);
+
+	printf("%d clients, %d of them sending %d frames of %d bytes, %u hardware threads\n", clients, senders, messages, frameSize, std::thread::hardware_concurrency());
+	printf("%-8s %8s %10s %16s %10s\n", "backend", "shards", "seconds", "delivered/s", "speedup");
+
+	for (const char* backend : backends)
+	{
+		double baseline = 0.0;
+		for (int shards : shardCounts)
+		{
+			BenchResult result = runBenchmark(backend, shards, clients, senders, messages, frameSize);
+			if (!result.ran)
+			{
+				printf("%-8s %8d %10s\n", backend, shards, "unavailable");
+				continue;
+			}
+
+			if (shards == 1)
+			{
+				baseline = result.deliveredPerSecond;
+			}
+
+			printf("%-8s %8d %10.3f %16.0f %9.2fx\n", backend, shards, result.seconds, result.deliveredPerSecond,
+				baseline > 0.0 ? result.deliveredPerSecond / baseline : 0.0);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,296 @@
+// Fan-out latency to healthy clients while a few others stop reading.
+//
+// A server engine relays every frame to all other connections like ChatServer's broadcastMessage. One client
+// sends timestamped frames at a steady rate, most clients read as fast as they can and a few never read at all,
+// with tiny receive buffers so their windows close almost immediately. We measure how long each frame takes to
+// reach the healthy readers, with and without stalled clients and under each slow consumer policy.
+// With blocking sends the first stalled client would freeze the server, here only its own queue fills.
+//
+// Linux only, build and run from the repository root:
+//   g++ -O2 -std=c++17 -pthread -o slow_consumer_bench Benchmarks/slow_consumer_bench.cpp
+//   ./slow_consumer_bench
+
+#include "../ChatServer/engine_factory.h"
+#include "bench_sockets.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// The sender's pace, slow enough that the healthy readers keep up
+static const int SEND_INTERVAL_US = 50;
+
+// Relays every frame to everyone but its sender
+class RelayHandler : public ServerEvents
+{
+public:
+
+	ServerEngine& m_Engine;
+	std::vector<SOCKET> m_Connections;
+	std::atomic<int> m_ConnectedCount;
+
+	RelayHandler(ServerEngine& engine)
+		: m_Engine(engine)
+	{
+		m_ConnectedCount = 0;
+	}
+
+	void OnConnected(SOCKET socket) override
+	{
+		m_Connections.push_back(socket);
+		m_ConnectedCount++;
+	}
+
+	void OnFrame(SOCKET socket, const uint8_t* frame, uint32_t packetSize) override
+	{
+		FrameRef broadcastFrame(frame, packetSize);
+		for (SOCKET clientSocket : m_Connections)
+		{
+			if (clientSocket != socket)
+			{
+				m_Engine.SendFrame(clientSocket, broadcastFrame);
+			}
+		}
+	}
+
+	void OnDisconnected(SOCKET socket) override
+	{
+		m_Connections.erase(std::find(m_Connections.begin(), m_Connections.end(), socket));
+		m_ConnectedCount--;
+	}
+};
+
+struct BenchResult
+{
+	bool ran;
+	double deliveredPercent;	// of the frames sent, averaged over the healthy readers
+	double p50Us;
+	double p99Us;
+	double maxUs;
+};
+
+// Engines run forever, so the server thread is left behind when the process exits.
+// The engine is created on that thread because the io_uring ring only accepts submissions from its creator.
+static RelayHandler* startServer(const std::string& backend, const OutboundLimits& limits, SOCKET listenSocket)
+{
+	std::atomic<int> state(0);	// 1 running, -1 unavailable
+	RelayHandler* handler = nullptr;
+
+	std::thread([&backend, &limits, listenSocket, &state, &handler]()
+	{
+		std::unique_ptr<ServerEngine> engine = createEngine(backend);
+		if (!engine)
+		{
+			state = -1;
+			return;
+		}
+
+		engine->SetOutboundLimits(limits);
+
+		RelayHandler* relay = new RelayHandler(*engine);
+		handler = relay;
+		state = 1;
+
+		ServerEngine* serverEngine = engine.release();
+		serverEngine->Run(listenSocket, *relay);
+	}).detach();
+
+	while (state.load() == 0)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	return state.load() == 1 ? handler : nullptr;
+}
+
+static int64_t nowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static BenchResult runBenchmark(const char* backend, const OutboundLimits& limits, int healthy, int stalled, int messages, int frameSize)
+{
+	BenchResult benchResult = { false, 0.0, 0.0, 0.0, 0.0 };
+
+	sockaddr_in address;
+	SOCKET listenSocket = listenOnLoopback(address);
+	if (listenSocket == INVALID_SOCKET)
+		return benchResult;
+
+	RelayHandler* handler = startServer(backend, limits, listenSocket);
+	if (handler == nullptr)
+	{
+		closesocket(listenSocket);
+		return benchResult;
+	}
+
+	// sockets[0] sends, then the healthy readers, then the stalled ones
+	int clients = 1 + healthy + stalled;
+	std::vector<SOCKET> sockets(clients);
+	for (int i = 0; i < clients; i++)
+	{
+		sockets[i] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+		// Set before connect so the advertised window starts small
+		if (i > healthy)
+		{
+			int receiveBuffer = 4096;
+			setsockopt(sockets[i], SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+		}
+
+		if (connect(sockets[i], (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR)
+		{
+			printf("connect failed with error %d after %d clients\n", WSAGetLastError(), i);
+			return benchResult;
+		}
+	}
+
+	while (handler->m_ConnectedCount.load() < clients)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	EpollReactor receivers;
+	std::vector<FrameReassembler> reassemblers(clients);
+	for (int i = 1; i <= healthy; i++)
+	{
+		setNonBlocking(sockets[i]);
+		receivers.Add(sockets[i], REACTOR_READ);
+	}
+
+	std::vector<int64_t> latencies;
+	latencies.reserve((size_t)messages * healthy);
+	std::atomic<bool> sending(true);
+
+	std::thread receiveThread([&]()
+	{
+		std::vector<ReactorEvent> readyEvents;
+		std::vector<uint8_t> chunk(RECV_CHUNK_SIZE);
+		int64_t idleSince = 0;
+
+		while ((int64_t)latencies.size() < (int64_t)messages * healthy)
+		{
+			int count = receivers.Wait(readyEvents, 100);
+
+			// Frames dropped by the policy never arrive, stop once the sender is done and the stream went quiet
+			if (count == 0 && !sending.load())
+			{
+				if (idleSince == 0)
+					idleSince = nowNs();
+				else if (nowNs() - idleSince > 500000000)
+					break;
+				continue;
+			}
+			idleSince = 0;
+
+			for (int i = 0; i < count; i++)
+			{
+				SOCKET readySocket = readyEvents[i].socket;
+				FrameReassembler& reassembler = reassemblers[std::find(sockets.begin(), sockets.end(), readySocket) - sockets.begin()];
+
+				int result;
+				while ((result = recv(readySocket, (char*)chunk.data(), (int)chunk.size(), RECV_DONTWAIT)) > 0)
+				{
+					int64_t arrived = nowNs();
+					reassembler.Feed(chunk.data(), result, [&](const uint8_t* frame, uint32_t packetSize)
+					{
+						// Skip the welcome messages, ours carry the send time after the chat header
+						if (packetSize == (uint32_t)frameSize)
+						{
+							int64_t sent;
+							memcpy(&sent, frame + 12, sizeof(sent));
+							latencies.push_back(arrived - sent);
+						}
+						return true;
+					});
+				}
+			}
+		}
+	});
+
+	// Chat frames in the usual wire format
+	std::vector<uint8_t> frame(frameSize, 'x');
+	uint32_t header[3] = { (uint32_t)frameSize, 1, (uint32_t)frameSize - 12 };
+	memcpy(frame.data(), header, sizeof(header));
+
+	const int64_t intervalNs = SEND_INTERVAL_US * 1000;
+	int64_t nextSend = nowNs();
+	for (int i = 0; i < messages; i++)
+	{
+		while (nowNs() < nextSend)
+		{
+		}
+		nextSend += intervalNs;
+
+		int64_t sent = nowNs();
+		memcpy(frame.data() + 12, &sent, sizeof(sent));
+		send(sockets[0], (const char*)frame.data(), frameSize, 0);
+	}
+	sending = false;
+
+	receiveThread.join();
+
+	std::sort(latencies.begin(), latencies.end());
+
+	benchResult.ran = true;
+	benchResult.deliveredPercent = 100.0 * latencies.size() / ((double)messages * healthy);
+	if (!latencies.empty())
+	{
+		benchResult.p50Us = latencies[latencies.size() / 2] / 1000.0;
+		benchResult.p99Us = latencies[latencies.size() * 99 / 100] / 1000.0;
+		benchResult.maxUs = latencies.back() / 1000.0;
+	}
+
+	for (SOCKET clientSocket : sockets)
+	{
+		closesocket(clientSocket);
+	}
+
+	return benchResult;
+}
+
+int main(int arg, char** argv)
+{
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+	const char* backends[] = { "select", "epoll", "uring" };
+	const SlowConsumerPolicy policies[] = { SLOW_CONSUMER_DROP_OLDEST, SLOW_CONSUMER_DROP_NEWEST, SLOW_CONSUMER_DISCONNECT };
+	const int stalledCounts[] = { 0, 4 };
+	const int healthy = 50;
+	const int messages = 20000;
+	const int frameSize = 512;
+
+	// Low limits so the stalled clients cross them early in the run
+	OutboundLimits limits;
+	limits.highWatermark = 256 * 1024;
+	limits.lowWatermark = 64 * 1024;
+
+	printf("%d healthy readers, %d frames of %d bytes every %d us\n", healthy, messages, frameSize, SEND_INTERVAL_US);
+	printf("%-8s %-12s %8s %10s %10s %10s %10s\n", "backend", "policy", "stalled", "delivered", "p50 us", "p99 us", "max us");
+
+	for (const char* backend : backends)
+	{
+		for (SlowConsumerPolicy policy : policies)
+		{
+			limits.policy = policy;
+
+			for (int stalled : stalledCounts)
+			{
+				BenchResult result = runBenchmark(backend, limits, healthy, stalled, messages, frameSize);
+				if (!result.ran)
+				{
+					printf("%-8s %-12s %8d %10s\n", backend, slowConsumerPolicyName(policy), stalled, "unavailable");
+					continue;
+				}
+
+				printf("%-8s %-12s %8d %9.1f%% %10.1f %10.1f %10.1f\n", backend, slowConsumerPolicyName(policy), stalled,
+					result.deliveredPercent, result.p50Us, result.p99Us, result.maxUs);
+			}
+		}
+	}
+
+	return 0;
+}
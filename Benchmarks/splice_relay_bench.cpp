@@ -0,0 +1,296 @@
+// What it costs the server to pass a large body on to several clients, spliced through kernel pipes by
+// SpliceRelay against the way any other bytes go through it.
+//
+// One client sends the body, the others only read. Relayed, the sender announces it with a FileMessage and the
+// engine moves the body from socket to socket with RelayBody. Framed, the sender cuts it into chat frames and the
+// server broadcasts every frame as ChatServer does, each one read into the reassembler, copied into a shared frame
+// and written from there to every reader. Reports the throughput and the CPU time of the server's thread.
+//
+// Linux only, build and run from the repository root:
+//   g++ -O2 -std=c++17 -pthread -o splice_relay_bench Benchmarks/splice_relay_bench.cpp
+//   ./splice_relay_bench 1024 4
+
+#include "../ChatServer/engine_factory.h"
+#include "../Common/chat_messages.h"
+#include "bench_sockets.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// Chat frames as large as a sender would reasonably make them, well under MAX_FRAME_SIZE
+static const uint32_t FRAMED_PAYLOAD = 60 * 1024;
+
+// Relays a FileMessage's body to everyone but its sender, and broadcasts anything else
+class FileHandler : public ServerEvents
+{
+public:
+
+	ServerEngine& m_Engine;
+	std::vector<SOCKET> m_Connections;
+	std::atomic<int> m_ConnectedCount;
+
+	FileHandler(ServerEngine& engine)
+		: m_Engine(engine)
+	{
+		m_ConnectedCount = 0;
+	}
+
+	void OnConnected(SOCKET socket) override
+	{
+		m_Connections.push_back(socket);
+		m_ConnectedCount++;
+	}
+
+	void OnFrame(SOCKET socket, const uint8_t* frame, uint32_t packetSize) override
+	{
+		FrameRef broadcastFrame(frame, packetSize);
+
+		FileMessage file;
+		if (decodeMessage(frame, packetSize, file))
+		{
+			std::vector<RelayTarget> targets;
+			for (SOCKET clientSocket : m_Connections)
+			{
+				if (clientSocket != socket)
+				{
+					targets.push_back(RelayTarget{ clientSocket, broadcastFrame });
+				}
+			}
+			m_Engine.RelayBody(socket, file.size, targets);
+			return;
+		}
+
+		for (SOCKET clientSocket : m_Connections)
+		{
+			if (clientSocket != socket)
+			{
+				m_Engine.SendFrame(clientSocket, broadcastFrame);
+			}
+		}
+	}
+
+	void OnDisconnected(SOCKET socket) override
+	{
+		m_Connections.erase(std::find(m_Connections.begin(), m_Connections.end(), socket));
+		m_ConnectedCount--;
+	}
+
+	void OnWake() override
+	{
+	}
+};
+
+// Engines run forever, so the server thread is left behind when the process exits. serverClock is that thread's
+// CPU clock, to read its time from here.
+static FileHandler* startServer(const std::string& backend, SOCKET listenSocket, clockid_t& serverClock)
+{
+	std::atomic<int> state(0);	// 1 running, -1 unavailable
+	FileHandler* handler = nullptr;
+
+	std::thread([&backend, listenSocket, &state, &handler, &serverClock]()
+	{
+		std::unique_ptr<ServerEngine> engine = createEngine(backend);
+		if (!engine)
+		{
+			state = -1;
+			return;
+		}
+
+		// The framed body must not count as a slow consumer, the readers keep up anyway
+		OutboundLimits limits = defaultOutboundLimits();
+		limits.highWatermark = 1u << 30;
+		limits.lowWatermark = 1u << 29;
+		engine->SetOutboundLimits(limits);
+
+		FileHandler* files = new FileHandler(*engine);
+		handler = files;
+		pthread_getcpuclockid(pthread_self(), &serverClock);
+		state = 1;
+
+		ServerEngine* serverEngine = engine.release();
+		serverEngine->Run(listenSocket, *files);
+	}).detach();
+
+	while (state.load() == 0)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	return state.load() == 1 ? handler : nullptr;
+}
+
+static double secondsOf(clockid_t clock)
+{
+	timespec time;
+	clock_gettime(clock, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+struct BenchResult
+{
+	bool ran;
+	double seconds;
+	double serverCpuSeconds;
+};
+
+static BenchResult runBenchmark(const char* backend, bool relayed, uint64_t bodySize, int readers)
+{
+	BenchResult benchResult = { false, 0.0, 0.0 };
+
+	sockaddr_in address;
+	SOCKET listenSocket = listenOnLoopback(address);
+	if (listenSocket == INVALID_SOCKET)
+		return benchResult;
+
+	clockid_t serverClock;
+	FileHandler* handler = startServer(backend, listenSocket, serverClock);
+	if (handler == nullptr)
+	{
+		closesocket(listenSocket);
+		return benchResult;
+	}
+
+	// sockets[0] sends, the others read
+	int clients = 1 + readers;
+	std::vector<SOCKET> sockets(clients);
+	for (int i = 0; i < clients; i++)
+	{
+		sockets[i] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (connect(sockets[i], (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR)
+		{
+			printf("connect failed with error %d after %d clients\n", WSAGetLastError(), i);
+			return benchResult;
+		}
+	}
+
+	while (handler->m_ConnectedCount.load() < clients)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	// What goes out, the body after its FileMessage or cut into chat frames
+	Buffer header;
+	FileMessage file;
+	file.room = 0;
+	file.size = bodySize;
+	file.name = "bench.bin";
+	encodeMessage(file, header);
+
+	uint64_t frames = (bodySize + FRAMED_PAYLOAD - 1) / FRAMED_PAYLOAD;
+	uint64_t expected = relayed ? header.Size() + bodySize : bodySize + frames * 12;
+
+	std::vector<std::thread> readerThreads;
+	for (int i = 1; i < clients; i++)
+	{
+		readerThreads.emplace_back([&sockets, i, expected]()
+		{
+			std::vector<uint8_t> chunk(256 * 1024);
+			uint64_t received = 0;
+			while (received < expected)
+			{
+				int result = recv(sockets[i], (char*)chunk.data(), (int)chunk.size(), 0);
+				if (result <= 0)
+				{
+					printf("reader %d lost its connection after %llu bytes\n", i, (unsigned long long)received);
+					return;
+				}
+				received += result;
+			}
+		});
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	double cpuStart = secondsOf(serverClock);
+
+	std::vector<uint8_t> block(relayed ? 1024 * 1024 : 12 + FRAMED_PAYLOAD, 'x');
+	if (relayed)
+	{
+		send(sockets[0], (const char*)header.Data(), (int)header.Size(), MSG_NOSIGNAL);
+	}
+
+	uint64_t left = bodySize;
+	while (left > 0)
+	{
+		size_t length;
+		if (relayed)
+		{
+			length = left < block.size() ? (size_t)left : block.size();
+			left -= length;
+		}
+		else
+		{
+			uint32_t payload = left < FRAMED_PAYLOAD ? (uint32_t)left : FRAMED_PAYLOAD;
+			uint32_t chatHeader[3] = { 12 + payload, MESSAGE_TYPE_CHAT, payload };
+			memcpy(block.data(), chatHeader, sizeof(chatHeader));
+			length = 12 + payload;
+			left -= payload;
+		}
+
+		if (send(sockets[0], (const char*)block.data(), (int)length, MSG_NOSIGNAL) != (int)length)
+		{
+			printf("send failed with error %d\n", WSAGetLastError());
+			break;
+		}
+	}
+
+	for (std::thread& readerThread : readerThreads)
+	{
+		readerThread.join();
+	}
+
+	benchResult.ran = true;
+	benchResult.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	benchResult.serverCpuSeconds = secondsOf(serverClock) - cpuStart;
+
+	for (SOCKET clientSocket : sockets)
+	{
+		closesocket(clientSocket);
+	}
+
+	return benchResult;
+}
+
+int main(int arg, char** argv)
+{
+	uint64_t megabytes = arg > 1 ? strtoull(argv[1], NULL, 10) : 1024;
+	int readers = arg > 2 ? atoi(argv[2]) : 4;
+	if (megabytes == 0 || readers <= 0)
+	{
+		printf("usage: splice_relay_bench [MB] [readers]\n");
+		return 1;
+	}
+
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+	uint64_t bodySize = megabytes * 1024 * 1024;
+	printf("%llu MB from one client to %d readers over loopback\n", (unsigned long long)megabytes, readers);
+	printf("%-8s %-9s %10s %12s %16s\n", "backend", "path", "MB/s", "server cpu s", "cpu ns per byte");
+
+	const char* backends[] = { "epoll", "uring" };
+	for (const char* backend : backends)
+	{
+		for (bool relayed : { false, true })
+		{
+			const char* path = relayed ? "spliced" : "framed";
+			BenchResult result = runBenchmark(backend, relayed, bodySize, readers);
+			if (!result.ran)
+			{
+				printf("%-8s %-9s %10s\n", backend, path, "unavailable");
+				continue;
+			}
+
+			// Per byte any reader got, the server writes every one of them once per reader
+			double delivered = (double)bodySize * readers;
+			printf("%-8s %-9s %10.0f %12.2f %16.2f\n", backend, path, megabytes / result.seconds, result.serverCpuSeconds,
+				result.serverCpuSeconds * 1e9 / delivered);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,439 @@
+// How fast large files go over loopback as streams, see StreamOpenMessage, and how long chat waits meanwhile.
+//
+// One client sends the bytes split over a number of streams and only sends chunks it has credit for, the readers
+// give credit back at half a window as ChatSession does. The server passes everything on through StreamRouter.
+// Between its chunks the sender says a timestamped chat line every few milliseconds, the readers report how long
+// the lines took to reach them past the chunks queued ahead of them both ways. Reports the throughput per reader,
+// the CPU time of the server's thread, and the chat latency.
+//
+// Linux only, build and run from the repository root:
+//   g++ -O2 -std=c++17 -pthread -o stream_transfer_bench Benchmarks/stream_transfer_bench.cpp
+//   ./stream_transfer_bench 1024 1 4
+
+#include "../ChatServer/engine_factory.h"
+#include "../ChatServer/stream_router.h"
+#include "../Common/chat_messages.h"
+#include "bench_sockets.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// How often the sender says a chat line between its chunks
+static const int CHAT_INTERVAL_MS = 5;
+
+// Opens every stream to everyone but its sender and broadcasts anything else, as ChatServer does for room 0
+class StreamHandler : public ServerEvents
+{
+public:
+
+	ServerEngine& m_Engine;
+	StreamRouter m_Router;
+	std::vector<SOCKET> m_Connections;
+	std::atomic<int> m_ConnectedCount;
+
+	StreamHandler(ServerEngine& engine)
+		: m_Engine(engine), m_Router(engine)
+	{
+		m_ConnectedCount = 0;
+	}
+
+	void OnConnected(SOCKET socket) override
+	{
+		m_Connections.push_back(socket);
+		m_ConnectedCount++;
+	}
+
+	void OnFrame(SOCKET socket, const uint8_t* frame, uint32_t packetSize) override
+	{
+		StreamOpenMessage open;
+		StreamChunkMessage chunk;
+		StreamCreditMessage credit;
+		StreamCloseMessage close;
+		if (decodeMessage(frame, packetSize, chunk))
+		{
+			m_Router.Chunk(socket, frame, packetSize, chunk);
+		}
+		else if (decodeMessage(frame, packetSize, credit))
+		{
+			m_Router.Credit(socket, credit);
+		}
+		else if (decodeMessage(frame, packetSize, open))
+		{
+			std::vector<StreamRouter::Reader> readers;
+			for (SOCKET clientSocket : m_Connections)
+			{
+				if (clientSocket != socket)
+				{
+					readers.push_back(StreamRouter::Reader{ clientSocket, WIRE_V1, 0 });
+				}
+			}
+			m_Router.Open(socket, WIRE_V1, open, readers);
+		}
+		else if (decodeMessage(frame, packetSize, close))
+		{
+			m_Router.Close(socket, close);
+		}
+		else
+		{
+			FrameRef broadcastFrame(frame, packetSize);
+			for (SOCKET clientSocket : m_Connections)
+			{
+				if (clientSocket != socket)
+				{
+					m_Engine.SendFrame(clientSocket, broadcastFrame);
+				}
+			}
+		}
+	}
+
+	void OnDisconnected(SOCKET socket) override
+	{
+		m_Router.Forget(socket);
+		m_Connections.erase(std::find(m_Connections.begin(), m_Connections.end(), socket));
+		m_ConnectedCount--;
+	}
+
+	void OnWake() override
+	{
+	}
+};
+
+// Engines run forever, so the server thread is left behind when the process exits. serverClock is that thread's
+// CPU clock, to read its time from here.
+static StreamHandler* startServer(const std::string& backend, SOCKET listenSocket, clockid_t& serverClock)
+{
+	std::atomic<int> state(0);	// 1 running, -1 unavailable
+	StreamHandler* handler = nullptr;
+
+	std::thread([&backend, listenSocket, &state, &handler, &serverClock]()
+	{
+		std::unique_ptr<ServerEngine> engine = createEngine(backend);
+		if (!engine)
+		{
+			state = -1;
+			return;
+		}
+
+		StreamHandler* streams = new StreamHandler(*engine);
+		handler = streams;
+		pthread_getcpuclockid(pthread_self(), &serverClock);
+		state = 1;
+
+		ServerEngine* serverEngine = engine.release();
+		serverEngine->Run(listenSocket, *streams);
+	}).detach();
+
+	while (state.load() == 0)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	return state.load() == 1 ? handler : nullptr;
+}
+
+static double secondsOf(clockid_t clock)
+{
+	timespec time;
+	clock_gettime(clock, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static uint64_t microsecondsNow()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Calls onFrame(const uint8_t* frame, uint32_t packetSize) for every frame that comes on the socket until it
+// returns false or the connection ends
+template <typename OnFrame>
+static void readFrames(SOCKET socket, OnFrame onFrame)
+{
+	Buffer in(RECV_CHUNK_SIZE);
+	while (true)
+	{
+		in.Compact();
+		int received = recv(socket, (char*)in.PrepareWrite(RECV_CHUNK_SIZE), RECV_CHUNK_SIZE, 0);
+		if (received <= 0)
+			return;
+		in.CommitWrite(received);
+
+		uint32_t frameSize;
+		while (peekFrameSize(WIRE_V1, in.Data() + in.m_ReadIndex, in.Remaining(), frameSize) == FRAME_SIZE_KNOWN
+			&& frameSize <= in.Remaining())
+		{
+			ByteSpan frame = in.ReadBytes(frameSize);
+			if (!onFrame(frame.data, frameSize))
+				return;
+		}
+	}
+}
+
+static bool sendAll(SOCKET socket, const Buffer& buffer)
+{
+	return send(socket, (const char*)buffer.Data(), (int)buffer.Size(), MSG_NOSIGNAL) == (int)buffer.Size();
+}
+
+struct BenchResult
+{
+	bool ran;
+	double seconds;
+	double serverCpuSeconds;
+	double chatMedianMs;
+	double chatMaxMs;
+	size_t chatLines;
+};
+
+static BenchResult runBenchmark(const char* backend, uint64_t totalBytes, int readers, int streams)
+{
+	BenchResult benchResult = { false, 0.0, 0.0, 0.0, 0.0, 0 };
+
+	sockaddr_in address;
+	SOCKET listenSocket = listenOnLoopback(address);
+	if (listenSocket == INVALID_SOCKET)
+		return benchResult;
+
+	clockid_t serverClock;
+	StreamHandler* handler = startServer(backend, listenSocket, serverClock);
+	if (handler == nullptr)
+	{
+		closesocket(listenSocket);
+		return benchResult;
+	}
+
+	// sockets[0] sends the streams and chats, the others read
+	int clients = 1 + readers;
+	std::vector<SOCKET> sockets(clients);
+	for (int i = 0; i < clients; i++)
+	{
+		sockets[i] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (connect(sockets[i], (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR)
+		{
+			printf("connect failed with error %d after %d clients\n", WSAGetLastError(), i);
+			return benchResult;
+		}
+
+		int noDelay = 1;
+		setsockopt(sockets[i], IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+	}
+
+	while (handler->m_ConnectedCount.load() < clients)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	uint64_t streamSize = totalBytes / streams;
+	std::mutex latencyLock;
+	std::vector<double> latenciesMs;
+
+	std::vector<std::thread> readerThreads;
+	for (int i = 1; i < clients; i++)
+	{
+		readerThreads.emplace_back([&, i]()
+		{
+			std::unordered_map<uint32_t, uint64_t> unacked;
+			int closed = 0;
+			Buffer out;
+			readFrames(sockets[i], [&](const uint8_t* frame, uint32_t packetSize)
+			{
+				StreamChunkMessage chunk;
+				StreamCloseMessage close;
+				ChatMessage chatMessage;
+				if (decodeMessage(frame, packetSize, chunk))
+				{
+					uint64_t& owed = unacked[chunk.stream];
+					owed += chunk.data.length();
+					if (owed >= STREAM_WINDOW / 2)
+					{
+						StreamCreditMessage credit;
+						credit.stream = chunk.stream;
+						credit.bytes = owed;
+						out.Clear();
+						encodeMessage(credit, out);
+						sendAll(sockets[i], out);
+						owed = 0;
+					}
+				}
+				else if (decodeMessage(frame, packetSize, chatMessage))
+				{
+					uint64_t sentUs = strtoull(std::string(chatMessage.message).c_str(), NULL, 10);
+					std::lock_guard<std::mutex> guard(latencyLock);
+					latenciesMs.push_back((microsecondsNow() - sentUs) / 1000.0);
+				}
+				else if (decodeMessage(frame, packetSize, close) && close.status == STREAM_DONE)
+				{
+					closed++;
+				}
+				return closed < streams;
+			});
+
+			if (closed < streams)
+			{
+				printf("reader %d lost its connection after %d of %d streams\n", i, closed, streams);
+			}
+		});
+	}
+
+	// Credit for the sender's streams, by its ids 1 to streams
+	std::vector<std::atomic<uint64_t>> credits(streams + 1);
+	for (std::atomic<uint64_t>& credit : credits)
+	{
+		credit = STREAM_WINDOW;
+	}
+	std::thread creditThread([&]()
+	{
+		readFrames(sockets[0], [&](const uint8_t* frame, uint32_t packetSize)
+		{
+			StreamCreditMessage credit;
+			if (decodeMessage(frame, packetSize, credit) && credit.stream >= 1 && credit.stream <= (uint32_t)streams)
+			{
+				credits[credit.stream] += credit.bytes;
+			}
+			return true;
+		});
+	});
+
+	auto start = std::chrono::steady_clock::now();
+	double cpuStart = secondsOf(serverClock);
+
+	// A chunk of every stream in turn while any has credit left, as ChatSession does
+	Buffer out;
+	for (int stream = 1; stream <= streams; stream++)
+	{
+		StreamOpenMessage open;
+		open.stream = stream;
+		open.room = 0;
+		open.size = streamSize;
+		open.name = "bench.bin";
+		encodeMessage(open, out);
+	}
+	sendAll(sockets[0], out);
+
+	std::vector<uint8_t> data(STREAM_CHUNK_SIZE, 'x');
+	std::vector<uint64_t> sent(streams + 1, 0);
+	int finished = 0;
+	uint64_t nextChatUs = 0;
+	while (finished < streams)
+	{
+		out.Clear();
+		if (microsecondsNow() >= nextChatUs)
+		{
+			std::string line = std::to_string(microsecondsNow());
+			ChatMessage chatMessage;
+			chatMessage.message = line;
+			encodeMessage(chatMessage, out);
+			nextChatUs = microsecondsNow() + CHAT_INTERVAL_MS * 1000;
+		}
+
+		for (int stream = 1; stream <= streams; stream++)
+		{
+			uint64_t left = std::min(streamSize - sent[stream], credits[stream].load() - sent[stream]);
+			uint32_t length = (uint32_t)std::min<uint64_t>(left, STREAM_CHUNK_SIZE);
+			if (length == 0)
+				continue;
+
+			StreamChunkMessage chunk;
+			chunk.stream = stream;
+			chunk.data = std::string_view((const char*)data.data(), length);
+			encodeMessage(chunk, out);
+			sent[stream] += length;
+
+			if (sent[stream] == streamSize)
+			{
+				StreamCloseMessage close;
+				close.stream = stream;
+				close.status = STREAM_DONE;
+				encodeMessage(close, out);
+				finished++;
+			}
+		}
+
+		if (out.Size() == 0)
+		{
+			// Out of credit everywhere, the readers are behind
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+			continue;
+		}
+
+		if (!sendAll(sockets[0], out))
+		{
+			printf("send failed with error %d\n", WSAGetLastError());
+			break;
+		}
+	}
+
+	for (std::thread& readerThread : readerThreads)
+	{
+		readerThread.join();
+	}
+
+	benchResult.ran = true;
+	benchResult.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	benchResult.serverCpuSeconds = secondsOf(serverClock) - cpuStart;
+
+	std::sort(latenciesMs.begin(), latenciesMs.end());
+	benchResult.chatLines = latenciesMs.size();
+	if (!latenciesMs.empty())
+	{
+		benchResult.chatMedianMs = latenciesMs[latenciesMs.size() / 2];
+		benchResult.chatMaxMs = latenciesMs.back();
+	}
+
+	for (SOCKET clientSocket : sockets)
+	{
+		shutdown(clientSocket, SD_BOTH);
+	}
+	creditThread.join();
+	for (SOCKET clientSocket : sockets)
+	{
+		closesocket(clientSocket);
+	}
+
+	return benchResult;
+}
+
+int main(int arg, char** argv)
+{
+	uint64_t megabytes = arg > 1 ? strtoull(argv[1], NULL, 10) : 1024;
+	int readers = arg > 2 ? atoi(argv[2]) : 1;
+	int maxStreams = arg > 3 ? atoi(argv[3]) : 4;
+	if (megabytes == 0 || readers <= 0 || maxStreams <= 0 || maxStreams > (int)StreamRouter::MAX_STREAMS_PER_SENDER)
+	{
+		printf("usage: stream_transfer_bench [MB] [readers] [streams, at most %d]\n", (int)StreamRouter::MAX_STREAMS_PER_SENDER);
+		return 1;
+	}
+
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+	uint64_t totalBytes = megabytes * 1024 * 1024;
+	printf("%llu MB from one client to %d reader(s) over loopback, chat every %d ms meanwhile\n", (unsigned long long)megabytes, readers, CHAT_INTERVAL_MS);
+	printf("%-8s %-8s %10s %12s %16s %14s %12s\n", "backend", "streams", "MB/s", "server cpu s", "cpu ns per byte", "chat p50 ms", "chat max ms");
+
+	const char* backends[] = { "epoll", "uring" };
+	for (const char* backend : backends)
+	{
+		for (int streams = 1; streams <= maxStreams; streams *= 2)
+		{
+			BenchResult result = runBenchmark(backend, totalBytes, readers, streams);
+			if (!result.ran)
+			{
+				printf("%-8s %-8d %10s\n", backend, streams, "unavailable");
+				continue;
+			}
+
+			double delivered = (double)(totalBytes / streams * streams) * readers;
+			printf("%-8s %-8d %10.0f %12.2f %16.2f %14.2f %12.2f\n", backend, streams, megabytes / result.seconds, result.serverCpuSeconds,
+				result.serverCpuSeconds * 1e9 / delivered, result.chatMedianMs, result.chatMaxMs);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,110 @@
+// What idle deadlines cost with many connections, the timer wheel against scanning every connection.
+//
+// Arms one timer per connection, the way ChatServer gives every client a liveness check, and times arming,
+// moving and cancelling them. Then runs a loop for a few seconds in which a small share of the deadlines comes
+// due on every pass, and compares the time spent in Advance with what a loop that checks every connection's
+// deadline spends finding the same ones.
+//
+// Build and run from the repository root:
+//   g++ -O2 -std=c++17 -o timer_wheel_bench Benchmarks/timer_wheel_bench.cpp
+//   ./timer_wheel_bench 100000
+
+#include "../Common/timer_wheel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+static double nanosecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int arg, char** argv)
+{
+	int connections = arg > 1 ? atoi(argv[1]) : 100000;
+	const uint64_t spreadMs = 3000;
+
+	std::mt19937 random(12345);
+	std::vector<uint64_t> delays(connections);
+	for (uint64_t& delay : delays)
+	{
+		delay = 1 + random() % spreadMs;
+	}
+
+	TimerWheel wheel;
+	std::unique_ptr<TimerWheel::Timer[]> timers(new TimerWheel::Timer[connections]);
+	size_t fired = 0;
+	for (int i = 0; i < connections; i++)
+	{
+		timers[i].m_Callback = [&fired]() { fired++; };
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < connections; i++)
+	{
+		wheel.Arm(timers[i], delays[i]);
+	}
+	printf("%d timers armed, %.1f ns each\n", connections, nanosecondsSince(start) / connections);
+
+	// What a connection that just received something does, its deadline moves
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < connections; i++)
+	{
+		wheel.Arm(timers[i], delays[connections - 1 - i]);
+	}
+	printf("moved, %.1f ns each\n", nanosecondsSince(start) / connections);
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < connections; i++)
+	{
+		wheel.Cancel(timers[i]);
+	}
+	printf("cancelled, %.1f ns each\n", nanosecondsSince(start) / connections);
+
+	// The same deadlines for both, a scan keeps one per connection and checks all of them every pass
+	std::vector<uint64_t> deadlines(connections);
+	wheel.Advance();
+	uint64_t now = wheel.Now();
+	for (int i = 0; i < connections; i++)
+	{
+		wheel.Arm(timers[i], delays[i]);
+		deadlines[i] = now + delays[i];
+	}
+
+	double advanceNs = 0;
+	double scanNs = 0;
+	size_t scanned = 0;
+	int passes = 0;
+	while (fired < (size_t)connections)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		passes++;
+
+		start = std::chrono::steady_clock::now();
+		wheel.Advance();
+		advanceNs += nanosecondsSince(start);
+
+		start = std::chrono::steady_clock::now();
+		uint64_t scanNow = timerNowMs();
+		for (int i = 0; i < connections; i++)
+		{
+			if (deadlines[i] <= scanNow)
+			{
+				deadlines[i] = UINT64_MAX;
+				scanned++;
+			}
+		}
+		scanNs += nanosecondsSince(start);
+	}
+
+	printf("%d passes until all %zu came due, %zu found by the scan\n", passes, fired, scanned);
+	printf("wheel: %.1f us per pass, %.1f ns per timer fired\n", advanceNs / passes / 1000, advanceNs / fired);
+	printf("scan:  %.1f us per pass, %.1f ns per deadline found\n", scanNs / passes / 1000, scanNs / scanned);
+
+	return 0;
+}
@@ -1,44 +1,25 @@
 #pragma once
 
-#define WIN32_LEAN_AND_MEAN
-
-#include <Windows.h>
-#include <WinSock2.h>
-#include <Ws2tcpip.h>
+#include "../Common/socket_platform.h"
 #include <stdlib.h>
 #include <stdio.h>
-#include <thread>
 #include <iostream>
-#include <atomic>
-#include <conio.h> // For _getch() to read input without immediate echoing
 #include<sstream>
 #include<chrono>
 #include <iomanip>
 #include <ctime>
 
-#include "buffer.h"
-#include <string>
+#ifdef _WIN32
+#include <conio.h> // For _getch() to read input without immediate echoing
+#endif
 
-// Need to link Ws2_32.lib
-#pragma comment(lib, "Ws2_32.lib")
+#include "../Common/event_loop.h"
+#include "../Common/frame_compression.h"
+#include "chat_session.h"
+#include <string>
 
 #define DEFAULT_PORT "8412"
 
-struct PacketHeader
-{
-    uint32_t packetSize;
-    uint32_t messageType;
-};
-
-struct ChatMessage
-{
-    PacketHeader header;
-    uint32_t messageLength;
-    std::string message;
-};
-
-std::atomic<bool> isRunning(true);
-
 std::string getCurrentTimestamp() {
     // Get current time
     auto now = std::chrono::system_clock::now();
@@ -46,7 +27,11 @@ std::string getCurrentTimestamp() {
 
     // Convert to local time
     std::tm now_tm; // Declare a tm variable
+#ifdef _WIN32
     localtime_s(&now_tm, &now_time_t); // Use localtime_s to fill the tm structure
+#else
+    localtime_r(&now_time_t, &now_tm);
+#endif
 
     // Format the time as a string (HH:MM:SS)
     std::ostringstream oss;
@@ -54,63 +39,6 @@ std::string getCurrentTimestamp() {
     return oss.str();
 }
 
-void receiveMessage(SOCKET socket)
-{
-    while (isRunning.load(std::memory_order_relaxed))
-    {
-        const int bufSize = 512;
-        Buffer buffer(bufSize);
-        int result = recv(socket, (char*)(&buffer.m_BufferData[0]), bufSize, 0);
-        if (result > 0)
-        {
-            uint32_t packetSize = buffer.ReadUInt32LE();
-            uint32_t messageType = buffer.ReadUInt32LE();
-
-
-            // testing recieving time stamp but i think its better to just send it so everyone sees it
-          /*  std::string time = getCurrentTimestamp();
-            std::cout << "\t\t(" + time + ")";*/
-
-            if (messageType == 1)
-            {
-                uint32_t messageLength = buffer.ReadUInt32LE();
-                std::string msg = buffer.ReadString(messageLength);
-                
-                std::cout << "\r" << msg << "\n";  // Print message and move to a new line
-            }
-        }
-        else if (result == 0)
-        {
-            std::cout << "Server closed the connection.\n";
-            break;
-        }
-        else
-        {
-            printf("recv failed with error %d\n", WSAGetLastError());
-            break;
-        }
-    }
-}
-
-void sendMessageToServer(SOCKET serverSocket, const std::string& message)
-{
-
-    ChatMessage chatMessage;
-    // Combine the message with the timestamp
-    chatMessage.message = message;
-    chatMessage.messageLength = chatMessage.message.length();  // Update message length
-    chatMessage.header.messageType = 1;
-    chatMessage.header.packetSize = sizeof(PacketHeader) + sizeof(uint32_t) + chatMessage.messageLength;
-
-    Buffer buffer(512);
-    buffer.WriteUInt32LE(chatMessage.header.packetSize);
-    buffer.WriteUInt32LE(chatMessage.header.messageType);
-    buffer.WriteUInt32LE(chatMessage.messageLength);
-    buffer.WriteString(chatMessage.message);
-
-    send(serverSocket, (const char*)(&buffer.m_BufferData[0]), chatMessage.header.packetSize, 0);
-}
-
 void printHeader() {
     // Print the header
     const char* header = "Eric's Chat Room";
@@ -145,64 +73,93 @@ void printHeader() {
     printf("\n");
 }
 
-void processInputAndSendMessage(SOCKET serverSocket, const std::string& username)
+// What the user types, as it is typed. The Windows console hands over keys one at a time without echoing
+// them, so we echo and handle backspace ourselves. Elsewhere the terminal does that and hands over whole lines.
+Task<> typeLines(EventLoop& loop, ChatSession& session)
 {
     std::string userInput;
-    char ch;
+    char keys[256];
 
-    // Reading input character by character
     while (true)
     {
-        
-        std::string time = getCurrentTimestamp();
-        ch = _getch();  // Get character without displaying it on console
+        co_await loop.ConsoleReadable();
 
-        if (ch == '\r')  // Enter key
+#ifdef _WIN32
+        int count = 0;
+        while (count < (int)sizeof(keys) && _kbhit())
         {
-            if (!userInput.empty())
-            {
-                if (userInput == "/exit")
-                {
-                    // Create a leave message
-                    std::string leaveMessage = time + username + " has left the chat";
-
-                    // Send the leave message to the server
-                    sendMessageToServer(serverSocket, leaveMessage);
-
-                    isRunning = false;
-                    std::cout << "Exiting chat...\n";
-                    break;
-                }
-
-                // Format message with username
-                std::string messageToSend = time + "[" + username + "]: " + userInput;
+            keys[count++] = (char)_getch();  // Get character without displaying it on console
+        }
+#else
+        int count = (int)read(STDIN_FILENO, keys, sizeof(keys));
+        if (count <= 0)
+        {
+            // End of input leaves the chat like /exit would
+            count = 0;
+            userInput = "/exit";
+            keys[count++] = '\n';
+        }
+#endif
 
-                // Send the message to the server
-                sendMessageToServer(serverSocket, messageToSend);
+        for (int i = 0; i < count; i++)
+        {
+            char ch = keys[i];
+            if (ch == '\r' || ch == '\n')  // Enter key
+            {
+                if (userInput.empty())
+                    continue;
 
-                // Clear the current input line and display the sent message
-                printf("\r%s\n", messageToSend.c_str());
+                bool staying = co_await session.Say(userInput, getCurrentTimestamp());
 
                 // Reset userInput for the next message
                 userInput.clear();
+
+                if (!staying)
+                {
+                    std::cout << "Exiting chat...\n";
+                    loop.Stop();
+                    co_return;
+                }
             }
-        }
-        else if (ch == '\b')  // Handle backspace
-        {
-            if (!userInput.empty())
+            else if (ch == '\b')  // Handle backspace
+            {
+                if (!userInput.empty())
+                {
+                    userInput.pop_back();
+                    printf("\b \b");  // Move cursor back, print space to erase, move cursor back again
+                }
+            }
+            else
             {
-                userInput.pop_back();
-                printf("\b \b");  // Move cursor back, print space to erase, move cursor back again
+                userInput += ch;
+#ifdef _WIN32
+                printf("%c", ch);  // Echo typed character
+#endif
             }
         }
-        else
-        {
-            userInput += ch;
-            printf("%c", ch);  // Echo typed character
-        }
     }
 }
 
+// Says hello, then reads and types at the same time until either side is done
+Task<> runSession(EventLoop& loop, ChatSession& session)
+{
+    bool joined = co_await session.Join(getCurrentTimestamp());
+    if (!joined)
+    {
+        loop.Stop();
+        co_return;
+    }
+
+    loop.Spawn(typeLines(loop, session));
+
+    co_await session.Receive();
+    if (!session.m_Left)
+    {
+        std::cout << "Server closed the connection.\n";
+    }
+    loop.Stop();
+}
+
 int main(int arg, char** argv)
 {
 
@@ -271,39 +228,21 @@ int main(int arg, char** argv)
    // printf("Connected to the server successfully!\n");
 
     std::cout << "Connected to the room as " << name << "...\n";
-  
-    std::string joinTime = getCurrentTimestamp();
 
-    // Notify others that this user has joined
-    ChatMessage joinMessage;
-    joinMessage.message = joinTime + name + " has joined the chat";
-    joinMessage.messageLength = joinMessage.message.length();
-    joinMessage.header.messageType = 1;
-    joinMessage.header.packetSize = joinMessage.messageLength + sizeof(joinMessage.messageLength) + sizeof(joinMessage.header.messageType) + sizeof(joinMessage.header.packetSize);
+    // Offered to the server in our hello, it compresses large broadcasts for us if it has the same one
+    CompressionDictionary chatDictionary;
+    chatDictionary.SetBuiltIn();
 
-    Buffer jbuffer(512);
-    jbuffer.WriteUInt32LE(joinMessage.header.packetSize);
-    jbuffer.WriteUInt32LE(joinMessage.header.messageType);
-    jbuffer.WriteUInt32LE(joinMessage.messageLength);
-    jbuffer.WriteString(joinMessage.message);
-
-    send(serverSocket, (const char*)(&jbuffer.m_BufferData[0]), joinMessage.header.packetSize, 0);
-
-    std::thread receiveThread(receiveMessage, serverSocket);
-
-    while (isRunning)
+    // One thread waits on the socket and the keyboard together, the session closes the socket when it goes
     {
-        processInputAndSendMessage(serverSocket, name);
+        EventLoop loop;
+        ChatSession session(loop, serverSocket, name, &chatDictionary);
+        loop.Spawn(runSession(loop, session));
+        loop.Run();
     }
 
     // Clean up after exiting the chat
     freeaddrinfo(info);
-    shutdown(serverSocket, SD_BOTH);
-    closesocket(serverSocket);
-
-    isRunning = false;
-    if (receiveThread.joinable())
-        receiveThread.join();
 
     WSACleanup();
 
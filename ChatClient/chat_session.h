@@ -0,0 +1,590 @@
+#pragma once
+
+#include "../Common/socket_platform.h"
+#include "../Common/event_loop.h"
+#include "../Common/frame_stream.h"
+#include "../Common/chat_messages.h"
+#include "../Common/frame_compression.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// One user's connection to the chat, run by coroutines on an EventLoop: Receive hands every line the server
+// sends to m_OnLine, Say sends what the user typed. Nothing in here blocks or owns a thread, so a process
+// can run as many sessions as it likes on one loop, e.g. to drive a server from a test.
+class ChatSession
+{
+public:
+
+	FrameStream m_Stream;
+	FrameCompressor m_Compressor;
+	std::string m_Name;
+	uint32_t m_CurrentRoom;		// set by /join, lines go to everyone while it is 0
+	bool m_Left;				// said /exit, the connection ending is our doing
+	bool m_Files;				// the server agreed to files in its hello
+	bool m_Streams;				// and to streams, files go as those then
+	bool m_SendingFile;			// a body is going out, nothing else may be written in the middle of it
+	bool m_PongOwed;			// a ping came while it was, answered right after
+	uint32_t m_PongSequence;
+	std::function<void(std::string_view line)> m_OnLine;
+
+	// A file we are sending, chunks go out as far as its credit goes whenever more comes
+	struct OutgoingStream
+	{
+		uint32_t id;
+		FILE* input;
+		std::string name;
+		uint64_t size;
+		uint64_t left;
+		uint64_t credit;	// bytes we may still send
+		bool failed;		// the file got shorter, what was promised can't come
+	};
+
+	// A file we are being sent, by the server's id for it. output is nullptr if it can't be saved, the chunks
+	// are still taken so the sender isn't held up.
+	struct IncomingStream
+	{
+		FILE* output;
+		std::string name;
+		uint64_t size;
+		uint64_t received;
+		uint64_t unacked;	// received but not given back as credit yet
+	};
+
+	std::vector<OutgoingStream> m_Outgoing;
+	std::unordered_map<uint32_t, IncomingStream> m_Incoming;
+	uint32_t m_NextStream;
+	Buffer m_Chunk;		// the next chunk read from a file, back to the pool when nothing is being sent
+
+	// Takes ownership of a connected socket. dictionary is offered to the server for compressing what it sends us.
+	ChatSession(EventLoop& loop, SOCKET socket, const std::string& name, const CompressionDictionary* dictionary)
+		: m_Stream(loop, socket), m_Compressor(dictionary), m_Chunk(0)
+	{
+		m_Name = name;
+		m_CurrentRoom = 0;
+		m_Left = false;
+		m_Files = false;
+		m_Streams = false;
+		m_NextStream = 1;
+		m_SendingFile = false;
+		m_PongOwed = false;
+		m_PongSequence = 0;
+		m_OnLine = [](std::string_view line)
+		{
+			printf("\r%.*s\n", (int)line.length(), line.data());  // Print message and move to a new line
+		};
+	}
+
+	// Whatever was still being sent or received is cut off
+	~ChatSession()
+	{
+		for (OutgoingStream& outgoing : m_Outgoing)
+		{
+			fclose(outgoing.input);
+		}
+		for (auto& entry : m_Incoming)
+		{
+			if (entry.second.output != nullptr)
+				fclose(entry.second.output);
+		}
+	}
+
+	// Says hello and tells everyone we're here. Returns false if the connection failed.
+	Task<bool> Join(const std::string& timestamp)
+	{
+		// Ask for large broadcasts compressed, a server that can't just never sends us any. We answer pings, so
+		// the server can tell us apart from a connection that died while we are only reading. Files we take and
+		// may send if it agrees, as streams if it can.
+		HelloMessage hello;
+		hello.features = HELLO_FEATURE_COMPRESSION | HELLO_FEATURE_HEARTBEAT | HELLO_FEATURE_FILES | HELLO_FEATURE_STREAMS;
+		hello.dictionaryId = m_Compressor.DictionaryId();
+		bool sent = co_await m_Stream.WriteFrame(hello);
+		if (!sent)
+			co_return false;
+
+		co_return co_await SendChat(timestamp + m_Name + " has joined the chat");
+	}
+
+	// Until the server closes the connection or we shut it down
+	Task<> Receive()
+	{
+		ByteSpan frame;
+		while (co_await m_Stream.ReadFrame(frame))
+		{
+			// Its body follows on the stream, read before the next frame
+			FileMessage file;
+			if (decodeMessage(frame.data, (uint32_t)frame.size, file))
+			{
+				bool received = co_await ReceiveFile(file);
+				if (!received)
+					break;
+				continue;
+			}
+
+			HelloMessage reply;
+			if (decodeMessage(frame.data, (uint32_t)frame.size, reply))
+			{
+				m_Files = (reply.features & HELLO_FEATURE_FILES) != 0;
+				m_Streams = (reply.features & HELLO_FEATURE_STREAMS) != 0;
+				continue;
+			}
+
+			// Stream frames are never packed, what they have us send goes out like a pong
+			bool queued = false;
+			if (OnStreamFrame(frame, queued))
+			{
+				if (queued)
+				{
+					bool sent = co_await m_Stream.Flush();
+					if (!sent)
+						break;
+				}
+				continue;
+			}
+
+			// A compressed frame unpacks into the frames it holds, anything else comes through as it is
+			bool answered = false;
+			bool valid = m_Compressor.Unpack(frame.data, (uint32_t)frame.size, [&](const uint8_t* message, uint32_t messageSize)
+			{
+				ChatMessage chatMessage;
+				RoomChatMessage roomChat;
+				PingMessage ping;
+				if (decodeMessage(message, messageSize, chatMessage))
+				{
+					m_OnLine(chatMessage.message);
+				}
+				else if (decodeMessage(message, messageSize, roomChat))
+				{
+					m_OnLine("(room " + std::to_string(roomChat.room) + ") " + std::string(roomChat.message));
+				}
+				else if (decodeMessage(message, messageSize, ping) && m_SendingFile)
+				{
+					m_PongOwed = true;
+					m_PongSequence = ping.sequence;
+				}
+				else if (decodeMessage(message, messageSize, ping))
+				{
+					PongMessage pong;
+					pong.sequence = ping.sequence;
+					m_Stream.Queue(pong);
+					answered = true;
+				}
+			});
+
+			if (!valid)
+			{
+				printf("Server sent a malformed message.\n");
+				break;
+			}
+
+			if (answered)
+			{
+				bool sent = co_await m_Stream.Flush();
+				if (!sent)
+					break;
+			}
+		}
+	}
+
+	// One line the user entered. /join N talks in room N from then on, /leave goes back to talking to everyone,
+	// /file PATH shares a file with the room or everyone and /exit says goodbye and ends the session. Returns
+	// false once the session is over.
+	Task<bool> Say(const std::string& userInput, const std::string& timestamp)
+	{
+		if (userInput.rfind("/file ", 0) == 0 && m_Streams)
+		{
+			co_return co_await OpenStream(userInput.substr(6));
+		}
+
+		if (userInput.rfind("/file ", 0) == 0)
+		{
+			co_return co_await SendFile(userInput.substr(6));
+		}
+
+		if (userInput == "/exit")
+		{
+			co_await SendChat(timestamp + m_Name + " has left the chat");
+			m_Left = true;
+			m_Stream.Shutdown();
+			co_return false;
+		}
+
+		if (userInput.rfind("/join ", 0) == 0 || userInput == "/leave")
+		{
+			if (m_CurrentRoom != 0)
+			{
+				LeaveRoomMessage leaveRoom;
+				leaveRoom.room = m_CurrentRoom;
+				m_Stream.Queue(leaveRoom);
+			}
+
+			m_CurrentRoom = userInput == "/leave" ? 0 : (uint32_t)strtoul(userInput.c_str() + 6, NULL, 10);
+			if (m_CurrentRoom != 0)
+			{
+				JoinRoomMessage joinRoom;
+				joinRoom.room = m_CurrentRoom;
+				m_Stream.Queue(joinRoom);
+				printf("\rNow talking in room %u, /leave to talk to everyone\n", m_CurrentRoom);
+			}
+			else
+			{
+				printf("\rNow talking to everyone\n");
+			}
+
+			co_return co_await m_Stream.Flush();
+		}
+
+		std::string messageToSend = timestamp + "[" + m_Name + "]: " + userInput;
+		bool sent = co_await SendChat(messageToSend, m_CurrentRoom);
+		if (!sent)
+			co_return false;
+
+		// Clear the current input line and display the sent message
+		printf("\r%s\n", messageToSend.c_str());
+		co_return true;
+	}
+
+	// The frame, then the file's bytes straight after it. A file that can't be read is only a message to the
+	// user. Returns false if the connection failed.
+	Task<bool> SendFile(const std::string& path)
+	{
+		if (!m_Files)
+		{
+			printf("\rThe server doesn't take files\n");
+			co_return true;
+		}
+
+		std::error_code error;
+		uint64_t size = std::filesystem::file_size(path, error);
+		FILE* input = error ? nullptr : fopen(path.c_str(), "rb");
+		if (input == nullptr)
+		{
+			printf("\rCan't read %s\n", path.c_str());
+			co_return true;
+		}
+
+		std::string name = std::filesystem::path(path).filename().string();
+		FileMessage file;
+		file.room = m_CurrentRoom;
+		file.size = size;
+		file.name = name;
+		m_Stream.Queue(file);
+
+		// Exactly size bytes have to follow whatever the file does meanwhile, a short read is padded
+		m_SendingFile = true;
+		std::vector<uint8_t> chunk(64 * 1024);
+		uint64_t left = size;
+		bool sent = true;
+		while (left > 0 && sent)
+		{
+			size_t want = left < chunk.size() ? (size_t)left : chunk.size();
+			size_t got = fread(chunk.data(), 1, want, input);
+			if (got < want)
+			{
+				memset(chunk.data() + got, 0, want - got);
+			}
+			sent = co_await m_Stream.WriteBytes(chunk.data(), want);
+			left -= want;
+		}
+		fclose(input);
+		m_SendingFile = false;
+
+		if (sent && m_PongOwed)
+		{
+			m_PongOwed = false;
+			PongMessage pong;
+			pong.sequence = m_PongSequence;
+			sent = co_await m_Stream.WriteFrame(pong);
+		}
+
+		if (sent)
+		{
+			printf("\rShared %s, %llu bytes\n", name.c_str(), (unsigned long long)size);
+		}
+		co_return sent;
+	}
+
+	// Opens a stream for the file and sends what its first credit allows, the rest goes out from Receive as
+	// credit comes, chat goes on meanwhile. A file that can't be read is only a message to the user. Returns
+	// false if the connection failed.
+	Task<bool> OpenStream(const std::string& path)
+	{
+		std::error_code error;
+		uint64_t size = std::filesystem::file_size(path, error);
+		FILE* input = error ? nullptr : fopen(path.c_str(), "rb");
+		if (input == nullptr)
+		{
+			printf("\rCan't read %s\n", path.c_str());
+			co_return true;
+		}
+
+		OutgoingStream outgoing;
+		outgoing.id = m_NextStream++;
+		outgoing.input = input;
+		outgoing.name = std::filesystem::path(path).filename().string();
+		outgoing.size = size;
+		outgoing.left = size;
+		outgoing.credit = STREAM_WINDOW;
+		outgoing.failed = false;
+
+		StreamOpenMessage open;
+		open.stream = outgoing.id;
+		open.room = m_CurrentRoom;
+		open.size = size;
+		open.name = outgoing.name;
+		m_Stream.Queue(open);
+		printf("\rSharing %s, %llu bytes\n", outgoing.name.c_str(), (unsigned long long)size);
+
+		m_Outgoing.push_back(std::move(outgoing));
+		PumpStreams();
+		co_return co_await m_Stream.Flush();
+	}
+
+private:
+
+	// Queues a chunk of every outgoing stream in turn while any has credit and something left, so they share the
+	// connection evenly, and closes the ones that are done. The chunks are read from the file into m_Chunk.
+	void PumpStreams()
+	{
+		bool queued = true;
+		while (queued)
+		{
+			queued = false;
+			for (OutgoingStream& outgoing : m_Outgoing)
+			{
+				uint64_t want = std::min<uint64_t>(std::min<uint64_t>(outgoing.left, outgoing.credit), STREAM_CHUNK_SIZE);
+				if (want == 0)
+					continue;
+
+				m_Chunk.Clear();
+				uint8_t* data = m_Chunk.PrepareWrite((size_t)want);
+				size_t got = fread(data, 1, (size_t)want, outgoing.input);
+				if (got == 0)
+				{
+					outgoing.left = 0;
+					outgoing.failed = true;
+					continue;
+				}
+
+				StreamChunkMessage chunk;
+				chunk.stream = outgoing.id;
+				chunk.data = std::string_view((const char*)data, got);
+				m_Stream.Queue(chunk);
+				outgoing.left -= got;
+				outgoing.credit -= got;
+				queued = true;
+			}
+		}
+
+		for (size_t i = 0; i < m_Outgoing.size();)
+		{
+			OutgoingStream& outgoing = m_Outgoing[i];
+			if (outgoing.left > 0)
+			{
+				i++;
+				continue;
+			}
+
+			StreamCloseMessage close;
+			close.stream = outgoing.id;
+			close.status = outgoing.failed ? STREAM_ABORTED : STREAM_DONE;
+			m_Stream.Queue(close);
+			if (close.status == STREAM_DONE)
+			{
+				printf("\rShared %s\n", outgoing.name.c_str());
+			}
+			else
+			{
+				printf("\rStopped sharing %s, it couldn't be read to the end\n", outgoing.name.c_str());
+			}
+			fclose(outgoing.input);
+			m_Outgoing.erase(m_Outgoing.begin() + i);
+		}
+
+		if (m_Outgoing.empty())
+		{
+			m_Chunk.Release();
+		}
+	}
+
+	// Handles the frame if it is one of a stream. queued is set if that queued frames to send, chunks or credit.
+	// Returns false for anything else.
+	bool OnStreamFrame(const ByteSpan& frame, bool& queued)
+	{
+		StreamOpenMessage open;
+		StreamChunkMessage chunk;
+		StreamCloseMessage close;
+		StreamCreditMessage credit;
+		if (decodeMessage(frame.data, (uint32_t)frame.size, chunk))
+		{
+			auto it = m_Incoming.find(chunk.stream);
+			if (it == m_Incoming.end())
+				return true;
+
+			// Straight from the receive buffer into the file
+			IncomingStream& incoming = it->second;
+			if (incoming.output != nullptr)
+			{
+				fwrite(chunk.data.data(), 1, chunk.data.length(), incoming.output);
+			}
+			incoming.received += chunk.data.length();
+			incoming.unacked += chunk.data.length();
+
+			// Half a window at a time, the sender never runs dry waiting for it
+			if (incoming.unacked >= STREAM_WINDOW / 2)
+			{
+				StreamCreditMessage more;
+				more.stream = chunk.stream;
+				more.bytes = incoming.unacked;
+				m_Stream.Queue(more);
+				incoming.unacked = 0;
+				queued = true;
+			}
+		}
+		else if (decodeMessage(frame.data, (uint32_t)frame.size, credit))
+		{
+			for (OutgoingStream& outgoing : m_Outgoing)
+			{
+				if (outgoing.id == credit.stream)
+				{
+					outgoing.credit += credit.bytes;
+					PumpStreams();
+					queued = true;
+					break;
+				}
+			}
+		}
+		else if (decodeMessage(frame.data, (uint32_t)frame.size, open))
+		{
+			IncomingStream incoming;
+			incoming.name = receivedName(open.name);
+			incoming.size = open.size;
+			incoming.received = 0;
+			incoming.unacked = 0;
+			incoming.output = fopen(incoming.name.c_str(), "wb");
+			if (incoming.output == nullptr)
+			{
+				printf("\rCan't write %s, dropping a file of %llu bytes\n", incoming.name.c_str(), (unsigned long long)open.size);
+			}
+
+			auto result = m_Incoming.emplace(open.stream, std::move(incoming));
+			if (!result.second && result.first->second.output != nullptr)
+			{
+				// The server never reuses an id that is still open, nothing sensible to do with another one
+				fclose(result.first->second.output);
+				result.first->second.output = nullptr;
+			}
+		}
+		else if (decodeMessage(frame.data, (uint32_t)frame.size, close))
+		{
+			// Refusals are about our own streams, by our id
+			if (close.status == STREAM_REFUSED)
+			{
+				for (size_t i = 0; i < m_Outgoing.size(); i++)
+				{
+					if (m_Outgoing[i].id == close.stream)
+					{
+						printf("\rThe server wouldn't take %s\n", m_Outgoing[i].name.c_str());
+						fclose(m_Outgoing[i].input);
+						m_Outgoing.erase(m_Outgoing.begin() + i);
+						break;
+					}
+				}
+				return true;
+			}
+
+			auto it = m_Incoming.find(close.stream);
+			if (it == m_Incoming.end())
+				return true;
+
+			IncomingStream& incoming = it->second;
+			if (incoming.output != nullptr)
+			{
+				fclose(incoming.output);
+				if (close.status == STREAM_DONE && incoming.received == incoming.size)
+				{
+					m_OnLine("Received a file of " + std::to_string(incoming.size) + " bytes, saved as " + incoming.name);
+				}
+				else
+				{
+					m_OnLine("A file was cut off after " + std::to_string(incoming.received) + " of " + std::to_string(incoming.size) + " bytes, dropped " + incoming.name);
+					remove(incoming.name.c_str());
+				}
+			}
+			m_Incoming.erase(it);
+		}
+		else
+		{
+			return false;
+		}
+
+		return true;
+	}
+
+	// Saved next to us as received_NAME, only the last part of the name the sender gave counts. The body is read
+	// even if it can't be saved, the stream goes on after it. Returns false if the connection failed.
+	Task<bool> ReceiveFile(const FileMessage& file)
+	{
+		std::string name = receivedName(file.name);
+		uint64_t size = file.size;
+
+		FILE* output = fopen(name.c_str(), "wb");
+		if (output == nullptr)
+		{
+			printf("\rCan't write %s, dropping a file of %llu bytes\n", name.c_str(), (unsigned long long)size);
+		}
+
+		bool received = co_await m_Stream.ReadBody(size, [&](const uint8_t* data, size_t length)
+		{
+			if (output != nullptr)
+			{
+				fwrite(data, 1, length, output);
+			}
+		});
+
+		if (output != nullptr)
+		{
+			fclose(output);
+			if (received)
+			{
+				m_OnLine("Received a file of " + std::to_string(size) + " bytes, saved as " + name);
+			}
+		}
+		co_return received;
+	}
+
+	// Only the last part of the name the sender gave counts, it mustn't be taken for a path
+	static std::string receivedName(std::string_view senderName)
+	{
+		std::string name = std::filesystem::path(std::string(senderName)).filename().string();
+		if (name.empty() || name == "." || name == "..")
+		{
+			name = "file";
+		}
+		return "received_" + name;
+	}
+
+	// Room 0 means no room, the message goes to everyone
+	Task<bool> SendChat(const std::string& message, uint32_t room = 0)
+	{
+		if (room != 0)
+		{
+			RoomChatMessage roomChat;
+			roomChat.room = room;
+			roomChat.message = message;
+			return m_Stream.WriteFrame(roomChat);
+		}
+
+		ChatMessage chatMessage;
+		chatMessage.message = message;
+		return m_Stream.WriteFrame(chatMessage);
+	}
+};
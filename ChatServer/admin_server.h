@@ -0,0 +1,169 @@
+#pragma once
+
+#include "../Common/socket_platform.h"
+#include "shard_group.h"
+#include "server_metrics.h"
+
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/select.h>
+#endif
+
+#define DEFAULT_ADMIN_PORT 8413
+
+// Serves every shard's metrics on a loopback port, away from the chat traffic.
+//
+// It runs on its own thread with plain blocking sockets, one request at a time, and only ever reads the metrics,
+// so however often it is scraped the shards don't notice. An HTTP GET gets an HTTP response for Prometheus,
+// anything else, e.g. a line typed into nc, gets just the text.
+class AdminServer
+{
+public:
+
+	static const int REQUEST_TIMEOUT_MS = 1000;
+
+	ShardGroup& m_Group;
+	SOCKET m_ListenSocket;
+	std::atomic<bool> m_Stopping;
+
+	AdminServer(ShardGroup& group)
+		: m_Group(group)
+	{
+		m_ListenSocket = INVALID_SOCKET;
+		m_Stopping = false;
+	}
+
+	// Binds 127.0.0.1 only, the metrics are nobody else's business
+	bool Listen(int port)
+	{
+		m_ListenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (m_ListenSocket == INVALID_SOCKET)
+		{
+			printf("admin socket failed with error %d\n", WSAGetLastError());
+			return false;
+		}
+
+#ifndef _WIN32
+		int reuseAddress = 1;
+		setsockopt(m_ListenSocket, SOL_SOCKET, SO_REUSEADDR, &reuseAddress, sizeof(reuseAddress));
+#endif
+
+		sockaddr_in address;
+		ZeroMemory(&address, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_port = htons((uint16_t)port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		if (bind(m_ListenSocket, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR || listen(m_ListenSocket, 16) == SOCKET_ERROR)
+		{
+			printf("admin port %d is not available, error %d\n", port, WSAGetLastError());
+			closesocket(m_ListenSocket);
+			m_ListenSocket = INVALID_SOCKET;
+			return false;
+		}
+
+		return true;
+	}
+
+	// Everything every shard has recorded so far, in the Prometheus text format
+	std::string Render()
+	{
+		std::string text;
+
+		// The engine pointers are only safe to follow once every shard has joined, and until one leaves
+		if (m_Group.m_JoinedCount.load() < m_Group.Count() || m_Group.m_Failed.load())
+			return text;
+
+		std::lock_guard<std::mutex> lock(m_Group.m_StopMutex);
+		if (m_Group.m_Stopped)
+			return text;
+
+		writeShardMetrics(text, m_Group.Count(), [&](int shard) -> ShardMetrics&
+		{
+			return m_Group.m_Shards[shard]->engine->Metrics();
+		});
+		return text;
+	}
+
+	// Returns within REQUEST_TIMEOUT_MS of Stop, and after the request it is serving
+	void Run()
+	{
+		while (!m_Stopping.load())
+		{
+			if (!WaitReadable(m_ListenSocket))
+				continue;
+
+			SOCKET clientSocket = accept(m_ListenSocket, NULL, NULL);
+			if (clientSocket == INVALID_SOCKET)
+			{
+				printf("admin accept failed with error %d\n", WSAGetLastError());
+				continue;
+			}
+
+			HandleRequest(clientSocket);
+			closesocket(clientSocket);
+		}
+	}
+
+	// From another thread, the listen socket stays open until Close so Run never waits on a closed one
+	void Stop()
+	{
+		m_Stopping = true;
+	}
+
+	void Close()
+	{
+		if (m_ListenSocket != INVALID_SOCKET)
+		{
+			closesocket(m_ListenSocket);
+			m_ListenSocket = INVALID_SOCKET;
+		}
+	}
+
+	void HandleRequest(SOCKET clientSocket)
+	{
+		// Whatever the request asks for it gets the metrics, we only look at whether it is HTTP.
+		// A client that never sends anything gets them after the timeout, so it can't hold up the next scrape.
+		char request[1024];
+		int length = 0;
+
+		if (WaitReadable(clientSocket))
+		{
+			length = recv(clientSocket, request, sizeof(request) - 1, 0);
+		}
+
+		bool http = length >= 4 && memcmp(request, "GET ", 4) == 0;
+
+		std::string body = Render();
+		std::string response;
+		if (http)
+		{
+			response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+		}
+		response += body;
+
+		// Blocking, so this only returns once it is all written or the client went away
+		size_t sent = 0;
+		while (sent < response.size())
+		{
+			int result = send(clientSocket, response.data() + sent, (int)(response.size() - sent), 0);
+			if (result <= 0)
+				break;
+			sent += result;
+		}
+	}
+
+	// Up to REQUEST_TIMEOUT_MS
+	static bool WaitReadable(SOCKET socket)
+	{
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(socket, &readable);
+		timeval timeout = { 0, REQUEST_TIMEOUT_MS * 1000 };
+		return select((int)socket + 1, &readable, NULL, NULL, &timeout) > 0;
+	}
+};
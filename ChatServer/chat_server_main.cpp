@@ -1,241 +1,1358 @@
 #pragma once
 
-#define WIN32_LEAN_AND_MEAN
-
-#include <Windows.h>
-#include <WinSock2.h>
-#include <Ws2tcpip.h>
+#include "../Common/socket_platform.h"
+#include "engine_factory.h"
+#include "shard_group.h"
+#include "admin_server.h"
+#include "room_index.h"
+#include "history_log.h"
+#include "rate_limiter.h"
+#include "stream_router.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <vector>
 #include <string>
-#include "buffer.h"
-
-// Need to link Ws2_32.lib
-#pragma comment(lib, "Ws2_32.lib")
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include "../Common/buffer.h"
+#include "../Common/chat_messages.h"
+#include "../Common/frame_compression.h"
+#include "../Common/slot_map.h"
 
 #define DEFAULT_PORT "8412"
 
-struct PacketHeader
+// How often shard 0 drops history past its age limit, appending does it too but a quiet room appends nothing
+#define HISTORY_EXPIRY_INTERVAL_MS 60000
+
+// How we notice clients that are gone without having closed their connection, in milliseconds, 0 is never.
+// A client that agreed to heartbeats is pinged whenever it has been silent for heartbeatIntervalMs and dropped
+// once that reaches idleTimeoutMs. One that can't answer pings looks the same as a user that is only reading,
+// so it is only dropped after legacyIdleTimeoutMs.
+struct LivenessSettings
 {
-	uint32_t packetSize;
-	uint32_t messageType;
+	uint64_t heartbeatIntervalMs;
+	uint64_t idleTimeoutMs;
+	uint64_t legacyIdleTimeoutMs;
 };
 
-struct ChatMessage
+inline LivenessSettings defaultLivenessSettings()
 {
-	PacketHeader header;
-	uint32_t messageLength;
-	std::string message;
-};
+	LivenessSettings settings;
+	settings.heartbeatIntervalMs = 30000;
+	settings.idleTimeoutMs = 90000;
+	settings.legacyIdleTimeoutMs = 0;
+	return settings;
+}
 
-void broadcastMessage(SOCKET senderSocket, std::vector<SOCKET>& clients, const Buffer& buffer, uint32_t packetSize)
+// Every recipient's queue references the same encoded frame, nothing is copied per recipient
+void broadcastMessage(ServerEngine& engine, SOCKET senderSocket, std::vector<SOCKET>& clients, const FrameRef& frame)
 {
 	for (SOCKET clientSocket : clients)
 	{
 		if (clientSocket != senderSocket)
 		{
-			send(clientSocket, (const char*)(&buffer.m_BufferData[0]), packetSize, 0);
+			engine.SendFrame(clientSocket, frame);
 		}
 	}
 }
 
-int main(int arg, char** argv)
+// The chat logic of one shard, the engine tells us about connections and bytes and we answer through it.
+// m_Clients and m_Rooms only hold this shard's clients, the others are reached through the shard group.
+// Everything in here works on v1 frames, clients on v2 are converted to and from it at the edges.
+class ChatServer : public ServerEvents
 {
-	// Initialize Winsock
-	WSADATA wsaData;
-	int result;
+public:
 
-	// Set version 2.2 with MAKEWORD(2,2)
-	result = WSAStartup(MAKEWORD(2, 2), &wsaData);
-	if (result != 0)
+	ServerEngine& m_Engine;
+	ShardGroup& m_Group;
+	int m_ShardIndex;
+
+	// Everything we keep per client. What a broadcast reads comes first, the liveness check is only looked at
+	// when it comes up. Frames only move lastHeardMs, the timer is set again when it comes up rather than on every frame.
+	struct Client
 	{
-		printf("WSAStartup failed with error %d\n", result);
-		return 1;
-	}
+		SOCKET socket;
+		WireEncoding encoding;
+		bool heartbeats;	// agreed to in its hello, it answers pings
+		bool files;			// agreed to in its hello, it may send files and is sent them
+		bool streams;		// the same for streams
+		uint32_t pingsSent;
+		uint64_t lastHeardMs;
+		TimerWheel::Timer check;
+		TokenBucket messageTokens;
+		TokenBucket byteTokens;
+	};
 
-	printf("WSAStartup successfully!\n");
+	typedef SlotMap<Client>::Handle ClientHandle;
 
-	struct addrinfo* info = nullptr;
-	struct addrinfo hints;
-	ZeroMemory(&hints, sizeof(hints));  // ensure we don't have garbage data
-	hints.ai_family = AF_INET;			// IPv4
-	hints.ai_socktype = SOCK_STREAM;	// Stream
-	hints.ai_protocol = IPPROTO_TCP;	// TCP
-	hints.ai_flags = AI_PASSIVE;
+	// Back to back so a broadcast to everyone walks them in order, and a disconnect is a swap and a pop however
+	// many there are. The engine only tells us sockets, m_Handles finds their record.
+	SlotMap<Client> m_Clients;
+	std::unordered_map<SOCKET, ClientHandle> m_Handles;
+	size_t m_UpgradedClients;	// on anything but plain v1, while there are none nobody's encoding has to be looked up
 
-	result = getaddrinfo(NULL, DEFAULT_PORT, &hints, &info);
-	if (result != 0)
+	RoomIndex m_Rooms;
+	bool m_Quiet;	// skip the per message printf, stdout can't keep up under load
+	HistoryLog* m_History;		// shared by every shard, nullptr with --no-history
+	int m_HistoryLines;			// how much of it a new user is shown
+	const CompressionDictionary* m_Compression;	// shared by every shard, nullptr with --no-compression
+	FrameCompressor m_Compressor;
+	Buffer m_Compressed;
+	Buffer m_Compact;		// a broadcast in v2
+	Buffer m_Converted;		// a frame from a v2 client in v1
+	LivenessSettings m_Liveness;
+	RateLimits m_RateLimits;
+	uint64_t m_MaxFileBytes;	// 0 turns files off, and streams
+	StreamRouter m_Streams;
+
+	ChatServer(ServerEngine& engine, ShardGroup& group, int shardIndex, bool quiet, HistoryLog* history, int historyLines, const CompressionDictionary* compression,
+		const LivenessSettings& liveness, const RateLimits& rateLimits, uint64_t maxFileBytes)
+		: m_Engine(engine), m_Group(group), m_Compressor(compression), m_Streams(engine)
 	{
-		printf("getaddrinfo failed with error %d\n", result);
-		WSACleanup();
-		return 1;
-	}
+		m_ShardIndex = shardIndex;
+		m_Quiet = quiet;
+		m_History = history;
+		m_HistoryLines = historyLines;
+		m_Compression = compression;
+		m_Liveness = liveness;
+		m_RateLimits = rateLimits;
+		m_MaxFileBytes = maxFileBytes;
+		m_UpgradedClients = 0;
 
-	printf("getaddrinfo was successful!\n");
+		if (m_History != nullptr && m_ShardIndex == 0)
+		{
+			ScheduleHistoryExpiry();
+		}
+	}
 
-	// Create the server socket
-	SOCKET listenSocket = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
-	if (listenSocket == INVALID_SOCKET)
+	void ScheduleHistoryExpiry()
 	{
-		printf("socket failed with error %d\n", WSAGetLastError());
-		freeaddrinfo(info);
-		WSACleanup();
-		return 1;
+		m_Engine.Timers().Defer(HISTORY_EXPIRY_INTERVAL_MS, [this]()
+		{
+			m_History->ExpireOld();
+			ScheduleHistoryExpiry();
+		});
 	}
 
-	printf("socket created successfully!\n");
-
-	result = bind(listenSocket, info->ai_addr, (int)info->ai_addrlen);
-	if (result == SOCKET_ERROR)
+	void OnConnected(SOCKET socket) override
 	{
-		printf("bind failed with error %d\n", WSAGetLastError());
-		closesocket(listenSocket);
-		freeaddrinfo(info);
-		WSACleanup();
-		return 1;
-	}
+		int totalConnections = ++m_Group.m_TotalConnections;
+		m_Group.m_EncodingCounts[ENCODING_V1]++;
 
-	printf("bind was successful!\n");
+		// Plain v1 and not a client that answers pings until its hello says otherwise
+		ClientHandle handle = m_Clients.Insert(Client());
+		m_Handles[socket] = handle;
 
-	// Listen for incoming connections
-	result = listen(listenSocket, SOMAXCONN);
-	if (result == SOCKET_ERROR)
+		Client& client = *m_Clients.Get(handle);
+		client.socket = socket;
+		client.encoding = ENCODING_V1;
+		client.heartbeats = false;
+		client.files = false;
+		client.streams = false;
+		client.pingsSent = 0;
+		client.lastHeardMs = m_Engine.Timers().Now();
+		client.messageTokens.Configure(m_RateLimits.messagesPerSecond, m_RateLimits.messageBurst, client.lastHeardMs);
+		client.byteTokens.Configure(m_RateLimits.bytesPerSecond, m_RateLimits.byteBurst, client.lastHeardMs);
+		client.check.m_Callback = [this, handle]() { CheckLiveness(handle); };
+		CheckLiveness(handle);
+
+		// Notify the new user about the number of active users
+		std::string userCountStr = "Welcome! There are currently " + std::to_string(totalConnections) + " user(s) in the chat.\nType '/exit' to leave the chat.";
+
+		ChatMessage userCountMessage;
+		userCountMessage.message = userCountStr;
+
+		Buffer buffer;
+		encodeMessage(userCountMessage, buffer);
+
+		m_Engine.Send(socket, buffer.Data(), (int)buffer.Size());
+
+		// Then what was said before they came, straight from the log's pages
+		if (m_History != nullptr && m_HistoryLines > 0)
+		{
+			m_History->ReadRecent(m_HistoryLines, [&](const uint8_t* data, size_t length)
+			{
+				m_Engine.Send(socket, data, (int)length);
+			});
+		}
+
+		if (!m_Quiet)
+		{
+			printf("Client connected. Total clients: %d\n", totalConnections);
+		}
+	}
+
+	void OnFrame(SOCKET socket, const uint8_t* frame, uint32_t packetSize) override
 	{
-		printf("listen failed with error %d\n", result);
-		closesocket(listenSocket);
-		freeaddrinfo(info);
-		WSACleanup();
-		return 1;
+		Client* client = Find(socket);
+		if (client == nullptr)
+			return;
+
+		client->lastHeardMs = m_Engine.Timers().Now();
+
+		// Before any of it is decoded, let alone fanned out. Chunks and credit are held back by credit instead,
+		// a transfer would never get past the byte limit.
+		WireVersion version = wireVersionOf(client->encoding);
+		uint32_t type = isCompressedFrame(frame, version) ? 0 : peekMessageType(frame, version);
+		if (type != MESSAGE_TYPE_STREAM_CHUNK && type != MESSAGE_TYPE_STREAM_CREDIT && !Admit(*client, frame, packetSize))
+			return;
+
+		// A file's body comes right after its frame, so one can't come packed with others
+		if (type == MESSAGE_TYPE_FILE)
+		{
+			OnFile(*client, version, frame, packetSize);
+			return;
+		}
+
+		Dispatch(socket, version, frame, packetSize);
 	}
 
-	printf("listen was successful!\n");
+	// Takes what the frame costs from the client's buckets, or if it is over its limits does what the flood
+	// policy says and returns false. A frame is one message however many lines it packs, and as many bytes as
+	// it unpacks to, since that is what every recipient gets.
+	bool Admit(Client& client, const uint8_t* frame, uint32_t packetSize)
+	{
+		uint64_t now = m_Engine.Timers().Now();
+		uint64_t waitMs = std::max(client.messageTokens.WaitMs(now), client.byteTokens.WaitMs(now));
+		if (waitMs == 0)
+		{
+			WireVersion version = wireVersionOf(client.encoding);
+			uint64_t size = packetSize;
+			uint64_t originalSize;
+			const uint8_t* dictionaryId;
+			if (isCompressedFrame(frame, version) && peekCompressedHeader(frame, packetSize, version, originalSize, dictionaryId)
+				&& originalSize > size && originalSize <= MAX_FRAME_SIZE)
+			{
+				size = originalSize;
+			}
 
-	std::vector<SOCKET> activeConnections;
-	fd_set socketsReadyForReading;
-	FD_ZERO(&socketsReadyForReading);
+			client.messageTokens.Take(1, now);
+			client.byteTokens.Take(size, now);
+			return true;
+		}
 
-	// Set a timeout for select
-	timeval tv;
-	tv.tv_sec = 1;
-	tv.tv_usec = 0;
+		ShardMetrics& metrics = m_Engine.Metrics();
+		switch (m_RateLimits.policy)
+		{
+		case FLOOD_DELAY:
+			// The frame comes back once the wait is over
+			metrics.floodDelays.Add();
+			m_Engine.PauseReading(client.socket, waitMs);
+			break;
+		case FLOOD_DROP:
+			metrics.floodDrops.Add();
+			break;
+		case FLOOD_DISCONNECT:
+			metrics.floodDisconnects.Add();
+			printf("Client %d is sending faster than its rate limits, disconnecting.\n", (int)client.socket);
+			m_Engine.Disconnect(client.socket);
+			break;
+		}
+		return false;
+	}
 
-	while (true)
+	void Dispatch(SOCKET socket, WireVersion version, const uint8_t* frame, uint32_t packetSize)
 	{
-		FD_ZERO(&socketsReadyForReading);
-		FD_SET(listenSocket, &socketsReadyForReading);
+		// What was packed is handled frame by frame as if it had arrived that way
+		if (isCompressedFrame(frame, version))
+		{
+			if (!m_Compressor.Unpack(frame, packetSize, [&](const uint8_t* innerFrame, uint32_t innerSize) { Dispatch(socket, version, innerFrame, innerSize); }, version))
+			{
+				printf("Dropping compressed frame that doesn't unpack\n");
+			}
+			return;
+		}
+
+		if (version == WIRE_V2)
+		{
+			m_Converted.Clear();
+			if (!convertFrame(WIRE_V2, WIRE_V1, frame, packetSize, m_Converted))
+			{
+				printf("Dropping v2 frame that doesn't decode or is too large in v1\n");
+				return;
+			}
+			frame = m_Converted.Data();
+			packetSize = (uint32_t)m_Converted.Size();
+		}
 
-		for (SOCKET clientSocket : activeConnections)
+		switch (peekMessageType(frame))
 		{
-			FD_SET(clientSocket, &socketsReadyForReading);
+		case MESSAGE_TYPE_CHAT:
+			OnChat(socket, frame, packetSize);
+			break;
+		case MESSAGE_TYPE_CHAT_BATCH:
+			OnChatBatch(socket, frame, packetSize);
+			break;
+		case MESSAGE_TYPE_JOIN_ROOM:
+			OnJoinRoom(socket, frame, packetSize);
+			break;
+		case MESSAGE_TYPE_LEAVE_ROOM:
+			OnLeaveRoom(socket, frame, packetSize);
+			break;
+		case MESSAGE_TYPE_ROOM_CHAT:
+			OnRoomChat(socket, frame, packetSize);
+			break;
+		case MESSAGE_TYPE_HELLO:
+			OnHello(socket, frame, packetSize);
+			break;
+		case MESSAGE_TYPE_PONG:
+			// Hearing from the client was all it was for
+			break;
+		case MESSAGE_TYPE_FILE:
+			// Packed, there is no telling where its body is
+			printf("Client %d sent a file inside a compressed frame, disconnecting.\n", (int)socket);
+			m_Engine.Disconnect(socket);
+			break;
+		case MESSAGE_TYPE_STREAM_OPEN:
+			OnStreamOpen(socket, version, frame, packetSize);
+			break;
+		case MESSAGE_TYPE_STREAM_CHUNK:
+			OnStreamChunk(socket, frame, packetSize);
+			break;
+		case MESSAGE_TYPE_STREAM_CLOSE:
+		{
+			StreamCloseMessage close;
+			if (decodeMessage(frame, packetSize, close))
+			{
+				m_Streams.Close(socket, close);
+			}
+			break;
+		}
+		case MESSAGE_TYPE_STREAM_CREDIT:
+		{
+			StreamCreditMessage credit;
+			if (decodeMessage(frame, packetSize, credit))
+			{
+				m_Streams.Credit(socket, credit);
+			}
+			break;
+		}
 		}
+	}
+
+	// When a client's check comes up: drops it if it has been silent for too long, pings it if it answers pings
+	// and has been quiet for a heartbeat interval, and sets the check for whichever of the two can come next
+	void CheckLiveness(ClientHandle handle)
+	{
+		Client* client = m_Clients.Get(handle);
+		if (client == nullptr)
+			return;
 
-		int count = select(0, &socketsReadyForReading, NULL, NULL, &tv);
+		TimerWheel& timers = m_Engine.Timers();
 
-		if (count == 0)  // Timeout occurred
+		// It can't send or be sent a frame while a file is on its way from or to it, the file is what we hear
+		if (m_Engine.IsRelaying(client->socket))
 		{
-			continue;
+			client->lastHeardMs = timers.Now();
 		}
-		else if (count == SOCKET_ERROR)
+
+		uint64_t silentMs = timers.Now() - client->lastHeardMs;
+		uint64_t idleTimeoutMs = client->heartbeats ? m_Liveness.idleTimeoutMs : m_Liveness.legacyIdleTimeoutMs;
+		if (idleTimeoutMs > 0 && silentMs >= idleTimeoutMs)
 		{
-			printf("select failed with error %d\n", WSAGetLastError());
-			continue;
+			printf("Client %d was silent for %d s, disconnecting.\n", (int)client->socket, (int)(silentMs / 1000));
+			m_Engine.Disconnect(client->socket);
+			return;
 		}
 
-		// Check if there's a new connection
-		if (FD_ISSET(listenSocket, &socketsReadyForReading))
+		uint64_t nextCheckMs = idleTimeoutMs > 0 ? idleTimeoutMs - silentMs : 0;
+		if (client->heartbeats)
 		{
-			SOCKET newClientSocket = accept(listenSocket, NULL, NULL);
-			if (newClientSocket == INVALID_SOCKET)
+			uint64_t untilPingMs = m_Liveness.heartbeatIntervalMs;
+			if (silentMs >= m_Liveness.heartbeatIntervalMs)
 			{
-				printf("accept failed with error %d\n", WSAGetLastError());
+				SendPing(*client);
 			}
 			else
 			{
-				activeConnections.push_back(newClientSocket);
+				untilPingMs -= silentMs;
+			}
+
+			if (nextCheckMs == 0 || untilPingMs < nextCheckMs)
+				nextCheckMs = untilPingMs;
+		}
 
-				// Notify the new user about the number of active users
-				ChatMessage userCountMessage;
-				
-				std::string userCountStr = "Welcome! There are currently " + std::to_string(activeConnections.size()) + " user(s) in the chat.\nType '/exit' to leave the chat.";
-				userCountMessage.message = userCountStr;
-				userCountMessage.messageLength = userCountMessage.message.length();
-				userCountMessage.header.messageType = 1;
-				userCountMessage.header.packetSize = sizeof(PacketHeader) + sizeof(uint32_t) + userCountMessage.messageLength;
+		if (nextCheckMs > 0)
+		{
+			timers.Arm(client->check, nextCheckMs);
+		}
+		else
+		{
+			timers.Cancel(client->check);
+		}
+	}
 
-				Buffer buffer(512);
-				buffer.WriteUInt32LE(userCountMessage.header.packetSize);
-				buffer.WriteUInt32LE(userCountMessage.header.messageType);
-				buffer.WriteUInt32LE(userCountMessage.messageLength);
-				buffer.WriteString(userCountMessage.message);
+	void SendPing(Client& client)
+	{
+		PingMessage ping;
+		ping.sequence = ++client.pingsSent;
 
-				send(newClientSocket, (const char*)(&buffer.m_BufferData[0]), userCountMessage.header.packetSize, 0);
+		Buffer buffer;
+		encodeMessage(ping, buffer, wireVersionOf(client.encoding));
+		m_Engine.Send(client.socket, buffer.Data(), (int)buffer.Size());
+	}
 
-				printf("Client connected. Total clients: %d\n", (int)activeConnections.size());
-			}
+	// Agrees to what we can do of what the client asked for and says so. v2 is always agreed to, the client
+	// already sends it after its hello and gets it after our answer.
+	void OnHello(SOCKET socket, const uint8_t* frame, uint32_t packetSize)
+	{
+		HelloMessage hello;
+		if (!decodeMessage(frame, packetSize, hello))
+			return;
+
+		HelloMessage reply;
+		reply.features = 0;
+		reply.dictionaryId = m_Compressor.DictionaryId();
+
+		bool compressed = false;
+		if (m_Compression != nullptr && (hello.features & HELLO_FEATURE_COMPRESSION) && hello.dictionaryId == reply.dictionaryId)
+		{
+			reply.features |= HELLO_FEATURE_COMPRESSION;
+			compressed = true;
+		}
+
+		WireVersion version = WIRE_V1;
+		if (hello.features & HELLO_FEATURE_WIRE_V2)
+		{
+			reply.features |= HELLO_FEATURE_WIRE_V2;
+			version = WIRE_V2;
+		}
+		m_Engine.SetWireVersion(socket, version);
+
+		// From now on a silent client is pinged, and dropped on the idle timeout rather than the legacy one
+		bool heartbeats = m_Liveness.heartbeatIntervalMs > 0 && (hello.features & HELLO_FEATURE_HEARTBEAT);
+		if (heartbeats)
+		{
+			reply.features |= HELLO_FEATURE_HEARTBEAT;
+		}
+
+		bool files = m_MaxFileBytes > 0 && (hello.features & HELLO_FEATURE_FILES);
+		if (files)
+		{
+			reply.features |= HELLO_FEATURE_FILES;
+		}
+
+		bool streams = m_MaxFileBytes > 0 && (hello.features & HELLO_FEATURE_STREAMS);
+		if (streams)
+		{
+			reply.features |= HELLO_FEATURE_STREAMS;
+		}
+
+		Buffer buffer;
+		encodeMessage(reply, buffer);
+		m_Engine.Send(socket, buffer.Data(), (int)buffer.Size());
+
+		Client* client = Find(socket);
+		if (client == nullptr)
+			return;
+
+		SetEncoding(*client, wireEncodingOf(version, compressed));
+		client->files = files;
+		client->streams = streams;
+
+		if (client->heartbeats != heartbeats)
+		{
+			client->heartbeats = heartbeats;
+			CheckLiveness(m_Handles[socket]);
+		}
+	}
+
+	// nullptr for a socket that isn't one of our clients
+	Client* Find(SOCKET socket)
+	{
+		auto it = m_Handles.find(socket);
+		return it != m_Handles.end() ? m_Clients.Get(it->second) : nullptr;
+	}
+
+	WireEncoding EncodingOf(SOCKET socket)
+	{
+		if (m_UpgradedClients == 0)
+			return ENCODING_V1;
+
+		Client* client = Find(socket);
+		return client != nullptr ? client->encoding : ENCODING_V1;
+	}
+
+	void SetEncoding(Client& client, WireEncoding encoding)
+	{
+		m_Group.m_EncodingCounts[client.encoding]--;
+		m_Group.m_EncodingCounts[encoding]++;
+
+		m_UpgradedClients -= client.encoding != ENCODING_V1;
+		m_UpgradedClients += encoding != ENCODING_V1;
+		client.encoding = encoding;
+	}
+
+	void OnChat(SOCKET socket, const uint8_t* frame, uint32_t packetSize)
+	{
+		ShardMetrics& metrics = m_Engine.Metrics();
+		uint64_t parseStart = metricsNow();
+
+		ChatMessage chatMessage;
+		if (!decodeMessage(frame, packetSize, chatMessage))
+		{
+			printf("Dropping chat message whose length runs past its frame\n");
+			return;
+		}
+
+		uint64_t fanoutStart = metricsNow();
+		metrics.parseNs.Record(fanoutStart - parseStart);
+
+		LogChat(packetSize, chatMessage);
+
+		// Encode once straight from the received bytes
+		FanOut(socket, frame, packetSize);
+		RecordHistory(frame, packetSize);
+
+		metrics.fanoutNs.Record(metricsNow() - fanoutStart);
+	}
+
+	// A burst from one sender. Its lines are already whole chat frames back to back, so after checking them
+	// they are passed on as one block, one queue entry per recipient however many lines it holds.
+	void OnChatBatch(SOCKET socket, const uint8_t* frame, uint32_t packetSize)
+	{
+		ShardMetrics& metrics = m_Engine.Metrics();
+		uint64_t parseStart = metricsNow();
+
+		ChatBatchMessage batch;
+		bool valid = decodeMessage(frame, packetSize, batch) && forEachBatchedChat(batch, [](const uint8_t*, uint32_t, const ChatMessage&) {});
+
+		if (!valid)
+		{
+			printf("Dropping chat batch that doesn't hold the chat frames it claims\n");
+			return;
+		}
+
+		// One line for the whole batch, a printf per line would cost more than the batching saves
+		if (!m_Quiet)
+		{
+			printf("Chat batch of %u line(s), %d bytes\n", batch.count, (int)batch.frames.length());
+		}
+
+		uint64_t fanoutStart = metricsNow();
+		metrics.parseNs.Record(fanoutStart - parseStart);
+
+		if (!batch.frames.empty())
+		{
+			FanOut(socket, (const uint8_t*)batch.frames.data(), (uint32_t)batch.frames.length());
+			RecordHistory((const uint8_t*)batch.frames.data(), (uint32_t)batch.frames.length());
+		}
+
+		metrics.fanoutNs.Record(metricsNow() - fanoutStart);
+	}
+
+	void OnJoinRoom(SOCKET socket, const uint8_t* frame, uint32_t packetSize)
+	{
+		JoinRoomMessage joinRoom;
+		if (!decodeMessage(frame, packetSize, joinRoom))
+			return;
+
+		if (m_Rooms.Join(joinRoom.room, socket) == RoomIndex::JOIN_TOO_MANY_ROOMS)
+		{
+			printf("Client %d is already in %d rooms, not joining room %u\n", (int)socket, (int)RoomIndex::MAX_ROOMS_PER_CONNECTION, joinRoom.room);
+		}
+	}
+
+	void OnLeaveRoom(SOCKET socket, const uint8_t* frame, uint32_t packetSize)
+	{
+		LeaveRoomMessage leaveRoom;
+		if (decodeMessage(frame, packetSize, leaveRoom))
+		{
+			m_Rooms.Leave(leaveRoom.room, socket);
+		}
+	}
+
+	// Only the room's other members get it, found through the room index rather than a scan of every client
+	void OnRoomChat(SOCKET socket, const uint8_t* frame, uint32_t packetSize)
+	{
+		ShardMetrics& metrics = m_Engine.Metrics();
+		uint64_t parseStart = metricsNow();
+
+		RoomChatMessage roomChat;
+		if (!decodeMessage(frame, packetSize, roomChat))
+		{
+			printf("Dropping room message whose length runs past its frame\n");
+			return;
 		}
 
-		// Handle incoming messages from clients
-		for (size_t i = 0; i < activeConnections.size(); i++)
+		// Only members may talk in a room
+		if (!m_Rooms.IsMember(roomChat.room, socket))
+			return;
+
+		uint64_t fanoutStart = metricsNow();
+		metrics.parseNs.Record(fanoutStart - parseStart);
+
+		if (!m_Quiet)
 		{
-			SOCKET clientSocket = activeConnections[i];
+			printf("Room %u: %.*s\n", roomChat.room, (int)roomChat.message.length(), roomChat.message.data());
+		}
+
+		FanOut(socket, frame, packetSize);
+
+		metrics.fanoutNs.Record(metricsNow() - fanoutStart);
+	}
 
-			if (FD_ISSET(clientSocket, &socketsReadyForReading))
+	// The body goes from the sender's socket to the recipients' without us seeing it, see ServerEngine::RelayBody.
+	// Only recipients on this shard get it, the others never see the frame either. A sender that breaks the rules
+	// is disconnected, its stream can't be made sense of past a body we won't take.
+	void OnFile(Client& sender, WireVersion version, const uint8_t* frame, uint32_t packetSize)
+	{
+		SOCKET socket = sender.socket;
+		if (version == WIRE_V2)
+		{
+			m_Converted.Clear();
+			if (!convertFrame(WIRE_V2, WIRE_V1, frame, packetSize, m_Converted))
 			{
-				const int bufSize = 512;
-				Buffer buffer(bufSize);
+				printf("Client %d sent a file frame that doesn't decode, disconnecting.\n", (int)socket);
+				m_Engine.Disconnect(socket);
+				return;
+			}
+			frame = m_Converted.Data();
+			packetSize = (uint32_t)m_Converted.Size();
+		}
+
+		FileMessage file;
+		if (!decodeMessage(frame, packetSize, file))
+		{
+			printf("Client %d sent a file frame that doesn't decode, disconnecting.\n", (int)socket);
+			m_Engine.Disconnect(socket);
+			return;
+		}
+
+		if (!sender.files || file.size > m_MaxFileBytes)
+		{
+			printf("Client %d sent a file of %llu bytes it may not send, disconnecting.\n", (int)socket, (unsigned long long)file.size);
+			m_Engine.Disconnect(socket);
+			return;
+		}
 
-				int result = recv(clientSocket, (char*)(&buffer.m_BufferData[0]), bufSize, 0);
+		// The frame goes on as it came, re-encoded for v2 clients once
+		FrameRef headers[2];
+		std::vector<RelayTarget> targets;
+		ForEachSharer(socket, file.room, [&](Client& client)
+		{
+			if (!client.files)
+				return;
 
-				if (result == SOCKET_ERROR)
+			WireVersion clientVersion = wireVersionOf(client.encoding);
+			FrameRef& header = headers[clientVersion == WIRE_V2];
+			if (!header)
+			{
+				if (clientVersion == WIRE_V2)
 				{
-					
-					printf("Client disconnected.\n"); // user left ungracefully 
-					//printf("recv failed with error %d\n", WSAGetLastError());
-					closesocket(clientSocket);
-					activeConnections.erase(activeConnections.begin() + i);
-					i--;
-					continue;
+					m_Compact.Clear();
+					if (!convertFrame(WIRE_V1, WIRE_V2, frame, packetSize, m_Compact))
+						return;
+					header = FrameRef(m_Compact.Data(), (uint32_t)m_Compact.Size());
 				}
-				else if (result == 0)
+				else
 				{
-					//printf("Client disconnected.\n");
-					closesocket(clientSocket);
-					activeConnections.erase(activeConnections.begin() + i);
-					i--;
-					continue;
+					header = FrameRef(frame, packetSize);
 				}
+			}
+			targets.push_back(RelayTarget{ client.socket, header });
+		});
 
-				uint32_t packetSize = buffer.ReadUInt32LE();
-				uint32_t messageType = buffer.ReadUInt32LE();
+		if (!m_Quiet)
+		{
+			printf("File %.*s from client %d, %llu bytes to %d client(s)\n", (int)file.name.length(), file.name.data(), (int)socket,
+				(unsigned long long)file.size, (int)targets.size());
+		}
 
-				if (messageType == 1)  // Chat message
-				{
-					uint32_t messageLength = buffer.ReadUInt32LE();
-					std::string msg = buffer.ReadString(messageLength);
+		// Nothing to relay, the frame is all there is
+		if (file.size == 0)
+		{
+			for (const RelayTarget& target : targets)
+			{
+				m_Engine.SendFrame(target.socket, target.header);
+			}
+			return;
+		}
 
-					printf("PacketSize: %d\nMessageType: %d\nMessageLength: %d\nMessage: %s\n", packetSize, messageType, messageLength, msg.c_str());
+		m_Engine.RelayBody(socket, file.size, targets);
+	}
 
-					// Broadcast the message to all clients except the sender
-					broadcastMessage(clientSocket, activeConnections, buffer, packetSize);
+	// Who on this shard a file or stream shared in room goes to besides its sender, everyone for room 0.
+	// Only members may share in a room, anyone else's is still read, just to nobody.
+	template <typename OnClient>
+	void ForEachSharer(SOCKET socket, uint32_t room, OnClient onClient)
+	{
+		if (room == 0)
+		{
+			for (Client& client : m_Clients)
+			{
+				if (client.socket != socket)
+				{
+					onClient(client);
+				}
+			}
+		}
+		else if (m_Rooms.IsMember(room, socket))
+		{
+			for (SOCKET member : *m_Rooms.Members(room))
+			{
+				Client* client = Find(member);
+				if (client != nullptr && member != socket)
+				{
+					onClient(*client);
 				}
+			}
+		}
+	}
+
+	// Opens a stream to whoever on this shard shares it and agreed to streams, see StreamRouter. One the sender
+	// may not send at all gets it disconnected, one too large is only refused.
+	void OnStreamOpen(SOCKET socket, WireVersion version, const uint8_t* frame, uint32_t packetSize)
+	{
+		Client* sender = Find(socket);
+		StreamOpenMessage open;
+		if (sender == nullptr || !decodeMessage(frame, packetSize, open))
+			return;
+
+		if (!sender->streams)
+		{
+			printf("Client %d opened a stream without agreeing to streams, disconnecting.\n", (int)socket);
+			m_Engine.Disconnect(socket);
+			return;
+		}
+
+		if (open.size > m_MaxFileBytes)
+		{
+			m_Streams.Refuse(socket, version, open.stream);
+			return;
+		}
 
-				FD_CLR(clientSocket, &socketsReadyForReading);
-				count--;
+		std::vector<StreamRouter::Reader> readers;
+		ForEachSharer(socket, open.room, [&](Client& client)
+		{
+			if (client.streams)
+			{
+				readers.push_back(StreamRouter::Reader{ client.socket, wireVersionOf(client.encoding), 0 });
 			}
+		});
+
+		if (m_Streams.Open(socket, version, open, readers) && !m_Quiet)
+		{
+			printf("Stream %.*s from client %d, %llu bytes to %d client(s)\n", (int)open.name.length(), open.name.data(), (int)socket,
+				(unsigned long long)open.size, (int)readers.size());
 		}
 	}
 
-	// Clean up
-	freeaddrinfo(info);
-	closesocket(listenSocket);
+	void OnStreamChunk(SOCKET socket, const uint8_t* frame, uint32_t packetSize)
+	{
+		StreamChunkMessage chunk;
+		if (!decodeMessage(frame, packetSize, chunk))
+			return;
+
+		if (!m_Streams.Chunk(socket, frame, packetSize, chunk))
+		{
+			printf("Client %d sent more of a stream than it may, disconnecting.\n", (int)socket);
+			m_Engine.Disconnect(socket);
+		}
+	}
 
-	for (SOCKET clientSocket : activeConnections)
+	// Sends a frame being fanned out to who on this shard gets it, a room's members for room chat and everyone otherwise
+	void SendToRecipients(SOCKET senderSocket, ShardGroup::Broadcast& broadcast)
 	{
-		closesocket(clientSocket);
+		const FrameRef& frame = broadcast.encodings[ENCODING_V1];
+		if (peekMessageType(frame.Data()) != MESSAGE_TYPE_ROOM_CHAT)
+		{
+			SendToEveryone(senderSocket, broadcast);
+			return;
+		}
+
+		RoomChatMessage roomChat;
+		if (!decodeMessage(frame.Data(), frame.Size(), roomChat))
+			return;
+
+		std::vector<SOCKET>* members = m_Rooms.Members(roomChat.room);
+		if (members != nullptr)
+		{
+			SendToMembers(senderSocket, *members, broadcast);
+		}
 	}
 
-	WSACleanup();
+	// Only what everyone saw goes in the history, room chat is for the room's members
+	void RecordHistory(const uint8_t* frames, uint32_t length)
+	{
+		if (m_History != nullptr)
+		{
+			m_History->Append(frames, length);
+		}
+	}
 
+	void LogChat(uint32_t packetSize, const ChatMessage& chatMessage)
+	{
+		if (m_Quiet)
+			return;
+
+		std::string_view msg = chatMessage.message;
+		printf("PacketSize: %d\nMessageType: %d\nMessageLength: %d\nMessage: %.*s\n", packetSize, MESSAGE_TYPE_CHAT, (int)msg.length(), (int)msg.length(), msg.data());
+	}
+
+	// Sends to every recipient except the sender, the other shards get the same frames and send them to their recipients
+	void FanOut(SOCKET socket, const uint8_t* data, uint32_t length)
+	{
+		ShardGroup::Broadcast broadcast;
+		broadcast.encodings[ENCODING_V1] = FrameRef(data, length);
+		if (!broadcast.encodings[ENCODING_V1])
+			return;
+
+		// Once per broadcast however many clients get them, and not at all while no client anywhere asked for them
+		for (int encoding = ENCODING_V1 + 1; encoding < ENCODING_COUNT; encoding++)
+		{
+			if (m_Group.IsEncodingUsed((WireEncoding)encoding))
+			{
+				Encode(broadcast, (WireEncoding)encoding);
+			}
+		}
+
+		SendToRecipients(socket, broadcast);
+		m_Group.Publish(m_ShardIndex, broadcast);
+	}
+
+	// Each client gets the encoding it negotiated, all of them reference the one copy of it. Everything needed
+	// is in the records, so this is one pass over m_Clients without a lookup.
+	void SendToEveryone(SOCKET senderSocket, ShardGroup::Broadcast& broadcast)
+	{
+		for (Client& client : m_Clients)
+		{
+			if (client.socket == senderSocket)
+				continue;
+
+			const FrameRef& frame = Encode(broadcast, client.encoding);
+			if (frame)
+			{
+				m_Engine.SendFrame(client.socket, frame);
+			}
+		}
+	}
+
+	// The same for a room, whose members are only sockets
+	void SendToMembers(SOCKET senderSocket, std::vector<SOCKET>& members, ShardGroup::Broadcast& broadcast)
+	{
+		if (m_UpgradedClients == 0)
+		{
+			broadcastMessage(m_Engine, senderSocket, members, broadcast.encodings[ENCODING_V1]);
+			return;
+		}
+
+		for (SOCKET clientSocket : members)
+		{
+			if (clientSocket == senderSocket)
+				continue;
+
+			const FrameRef& frame = Encode(broadcast, EncodingOf(clientSocket));
+			if (frame)
+			{
+				m_Engine.SendFrame(clientSocket, frame);
+			}
+		}
+	}
+
+	// Makes an encoding the broadcast doesn't have yet, usually because a client negotiated it after another shard
+	// published it. A compressed one that didn't pay is the uncompressed frame again, so it is only tried once.
+	const FrameRef& Encode(ShardGroup::Broadcast& broadcast, WireEncoding encoding)
+	{
+		FrameRef& frame = broadcast.encodings[encoding];
+		if (frame || encoding == ENCODING_V1)
+			return frame;
+
+		if (encoding == ENCODING_V2)
+		{
+			const FrameRef& v1 = broadcast.encodings[ENCODING_V1];
+			m_Compact.Clear();
+			if (convertFrames(WIRE_V1, WIRE_V2, v1.Data(), v1.Size(), m_Compact))
+			{
+				frame = FrameRef(m_Compact.Data(), (uint32_t)m_Compact.Size());
+			}
+			return frame;
+		}
+
+		WireVersion version = wireVersionOf(encoding);
+		const FrameRef& plain = Encode(broadcast, wireEncodingOf(version, false));
+
+		m_Compressed.Clear();
+		if (m_Compression != nullptr && plain && m_Compressor.Compress(plain.Data(), plain.Size(), m_Compressed, version))
+		{
+			frame = FrameRef(m_Compressed.Data(), (uint32_t)m_Compressed.Size());
+		}
+		else
+		{
+			frame = plain;
+		}
+		return frame;
+	}
+
+	void OnDisconnected(SOCKET socket) override
+	{
+		auto it = m_Handles.find(socket);
+		if (it == m_Handles.end())
+			return;
+
+		Client* client = m_Clients.Get(it->second);
+		m_Group.m_EncodingCounts[client->encoding]--;
+		m_UpgradedClients -= client->encoding != ENCODING_V1;
+		m_Group.m_TotalConnections--;
+
+		m_Rooms.LeaveAll(socket);
+		m_Streams.Forget(socket);
+		m_Clients.Remove(it->second);
+		m_Handles.erase(it);
+	}
+
+	// Messages from clients on other shards, the sender isn't one of ours
+	void OnWake() override
+	{
+		m_Group.Receive(m_ShardIndex, [&](ShardGroup::Broadcast& broadcast)
+		{
+			SendToRecipients(INVALID_SOCKET, broadcast);
+		});
+	}
+};
+
+// Returns INVALID_SOCKET on failure. With reusePort every shard can have its own listener on the same port.
+SOCKET createListenSocket(addrinfo* info, bool reusePort)
+{
+	SOCKET listenSocket = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+	if (listenSocket == INVALID_SOCKET)
+	{
+		printf("socket failed with error %d\n", WSAGetLastError());
+		return INVALID_SOCKET;
+	}
+
+#ifndef _WIN32
+	// Let a restarted server bind while old connections sit in TIME_WAIT
+	int reuseAddress = 1;
+	setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuseAddress, sizeof(reuseAddress));
+#endif
+
+	if (reusePort && !setReusePort(listenSocket))
+	{
+		printf("SO_REUSEPORT failed with error %d\n", WSAGetLastError());
+		closesocket(listenSocket);
+		return INVALID_SOCKET;
+	}
+
+	if (bind(listenSocket, info->ai_addr, (int)info->ai_addrlen) == SOCKET_ERROR)
+	{
+		printf("bind failed with error %d\n", WSAGetLastError());
+		closesocket(listenSocket);
+		return INVALID_SOCKET;
+	}
+
+	// Listen for incoming connections
+	if (listen(listenSocket, SOMAXCONN) == SOCKET_ERROR)
+	{
+		printf("listen failed with error %d\n", WSAGetLastError());
+		closesocket(listenSocket);
+		return INVALID_SOCKET;
+	}
+
+	return listenSocket;
+}
+
+// --train-dictionary, trains a dictionary for --dictionary on the newest chat lines in the history and saves it.
+// Run it while no server is using the directory, then hand the file to the server and its clients.
+int trainDictionary(const std::string& historyDirectory, const HistoryRetention& retention, const std::string& path)
+{
+	const uint64_t SAMPLE_LINES = 100000;
+	const size_t DICTIONARY_SIZE = 16 * 1024;
+
+	HistoryLog history;
+	if (!history.Open(historyDirectory, retention))
+		return 1;
+
+	// Just the text of each line, it is what compressed frames are mostly made of
+	std::vector<std::string> samples;
+	history.ReadRecent(SAMPLE_LINES, [&](const uint8_t* data, size_t length)
+	{
+		forEachFrame(WIRE_V1, data, length, [&](const uint8_t* frame, uint32_t packetSize)
+		{
+			ChatMessage chatMessage;
+			if (decodeMessage(frame, packetSize, chatMessage) && !chatMessage.message.empty())
+			{
+				samples.emplace_back(chatMessage.message);
+			}
+		});
+	});
+
+	if (samples.empty())
+	{
+		printf("no chat lines in %s to train on\n", historyDirectory.c_str());
+		return 1;
+	}
+
+	CompressionDictionary dictionary;
+	dictionary.Set(CompressionDictionary::Train(samples, DICTIONARY_SIZE));
+	if (!dictionary.Save(path))
+		return 1;
+
+	printf("Trained dictionary %08x (%zu bytes) on %zu line(s), saved to %s\n", dictionary.m_Id, dictionary.m_Text.size(), samples.size(), path.c_str());
 	return 0;
 }
+
+// One shard's thread, everything it touches apart from the shard group is its own
+void runShard(ShardGroup& group, int index, std::string backend, OutboundLimits limits, SOCKET listenSocket, bool quiet, HistoryLog* history, int historyLines,
+	const CompressionDictionary* compression, LivenessSettings liveness, RateLimits rateLimits, uint64_t maxFileBytes)
+{
+	// Created here because the io_uring engine must be driven by the thread that set it up
+	std::unique_ptr<ServerEngine> engine = createEngine(backend);
+	if (!engine)
+	{
+		printf("backend '%s' is not available on this platform\n", backend.c_str());
+	}
+
+	if (!group.Join(index, engine.get()))
+	{
+		group.Leave(index);
+		return;
+	}
+
+	engine->SetOutboundLimits(limits);
+
+	if (index == 0)
+	{
+		printf("Using the %s engine on %d thread(s), slow clients: %s above %d bytes queued\n", engine->Name(), group.Count(), slowConsumerPolicyName(limits.policy), (int)limits.highWatermark);
+		if (rateLimits.messagesPerSecond == 0 && rateLimits.bytesPerSecond == 0)
+		{
+			printf("Clients aren't rate limited\n");
+		}
+		else
+		{
+			printf("Clients over %u messages or %u KB per second: %s\n", rateLimits.messagesPerSecond, rateLimits.bytesPerSecond / 1024, floodPolicyName(rateLimits.policy));
+		}
+	}
+
+	ChatServer chatServer(*engine, group, index, quiet, history, historyLines, compression, liveness, rateLimits, maxFileBytes);
+	engine->Run(listenSocket, chatServer);
+	group.Leave(index);
+
+	for (ChatServer::Client& client : chatServer.m_Clients)
+	{
+		closesocket(client.socket);
+	}
+}
+
+int main(int arg, char** argv)
+{
+	// Pick the I/O backend with --backend select|epoll|uring, --quiet stops the per message logging.
+	// --high-watermark and --low-watermark are per client queued bytes, --slow-policy drop-oldest|drop-newest|disconnect
+	// picks what happens to a client that stays over the high one. --threads runs that many shards.
+	// --admin-port serves the metrics on 127.0.0.1, 0 turns it off.
+	// --history-dir is where broadcasts are logged, --history-lines how many a new user is shown,
+	// --history-max-mb and --history-max-days how much is kept. --no-history turns it off.
+	// Clients that ask for it get large broadcasts compressed, with the built in chat dictionary or the one
+	// from --dictionary, which they need too. --train-dictionary FILE writes one trained on the history to FILE
+	// instead of serving. --no-compression turns it off. Clients that ask for the compact
+	// v2 wire format always get it, the others keep v1.
+	// Clients that agreed to heartbeats are pinged after --heartbeat-interval seconds of silence and dropped after
+	// --idle-timeout, the others after --legacy-idle-timeout. 0 turns any of them off.
+	// --message-rate messages and --byte-rate KB per second limit what each client may send, with bursts of up to
+	// --message-burst messages (200) and --byte-burst KB (1024). Both are off by default, a rate of 0 turns that
+	// limit off. A chat batch or a compressed frame is one message however many lines it holds, so against
+	// batched floods only the byte limit helps. --flood-policy delay|drop|disconnect picks what happens to a client
+	// that sends more.
+	// Clients that agreed to files or streams may share ones of up to --max-file-mb with the others on their shard,
+	// 0 turns both off.
+	std::string backend = defaultReactorName();
+	bool quiet = false;
+	int threads = 1;
+	int adminPort = DEFAULT_ADMIN_PORT;
+	std::string historyDirectory = "chat_history";
+	int historyLines = 50;
+	HistoryRetention retention = defaultHistoryRetention();
+	OutboundLimits limits = defaultOutboundLimits();
+	LivenessSettings liveness = defaultLivenessSettings();
+	RateLimits rateLimits = defaultRateLimits();
+	uint64_t maxFileBytes = 256 * 1024 * 1024;
+	bool compressionEnabled = true;
+	std::string dictionaryPath;
+	std::string trainDictionaryPath;
+	for (int i = 1; i < arg; i++)
+	{
+		if (strcmp(argv[i], "--backend") == 0 && i + 1 < arg)
+		{
+			backend = argv[++i];
+		}
+		else if (strcmp(argv[i], "--quiet") == 0)
+		{
+			quiet = true;
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < arg)
+		{
+			threads = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--admin-port") == 0 && i + 1 < arg)
+		{
+			adminPort = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--history-dir") == 0 && i + 1 < arg)
+		{
+			historyDirectory = argv[++i];
+		}
+		else if (strcmp(argv[i], "--no-history") == 0)
+		{
+			historyDirectory.clear();
+		}
+		else if (strcmp(argv[i], "--history-lines") == 0 && i + 1 < arg)
+		{
+			historyLines = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--history-max-mb") == 0 && i + 1 < arg)
+		{
+			retention.maxBytes = strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+		}
+		else if (strcmp(argv[i], "--history-max-days") == 0 && i + 1 < arg)
+		{
+			retention.maxAgeSeconds = strtoull(argv[++i], NULL, 10) * 24 * 60 * 60;
+		}
+		else if (strcmp(argv[i], "--no-compression") == 0)
+		{
+			compressionEnabled = false;
+		}
+		else if (strcmp(argv[i], "--dictionary") == 0 && i + 1 < arg)
+		{
+			dictionaryPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--train-dictionary") == 0 && i + 1 < arg)
+		{
+			trainDictionaryPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--high-watermark") == 0 && i + 1 < arg)
+		{
+			limits.highWatermark = strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--low-watermark") == 0 && i + 1 < arg)
+		{
+			limits.lowWatermark = strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--heartbeat-interval") == 0 && i + 1 < arg)
+		{
+			liveness.heartbeatIntervalMs = strtoull(argv[++i], NULL, 10) * 1000;
+		}
+		else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < arg)
+		{
+			liveness.idleTimeoutMs = strtoull(argv[++i], NULL, 10) * 1000;
+		}
+		else if (strcmp(argv[i], "--legacy-idle-timeout") == 0 && i + 1 < arg)
+		{
+			liveness.legacyIdleTimeoutMs = strtoull(argv[++i], NULL, 10) * 1000;
+		}
+		else if (strcmp(argv[i], "--message-rate") == 0 && i + 1 < arg)
+		{
+			rateLimits.messagesPerSecond = strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--message-burst") == 0 && i + 1 < arg)
+		{
+			rateLimits.messageBurst = strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--byte-rate") == 0 && i + 1 < arg)
+		{
+			rateLimits.bytesPerSecond = strtoul(argv[++i], NULL, 10) * 1024;
+		}
+		else if (strcmp(argv[i], "--byte-burst") == 0 && i + 1 < arg)
+		{
+			rateLimits.byteBurst = strtoul(argv[++i], NULL, 10) * 1024;
+		}
+		else if (strcmp(argv[i], "--flood-policy") == 0 && i + 1 < arg)
+		{
+			if (!parseFloodPolicy(argv[++i], rateLimits.policy))
+			{
+				printf("unknown flood policy '%s'\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--max-file-mb") == 0 && i + 1 < arg)
+		{
+			maxFileBytes = strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+		}
+		else if (strcmp(argv[i], "--slow-policy") == 0 && i + 1 < arg)
+		{
+			if (!parseSlowConsumerPolicy(argv[++i], limits.policy))
+			{
+				printf("unknown slow consumer policy '%s'\n", argv[i]);
+				return 1;
+			}
+		}
+	}
+
+	if (limits.lowWatermark > limits.highWatermark)
+	{
+		printf("the low watermark can't be above the high watermark\n");
+		return 1;
+	}
+
+	// Otherwise a client would be dropped before it was ever pinged
+	if (liveness.heartbeatIntervalMs > 0 && liveness.idleTimeoutMs > 0 && liveness.idleTimeoutMs <= liveness.heartbeatIntervalMs)
+	{
+		printf("the idle timeout has to be longer than the heartbeat interval\n");
+		return 1;
+	}
+
+	// An empty bucket would never let anything through
+	if ((rateLimits.messagesPerSecond > 0 && rateLimits.messageBurst == 0) || (rateLimits.bytesPerSecond > 0 && rateLimits.byteBurst == 0))
+	{
+		printf("a rate limit needs a burst of at least 1\n");
+		return 1;
+	}
+
+	if (!trainDictionaryPath.empty())
+	{
+		if (historyDirectory.empty())
+		{
+			printf("--train-dictionary trains on the history, it can't be used with --no-history\n");
+			return 1;
+		}
+		return trainDictionary(historyDirectory, retention, trainDictionaryPath);
+	}
+
+	if (threads < 1)
+	{
+		threads = 1;
+	}
+
+#ifdef _WIN32
+	if (threads > 1)
+	{
+		printf("--threads needs SO_REUSEPORT, running on one thread\n");
+		threads = 1;
+	}
+#endif
+
+	// Initialize Winsock
+	WSADATA wsaData;
+	int result;
+
+	// Set version 2.2 with MAKEWORD(2,2)
+	result = WSAStartup(MAKEWORD(2, 2), &wsaData);
+	if (result != 0)
+	{
+		printf("WSAStartup failed with error %d\n", result);
+		return 1;
+	}
+
+	printf("WSAStartup successfully!\n");
+
+	struct addrinfo* info = nullptr;
+	struct addrinfo hints;
+	ZeroMemory(&hints, sizeof(hints));  // ensure we don't have garbage data
+	hints.ai_family = AF_INET;			// IPv4
+	hints.ai_socktype = SOCK_STREAM;	// Stream
+	hints.ai_protocol = IPPROTO_TCP;	// TCP
+	hints.ai_flags = AI_PASSIVE;
+
+	result = getaddrinfo(NULL, DEFAULT_PORT, &hints, &info);
+	if (result != 0)
+	{
+		printf("getaddrinfo failed with error %d\n", result);
+		WSACleanup();
+		return 1;
+	}
+
+	printf("getaddrinfo was successful!\n");
+
+	// One listener per shard on the same port, the kernel spreads new connections across them
+	std::vector<SOCKET> listenSockets;
+	for (int i = 0; i < threads; i++)
+	{
+		SOCKET listenSocket = createListenSocket(info, threads > 1);
+		if (listenSocket == INVALID_SOCKET)
+		{
+			for (SOCKET openSocket : listenSockets)
+			{
+				closesocket(openSocket);
+			}
+			freeaddrinfo(info);
+			WSACleanup();
+			return 1;
+		}
+
+		listenSockets.push_back(listenSocket);
+	}
+
+	printf("listen was successful!\n");
+
+	// Opened before any shard runs, it is found again from its index files after a restart
+	HistoryLog history;
+	bool historyEnabled = !historyDirectory.empty();
+	if (historyEnabled)
+	{
+		auto openStart = std::chrono::steady_clock::now();
+		if (!history.Open(historyDirectory, retention))
+		{
+			printf("running without history\n");
+			historyEnabled = false;
+		}
+		else
+		{
+			double openMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - openStart).count();
+			printf("History in %s: %llu messages in %d segment(s), opened in %.1f ms\n", historyDirectory.c_str(),
+				(unsigned long long)history.Count(), (int)history.SegmentCount(), openMs);
+		}
+	}
+
+	CompressionDictionary dictionary;
+	if (compressionEnabled)
+	{
+		if (dictionaryPath.empty())
+		{
+			dictionary.SetBuiltIn();
+		}
+		else if (!dictionary.Load(dictionaryPath))
+		{
+			for (SOCKET listenSocket : listenSockets)
+			{
+				closesocket(listenSocket);
+			}
+			freeaddrinfo(info);
+			WSACleanup();
+			return 1;
+		}
+		printf("Compression offered with dictionary %08x (%zu bytes)\n", dictionary.m_Id, dictionary.m_Text.size());
+	}
+
+	ShardGroup group(threads);
+	std::vector<std::thread> shardThreads;
+	for (int i = 0; i < threads; i++)
+	{
+		shardThreads.emplace_back(runShard, std::ref(group), i, backend, limits, listenSockets[i], quiet, historyEnabled ? &history : nullptr, historyLines,
+			compressionEnabled ? &dictionary : nullptr, liveness, rateLimits, maxFileBytes);
+	}
+
+	// Only reads the engines while none has left the group, and is stopped before the group goes away
+	AdminServer adminServer(group);
+	std::thread adminThread;
+	if (adminPort != 0 && adminServer.Listen(adminPort))
+	{
+		printf("Serving metrics on 127.0.0.1:%d\n", adminPort);
+		adminThread = std::thread(&AdminServer::Run, &adminServer);
+	}
+
+	for (std::thread& shardThread : shardThreads)
+	{
+		shardThread.join();
+	}
+
+	if (adminThread.joinable())
+	{
+		adminServer.Stop();
+		adminThread.join();
+		adminServer.Close();
+	}
+
+	// Clean up
+	freeaddrinfo(info);
+
+	for (SOCKET listenSocket : listenSockets)
+	{
+		closesocket(listenSocket);
+	}
+
+	WSACleanup();
+
+	return group.m_Failed ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "server_engine.h"
+#include "reactor_engine.h"
+#include "uring_engine.h"
+
+#include <stdio.h>
+#include <memory>
+#include <string>
+
+// Returns nullptr if the backend is unknown or unavailable on this platform
+inline std::unique_ptr<ServerEngine> createEngine(const std::string& backend)
+{
+#ifdef __linux__
+	if (backend == "uring")
+	{
+		std::unique_ptr<UringEngine> engine(new UringEngine());
+		int result = engine->Init();
+		if (result < 0)
+		{
+			printf("io_uring setup failed with error %d\n", -result);
+			return nullptr;
+		}
+		return engine;
+	}
+#endif
+
+	std::unique_ptr<Reactor> reactor = createReactor(backend);
+	if (!reactor)
+		return nullptr;
+
+	return std::unique_ptr<ServerEngine>(new ReactorEngine(std::move(reactor)));
+}
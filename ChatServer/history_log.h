@@ -0,0 +1,380 @@
+#pragma once
+
+#include "../Common/mapped_file.h"
+#include "../Common/frame_reassembler.h"
+#include "../Common/buffer.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Every message broadcast to everyone, kept on disk so new users can be shown what they missed.
+//
+// Frames are appended in their wire form to memory mapped segment files, back to back, so the history for a
+// join is a few contiguous ranges of mapped memory handed to Send as they are. Each segment has an index file
+// next to it with one entry per frame and a header whose count is only bumped once the frame and its entry are
+// written, a restart reads that count and checks the last entries instead of walking the data. A segment is
+// named after the sequence number of its first frame. Full segments are closed and a new one started, the
+// oldest ones are deleted once the total goes over the size limit or they get older than the age limit.
+//
+// Shards append and read under one mutex, an append is two memcpys so it is held very briefly.
+
+struct HistoryRetention
+{
+	uint64_t maxBytes;			// across all segments, the oldest ones go first
+	uint64_t maxAgeSeconds;		// segments whose newest frame is older than this are deleted, 0 keeps them
+};
+
+inline HistoryRetention defaultHistoryRetention()
+{
+	HistoryRetention retention;
+	retention.maxBytes = 1024ull * 1024 * 1024;
+	retention.maxAgeSeconds = 7 * 24 * 60 * 60;
+	return retention;
+}
+
+class HistoryLog
+{
+public:
+
+	static const size_t SEGMENT_BYTES = 64 * 1024 * 1024;
+	static const size_t INDEX_ENTRIES = 1024 * 1024;
+	static const uint32_t INDEX_MAGIC = 0x58494843;	// "CHIX"
+	static const uint32_t INDEX_VERSION = 1;
+
+	struct IndexHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t firstSequence;
+		uint64_t count;			// entries that are completely written, the commit point
+		uint8_t reserved[40];
+	};
+
+	struct IndexEntry
+	{
+		uint32_t offset;		// into the segment's data file
+		uint32_t packetSize;
+		uint64_t timeMs;		// wall clock when it was appended, for retention by age
+	};
+
+	static_assert(sizeof(IndexHeader) == 64 && sizeof(IndexEntry) == 16, "index layout is on disk");
+
+	struct Segment
+	{
+		uint64_t firstSequence;
+		uint64_t count;
+		size_t dataBytes;		// end of the last frame
+		MappedFile data;
+		MappedFile index;
+		std::string dataPath;
+		std::string indexPath;
+
+		IndexHeader* Header()
+		{
+			return (IndexHeader*)index.m_Data;
+		}
+
+		IndexEntry* Entries()
+		{
+			return (IndexEntry*)(index.m_Data + sizeof(IndexHeader));
+		}
+
+		uint64_t LastTimeMs()
+		{
+			return count > 0 ? Entries()[count - 1].timeMs : 0;
+		}
+
+		// A clock that went backwards doesn't make anything old
+		bool OlderThan(uint64_t maxAgeSeconds, uint64_t timeMs)
+		{
+			uint64_t lastTimeMs = LastTimeMs();
+			return maxAgeSeconds > 0 && timeMs > lastTimeMs && timeMs - lastTimeMs > maxAgeSeconds * 1000;
+		}
+	};
+
+	std::string m_Directory;
+	HistoryRetention m_Retention;
+	std::deque<std::unique_ptr<Segment>> m_Segments;	// oldest first, the last one is appended to
+	uint64_t m_TotalBytes;
+	std::mutex m_Mutex;
+
+	HistoryLog()
+	{
+		m_Retention = defaultHistoryRetention();
+		m_TotalBytes = 0;
+	}
+
+	// Creates the directory if needed and picks up the segments already in it
+	bool Open(const std::string& directory, const HistoryRetention& retention)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		m_Directory = directory;
+		m_Retention = retention;
+
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+		if (error)
+		{
+			printf("could not create the history directory %s: %s\n", directory.c_str(), error.message().c_str());
+			return false;
+		}
+
+		// Only the index files are looked at, a data file without one never got a frame committed
+		std::vector<uint64_t> firstSequences;
+		for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory, error))
+		{
+			std::string name = entry.path().filename().string();
+			uint64_t firstSequence;
+			char extension[8];
+			if (sscanf(name.c_str(), "%" SCNu64 ".%7s", &firstSequence, extension) == 2 && strcmp(extension, "idx") == 0)
+			{
+				firstSequences.push_back(firstSequence);
+			}
+		}
+		std::sort(firstSequences.begin(), firstSequences.end());
+
+		for (uint64_t firstSequence : firstSequences)
+		{
+			std::unique_ptr<Segment> segment = OpenSegment(firstSequence);
+			if (!segment)
+				return false;
+
+			if (segment->count == 0 && firstSequence != firstSequences.back())
+			{
+				DeleteSegment(*segment);
+				continue;
+			}
+
+			m_TotalBytes += segment->dataBytes;
+			m_Segments.push_back(std::move(segment));
+		}
+
+		if (m_Segments.empty() && !StartSegment(0))
+			return false;
+
+		EnforceRetention(nowMs());
+		return true;
+	}
+
+	uint64_t Count()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		uint64_t count = 0;
+		for (std::unique_ptr<Segment>& segment : m_Segments)
+		{
+			count += segment->count;
+		}
+		return count;
+	}
+
+	size_t SegmentCount()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Segments.size();
+	}
+
+	// Appends one or more whole frames back to back, e.g. a batch's chat frames, each gets its own entry
+	void Append(const uint8_t* frames, size_t length)
+	{
+		uint64_t timeMs = nowMs();
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		while (length >= FRAME_HEADER_SIZE)
+		{
+			uint32_t packetSize = loadUInt32LE(frames);
+			// Replayed to every client that joins, one none of them would read would cost each its connection
+			if (packetSize < FRAME_HEADER_SIZE || packetSize > MAX_FRAME_SIZE || packetSize > length)
+				return;
+
+			Segment* segment = m_Segments.back().get();
+			if (segment->dataBytes + packetSize > SEGMENT_BYTES || segment->count == INDEX_ENTRIES)
+			{
+				segment->data.Sync();
+				segment->index.Sync();
+				if (!StartSegment(segment->firstSequence + segment->count))
+					return;
+				segment = m_Segments.back().get();
+				EnforceRetention(timeMs);
+			}
+
+			memcpy(segment->data.m_Data + segment->dataBytes, frames, packetSize);
+
+			IndexEntry& entry = segment->Entries()[segment->count];
+			entry.offset = (uint32_t)segment->dataBytes;
+			entry.packetSize = packetSize;
+			entry.timeMs = timeMs;
+
+			// Only now is it part of the log
+			segment->count++;
+			segment->dataBytes += packetSize;
+			segment->Header()->count = segment->count;
+			m_TotalBytes += packetSize;
+
+			frames += packetSize;
+			length -= packetSize;
+		}
+
+		if (m_Segments.size() > 1 && m_Segments.front()->OlderThan(m_Retention.maxAgeSeconds, timeMs))
+		{
+			EnforceRetention(timeMs);
+		}
+	}
+
+	// Age is otherwise only looked at when something is appended, a room that went quiet would keep its old
+	// segments past the limit until the next line
+	void ExpireOld()
+	{
+		uint64_t timeMs = nowMs();
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		if (m_Segments.size() > 1 && m_Segments.front()->OlderThan(m_Retention.maxAgeSeconds, timeMs))
+		{
+			EnforceRetention(timeMs);
+		}
+	}
+
+	// Calls onRange(const uint8_t* data, size_t length) with the last count frames, oldest first, in as few
+	// contiguous ranges as the segments allow. The ranges point into the mapping and are only valid during the call.
+	template <typename OnRange>
+	uint64_t ReadRecent(uint64_t count, OnRange onRange)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		// Walk back to the segment the oldest wanted frame is in
+		size_t first = m_Segments.size();
+		uint64_t found = 0;
+		while (first > 0 && found < count)
+		{
+			first--;
+			found += m_Segments[first]->count;
+		}
+
+		uint64_t skip = found > count ? found - count : 0;
+		for (size_t i = first; i < m_Segments.size(); i++)
+		{
+			Segment& segment = *m_Segments[i];
+			if (skip >= segment.count)
+			{
+				skip -= segment.count;
+				continue;
+			}
+
+			size_t start = segment.Entries()[skip].offset;
+			onRange(segment.data.m_Data + start, segment.dataBytes - start);
+			skip = 0;
+		}
+
+		return found < count ? found : count;
+	}
+
+private:
+
+	static uint64_t nowMs()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	std::string PathFor(uint64_t firstSequence, const char* extension)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "%020" PRIu64 ".%s", firstSequence, extension);
+		return (std::filesystem::path(m_Directory) / name).string();
+	}
+
+	// Maps both files and works out how much of the segment was committed
+	std::unique_ptr<Segment> OpenSegment(uint64_t firstSequence)
+	{
+		std::unique_ptr<Segment> segment(new Segment());
+		segment->firstSequence = firstSequence;
+		segment->dataPath = PathFor(firstSequence, "log");
+		segment->indexPath = PathFor(firstSequence, "idx");
+
+		if (!segment->data.Open(segment->dataPath, SEGMENT_BYTES)
+			|| !segment->index.Open(segment->indexPath, sizeof(IndexHeader) + INDEX_ENTRIES * sizeof(IndexEntry)))
+		{
+			printf("could not map history segment %s, error %d\n", segment->dataPath.c_str(), errno);
+			return nullptr;
+		}
+
+		IndexHeader* header = segment->Header();
+		if (segment->index.m_Created || header->magic != INDEX_MAGIC)
+		{
+			memset(header, 0, sizeof(IndexHeader));
+			header->magic = INDEX_MAGIC;
+			header->version = INDEX_VERSION;
+			header->firstSequence = firstSequence;
+		}
+
+		// The count is written last, but a crash can still leave entries whose frames the kernel never got.
+		// Back off until the last entry describes a frame that is really there.
+		uint64_t count = header->count < INDEX_ENTRIES ? header->count : INDEX_ENTRIES;
+		while (count > 0)
+		{
+			const IndexEntry& last = segment->Entries()[count - 1];
+			if ((uint64_t)last.offset + last.packetSize <= SEGMENT_BYTES && last.packetSize >= FRAME_HEADER_SIZE
+				&& loadUInt32LE(segment->data.m_Data + last.offset) == last.packetSize)
+			{
+				break;
+			}
+			count--;
+		}
+
+		if (count != header->count)
+		{
+			printf("history segment %s had %" PRIu64 " uncommitted entries, dropped them\n", segment->indexPath.c_str(), header->count - count);
+			header->count = count;
+		}
+
+		segment->count = count;
+		segment->dataBytes = count > 0 ? segment->Entries()[count - 1].offset + segment->Entries()[count - 1].packetSize : 0;
+		return segment;
+	}
+
+	bool StartSegment(uint64_t firstSequence)
+	{
+		std::unique_ptr<Segment> segment = OpenSegment(firstSequence);
+		if (!segment)
+			return false;
+
+		m_TotalBytes += segment->dataBytes;
+		m_Segments.push_back(std::move(segment));
+		return true;
+	}
+
+	void DeleteSegment(Segment& segment)
+	{
+		segment.data.Close();
+		segment.index.Close();
+
+		std::error_code error;
+		std::filesystem::remove(segment.dataPath, error);
+		std::filesystem::remove(segment.indexPath, error);
+	}
+
+	// Never deletes the segment being appended to
+	void EnforceRetention(uint64_t timeMs)
+	{
+		while (m_Segments.size() > 1)
+		{
+			Segment& oldest = *m_Segments.front();
+			if (m_TotalBytes <= m_Retention.maxBytes && !oldest.OlderThan(m_Retention.maxAgeSeconds, timeMs))
+				break;
+
+			m_TotalBytes -= oldest.dataBytes;
+			DeleteSegment(oldest);
+			m_Segments.pop_front();
+		}
+	}
+};
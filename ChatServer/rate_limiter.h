@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+// What to do with a client that sends faster than its rate limits allow
+enum FloodPolicy
+{
+	FLOOD_DELAY,		// stop reading from it until it is back under the limits, TCP holds back the rest
+	FLOOD_DROP,			// throw away what it sends until it is back under the limits
+	FLOOD_DISCONNECT,	// close the connection
+};
+
+// Per client. A rate of 0 turns that limit off, a burst is how much may come at once after a quiet spell.
+struct RateLimits
+{
+	uint32_t messagesPerSecond;
+	uint32_t messageBurst;
+	uint32_t bytesPerSecond;
+	uint32_t byteBurst;
+	FloodPolicy policy;
+};
+
+// Off unless a rate is given, load tests and benchmarks push far more than anyone typing. The bursts are what
+// goes with a rate then, well above anyone typing so a script or a paste gets through.
+inline RateLimits defaultRateLimits()
+{
+	RateLimits limits;
+	limits.messagesPerSecond = 0;
+	limits.messageBurst = 200;
+	limits.bytesPerSecond = 0;
+	limits.byteBurst = 1024 * 1024;
+	limits.policy = FLOOD_DELAY;
+	return limits;
+}
+
+// Accepts delay, drop or disconnect
+inline bool parseFloodPolicy(const std::string& name, FloodPolicy& policy)
+{
+	if (name == "delay")
+		policy = FLOOD_DELAY;
+	else if (name == "drop")
+		policy = FLOOD_DROP;
+	else if (name == "disconnect")
+		policy = FLOOD_DISCONNECT;
+	else
+		return false;
+
+	return true;
+}
+
+inline const char* floodPolicyName(FloodPolicy policy)
+{
+	switch (policy)
+	{
+	case FLOOD_DELAY: return "delay";
+	case FLOOD_DROP: return "drop";
+	case FLOOD_DISCONNECT: return "disconnect";
+	}
+	return "unknown";
+}
+
+// A rate with some slack: tokens come in at ratePerSecond up to burst and whatever is limited takes them.
+//
+// Counted in thousandths of a token, so even a slow rate refills a little every millisecond without any floating
+// point. A bucket with anything in it lets a take through even if that leaves it in debt, so one frame larger than
+// the whole burst isn't stuck forever, the sender just waits the debt off afterwards.
+class TokenBucket
+{
+public:
+
+	TokenBucket()
+	{
+		m_Rate = 0;
+		m_Capacity = 0;
+		m_Tokens = 0;
+		m_LastMs = 0;
+	}
+
+	// Starts out full. A rate of 0 never limits anything.
+	void Configure(uint32_t ratePerSecond, uint32_t burst, uint64_t nowMs)
+	{
+		m_Rate = ratePerSecond;		// thousandths of a token per millisecond
+		m_Capacity = (int64_t)burst * 1000;
+		m_Tokens = m_Capacity;
+		m_LastMs = nowMs;
+	}
+
+	// How long until the bucket has something in it again, 0 if it has now
+	uint64_t WaitMs(uint64_t nowMs)
+	{
+		if (m_Rate == 0)
+			return 0;
+
+		Refill(nowMs);
+		if (m_Tokens > 0)
+			return 0;
+
+		return (uint64_t)(-m_Tokens) / m_Rate + 1;
+	}
+
+	void Take(uint64_t amount, uint64_t nowMs)
+	{
+		if (m_Rate == 0)
+			return;
+
+		Refill(nowMs);
+		m_Tokens -= (int64_t)amount * 1000;
+	}
+
+private:
+
+	int64_t m_Tokens;
+	int64_t m_Capacity;
+	uint32_t m_Rate;
+	uint64_t m_LastMs;
+
+	void Refill(uint64_t nowMs)
+	{
+		if (nowMs <= m_LastMs)
+			return;
+
+		// Compared first so a bucket left alone for weeks can't overflow
+		uint64_t elapsedMs = nowMs - m_LastMs;
+		m_LastMs = nowMs;
+		if (elapsedMs > (uint64_t)(m_Capacity - m_Tokens) / m_Rate)
+		{
+			m_Tokens = m_Capacity;
+		}
+		else
+		{
+			m_Tokens += (int64_t)elapsedMs * m_Rate;
+		}
+	}
+};
@@ -0,0 +1,772 @@
+#pragma once
+
+#include "server_engine.h"
+#include "../Common/reactor.h"
+#include "../Common/frame_reassembler.h"
+#include "../Common/outbound_queue.h"
+#include "../Common/wakeup.h"
+
+#include <stdio.h>
+#include <unordered_map>
+
+// Connections accepted per tick at most. A reconnect storm is taken in batches this size with everyone
+// else's traffic handled in between, rather than one per wakeup while the backlog overflows.
+const int ACCEPT_BUDGET_PER_TICK = 128;
+
+// Readiness based engine: wait on the reactor, then recv/send on the ready sockets directly.
+//
+// Client sockets are non-blocking and sends only queue the frame. Every connection that got frames during a tick
+// is written once at the end of it, whatever the socket doesn't take stays queued and the socket is watched for
+// writability until it drains. A client that stops reading only grows its own queue, up to the outbound limits.
+class ReactorEngine : public ServerEngine
+{
+public:
+
+	struct Connection
+	{
+		FrameReassembler reassembler;
+		OutboundQueue outbound;
+		bool closed;			// disconnected while its frames were being dispatched, freed once that ends
+		bool queuedForFlush;
+		bool watchingWrites;	// registered for REACTOR_WRITE because the socket didn't take everything
+		bool readPaused;		// not registered for REACTOR_READ until resume comes up, see PauseReading
+		TimerWheel::Timer resume;
+		bool relaying;			// what it sends now is a body its relay reads, see RelayBody
+		SOCKET receivingFrom;	// whose relay is sending it a body, INVALID_SOCKET while none is
+		size_t relayTarget;		// which of that relay's targets it is
+		uint32_t interest;		// what it is registered with the reactor for
+	};
+
+	std::unique_ptr<Reactor> m_Reactor;
+	std::vector<ReactorEvent> m_ReadyEvents;
+	ServerEvents* m_Events;
+	OutboundLimits m_Limits;
+
+	// One read buffer for every socket, only the unfinished tail of a read is kept per connection
+	std::vector<uint8_t> m_RecvChunk;
+	std::unordered_map<SOCKET, Connection> m_Connections;
+	std::vector<SOCKET> m_SocketsToFlush;
+
+	// Slow consumers found in the middle of a broadcast, closing them there would change the list being walked
+	std::vector<SOCKET> m_SocketsToDisconnect;
+
+	// Bodies on their way, by the socket they come from. The relays to pump are the ones that may be able to move
+	// again, the yielded ones had more to move right away and get their turn next tick.
+	std::unordered_map<SOCKET, std::unique_ptr<SpliceRelay>> m_Relays;
+	std::vector<SOCKET> m_RelaysToPump;
+	std::vector<SOCKET> m_RelaysYielded;
+	std::vector<SOCKET> m_RelayFinished;
+	std::vector<SOCKET> m_RelayFailed;
+
+	// Lets a Disconnect from inside OnFrame stop the read loop for that socket
+	SOCKET m_CurrentSocket;
+	bool m_CurrentClosed;
+
+	// Registered with the reactor so other threads can interrupt Wait
+	Wakeup m_Wakeup;
+
+	int m_AcceptBudget;
+	bool m_AcceptPending;	// the last batch used up the budget, more may be waiting in the backlog
+
+	TimerWheel m_Timers;
+
+	ShardMetrics m_Metrics;
+
+	ReactorEngine(std::unique_ptr<Reactor> reactor)
+		: m_Reactor(std::move(reactor))
+	{
+		m_Events = nullptr;
+		m_Limits = defaultOutboundLimits();
+		m_CurrentSocket = INVALID_SOCKET;
+		m_CurrentClosed = false;
+		m_RecvChunk.resize(RECV_CHUNK_SIZE);
+		m_AcceptBudget = ACCEPT_BUDGET_PER_TICK;
+		m_AcceptPending = false;
+
+		if (!m_Wakeup.Init())
+		{
+			printf("could not create the wakeup handle, error %d\n", WSAGetLastError());
+		}
+	}
+
+	const char* Name() const override
+	{
+		return m_Reactor->Name();
+	}
+
+	ShardMetrics& Metrics() override
+	{
+		return m_Metrics;
+	}
+
+	TimerWheel& Timers() override
+	{
+		return m_Timers;
+	}
+
+	void SetOutboundLimits(const OutboundLimits& limits) override
+	{
+		m_Limits = limits;
+	}
+
+	void Send(SOCKET socket, const uint8_t* data, int length) override
+	{
+		FrameRef frame(data, length);
+		if (frame)
+		{
+			SendFrame(socket, frame);
+		}
+	}
+
+	void SendFrame(SOCKET socket, const FrameRef& frame) override
+	{
+		auto it = m_Connections.find(socket);
+		if (it == m_Connections.end())
+			return;
+
+		Connection& connection = it->second;
+		if (connection.closed)
+			return;
+
+		size_t queuedBefore = connection.outbound.m_QueuedBytes;
+		uint64_t droppedBefore = connection.outbound.m_DroppedFrames;
+
+		OutboundQueue::PushResult result = connection.outbound.Push(frame, m_Limits);
+
+		// Drop-oldest can shrink the queue while pushing, so count the difference rather than the frame
+		m_Metrics.queuedBytes.Add((int64_t)connection.outbound.m_QueuedBytes - (int64_t)queuedBefore);
+		m_Metrics.droppedFrames.Add(connection.outbound.m_DroppedFrames - droppedBefore);
+
+		if (result == OutboundQueue::PUSH_DISCONNECT)
+		{
+			m_Metrics.slowConsumerDisconnects.Add();
+			printf("Client %d fell %d bytes behind, disconnecting.\n", (int)socket, (int)connection.outbound.m_QueuedBytes);
+			m_SocketsToDisconnect.push_back(socket);
+			return;
+		}
+
+		// A client already waiting for writability gets flushed by the reactor when it drains
+		if (result == OutboundQueue::PUSH_QUEUED && !connection.queuedForFlush && !connection.watchingWrites)
+		{
+			connection.queuedForFlush = true;
+			m_SocketsToFlush.push_back(socket);
+		}
+	}
+
+	void SetWireVersion(SOCKET socket, WireVersion version) override
+	{
+		auto it = m_Connections.find(socket);
+		if (it != m_Connections.end())
+			it->second.reassembler.m_Version = version;
+	}
+
+	void Disconnect(SOCKET socket) override
+	{
+		auto it = m_Connections.find(socket);
+		if (it == m_Connections.end() || it->second.closed)
+			return;
+
+		m_Metrics.disconnects.Add();
+		m_Metrics.queuedBytes.Add(-(int64_t)it->second.outbound.m_QueuedBytes);
+
+		// A body it was sending ends with it, one it was receiving carries on to the others
+		if (it->second.relaying)
+		{
+			AbortRelay(socket);
+		}
+		LeaveRelay(it->second);
+
+		if (socket == m_CurrentSocket)
+		{
+			// The socket being read is still inside its reassembler, Run frees it after the read loop
+			it->second.closed = true;
+			m_CurrentClosed = true;
+		}
+		else
+		{
+			m_Connections.erase(it);
+		}
+
+		m_Reactor->Remove(socket);
+		closesocket(socket);
+		m_Events->OnDisconnected(socket);
+	}
+
+	void Wake() override
+	{
+		m_Wakeup.Signal();
+	}
+
+	// Writes what the socket takes and watches it for writability only while something is left over
+	void FlushConnection(SOCKET socket, Connection& connection)
+	{
+		// Once a body it is receiving has started, the socket is the relay's until the body is through
+		SpliceRelay* relay = RelayTo(connection);
+		if (relay != nullptr && relay->m_Targets[connection.relayTarget].ready)
+		{
+			relay->WriteTarget(connection.relayTarget, m_RelayFinished, m_RelayFailed);
+			m_RelaysToPump.push_back(connection.receivingFrom);
+			SettleRelayTargets();
+			UpdateInterest(socket, connection);
+			return;
+		}
+
+		size_t queuedBefore = connection.outbound.m_QueuedBytes;
+		bool written = connection.outbound.WriteTo(socket, m_Limits);
+
+		size_t sent = queuedBefore - connection.outbound.m_QueuedBytes;
+		m_Metrics.bytesOut.Add(sent);
+		m_Metrics.queuedBytes.Add(-(int64_t)sent);
+
+		if (!written)
+		{
+			Disconnect(socket);
+			return;
+		}
+
+		connection.watchingWrites = !connection.outbound.Empty();
+
+		// Everything queued before the body has gone, the header and the body are next
+		if (relay != nullptr && !connection.watchingWrites)
+		{
+			relay->SetReady(connection.relayTarget, m_RelayFinished, m_RelayFailed);
+			m_RelaysToPump.push_back(connection.receivingFrom);
+			SettleRelayTargets();
+		}
+
+		UpdateInterest(socket, connection);
+	}
+
+	uint32_t InterestOf(SOCKET socket, const Connection& connection)
+	{
+		// A relay only reads its source when it has run dry, and writes a target when it fell behind
+		bool read = !connection.readPaused;
+		if (connection.relaying)
+		{
+			auto it = m_Relays.find(socket);
+			read = read && it != m_Relays.end() && it->second->m_SourceBlocked;
+		}
+
+		bool write = connection.watchingWrites;
+		SpliceRelay* relay = RelayTo(connection);
+		if (relay != nullptr && relay->m_Targets[connection.relayTarget].ready)
+		{
+			write = relay->m_Targets[connection.relayTarget].blocked;
+		}
+
+		return (read ? (uint32_t)REACTOR_READ : 0) | (write ? (uint32_t)REACTOR_WRITE : 0);
+	}
+
+	// Registers what the connection needs now, if that changed
+	void UpdateInterest(SOCKET socket, Connection& connection)
+	{
+		uint32_t interest = InterestOf(socket, connection);
+		if (interest != connection.interest)
+		{
+			connection.interest = interest;
+			m_Reactor->Modify(socket, interest);
+		}
+	}
+
+	// The reassembler holds on to what was read but not handed out yet, and with the socket out of the read set
+	// the rest stays in the kernel
+	void PauseReading(SOCKET socket, uint64_t delayMs) override
+	{
+		auto it = m_Connections.find(socket);
+		if (it == m_Connections.end() || it->second.closed)
+			return;
+
+		Connection& connection = it->second;
+		connection.reassembler.Hold();
+		m_Timers.Arm(connection.resume, delayMs);
+
+		connection.readPaused = true;
+		UpdateInterest(socket, connection);
+	}
+
+	// What was held goes to OnFrame first, which may pause the socket again
+	void ResumeReading(SOCKET socket)
+	{
+		auto it = m_Connections.find(socket);
+		if (it == m_Connections.end() || it->second.closed)
+			return;
+
+		Connection& connection = it->second;
+		connection.readPaused = false;
+
+		m_CurrentSocket = socket;
+		m_CurrentClosed = false;
+		bool valid = connection.reassembler.Release([&](const uint8_t* frame, uint32_t packetSize)
+		{
+			m_Events->OnFrame(socket, frame, packetSize);
+			return !m_CurrentClosed;
+		});
+		m_CurrentSocket = INVALID_SOCKET;
+
+		if (m_CurrentClosed)
+		{
+			m_Connections.erase(it);
+			return;
+		}
+
+		if (!valid)
+		{
+			printf("Client sent a malformed frame, disconnecting.\n");
+			Disconnect(socket);
+			return;
+		}
+
+		// Registering it again has epoll report anything that arrived meanwhile, even if it never stopped
+		// watching it, e.g. what came right after a relayed body
+		if (!connection.readPaused && !connection.relaying)
+		{
+			connection.interest = InterestOf(socket, connection);
+			m_Reactor->Modify(socket, connection.interest);
+		}
+	}
+
+	// The relay a target connection is receiving a body from, nullptr if none
+	SpliceRelay* RelayTo(const Connection& connection)
+	{
+		if (connection.receivingFrom == INVALID_SOCKET)
+			return nullptr;
+
+		auto it = m_Relays.find(connection.receivingFrom);
+		return it != m_Relays.end() ? it->second.get() : nullptr;
+	}
+
+	// What follows the frame is read by the relay rather than the reassembler from here on. Targets that are
+	// still writing what was queued for them before start once they are through with it.
+	size_t RelayBody(SOCKET socket, uint64_t bodySize, const std::vector<RelayTarget>& targets) override
+	{
+		auto it = m_Connections.find(socket);
+		if (it == m_Connections.end() || it->second.closed || it->second.relaying)
+			return 0;
+
+		std::unique_ptr<SpliceRelay> relay(new SpliceRelay(socket, bodySize));
+		if (!relay->Open())
+		{
+			printf("could not open a pipe to relay from client %d, error %d, disconnecting.\n", (int)socket, WSAGetLastError());
+			Disconnect(socket);
+			return 0;
+		}
+
+		for (const RelayTarget& target : targets)
+		{
+			auto targetIt = m_Connections.find(target.socket);
+			if (target.socket == socket || targetIt == m_Connections.end() || targetIt->second.closed)
+				continue;
+
+			// Bodies aren't queued, one at a time
+			Connection& connection = targetIt->second;
+			if (connection.receivingFrom != INVALID_SOCKET)
+			{
+				m_Metrics.relayBusyTargets.Add();
+				continue;
+			}
+
+			connection.receivingFrom = socket;
+			connection.relayTarget = relay->AddTarget(target.socket, target.header, connection.outbound.Empty());
+		}
+
+		size_t count = relay->m_Targets.size();
+		it->second.relaying = true;
+		it->second.reassembler.HoldAfter();
+		m_Relays[socket] = std::move(relay);
+		m_Metrics.relays.Add();
+
+		// Pumped once OnFrame has returned and the reassembler holds what followed the frame
+		m_RelaysToPump.push_back(socket);
+		return count;
+	}
+
+	bool IsRelaying(SOCKET socket) override
+	{
+		auto it = m_Connections.find(socket);
+		return it != m_Connections.end() && (it->second.relaying || it->second.receivingFrom != INVALID_SOCKET);
+	}
+
+	void PumpRelay(SOCKET source)
+	{
+		auto relayIt = m_Relays.find(source);
+		auto it = m_Connections.find(source);
+		if (relayIt == m_Relays.end() || it == m_Connections.end())
+			return;
+
+		SpliceRelay& relay = *relayIt->second;
+		Connection& connection = it->second;
+
+		uint64_t movedBefore = relay.m_Moved;
+		SpliceRelay::Result result = relay.Pump(connection.reassembler.m_Partial, true, m_RelayFinished, m_RelayFailed);
+		m_Metrics.relayBytes.Add(relay.m_Moved - movedBefore);
+		SettleRelayTargets();
+
+		// Targets that took less than they were given wait to be writable
+		for (const SpliceRelay::Target& target : relay.m_Targets)
+		{
+			auto targetIt = m_Connections.find(target.socket);
+			if (!target.finished && targetIt != m_Connections.end() && !targetIt->second.closed)
+			{
+				UpdateInterest(target.socket, targetIt->second);
+			}
+		}
+
+		switch (result)
+		{
+		case SpliceRelay::RELAY_DONE:
+			// Its frames carry on with whatever came after the body
+			m_Relays.erase(relayIt);
+			connection.relaying = false;
+			ResumeReading(source);
+			break;
+		case SpliceRelay::RELAY_FAILED:
+			printf("Client %d went away part way through a body it was sending, disconnecting.\n", (int)source);
+			Disconnect(source);
+			break;
+		case SpliceRelay::RELAY_YIELDED:
+			m_RelaysYielded.push_back(source);
+			UpdateInterest(source, connection);
+			break;
+		case SpliceRelay::RELAY_WAITING:
+			UpdateInterest(source, connection);
+			break;
+		}
+	}
+
+	void PumpRelays()
+	{
+		// A pump can start another relay or finish a target that unblocks one, so this list may grow meanwhile
+		for (size_t i = 0; i < m_RelaysToPump.size(); i++)
+		{
+			PumpRelay(m_RelaysToPump[i]);
+		}
+
+		m_RelaysToPump.clear();
+	}
+
+	// Targets the relays are done with: the ones that failed are closed, the others go back to their own queue.
+	// Both only later in the tick, nothing is freed under the caller.
+	void SettleRelayTargets()
+	{
+		for (SOCKET socket : m_RelayFailed)
+		{
+			auto it = m_Connections.find(socket);
+			if (it != m_Connections.end())
+			{
+				it->second.receivingFrom = INVALID_SOCKET;
+				m_SocketsToDisconnect.push_back(socket);
+			}
+		}
+		m_RelayFailed.clear();
+
+		for (SOCKET socket : m_RelayFinished)
+		{
+			auto it = m_Connections.find(socket);
+			if (it == m_Connections.end())
+				continue;
+
+			Connection& connection = it->second;
+			connection.receivingFrom = INVALID_SOCKET;
+			if (connection.closed)
+				continue;
+
+			if (!connection.outbound.Empty() && !connection.queuedForFlush)
+			{
+				connection.queuedForFlush = true;
+				m_SocketsToFlush.push_back(socket);
+			}
+			UpdateInterest(socket, connection);
+		}
+		m_RelayFinished.clear();
+	}
+
+	// The source is going away, targets that got part of the body can't make sense of their stream any more
+	void AbortRelay(SOCKET source)
+	{
+		auto relayIt = m_Relays.find(source);
+		if (relayIt == m_Relays.end())
+			return;
+
+		std::unique_ptr<SpliceRelay> relay = std::move(relayIt->second);
+		m_Relays.erase(relayIt);
+		m_Metrics.relayAborts.Add();
+
+		relay->Abort(m_RelayFinished, m_RelayFailed);
+		SettleRelayTargets();
+	}
+
+	// A target going away, the relay may have been waiting only for it
+	void LeaveRelay(Connection& connection)
+	{
+		SpliceRelay* relay = RelayTo(connection);
+		if (relay != nullptr)
+		{
+			relay->Drop(connection.relayTarget);
+			m_RelaysToPump.push_back(connection.receivingFrom);
+		}
+		connection.receivingFrom = INVALID_SOCKET;
+	}
+
+	void FlushSends()
+	{
+		// Flushing can finish a relay target, which queues it again
+		for (size_t i = 0; i < m_SocketsToFlush.size(); i++)
+		{
+			SOCKET socket = m_SocketsToFlush[i];
+			auto it = m_Connections.find(socket);
+			if (it == m_Connections.end())
+				continue;
+
+			// A connection closed from inside OnFrame is only waiting to be freed
+			it->second.queuedForFlush = false;
+			if (!it->second.closed)
+			{
+				FlushConnection(socket, it->second);
+			}
+		}
+
+		m_SocketsToFlush.clear();
+	}
+
+	void DisconnectSlowConsumers()
+	{
+		for (size_t i = 0; i < m_SocketsToDisconnect.size(); i++)
+		{
+			Disconnect(m_SocketsToDisconnect[i]);
+		}
+
+		m_SocketsToDisconnect.clear();
+	}
+
+	// Drains the accept queue up to the budget. An edge triggered backend won't report the listen socket again
+	// for connections already waiting, so a batch that ends on the budget leaves m_AcceptPending set and the
+	// next tick carries on without waiting.
+	void AcceptNewClients(SOCKET listenSocket)
+	{
+		m_AcceptPending = false;
+		for (int accepted = 0; accepted < m_AcceptBudget; accepted++)
+		{
+			// Sends must never block the loop, a full socket buffer just leaves the frames queued
+			SOCKET newClientSocket = acceptNonBlocking(listenSocket);
+			if (newClientSocket == INVALID_SOCKET)
+			{
+				int error = WSAGetLastError();
+				if (!isWouldBlock(error))
+				{
+					printf("accept failed with error %d\n", error);
+				}
+				return;
+			}
+
+			if (!m_Reactor->Add(newClientSocket, REACTOR_READ))
+			{
+				printf("%s reactor could not register socket %d, closing it\n", m_Reactor->Name(), (int)newClientSocket);
+				closesocket(newClientSocket);
+				continue;
+			}
+
+			Connection& connection = m_Connections[newClientSocket];
+			connection.closed = false;
+			connection.queuedForFlush = false;
+			connection.watchingWrites = false;
+			connection.readPaused = false;
+			connection.resume.m_Callback = [this, newClientSocket]() { ResumeReading(newClientSocket); };
+			connection.relaying = false;
+			connection.receivingFrom = INVALID_SOCKET;
+			connection.interest = REACTOR_READ;
+
+			// The welcome is only queued, it goes out with the tick's other sends
+			m_Metrics.accepts.Add();
+			m_Events->OnConnected(newClientSocket);
+		}
+
+		m_AcceptPending = true;
+	}
+
+	// Returns false when the client has disconnected
+	bool HandleClientMessages(SOCKET clientSocket)
+	{
+		// Edge triggered backends won't report this socket again until more data arrives,
+		// so keep reading until recv would block
+		int recvFlags = m_Reactor->IsEdgeTriggered() ? RECV_DONTWAIT : 0;
+
+		m_CurrentSocket = clientSocket;
+		m_CurrentClosed = false;
+
+		Connection& connection = m_Connections[clientSocket];
+		FrameReassembler& reassembler = connection.reassembler;
+
+		do
+		{
+			int result = recv(clientSocket, (char*)m_RecvChunk.data(), RECV_CHUNK_SIZE, recvFlags);
+
+			if (result == SOCKET_ERROR)
+			{
+				if (isWouldBlock(WSAGetLastError()))
+				{
+					return true;
+				}
+
+				printf("Client disconnected.\n"); // user left ungracefully
+				//printf("recv failed with error %d\n", WSAGetLastError());
+				return false;
+			}
+			else if (result == 0)
+			{
+				//printf("Client disconnected.\n");
+				return false;
+			}
+
+			m_Metrics.bytesIn.Add(result);
+
+			// One read can hold many frames and end part way into the next one
+			bool valid = reassembler.Feed(m_RecvChunk.data(), result, [&](const uint8_t* frame, uint32_t packetSize)
+			{
+				m_Events->OnFrame(clientSocket, frame, packetSize);
+				return !m_CurrentClosed;
+			});
+
+			if (!valid)
+			{
+				printf("Client sent a malformed frame, disconnecting.\n");
+				return false;
+			}
+
+			// Write out what this read fanned out before reading more, a sender with a backlog
+			// would otherwise grow every recipient's queue by all of it in one go
+			FlushSends();
+			DisconnectSlowConsumers();
+		} while (m_Reactor->IsEdgeTriggered() && !m_CurrentClosed && !connection.readPaused && !connection.relaying);
+
+		return true;
+	}
+
+	int Run(SOCKET listenSocket, ServerEvents& events) override
+	{
+		m_Events = &events;
+
+		// Accepting until it would block needs a non-blocking listener whatever the backend
+		setNonBlocking(listenSocket);
+		m_Reactor->Add(listenSocket, REACTOR_READ);
+
+		if (m_Wakeup.Handle() != INVALID_SOCKET)
+		{
+			m_Reactor->Add(m_Wakeup.Handle(), REACTOR_READ);
+		}
+
+		while (true)
+		{
+			// Only the sockets that are ready come back, registration happens once at accept.
+			// Nothing to do until then means no timeout at all, the next timer is the only reason to wake up.
+			uint64_t waitStart = metricsNow();
+			bool moreToDo = m_AcceptPending || !m_RelaysYielded.empty();
+			int count = m_Reactor->Wait(m_ReadyEvents, moreToDo ? 0 : m_Timers.TimeoutMs(-1));
+			uint64_t handleStart = metricsNow();
+			m_Metrics.waitNs.Record(handleStart - waitStart);
+
+			// Whatever came due while we waited. It also brings the wheel's clock up to date for the events below,
+			// what the timers send goes out with the rest of the tick.
+			m_Timers.Advance();
+			DisconnectSlowConsumers();
+
+			// Relays that had more to move when their last turn ended
+			m_RelaysToPump.insert(m_RelaysToPump.end(), m_RelaysYielded.begin(), m_RelaysYielded.end());
+			m_RelaysYielded.clear();
+
+			if (count == SOCKET_ERROR)
+			{
+				printf("%s wait failed with error %d\n", m_Reactor->Name(), WSAGetLastError());
+				continue;
+			}
+
+			for (const ReactorEvent& event : m_ReadyEvents)
+			{
+				// New connections are taken after this batch of events, so existing clients go first
+				if (event.socket == listenSocket)
+				{
+					m_AcceptPending = true;
+					continue;
+				}
+
+				// Another thread has work for us, drain first so a wake that races with OnWake isn't lost
+				if (event.socket == m_Wakeup.Handle())
+				{
+					m_Wakeup.Drain();
+					m_Events->OnWake();
+					DisconnectSlowConsumers();
+					continue;
+				}
+
+				// The socket may have been closed by an earlier event in this batch
+				auto it = m_Connections.find(event.socket);
+				if (it == m_Connections.end())
+				{
+					continue;
+				}
+
+				// A client that was behind has room again
+				if (event.events & REACTOR_WRITE)
+				{
+					FlushConnection(event.socket, it->second);
+				}
+
+				// A client sending a body is read by its relay. The body can't be finished once it hung up, and a
+				// level triggered backend would report the hangup on every wait meanwhile.
+				it = m_Connections.find(event.socket);
+				if (it != m_Connections.end() && it->second.relaying)
+				{
+					if ((event.events & REACTOR_HANGUP) && !m_Reactor->IsEdgeTriggered())
+					{
+						Disconnect(event.socket);
+					}
+					else if (event.events & (REACTOR_READ | REACTOR_HANGUP))
+					{
+						m_RelaysToPump.push_back(event.socket);
+					}
+				}
+				// A paused client is only read again once its pause is over. One that hung up is closed right away,
+				// a level triggered backend would otherwise report the hangup on every wait until then.
+				else if (it != m_Connections.end() && it->second.readPaused)
+				{
+					if (event.events & REACTOR_HANGUP)
+					{
+						Disconnect(event.socket);
+					}
+				}
+				// Handle incoming messages from clients
+				else if ((event.events & (REACTOR_READ | REACTOR_HANGUP)) && it != m_Connections.end())
+				{
+					if (!HandleClientMessages(event.socket) && !m_CurrentClosed)
+					{
+						Disconnect(event.socket);
+					}
+
+					if (m_CurrentClosed)
+					{
+						m_Connections.erase(event.socket);
+					}
+
+					m_CurrentSocket = INVALID_SOCKET;
+				}
+
+				PumpRelays();
+				DisconnectSlowConsumers();
+			}
+
+			if (m_AcceptPending)
+			{
+				AcceptNewClients(listenSocket);
+			}
+
+			// One write per client for everything this tick sent it
+			PumpRelays();
+			FlushSends();
+			PumpRelays();
+			DisconnectSlowConsumers();
+
+			m_Metrics.handleNs.Record(metricsNow() - handleStart);
+		}
+
+		return 0;
+	}
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "../Common/socket_platform.h"
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+// Which of a shard's connections are in which room.
+//
+// Each room keeps its members in a dense array, so a fan-out walks exactly the room's sockets back to back
+// instead of scanning every connection. Every connection remembers where it sits in each room it joined,
+// so leaving is a swap with the room's last member and a pop, never a search or a shift. A connection is in
+// at most MAX_ROOMS_PER_CONNECTION rooms, which keeps its own list short enough to scan.
+class RoomIndex
+{
+public:
+
+	static const size_t MAX_ROOMS_PER_CONNECTION = 64;
+
+	enum JoinResult
+	{
+		JOIN_OK,
+		JOIN_ALREADY_MEMBER,
+		JOIN_TOO_MANY_ROOMS,
+	};
+
+	struct Membership
+	{
+		uint32_t room;
+		uint32_t position;	// index into the room's members
+	};
+
+	std::unordered_map<uint32_t, std::vector<SOCKET>> m_Rooms;		// rooms without members are removed
+	std::unordered_map<SOCKET, std::vector<Membership>> m_Memberships;
+
+	JoinResult Join(uint32_t room, SOCKET socket)
+	{
+		std::vector<Membership>& memberships = m_Memberships[socket];
+		if (Find(memberships, room) != nullptr)
+			return JOIN_ALREADY_MEMBER;
+		if (memberships.size() >= MAX_ROOMS_PER_CONNECTION)
+			return JOIN_TOO_MANY_ROOMS;
+
+		std::vector<SOCKET>& members = m_Rooms[room];
+		memberships.push_back(Membership{ room, (uint32_t)members.size() });
+		members.push_back(socket);
+		return JOIN_OK;
+	}
+
+	// Returns false if the socket wasn't in the room
+	bool Leave(uint32_t room, SOCKET socket)
+	{
+		auto found = m_Memberships.find(socket);
+		if (found == m_Memberships.end())
+			return false;
+
+		std::vector<Membership>& memberships = found->second;
+		Membership* membership = Find(memberships, room);
+		if (membership == nullptr)
+			return false;
+
+		RemoveFromRoom(room, membership->position);
+
+		*membership = memberships.back();
+		memberships.pop_back();
+		if (memberships.empty())
+		{
+			m_Memberships.erase(found);
+		}
+		return true;
+	}
+
+	// For a disconnect, takes the socket out of every room it is in
+	void LeaveAll(SOCKET socket)
+	{
+		auto found = m_Memberships.find(socket);
+		if (found == m_Memberships.end())
+			return;
+
+		for (const Membership& membership : found->second)
+		{
+			RemoveFromRoom(membership.room, membership.position);
+		}
+		m_Memberships.erase(found);
+	}
+
+	bool IsMember(uint32_t room, SOCKET socket)
+	{
+		auto found = m_Memberships.find(socket);
+		return found != m_Memberships.end() && Find(found->second, room) != nullptr;
+	}
+
+	// nullptr for a room nobody on this shard is in. Don't Join or Leave while walking it.
+	std::vector<SOCKET>* Members(uint32_t room)
+	{
+		auto found = m_Rooms.find(room);
+		return found != m_Rooms.end() ? &found->second : nullptr;
+	}
+
+	size_t RoomCount() const
+	{
+		return m_Rooms.size();
+	}
+
+private:
+
+	static Membership* Find(std::vector<Membership>& memberships, uint32_t room)
+	{
+		for (Membership& membership : memberships)
+		{
+			if (membership.room == room)
+				return &membership;
+		}
+		return nullptr;
+	}
+
+	// Moves the room's last member into the hole and tells it where it went now
+	void RemoveFromRoom(uint32_t room, uint32_t position)
+	{
+		auto found = m_Rooms.find(room);
+		std::vector<SOCKET>& members = found->second;
+
+		SOCKET moved = members.back();
+		members[position] = moved;
+		members.pop_back();
+
+		if (members.empty())
+		{
+			m_Rooms.erase(found);
+			return;
+		}
+
+		if (position < members.size())
+		{
+			Find(m_Memberships[moved], room)->position = position;
+		}
+	}
+};
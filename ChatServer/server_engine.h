@@ -0,0 +1,84 @@
+#pragma once
+
+#include "../Common/socket_platform.h"
+#include "../Common/shared_frame.h"
+#include "../Common/outbound_queue.h"
+#include "../Common/frame_reassembler.h"
+#include "../Common/timer_wheel.h"
+#include "server_metrics.h"
+#include "splice_relay.h"
+#include <stdint.h>
+
+// What the chat logic sees of the network, independent of how the engine moves the bytes
+class ServerEvents
+{
+public:
+
+	virtual ~ServerEvents() {}
+
+	virtual void OnConnected(SOCKET socket) = 0;
+
+	// Called once per complete frame, the engine reassembles the stream so frame always starts at a
+	// header of the connection's wire version and holds exactly packetSize bytes. It is only valid for the duration of the call.
+	virtual void OnFrame(SOCKET socket, const uint8_t* frame, uint32_t packetSize) = 0;
+
+	virtual void OnDisconnected(SOCKET socket) = 0;
+
+	// Called on the engine's thread after another thread called Wake
+	virtual void OnWake() {}
+};
+
+// Owns the sockets and the event loop. The chat logic only ever calls Send and Disconnect, other threads only Wake.
+class ServerEngine
+{
+public:
+
+	virtual ~ServerEngine() {}
+
+	virtual const char* Name() const = 0;
+
+	// Written only by the engine's thread, safe to read from any other
+	virtual ShardMetrics& Metrics() = 0;
+
+	// How much may be queued for one client that isn't reading, and what happens when it is exceeded
+	virtual void SetOutboundLimits(const OutboundLimits& limits) = 0;
+
+	// Sends never block, whatever the socket can't take yet is queued per client.
+	// The engine copies what it needs, data only has to stay valid for the call
+	virtual void Send(SOCKET socket, const uint8_t* data, int length) = 0;
+
+	// Queues an already encoded frame without copying it, the engine holds a reference until it is written.
+	// Broadcasts use this so one encoded frame serves every recipient.
+	virtual void SendFrame(SOCKET socket, const FrameRef& frame) = 0;
+
+	// Runs on the engine's thread between events, the engine never waits past the next timer that is due.
+	// Timer callbacks may Send and Disconnect like OnFrame does.
+	virtual TimerWheel& Timers() = 0;
+
+	// Closes the socket, OnDisconnected is called before this returns
+	virtual void Disconnect(SOCKET socket) = 0;
+
+	// How the socket's incoming frames are laid out from the next one on, OnFrame can call it for the frame after it
+	virtual void SetWireVersion(SOCKET socket, WireVersion version) = 0;
+
+	// Stops reading from the socket for delayMs, so a client that sends too fast fills its own TCP window rather
+	// than our CPU. Called from OnFrame, that frame is handed to OnFrame again when reading resumes, followed by
+	// the rest of what had been read. Pausing a paused socket moves its resume time.
+	virtual void PauseReading(SOCKET socket, uint64_t delayMs) = 0;
+
+	// For a frame followed by bodySize bytes that aren't frames, e.g. a file. Called from OnFrame, the engine sends
+	// each target its header and then the body straight from the socket, see SpliceRelay, and hands out the
+	// socket's frames again after it. A target gets nothing else until it has the whole body, one that is already
+	// receiving a body is left out. Returns how many targets it will go to, the body is read and dropped if none.
+	virtual size_t RelayBody(SOCKET socket, uint64_t bodySize, const std::vector<RelayTarget>& targets) = 0;
+
+	// True while a body is being relayed from or to the socket, it neither sends nor is sent frames meanwhile
+	virtual bool IsRelaying(SOCKET socket) = 0;
+
+	// The only call that is safe from other threads, makes the engine call OnWake on its own thread soon.
+	// Several wakes before the engine gets to it may result in a single OnWake.
+	virtual void Wake() = 0;
+
+	// Runs the event loop on an already listening socket
+	virtual int Run(SOCKET listenSocket, ServerEvents& events) = 0;
+};
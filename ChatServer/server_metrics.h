@@ -0,0 +1,164 @@
+#pragma once
+
+#include "../Common/metrics.h"
+
+#include <stdio.h>
+#include <string>
+
+// What one shard records about itself. The engine and the chat logic on the shard's thread write it,
+// the admin endpoint reads it from its own thread. Times are in nanoseconds.
+struct ShardMetrics
+{
+	MetricHistogram waitNs;			// blocked in the readiness wait or io_uring_enter
+	MetricHistogram handleNs;		// handling what one wait returned
+	MetricHistogram parseNs;		// decoding one message
+	MetricHistogram fanoutNs;		// queueing one message for every recipient, local and on other shards
+
+	MetricCounter bytesIn;
+	MetricCounter bytesOut;
+	MetricCounter accepts;
+	MetricCounter disconnects;
+	MetricCounter droppedFrames;	// dropped for clients over the high watermark
+	MetricCounter slowConsumerDisconnects;
+	MetricCounter floodDelays;		// frames from clients over their rate limits, by what was done with them
+	MetricCounter floodDrops;
+	MetricCounter floodDisconnects;
+	MetricCounter relays;			// bodies relayed, e.g. files, and how many bytes of them were read
+	MetricCounter relayBytes;
+	MetricCounter relayAborts;		// whose sender went away part way through
+	MetricCounter relayBusyTargets;	// clients left out of a relay because they were receiving another one
+	MetricCounter streams;			// streams opened and how many chunk bytes came in on them
+	MetricCounter streamBytes;
+	MetricCounter streamAborts;		// that ended short, their sender stopped or went away
+	MetricCounter streamRefusals;	// not opened, e.g. the sender had too many already
+
+	MetricGauge queuedBytes;		// written to no socket yet, across all of the shard's connections
+};
+
+// Plain text, one "name{shard="N"} value" line per sample, the format Prometheus scrapes.
+// Histograms are reported as summaries with a few quantiles, a sum and a count.
+class MetricsWriter
+{
+public:
+
+	std::string& m_Out;
+
+	MetricsWriter(std::string& out)
+		: m_Out(out)
+	{
+	}
+
+	void Type(const char* name, const char* type)
+	{
+		char line[160];
+		snprintf(line, sizeof(line), "# TYPE %s %s\n", name, type);
+		m_Out += line;
+	}
+
+	void Sample(const char* name, const char* suffix, int shard, const char* quantile, int64_t value)
+	{
+		char line[200];
+		if (quantile != nullptr)
+		{
+			snprintf(line, sizeof(line), "%s%s{shard=\"%d\",quantile=\"%s\"} %lld\n", name, suffix, shard, quantile, (long long)value);
+		}
+		else
+		{
+			snprintf(line, sizeof(line), "%s%s{shard=\"%d\"} %lld\n", name, suffix, shard, (long long)value);
+		}
+		m_Out += line;
+	}
+
+	void Summary(const char* name, int shard, const MetricHistogram& histogram)
+	{
+		LatencyHistogram snapshot;
+		histogram.Snapshot(snapshot);
+
+		Sample(name, "", shard, "0.5", (int64_t)snapshot.Percentile(50));
+		Sample(name, "", shard, "0.9", (int64_t)snapshot.Percentile(90));
+		Sample(name, "", shard, "0.99", (int64_t)snapshot.Percentile(99));
+		Sample(name, "", shard, "0.999", (int64_t)snapshot.Percentile(99.9));
+		Sample(name, "", shard, "1", (int64_t)snapshot.Max());
+		Sample(name, "_sum", shard, nullptr, (int64_t)snapshot.m_Sum);
+		Sample(name, "_count", shard, nullptr, (int64_t)snapshot.Count());
+	}
+};
+
+// Appends every shard's metrics, grouped by metric so each # TYPE line appears once
+template <typename ShardMetricsAt>
+void writeShardMetrics(std::string& out, int shardCount, ShardMetricsAt metricsAt)
+{
+	MetricsWriter writer(out);
+
+	struct SummaryField
+	{
+		const char* name;
+		MetricHistogram ShardMetrics::* histogram;
+	};
+
+	const SummaryField summaries[] =
+	{
+		{ "chat_wait_ns", &ShardMetrics::waitNs },
+		{ "chat_handle_ns", &ShardMetrics::handleNs },
+		{ "chat_parse_ns", &ShardMetrics::parseNs },
+		{ "chat_fanout_ns", &ShardMetrics::fanoutNs },
+	};
+
+	for (const SummaryField& field : summaries)
+	{
+		writer.Type(field.name, "summary");
+		for (int shard = 0; shard < shardCount; shard++)
+		{
+			writer.Summary(field.name, shard, metricsAt(shard).*field.histogram);
+		}
+	}
+
+	struct CounterField
+	{
+		const char* name;
+		MetricCounter ShardMetrics::* counter;
+	};
+
+	const CounterField counters[] =
+	{
+		{ "chat_bytes_in_total", &ShardMetrics::bytesIn },
+		{ "chat_bytes_out_total", &ShardMetrics::bytesOut },
+		{ "chat_accepts_total", &ShardMetrics::accepts },
+		{ "chat_disconnects_total", &ShardMetrics::disconnects },
+		{ "chat_dropped_frames_total", &ShardMetrics::droppedFrames },
+		{ "chat_slow_consumer_disconnects_total", &ShardMetrics::slowConsumerDisconnects },
+		{ "chat_flood_delays_total", &ShardMetrics::floodDelays },
+		{ "chat_flood_drops_total", &ShardMetrics::floodDrops },
+		{ "chat_flood_disconnects_total", &ShardMetrics::floodDisconnects },
+		{ "chat_relays_total", &ShardMetrics::relays },
+		{ "chat_relay_bytes_total", &ShardMetrics::relayBytes },
+		{ "chat_relay_aborts_total", &ShardMetrics::relayAborts },
+		{ "chat_relay_busy_targets_total", &ShardMetrics::relayBusyTargets },
+		{ "chat_streams_total", &ShardMetrics::streams },
+		{ "chat_stream_bytes_total", &ShardMetrics::streamBytes },
+		{ "chat_stream_aborts_total", &ShardMetrics::streamAborts },
+		{ "chat_stream_refusals_total", &ShardMetrics::streamRefusals },
+	};
+
+	for (const CounterField& field : counters)
+	{
+		writer.Type(field.name, "counter");
+		for (int shard = 0; shard < shardCount; shard++)
+		{
+			writer.Sample(field.name, "", shard, nullptr, (int64_t)(metricsAt(shard).*field.counter).Value());
+		}
+	}
+
+	writer.Type("chat_connections", "gauge");
+	for (int shard = 0; shard < shardCount; shard++)
+	{
+		const ShardMetrics& metrics = metricsAt(shard);
+		writer.Sample("chat_connections", "", shard, nullptr, (int64_t)(metrics.accepts.Value() - metrics.disconnects.Value()));
+	}
+
+	writer.Type("chat_queued_bytes", "gauge");
+	for (int shard = 0; shard < shardCount; shard++)
+	{
+		writer.Sample("chat_queued_bytes", "", shard, nullptr, (int64_t)metricsAt(shard).queuedBytes.Value());
+	}
+}
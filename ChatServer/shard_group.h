@@ -0,0 +1,149 @@
+#pragma once
+
+#include "server_engine.h"
+#include "../Common/mpsc_inbox.h"
+#include "../Common/frame_reassembler.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// What a client negotiated with its hello, every broadcast is encoded at most once per kind
+enum WireEncoding
+{
+	ENCODING_V1,
+	ENCODING_V1_COMPRESSED,
+	ENCODING_V2,
+	ENCODING_V2_COMPRESSED,
+	ENCODING_COUNT,
+};
+
+inline WireEncoding wireEncodingOf(WireVersion version, bool compressed)
+{
+	if (version == WIRE_V2)
+		return compressed ? ENCODING_V2_COMPRESSED : ENCODING_V2;
+	return compressed ? ENCODING_V1_COMPRESSED : ENCODING_V1;
+}
+
+inline WireVersion wireVersionOf(WireEncoding encoding)
+{
+	return encoding == ENCODING_V2 || encoding == ENCODING_V2_COMPRESSED ? WIRE_V2 : WIRE_V1;
+}
+
+// The threads of a sharded server.
+//
+// Every shard is one thread with its own engine, its own SO_REUSEPORT listener and its own connections, nothing
+// about a connection is shared. A broadcast is fanned out locally by the shard that received it, and the encoded
+// frame is handed to every other shard through that shard's lock-free inbox. Each of them fans it out to its own
+// connections on its own thread, so the only cross thread traffic per message is one push and one wakeup per shard.
+class ShardGroup
+{
+public:
+
+	// Every encoding some client needs travels with the frame, each is made once by the receiving shard for every
+	// shard's clients. An empty one means nobody needed it or, for the compressed ones, that it didn't pay.
+	struct Broadcast
+	{
+		FrameRef encodings[ENCODING_COUNT];
+	};
+
+	struct Shard
+	{
+		ServerEngine* engine;
+		MpscInbox<Broadcast> inbox;
+	};
+
+	std::vector<std::unique_ptr<Shard>> m_Shards;
+	std::atomic<int> m_JoinedCount;
+	std::atomic<bool> m_Failed;
+	std::mutex m_StopMutex;		// held by other threads while they look at the engines, see Leave
+	bool m_Stopped;				// some shard's engine is gone
+	std::atomic<int> m_TotalConnections;	// across all shards, for the welcome message
+	std::atomic<int> m_EncodingCounts[ENCODING_COUNT];	// connections per encoding across all shards, nothing is encoded for a 0
+
+	ShardGroup(int count)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			m_Shards.emplace_back(new Shard());
+			m_Shards.back()->engine = nullptr;
+		}
+
+		m_JoinedCount = 0;
+		m_Failed = false;
+		m_Stopped = false;
+		m_TotalConnections = 0;
+		for (int i = 0; i < ENCODING_COUNT; i++)
+		{
+			m_EncodingCounts[i] = 0;
+		}
+	}
+
+	int Count() const
+	{
+		return (int)m_Shards.size();
+	}
+
+	// Called on each shard's thread once its engine is ready, or with nullptr if it couldn't start.
+	// Waits for every shard so nobody publishes to an engine that doesn't exist yet.
+	// Returns false if any shard failed, the thread should give up.
+	bool Join(int index, ServerEngine* engine)
+	{
+		m_Shards[index]->engine = engine;
+		if (engine == nullptr)
+		{
+			m_Failed = true;
+		}
+
+		m_JoinedCount++;
+		while (m_JoinedCount.load() < Count())
+		{
+			std::this_thread::yield();
+		}
+
+		return !m_Failed.load();
+	}
+
+	// Called on the shard's thread before its engine is destroyed, whether it ran or not. Waits for whoever is
+	// looking at the engines under m_StopMutex, they check m_Stopped first.
+	void Leave(int index)
+	{
+		std::lock_guard<std::mutex> lock(m_StopMutex);
+		m_Stopped = true;
+		m_Shards[index]->engine = nullptr;
+	}
+
+	bool IsEncodingUsed(WireEncoding encoding) const
+	{
+		return m_EncodingCounts[encoding].load(std::memory_order_relaxed) > 0;
+	}
+
+	// Hands the broadcast to every other shard, they send it to their own connections
+	void Publish(int fromShard, const Broadcast& broadcast)
+	{
+		for (int i = 0; i < Count(); i++)
+		{
+			if (i == fromShard)
+				continue;
+
+			m_Shards[i]->inbox.Push(broadcast);
+			m_Shards[i]->engine->Wake();
+		}
+	}
+
+	void Publish(int fromShard, const FrameRef& frame)
+	{
+		Broadcast broadcast;
+		broadcast.encodings[ENCODING_V1] = frame;
+		Publish(fromShard, broadcast);
+	}
+
+	// Called from the shard's OnWake, onBroadcast(Broadcast&) gets everything published to it, oldest first
+	template <typename OnBroadcast>
+	int Receive(int shard, OnBroadcast onBroadcast)
+	{
+		return m_Shards[shard]->inbox.Drain(onBroadcast);
+	}
+};
@@ -0,0 +1,533 @@
+#pragma once
+
+#include "../Common/socket_platform.h"
+#include "../Common/shared_frame.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+// Body bytes read from the source at most per round, what an empty pipe takes at its default size
+const size_t RELAY_CHUNK_SIZE = 64 * 1024;
+
+// Body bytes one Pump moves at most, so a fast transfer shares the loop with everyone else's traffic
+const uint64_t RELAY_BYTES_PER_PUMP = 1024 * 1024;
+
+// Where a relayed body passes through on its way to a socket.
+//
+// On Linux a kernel pipe, filled from the source socket with splice, copied to another pipe with tee and emptied
+// into a target socket with splice again, so the bytes move between socket buffers by page reference and never
+// come up into our memory. Elsewhere it is a plain buffer and they are copied like any other read.
+class RelayPipe
+{
+public:
+
+	RelayPipe()
+	{
+		m_Read = -1;
+		m_Write = -1;
+		m_Size = 0;
+		m_Open = false;
+	}
+
+	~RelayPipe()
+	{
+		Close();
+	}
+
+	RelayPipe(const RelayPipe&) = delete;
+	RelayPipe& operator=(const RelayPipe&) = delete;
+
+	RelayPipe(RelayPipe&& other) noexcept
+	{
+		m_Read = other.m_Read;
+		m_Write = other.m_Write;
+		m_Size = other.m_Size;
+		m_Open = other.m_Open;
+		m_Data = std::move(other.m_Data);
+		other.m_Read = -1;
+		other.m_Write = -1;
+		other.m_Size = 0;
+		other.m_Open = false;
+	}
+
+	RelayPipe& operator=(RelayPipe&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Close();
+			std::swap(m_Read, other.m_Read);
+			std::swap(m_Write, other.m_Write);
+			std::swap(m_Size, other.m_Size);
+			std::swap(m_Open, other.m_Open);
+			m_Data.swap(other.m_Data);
+		}
+		return *this;
+	}
+
+	bool Open()
+	{
+#ifdef __linux__
+		int fds[2];
+		if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0)
+			return false;
+
+		m_Read = fds[0];
+		m_Write = fds[1];
+#endif
+		m_Size = 0;
+		m_Open = true;
+		return true;
+	}
+
+	void Close()
+	{
+#ifdef __linux__
+		if (m_Read != -1)
+		{
+			close(m_Read);
+			close(m_Write);
+		}
+#endif
+		m_Read = -1;
+		m_Write = -1;
+		m_Size = 0;
+		m_Open = false;
+		m_Data.clear();
+	}
+
+	bool IsOpen() const
+	{
+		return m_Open;
+	}
+
+	// Bytes in it
+	size_t Size() const
+	{
+		return m_Size;
+	}
+
+	// Up to max bytes from a non-blocking socket. Returns how many, 0 if it has none right now and -1 once it
+	// has closed or failed.
+	int64_t FillFrom(SOCKET socket, size_t max)
+	{
+#ifdef __linux__
+		ssize_t moved = splice(socket, NULL, m_Write, NULL, max, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (moved < 0)
+			return isWouldBlock(errno) ? 0 : -1;
+#else
+		size_t used = m_Data.size();
+		m_Data.resize(used + max);
+		int moved = recv(socket, (char*)m_Data.data() + used, (int)max, 0);
+		m_Data.resize(used + (moved > 0 ? moved : 0));
+		if (moved < 0)
+			return isWouldBlock(WSAGetLastError()) ? 0 : -1;
+#endif
+		if (moved == 0)
+			return -1;
+
+		m_Size += moved;
+		return moved;
+	}
+
+	// Bytes that were already read, e.g. with the frame that announced them. Returns how many it took.
+	int64_t FillFrom(const uint8_t* data, size_t length)
+	{
+#ifdef __linux__
+		ssize_t written = write(m_Write, data, length);
+		if (written < 0)
+			return isWouldBlock(errno) ? 0 : -1;
+#else
+		m_Data.insert(m_Data.end(), data, data + length);
+		size_t written = length;
+#endif
+		m_Size += written;
+		return written;
+	}
+
+	// Everything in it, also into other, which must be empty. Returns false if other couldn't take all of it.
+	bool CopyTo(RelayPipe& other)
+	{
+#ifdef __linux__
+		ssize_t copied = tee(m_Read, other.m_Write, m_Size, SPLICE_F_NONBLOCK);
+		if (copied < 0)
+			return false;
+#else
+		other.m_Data = m_Data;
+		size_t copied = m_Size;
+#endif
+		other.m_Size += copied;
+		return (size_t)copied == m_Size;
+	}
+
+	// As much as a non-blocking socket takes. more says there is more to come after this, so TCP doesn't push
+	// out a short segment for what was left. Returns how many bytes it took, -1 if it failed.
+	int64_t DrainTo(SOCKET socket, bool more)
+	{
+#ifdef __linux__
+		ssize_t moved = splice(m_Read, NULL, socket, NULL, m_Size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK | (more ? SPLICE_F_MORE : 0));
+		if (moved < 0)
+			return isWouldBlock(errno) ? 0 : -1;
+#else
+		int moved = send(socket, (const char*)m_Data.data() + (m_Data.size() - m_Size), (int)m_Size, 0);
+		if (moved < 0)
+			return isWouldBlock(WSAGetLastError()) ? 0 : -1;
+#endif
+		m_Size -= moved;
+		if (m_Size == 0)
+			m_Data.clear();
+		return moved;
+	}
+
+	// Empties it without looking at what was in it
+	void Discard()
+	{
+#ifdef __linux__
+		static int devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+		while (m_Size > 0)
+		{
+			ssize_t moved = devNull != -1 ? splice(m_Read, NULL, devNull, NULL, m_Size, SPLICE_F_MOVE) : -1;
+			if (moved <= 0)
+			{
+				// Reading it into nowhere works anywhere
+				uint8_t scratch[4096];
+				moved = read(m_Read, scratch, m_Size < sizeof(scratch) ? m_Size : sizeof(scratch));
+				if (moved <= 0)
+					break;
+			}
+			m_Size -= moved;
+		}
+#endif
+		m_Size = 0;
+		m_Data.clear();
+	}
+
+private:
+
+	int m_Read;
+	int m_Write;
+	size_t m_Size;
+	bool m_Open;
+	std::vector<uint8_t> m_Data;	// the bytes themselves where there are no kernel pipes
+};
+
+// Who a relayed body goes to, and the frame announcing it in that target's own wire format
+struct RelayTarget
+{
+	SOCKET socket;
+	FrameRef header;
+};
+
+// One body on its way from a source socket to the targets, e.g. a file someone shared with a room.
+//
+// It moves in rounds of up to a chunk: read into the relay's pipe, copied to every target, and read again only once
+// every target's socket has taken its copy. So the transfer goes at the pace of the slowest target and nothing piles
+// up anywhere, the source is simply not read meanwhile and TCP holds it back. A target that takes its copy in one go
+// gives its pipe straight back, only the ones that fall behind hold one, and the last target of a round gets the
+// relay's own pipe rather than a copy.
+//
+// A target gets its header and then the body only once the engine says it is ready, i.e. has written whatever was
+// queued for it before. It is never written anything else until the body is through. Not thread safe, the engine
+// drives it from its own loop whenever the source is readable or a target writable.
+class SpliceRelay
+{
+public:
+
+	enum Result
+	{
+		RELAY_WAITING,	// for the source to be readable or a target to be writable
+		RELAY_YIELDED,	// moved its share for now, pump it again soon
+		RELAY_DONE,		// every target still there has the whole body
+		RELAY_FAILED,	// the source closed or failed part way through, or there were no pipes left
+	};
+
+	struct Target
+	{
+		SOCKET socket;
+		FrameRef header;
+		uint32_t headerWritten;
+		RelayPipe pipe;		// the part of the current chunk its socket hasn't taken yet, open only while it has any
+		bool ready;			// whatever was queued for it before the relay has been written
+		bool blocked;		// its socket took less than it was given, waiting for it to be writable
+		bool finished;		// has the whole body, or was dropped
+	};
+
+	SOCKET m_Source;
+	uint64_t m_Remaining;	// body bytes still to come from the source
+	uint64_t m_Moved;		// body bytes taken from the source so far
+	bool m_SourceBlocked;	// had nothing more to read, waiting for it to be readable
+	std::vector<Target> m_Targets;	// stay put, the engine refers to them by index
+
+	SpliceRelay(SOCKET source, uint64_t bodySize)
+	{
+		m_Source = source;
+		m_Remaining = bodySize;
+		m_Moved = 0;
+		m_SourceBlocked = false;
+		m_Behind = 0;
+		m_Unfinished = 0;
+	}
+
+	// Returns false if there was no pipe to be had
+	bool Open()
+	{
+		return m_Pipe.Open();
+	}
+
+	// Returns the target's index
+	size_t AddTarget(SOCKET socket, const FrameRef& header, bool ready)
+	{
+		m_Targets.emplace_back();
+		Target& target = m_Targets.back();
+		target.socket = socket;
+		target.header = header;
+		target.headerWritten = 0;
+		target.ready = ready;
+		target.blocked = false;
+		target.finished = false;
+		m_Unfinished++;
+		return m_Targets.size() - 1;
+	}
+
+	bool Done() const
+	{
+		return m_Remaining == 0 && m_Unfinished == 0;
+	}
+
+	// Reads from the source and passes it on for as long as every target keeps up, up to RELAY_BYTES_PER_PUMP.
+	// held is what was read from the source after the frame announcing the body, it goes first and what is used
+	// of it is erased. canReadSource is false while the source may still have reads of its own in flight.
+	// Targets that got all of the body are added to finished, ones whose socket failed to failed.
+	Result Pump(std::vector<uint8_t>& held, bool canReadSource, std::vector<SOCKET>& finished, std::vector<SOCKET>& failed)
+	{
+		uint64_t budget = RELAY_BYTES_PER_PUMP;
+		while (m_Behind == 0 && m_Remaining > 0)
+		{
+			if (budget == 0)
+				return RELAY_YIELDED;
+
+			size_t want = m_Remaining < RELAY_CHUNK_SIZE ? (size_t)m_Remaining : RELAY_CHUNK_SIZE;
+			int64_t got = 0;
+			if (!held.empty())
+			{
+				got = m_Pipe.FillFrom(held.data(), want < held.size() ? want : held.size());
+				if (got > 0)
+				{
+					held.erase(held.begin(), held.begin() + (size_t)got);
+				}
+			}
+			else if (canReadSource)
+			{
+				got = m_Pipe.FillFrom(m_Source, want);
+			}
+
+			if (got < 0)
+				return RELAY_FAILED;
+
+			m_SourceBlocked = got == 0;
+			if (got == 0)
+				return RELAY_WAITING;
+
+			m_Remaining -= got;
+			m_Moved += got;
+			budget -= (uint64_t)got < budget ? (uint64_t)got : budget;
+
+			if (!FanOut(finished, failed))
+				return RELAY_FAILED;
+
+			// The targets that took all of the last round while it was still being handed out
+			if (m_Remaining == 0)
+			{
+				for (Target& target : m_Targets)
+				{
+					FinishIfThrough(target, finished);
+				}
+			}
+		}
+
+		return Done() ? RELAY_DONE : RELAY_WAITING;
+	}
+
+	// Writes what the target is owed, when it became ready or its socket writable. The engine pumps the relay
+	// afterwards if that was the last target the round waited for.
+	void WriteTarget(size_t index, std::vector<SOCKET>& finished, std::vector<SOCKET>& failed)
+	{
+		Target& target = m_Targets[index];
+		if (target.finished || !target.ready)
+			return;
+
+		target.blocked = false;
+		while (target.headerWritten < target.header.Size())
+		{
+			int sent = send(target.socket, (const char*)target.header.Data() + target.headerWritten, (int)(target.header.Size() - target.headerWritten), 0);
+			if (sent < 0)
+			{
+				if (isWouldBlock(WSAGetLastError()))
+				{
+					target.blocked = true;
+				}
+				else
+				{
+					Fail(target, failed);
+				}
+				return;
+			}
+			target.headerWritten += sent;
+		}
+
+		if (target.pipe.IsOpen())
+		{
+			if (target.pipe.DrainTo(target.socket, m_Remaining > 0) < 0)
+			{
+				Fail(target, failed);
+				return;
+			}
+
+			if (target.pipe.Size() > 0)
+			{
+				target.blocked = true;
+				return;
+			}
+
+			m_SparePipes.push_back(std::move(target.pipe));
+			m_Behind--;
+		}
+
+		FinishIfThrough(target, finished);
+	}
+
+	// Whatever was queued for the target before has been written, it can have its header and body now
+	void SetReady(size_t index, std::vector<SOCKET>& finished, std::vector<SOCKET>& failed)
+	{
+		m_Targets[index].ready = true;
+		WriteTarget(index, finished, failed);
+	}
+
+	// The target went away, the others carry on without it
+	void Drop(size_t index)
+	{
+		Target& target = m_Targets[index];
+		if (target.finished)
+			return;
+
+		target.finished = true;
+		m_Unfinished--;
+		if (target.pipe.IsOpen())
+		{
+			target.pipe.Close();
+			m_Behind--;
+		}
+	}
+
+	// The source went away part way through. Targets that were written any of it have a broken stream and are
+	// added to failed, the others never saw a thing and are added to finished.
+	void Abort(std::vector<SOCKET>& finished, std::vector<SOCKET>& failed)
+	{
+		for (size_t i = 0; i < m_Targets.size(); i++)
+		{
+			Target& target = m_Targets[i];
+			if (target.finished)
+				continue;
+
+			if (target.headerWritten > 0)
+			{
+				failed.push_back(target.socket);
+			}
+			else
+			{
+				finished.push_back(target.socket);
+			}
+			Drop(i);
+		}
+	}
+
+private:
+
+	RelayPipe m_Pipe;		// the chunk being handed out
+	std::vector<RelayPipe> m_SparePipes;
+	size_t m_Behind;		// targets still holding part of the current chunk, the next one waits for them
+	size_t m_Unfinished;
+
+	bool TakeSparePipe(RelayPipe& pipe)
+	{
+		if (m_SparePipes.empty())
+		{
+			if (!pipe.Open())
+			{
+				printf("could not open a pipe for a relay, error %d\n", WSAGetLastError());
+				return false;
+			}
+			return true;
+		}
+
+		pipe = std::move(m_SparePipes.back());
+		m_SparePipes.pop_back();
+		return true;
+	}
+
+	// Gives every target a copy of the chunk and writes as much of it as each socket takes right away
+	bool FanOut(std::vector<SOCKET>& finished, std::vector<SOCKET>& failed)
+	{
+		size_t left = m_Unfinished;
+		for (size_t i = 0; i < m_Targets.size() && left > 0; i++)
+		{
+			Target& target = m_Targets[i];
+			if (target.finished)
+				continue;
+
+			if (--left == 0)
+			{
+				// The last one needs no copy
+				target.pipe = std::move(m_Pipe);
+				if (!TakeSparePipe(m_Pipe))
+					return false;
+			}
+			else
+			{
+				if (!TakeSparePipe(target.pipe))
+					return false;
+
+				if (!m_Pipe.CopyTo(target.pipe))
+				{
+					printf("could not copy a relayed chunk for client %d\n", (int)target.socket);
+					m_Behind++;
+					Fail(target, failed);
+					continue;
+				}
+			}
+
+			m_Behind++;
+			WriteTarget(i, finished, failed);
+		}
+
+		// Nobody was left to take it
+		if (m_Pipe.Size() > 0)
+		{
+			m_Pipe.Discard();
+		}
+		return true;
+	}
+
+	void FinishIfThrough(Target& target, std::vector<SOCKET>& finished)
+	{
+		if (target.finished || m_Remaining > 0 || m_Pipe.Size() > 0 || !target.ready
+			|| target.headerWritten < target.header.Size() || target.pipe.IsOpen())
+			return;
+
+		target.finished = true;
+		m_Unfinished--;
+		finished.push_back(target.socket);
+	}
+
+	void Fail(Target& target, std::vector<SOCKET>& failed)
+	{
+		Drop((size_t)(&target - m_Targets.data()));
+		failed.push_back(target.socket);
+	}
+};
@@ -0,0 +1,294 @@
+#pragma once
+
+#include "../Common/socket_platform.h"
+#include "../Common/buffer.h"
+#include "../Common/chat_messages.h"
+#include "../Common/shared_frame.h"
+#include "server_engine.h"
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+// Passes a shard's streams, see StreamOpenMessage, from their senders to their readers and credit the other way.
+//
+// Every reader has its own window, a chunk is only passed on once every reader has room for it, so the sender's
+// credit is the least any reader gave. A slow reader holds its streams back rather than having them pile up in
+// its queue, and between any two chunks in there is room for chat. Readers that go away stop counting.
+//
+// Everything the router sends is queued undroppable. A reader that missed a chunk would never credit it and the
+// stream would stall for all of its readers, and credit already bounds how much of it a reader can have queued.
+//
+// Chunks are never decoded, the frame is copied once into a pooled SharedFrame with the router's id patched in
+// and every v1 reader's queue references that, v2 readers share one more. Works on v1 frames like ChatServer.
+class StreamRouter
+{
+public:
+
+	// How many streams one client may have open at once
+	static const size_t MAX_STREAMS_PER_SENDER = 8;
+
+	struct Reader
+	{
+		SOCKET socket;
+		WireVersion version;
+		uint64_t allowed;	// how many of the stream's bytes it can take in all, set by Open
+	};
+
+	StreamRouter(ServerEngine& engine)
+		: m_Engine(engine)
+	{
+		m_NextId = 1;
+	}
+
+	size_t Count() const
+	{
+		return m_Streams.size();
+	}
+
+	// Opens the sender's stream to readers, or refuses it if the sender already has too many open or is reusing
+	// an id. Returns false if it was refused.
+	bool Open(SOCKET sender, WireVersion senderVersion, const StreamOpenMessage& open, std::vector<Reader> readers)
+	{
+		uint64_t key = KeyOf(sender, open.stream);
+		if (m_BySender.count(key) != 0 || OpenedBy(sender) >= MAX_STREAMS_PER_SENDER)
+		{
+			Refuse(sender, senderVersion, open.stream);
+			return false;
+		}
+
+		uint32_t id = NewId();
+		m_BySender[key] = id;
+		Stream& stream = m_Streams[id];
+		stream.sender = sender;
+		stream.senderVersion = senderVersion;
+		stream.senderStream = open.stream;
+		stream.size = open.size;
+		stream.received = 0;
+		stream.granted = STREAM_WINDOW;
+		stream.readers = std::move(readers);
+
+		StreamOpenMessage opened = open;
+		opened.stream = id;
+		for (Reader& reader : stream.readers)
+		{
+			reader.allowed = STREAM_WINDOW;
+			Send(reader.socket, reader.version, opened);
+		}
+
+		m_Engine.Metrics().streams.Add();
+
+		// Without readers nothing holds it back
+		Grant(stream);
+		return true;
+	}
+
+	// Tells the sender its stream won't be opened, under its own id
+	void Refuse(SOCKET sender, WireVersion senderVersion, uint32_t stream)
+	{
+		m_Engine.Metrics().streamRefusals.Add();
+		StreamCloseMessage refused;
+		refused.stream = stream;
+		refused.status = STREAM_REFUSED;
+		Send(sender, senderVersion, refused);
+	}
+
+	// One chunk from its sender. Chunks of a stream that was refused or aborted may still be on their way and are
+	// dropped. Returns false if the sender sent more than its credit or the stream's size, or a chunk too large.
+	bool Chunk(SOCKET sender, const uint8_t* frame, uint32_t packetSize, const StreamChunkMessage& chunk)
+	{
+		auto it = m_BySender.find(KeyOf(sender, chunk.stream));
+		if (it == m_BySender.end())
+			return true;
+
+		uint32_t id = it->second;
+		Stream& stream = m_Streams[id];
+		uint64_t length = chunk.data.length();
+		if (length > STREAM_CHUNK_SIZE || stream.received + length > stream.granted || stream.received + length > stream.size)
+			return false;
+
+		stream.received += length;
+		m_Engine.Metrics().streamBytes.Add(length);
+
+		// The one copy of the chunk, with our id for the sender's
+		FrameRef frames[2];
+		frames[0] = FrameRef(frame, packetSize);
+		if (!frames[0])
+			return true;
+		storeUInt32LE(frames[0].MutableData() + FRAME_HEADER_SIZE, id);
+		frames[0].MarkUndroppable();
+
+		for (const Reader& reader : stream.readers)
+		{
+			FrameRef& readerFrame = frames[reader.version == WIRE_V2];
+			if (!readerFrame)
+			{
+				m_Compact.Clear();
+				if (!convertFrame(WIRE_V1, WIRE_V2, frames[0].Data(), frames[0].Size(), m_Compact))
+					continue;
+				readerFrame = FrameRef(m_Compact.Data(), (uint32_t)m_Compact.Size());
+				if (!readerFrame)
+					continue;
+				readerFrame.MarkUndroppable();
+			}
+			m_Engine.SendFrame(reader.socket, readerFrame);
+		}
+		return true;
+	}
+
+	// From a reader, for the router's id. Anyone else's credit is ignored.
+	void Credit(SOCKET socket, const StreamCreditMessage& credit)
+	{
+		auto it = m_Streams.find(credit.stream);
+		if (it == m_Streams.end())
+			return;
+
+		Stream& stream = it->second;
+		for (Reader& reader : stream.readers)
+		{
+			if (reader.socket == socket)
+			{
+				reader.allowed += credit.bytes;
+				Grant(stream);
+				return;
+			}
+		}
+	}
+
+	// From the sender. Done is only passed on as done if all of it came.
+	void Close(SOCKET sender, const StreamCloseMessage& close)
+	{
+		auto it = m_BySender.find(KeyOf(sender, close.stream));
+		if (it == m_BySender.end())
+			return;
+
+		uint32_t id = it->second;
+		Stream& stream = m_Streams[id];
+		uint32_t status = close.status == STREAM_DONE && stream.received == stream.size ? STREAM_DONE : STREAM_ABORTED;
+		End(id, stream, status);
+		m_BySender.erase(it);
+		m_Streams.erase(id);
+	}
+
+	// The client is gone. What it was sending is aborted, what it was reading carries on without it.
+	void Forget(SOCKET socket)
+	{
+		for (auto it = m_Streams.begin(); it != m_Streams.end();)
+		{
+			Stream& stream = it->second;
+			if (stream.sender == socket)
+			{
+				End(it->first, stream, STREAM_ABORTED);
+				m_BySender.erase(KeyOf(stream.sender, stream.senderStream));
+				it = m_Streams.erase(it);
+				continue;
+			}
+
+			for (size_t i = 0; i < stream.readers.size(); i++)
+			{
+				if (stream.readers[i].socket == socket)
+				{
+					stream.readers[i] = stream.readers.back();
+					stream.readers.pop_back();
+					Grant(stream);
+					break;
+				}
+			}
+			++it;
+		}
+	}
+
+private:
+
+	struct Stream
+	{
+		SOCKET sender;
+		WireVersion senderVersion;
+		uint32_t senderStream;	// its id to the sender
+		uint64_t size;
+		uint64_t received;		// chunk bytes from the sender so far
+		uint64_t granted;		// how many the sender may send in all
+		std::vector<Reader> readers;
+	};
+
+	ServerEngine& m_Engine;
+	std::unordered_map<uint32_t, Stream> m_Streams;		// by our id
+	std::unordered_map<uint64_t, uint32_t> m_BySender;	// our id by sender and its id
+	uint32_t m_NextId;
+	Buffer m_Encoded;
+	Buffer m_Compact;	// a chunk in v2
+
+	static uint64_t KeyOf(SOCKET sender, uint32_t stream)
+	{
+		return ((uint64_t)(uint32_t)sender << 32) | stream;
+	}
+
+	// Skips ids still in use once they wrap
+	uint32_t NewId()
+	{
+		while (m_NextId == 0 || m_Streams.count(m_NextId) != 0)
+		{
+			m_NextId++;
+		}
+		return m_NextId++;
+	}
+
+	size_t OpenedBy(SOCKET sender) const
+	{
+		size_t count = 0;
+		for (const auto& entry : m_Streams)
+		{
+			count += entry.second.sender == sender;
+		}
+		return count;
+	}
+
+	// Sends the sender whatever credit every reader has room for that it wasn't given yet
+	void Grant(Stream& stream)
+	{
+		uint64_t least = stream.size;
+		for (const Reader& reader : stream.readers)
+		{
+			if (reader.allowed < least)
+				least = reader.allowed;
+		}
+
+		if (least <= stream.granted)
+			return;
+
+		StreamCreditMessage credit;
+		credit.stream = stream.senderStream;
+		credit.bytes = least - stream.granted;
+		stream.granted = least;
+		Send(stream.sender, stream.senderVersion, credit);
+	}
+
+	void End(uint32_t id, const Stream& stream, uint32_t status)
+	{
+		if (status != STREAM_DONE)
+		{
+			m_Engine.Metrics().streamAborts.Add();
+		}
+
+		StreamCloseMessage close;
+		close.stream = id;
+		close.status = status;
+		for (const Reader& reader : stream.readers)
+		{
+			Send(reader.socket, reader.version, close);
+		}
+	}
+
+	template <typename Message>
+	void Send(SOCKET socket, WireVersion version, const Message& message)
+	{
+		m_Encoded.Clear();
+		encodeMessage(message, m_Encoded, version);
+
+		FrameRef frame(m_Encoded.Data(), (uint32_t)m_Encoded.Size());
+		if (!frame)
+			return;
+		frame.MarkUndroppable();
+		m_Engine.SendFrame(socket, frame);
+	}
+};
@@ -0,0 +1,884 @@
+#pragma once
+
+#ifdef __linux__
+
+#include "server_engine.h"
+#include "../Common/io_uring.h"
+#include "../Common/frame_reassembler.h"
+#include "../Common/outbound_queue.h"
+#include "../Common/wakeup.h"
+
+#include <stdio.h>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <poll.h>
+#include <sys/uio.h>
+
+// Completion based engine on io_uring.
+//
+// Every connection has one multishot recv armed that keeps producing completions into a shared provided buffer
+// ring, so receiving costs no syscall of its own. Sends made while handling a batch of completions are queued
+// per connection and go to the kernel together in the next io_uring_enter, so one chat line fanned out to N
+// users is a single kernel transition instead of N.
+class UringEngine : public ServerEngine
+{
+public:
+
+	enum Operation : uint64_t
+	{
+		OP_ACCEPT = 1,
+		OP_RECV = 2,
+		OP_SEND = 3,
+		OP_WAKE = 4,
+		OP_CANCEL = 5,
+		OP_RELAY_READABLE = 6,	// one-shot polls for a relay, see ArmRelayPolls
+		OP_RELAY_WRITABLE = 7,
+	};
+
+	static const unsigned RING_ENTRIES = 4096;
+	static const unsigned COMPLETION_ENTRIES = 16384;
+	static const unsigned RECV_BUFFER_COUNT = 4096;		// must be a power of two
+	static const unsigned RECV_BUFFER_SIZE = 4096;
+	static const int MAX_IOVECS_PER_SEND = OutboundQueue::MAX_FRAMES_PER_WRITE;
+	static const int MAX_COMPLETIONS_PER_TICK = 256;
+
+	struct Connection
+	{
+		uint32_t generation;
+		bool closed;			// disconnected while its frames were being dispatched, freed once that ends
+		bool sendInFlight;
+		bool queuedForFlush;
+		bool recvArmed;			// a multishot recv is in the kernel, until its last completion
+		bool readPaused;		// see PauseReading, its recv is cancelled and not armed again until resume comes up
+		TimerWheel::Timer resume;
+		bool relaying;			// what it sends now is a body its relay reads, see RelayBody
+		SOCKET receivingFrom;	// whose relay is sending it a body, INVALID_SOCKET while none is
+		size_t relayTarget;		// which of that relay's targets it is
+		bool pollingIn;			// a relay poll is in the kernel for it
+		bool pollingOut;
+		OutboundQueue outbound;	// the frames of an in-flight sendmsg are pinned so drop-oldest can't free them
+		msghdr sendMessage;		// must stay put while the sendmsg is in flight
+		iovec sendIovecs[MAX_IOVECS_PER_SEND];
+		FrameReassembler reassembler;
+	};
+
+	IoUring m_Ring;
+	ProvidedBufferRing m_RecvBuffers;
+	std::unordered_map<SOCKET, Connection> m_Connections;	// nodes are stable, the msghdr pointers stay valid
+	std::vector<SOCKET> m_SocketsToFlush;
+	std::vector<SOCKET> m_SocketsToDisconnect;	// slow consumers found mid broadcast, closed after the completion
+
+	// Bodies on their way, by the socket they come from, as in ReactorEngine
+	std::unordered_map<SOCKET, std::unique_ptr<SpliceRelay>> m_Relays;
+	std::vector<SOCKET> m_RelaysToPump;
+	std::vector<SOCKET> m_RelaysYielded;
+	std::vector<SOCKET> m_RelayFinished;
+	std::vector<SOCKET> m_RelayFailed;
+	OutboundLimits m_Limits;
+	uint32_t m_NextGeneration;
+	SOCKET m_ListenSocket;
+	SOCKET m_DispatchSocket;	// connection whose frames are being handed to OnFrame
+	ServerEvents* m_Events;
+	Wakeup m_Wakeup;			// polled by the ring so other threads can interrupt the wait
+	ShardMetrics m_Metrics;
+	TimerWheel m_Timers;
+
+	UringEngine()
+	{
+		m_Limits = defaultOutboundLimits();
+		m_NextGeneration = 0;
+		m_ListenSocket = INVALID_SOCKET;
+		m_DispatchSocket = INVALID_SOCKET;
+		m_Events = nullptr;
+	}
+
+	// Returns 0 or a negative errno, the kernel may not support io_uring or may have it disabled.
+	// The ring is set up single issuer, so call this on the thread that will call Run.
+	int Init()
+	{
+		int result = m_Ring.Init(RING_ENTRIES, COMPLETION_ENTRIES);
+		if (result < 0)
+			return result;
+
+		if (!m_Wakeup.Init())
+			return -errno;
+
+		return m_RecvBuffers.Init(m_Ring, 0, RECV_BUFFER_COUNT, RECV_BUFFER_SIZE);
+	}
+
+	const char* Name() const override
+	{
+		return "io_uring";
+	}
+
+	ShardMetrics& Metrics() override
+	{
+		return m_Metrics;
+	}
+
+	TimerWheel& Timers() override
+	{
+		return m_Timers;
+	}
+
+	void SetOutboundLimits(const OutboundLimits& limits) override
+	{
+		m_Limits = limits;
+	}
+
+	// User data carries the operation, the socket and a generation so completions that arrive after
+	// a socket was closed (and its number reused by accept) are recognised and dropped
+	static uint64_t MakeUserData(Operation operation, uint32_t generation, SOCKET socket)
+	{
+		return (operation << 56) | ((uint64_t)(generation & 0xFFFFFF) << 32) | (uint32_t)socket;
+	}
+
+	io_uring_sqe* NextSqe()
+	{
+		io_uring_sqe* sqe = m_Ring.GetSqe();
+		if (sqe == nullptr)
+		{
+			// Submission queue is full, hand what we have to the kernel without waiting
+			m_Ring.SubmitAndWait(0, 0);
+			sqe = m_Ring.GetSqe();
+		}
+		return sqe;
+	}
+
+	void ArmAccept()
+	{
+		io_uring_sqe* sqe = NextSqe();
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = m_ListenSocket;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_CLOEXEC | SOCK_NONBLOCK;	// io_uring doesn't mind, splice in a relay needs it
+		sqe->user_data = MakeUserData(OP_ACCEPT, 0, m_ListenSocket);
+	}
+
+	void ArmWake()
+	{
+		io_uring_sqe* sqe = NextSqe();
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = m_Wakeup.Handle();
+		sqe->poll32_events = POLLIN;
+		sqe->len = IORING_POLL_ADD_MULTI;
+		sqe->user_data = MakeUserData(OP_WAKE, 0, m_Wakeup.Handle());
+	}
+
+	void ArmRecv(SOCKET socket, Connection& connection)
+	{
+		connection.recvArmed = true;
+
+		io_uring_sqe* sqe = NextSqe();
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = socket;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = m_RecvBuffers.m_GroupId;
+		sqe->user_data = MakeUserData(OP_RECV, connection.generation, socket);
+	}
+
+	// Completions of the cancelled recv that were already on their way are held by the reassembler too
+	void PauseReading(SOCKET socket, uint64_t delayMs) override
+	{
+		auto it = m_Connections.find(socket);
+		if (it == m_Connections.end() || it->second.closed)
+			return;
+
+		Connection& connection = it->second;
+		connection.reassembler.Hold();
+		m_Timers.Arm(connection.resume, delayMs);
+
+		if (connection.readPaused)
+			return;
+
+		connection.readPaused = true;
+		CancelRecv(socket, connection);
+	}
+
+	void CancelRecv(SOCKET socket, Connection& connection)
+	{
+		if (connection.recvArmed)
+		{
+			io_uring_sqe* sqe = NextSqe();
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = -1;
+			sqe->addr = MakeUserData(OP_RECV, connection.generation, socket);
+			sqe->user_data = MakeUserData(OP_CANCEL, connection.generation, socket);
+		}
+	}
+
+	// What was held goes to OnFrame first, which may pause the socket again
+	void ResumeReading(SOCKET socket)
+	{
+		auto it = m_Connections.find(socket);
+		if (it == m_Connections.end() || it->second.closed)
+			return;
+
+		Connection& connection = it->second;
+		connection.readPaused = false;
+
+		m_DispatchSocket = socket;
+		bool valid = connection.reassembler.Release([&](const uint8_t* frame, uint32_t packetSize)
+		{
+			m_Events->OnFrame(socket, frame, packetSize);
+			return !connection.closed;
+		});
+		m_DispatchSocket = INVALID_SOCKET;
+
+		if (connection.closed)
+		{
+			m_Connections.erase(it);
+			return;
+		}
+
+		if (!valid)
+		{
+			printf("Client sent a malformed frame, disconnecting.\n");
+			Disconnect(socket);
+			return;
+		}
+
+		// The cancelled recv may not have finished yet, its last completion arms the next one then
+		if (!connection.readPaused && !connection.relaying && !connection.recvArmed)
+		{
+			ArmRecv(socket, connection);
+		}
+	}
+
+	// The relay a target connection is receiving a body from, nullptr if none
+	SpliceRelay* RelayTo(const Connection& connection)
+	{
+		if (connection.receivingFrom == INVALID_SOCKET)
+			return nullptr;
+
+		auto it = m_Relays.find(connection.receivingFrom);
+		return it != m_Relays.end() ? it->second.get() : nullptr;
+	}
+
+	// The recv is cancelled like for a pause, the relay reads the socket itself once its last completion is in.
+	// A target is ready once its queue is empty, which also means no send is in flight.
+	size_t RelayBody(SOCKET socket, uint64_t bodySize, const std::vector<RelayTarget>& targets) override
+	{
+		auto it = m_Connections.find(socket);
+		if (it == m_Connections.end() || it->second.closed || it->second.relaying)
+			return 0;
+
+		std::unique_ptr<SpliceRelay> relay(new SpliceRelay(socket, bodySize));
+		if (!relay->Open())
+		{
+			printf("could not open a pipe to relay from client %d, error %d, disconnecting.\n", (int)socket, errno);
+			Disconnect(socket);
+			return 0;
+		}
+
+		for (const RelayTarget& target : targets)
+		{
+			auto targetIt = m_Connections.find(target.socket);
+			if (target.socket == socket || targetIt == m_Connections.end() || targetIt->second.closed)
+				continue;
+
+			Connection& connection = targetIt->second;
+			if (connection.receivingFrom != INVALID_SOCKET)
+			{
+				m_Metrics.relayBusyTargets.Add();
+				continue;
+			}
+
+			connection.receivingFrom = socket;
+			connection.relayTarget = relay->AddTarget(target.socket, target.header, connection.outbound.Empty());
+		}
+
+		Connection& connection = it->second;
+		size_t count = relay->m_Targets.size();
+		connection.relaying = true;
+		connection.reassembler.HoldAfter();
+		CancelRecv(socket, connection);
+		m_Relays[socket] = std::move(relay);
+		m_Metrics.relays.Add();
+
+		m_RelaysToPump.push_back(socket);
+		return count;
+	}
+
+	bool IsRelaying(SOCKET socket) override
+	{
+		auto it = m_Connections.find(socket);
+		return it != m_Connections.end() && (it->second.relaying || it->second.receivingFrom != INVALID_SOCKET);
+	}
+
+	// Nothing else reads a relay's source or writes its ready targets meanwhile, so a one-shot poll says when
+	// to carry on
+	void ArmRelayPolls(SOCKET socket, Connection& connection)
+	{
+		if (connection.relaying && !connection.recvArmed && !connection.pollingIn)
+		{
+			auto it = m_Relays.find(socket);
+			if (it != m_Relays.end() && it->second->m_SourceBlocked)
+			{
+				ArmPoll(socket, connection, OP_RELAY_READABLE, POLLIN);
+				connection.pollingIn = true;
+			}
+		}
+
+		SpliceRelay* relay = RelayTo(connection);
+		if (relay != nullptr && !connection.pollingOut && relay->m_Targets[connection.relayTarget].blocked)
+		{
+			ArmPoll(socket, connection, OP_RELAY_WRITABLE, POLLOUT);
+			connection.pollingOut = true;
+		}
+	}
+
+	void ArmPoll(SOCKET socket, Connection& connection, Operation operation, uint32_t events)
+	{
+		io_uring_sqe* sqe = NextSqe();
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = socket;
+		sqe->poll32_events = events;
+		sqe->user_data = MakeUserData(operation, connection.generation, socket);
+	}
+
+	void HandleRelayPoll(SOCKET socket, uint32_t generation, Operation operation)
+	{
+		auto it = m_Connections.find(socket);
+		if (it == m_Connections.end() || (it->second.generation & 0xFFFFFF) != generation)
+			return;
+
+		Connection& connection = it->second;
+		if (operation == OP_RELAY_READABLE)
+		{
+			connection.pollingIn = false;
+			if (connection.relaying)
+			{
+				m_RelaysToPump.push_back(socket);
+			}
+			return;
+		}
+
+		connection.pollingOut = false;
+		SpliceRelay* relay = RelayTo(connection);
+		if (relay != nullptr)
+		{
+			relay->WriteTarget(connection.relayTarget, m_RelayFinished, m_RelayFailed);
+			m_RelaysToPump.push_back(connection.receivingFrom);
+			SettleRelayTargets();
+			ArmRelayPolls(socket, connection);
+		}
+	}
+
+	void PumpRelay(SOCKET source)
+	{
+		auto relayIt = m_Relays.find(source);
+		auto it = m_Connections.find(source);
+		if (relayIt == m_Relays.end() || it == m_Connections.end())
+			return;
+
+		SpliceRelay& relay = *relayIt->second;
+		Connection& connection = it->second;
+
+		uint64_t movedBefore = relay.m_Moved;
+		SpliceRelay::Result result = relay.Pump(connection.reassembler.m_Partial, !connection.recvArmed, m_RelayFinished, m_RelayFailed);
+		m_Metrics.relayBytes.Add(relay.m_Moved - movedBefore);
+		SettleRelayTargets();
+
+		for (const SpliceRelay::Target& target : relay.m_Targets)
+		{
+			auto targetIt = m_Connections.find(target.socket);
+			if (!target.finished && targetIt != m_Connections.end() && !targetIt->second.closed)
+			{
+				ArmRelayPolls(target.socket, targetIt->second);
+			}
+		}
+
+		switch (result)
+		{
+		case SpliceRelay::RELAY_DONE:
+			m_Relays.erase(relayIt);
+			connection.relaying = false;
+			ResumeReading(source);
+			break;
+		case SpliceRelay::RELAY_FAILED:
+			printf("Client %d went away part way through a body it was sending, disconnecting.\n", (int)source);
+			Disconnect(source);
+			break;
+		case SpliceRelay::RELAY_YIELDED:
+			m_RelaysYielded.push_back(source);
+			break;
+		case SpliceRelay::RELAY_WAITING:
+			ArmRelayPolls(source, connection);
+			break;
+		}
+	}
+
+	void PumpRelays()
+	{
+		for (size_t i = 0; i < m_RelaysToPump.size(); i++)
+		{
+			PumpRelay(m_RelaysToPump[i]);
+		}
+
+		m_RelaysToPump.clear();
+	}
+
+	// Failed targets are closed after the completion, finished ones get their queue flushed with the rest
+	void SettleRelayTargets()
+	{
+		for (SOCKET socket : m_RelayFailed)
+		{
+			auto it = m_Connections.find(socket);
+			if (it != m_Connections.end())
+			{
+				it->second.receivingFrom = INVALID_SOCKET;
+				m_SocketsToDisconnect.push_back(socket);
+			}
+		}
+		m_RelayFailed.clear();
+
+		for (SOCKET socket : m_RelayFinished)
+		{
+			auto it = m_Connections.find(socket);
+			if (it == m_Connections.end())
+				continue;
+
+			Connection& connection = it->second;
+			connection.receivingFrom = INVALID_SOCKET;
+			if (!connection.closed && !connection.outbound.Empty() && !connection.queuedForFlush)
+			{
+				connection.queuedForFlush = true;
+				m_SocketsToFlush.push_back(socket);
+			}
+		}
+		m_RelayFinished.clear();
+	}
+
+	void AbortRelay(SOCKET source)
+	{
+		auto relayIt = m_Relays.find(source);
+		if (relayIt == m_Relays.end())
+			return;
+
+		std::unique_ptr<SpliceRelay> relay = std::move(relayIt->second);
+		m_Relays.erase(relayIt);
+		m_Metrics.relayAborts.Add();
+
+		relay->Abort(m_RelayFinished, m_RelayFailed);
+		SettleRelayTargets();
+	}
+
+	void LeaveRelay(Connection& connection)
+	{
+		SpliceRelay* relay = RelayTo(connection);
+		if (relay != nullptr)
+		{
+			relay->Drop(connection.relayTarget);
+			m_RelaysToPump.push_back(connection.receivingFrom);
+		}
+		connection.receivingFrom = INVALID_SOCKET;
+	}
+
+	void Send(SOCKET socket, const uint8_t* data, int length) override
+	{
+		FrameRef frame(data, length);
+		if (frame)
+		{
+			SendFrame(socket, frame);
+		}
+	}
+
+	void SendFrame(SOCKET socket, const FrameRef& frame) override
+	{
+		auto it = m_Connections.find(socket);
+		if (it == m_Connections.end())
+			return;
+
+		Connection& connection = it->second;
+		if (connection.closed)
+			return;
+
+		size_t queuedBefore = connection.outbound.m_QueuedBytes;
+		uint64_t droppedBefore = connection.outbound.m_DroppedFrames;
+
+		OutboundQueue::PushResult result = connection.outbound.Push(frame, m_Limits);
+
+		// Drop-oldest can shrink the queue while pushing, so count the difference rather than the frame
+		m_Metrics.queuedBytes.Add((int64_t)connection.outbound.m_QueuedBytes - (int64_t)queuedBefore);
+		m_Metrics.droppedFrames.Add(connection.outbound.m_DroppedFrames - droppedBefore);
+
+		if (result == OutboundQueue::PUSH_DISCONNECT)
+		{
+			m_Metrics.slowConsumerDisconnects.Add();
+			printf("Client %d fell %d bytes behind, disconnecting.\n", (int)socket, (int)connection.outbound.m_QueuedBytes);
+			m_SocketsToDisconnect.push_back(socket);
+			return;
+		}
+
+		if (result == OutboundQueue::PUSH_QUEUED && !connection.sendInFlight && !connection.queuedForFlush)
+		{
+			connection.queuedForFlush = true;
+			m_SocketsToFlush.push_back(socket);
+		}
+	}
+
+	void Wake() override
+	{
+		m_Wakeup.Signal();
+	}
+
+	void SetWireVersion(SOCKET socket, WireVersion version) override
+	{
+		auto it = m_Connections.find(socket);
+		if (it != m_Connections.end())
+			it->second.reassembler.m_Version = version;
+	}
+
+	void Disconnect(SOCKET socket) override
+	{
+		auto it = m_Connections.find(socket);
+		if (it == m_Connections.end() || it->second.closed)
+			return;
+
+		m_Metrics.disconnects.Add();
+		m_Metrics.queuedBytes.Add(-(int64_t)it->second.outbound.m_QueuedBytes);
+
+		// A body it was sending ends with it, one it was receiving carries on to the others
+		if (it->second.relaying)
+		{
+			AbortRelay(socket);
+		}
+		LeaveRelay(it->second);
+
+		// The connection being dispatched is still inside its reassembler, HandleRecv frees it afterwards
+		if (socket == m_DispatchSocket)
+		{
+			it->second.closed = true;
+		}
+		else
+		{
+			m_Connections.erase(it);
+		}
+
+		// shutdown completes the armed multishot recv, close alone would leave it holding the socket open
+		shutdown(socket, SHUT_RDWR);
+		closesocket(socket);
+		m_Events->OnDisconnected(socket);
+	}
+
+	void DisconnectSlowConsumers()
+	{
+		for (size_t i = 0; i < m_SocketsToDisconnect.size(); i++)
+		{
+			Disconnect(m_SocketsToDisconnect[i]);
+		}
+
+		m_SocketsToDisconnect.clear();
+	}
+
+	// Turns every connection that had sends queued this tick into one sendmsg SQE.
+	// They are all submitted by the single io_uring_enter at the top of the loop.
+	void FlushSends()
+	{
+		for (SOCKET socket : m_SocketsToFlush)
+		{
+			auto it = m_Connections.find(socket);
+			if (it == m_Connections.end())
+				continue;
+
+			Connection& connection = it->second;
+			connection.queuedForFlush = false;
+			if (connection.closed || connection.sendInFlight || connection.outbound.Empty())
+				continue;
+
+			// Once a body it is receiving has started, the socket is the relay's until the body is through
+			SpliceRelay* relay = RelayTo(connection);
+			if (relay != nullptr && relay->m_Targets[connection.relayTarget].ready)
+				continue;
+
+			// Gather as many queued frames as fit into one sendmsg
+			int iovecCount = connection.outbound.Gather<iovec>(connection.sendIovecs, MAX_IOVECS_PER_SEND, [](iovec& vector, const uint8_t* data, size_t length)
+			{
+				vector.iov_base = (void*)data;
+				vector.iov_len = length;
+			});
+			connection.outbound.m_InFlightFrames = iovecCount;
+
+			memset(&connection.sendMessage, 0, sizeof(connection.sendMessage));
+			connection.sendMessage.msg_iov = connection.sendIovecs;
+			connection.sendMessage.msg_iovlen = iovecCount;
+
+			io_uring_sqe* sqe = NextSqe();
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->fd = socket;
+			sqe->addr = (uint64_t)(uintptr_t)&connection.sendMessage;
+			sqe->len = 1;
+			sqe->msg_flags = MSG_NOSIGNAL;
+			sqe->user_data = MakeUserData(OP_SEND, connection.generation, socket);
+
+			connection.sendInFlight = true;
+		}
+
+		m_SocketsToFlush.clear();
+	}
+
+	void HandleAccept(int result, uint32_t flags)
+	{
+		if (result >= 0)
+		{
+			SOCKET socket = result;
+
+			Connection& connection = m_Connections[socket];
+			connection.generation = ++m_NextGeneration;
+			connection.closed = false;
+			connection.sendInFlight = false;
+			connection.queuedForFlush = false;
+			connection.readPaused = false;
+			connection.relaying = false;
+			connection.receivingFrom = INVALID_SOCKET;
+			connection.pollingIn = false;
+			connection.pollingOut = false;
+			connection.resume.m_Callback = [this, socket]() { ResumeReading(socket); };
+			connection.outbound = OutboundQueue();
+			connection.reassembler.m_Partial.clear();
+
+			ArmRecv(socket, connection);
+			m_Metrics.accepts.Add();
+			m_Events->OnConnected(socket);
+		}
+		else
+		{
+			printf("accept failed with error %d\n", -result);
+		}
+
+		if (!(flags & IORING_CQE_F_MORE))
+		{
+			ArmAccept();
+		}
+	}
+
+	void HandleRecv(SOCKET socket, uint32_t generation, int result, uint32_t flags)
+	{
+		bool hasBuffer = (flags & IORING_CQE_F_BUFFER) != 0;
+		uint16_t bufferId = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+
+		auto it = m_Connections.find(socket);
+		if (it == m_Connections.end() || (it->second.generation & 0xFFFFFF) != generation)
+		{
+			if (hasBuffer)
+				m_RecvBuffers.Recycle(bufferId);
+			return;
+		}
+
+		Connection& connection = it->second;
+		bool lastCompletion = !(flags & IORING_CQE_F_MORE);
+		if (lastCompletion)
+		{
+			connection.recvArmed = false;
+		}
+
+		if (result > 0)
+		{
+			m_Metrics.bytesIn.Add(result);
+
+			// A completion can hold many frames and end part way into the next one
+			m_DispatchSocket = socket;
+			bool valid = connection.reassembler.Feed(m_RecvBuffers.Data(bufferId), result, [&](const uint8_t* frame, uint32_t packetSize)
+			{
+				m_Events->OnFrame(socket, frame, packetSize);
+				return !connection.closed;
+			});
+			m_DispatchSocket = INVALID_SOCKET;
+
+			m_RecvBuffers.Recycle(bufferId);
+
+			if (connection.closed)
+			{
+				m_Connections.erase(socket);
+				return;
+			}
+
+			if (!valid)
+			{
+				printf("Client sent a malformed frame, disconnecting.\n");
+				Disconnect(socket);
+				return;
+			}
+
+			// Its relay takes what came after the body's frame from the reassembler
+			if (connection.relaying)
+			{
+				m_RelaysToPump.push_back(socket);
+			}
+			else if (lastCompletion && !connection.readPaused)
+			{
+				ArmRecv(socket, connection);
+			}
+			return;
+		}
+
+		if (hasBuffer)
+			m_RecvBuffers.Recycle(bufferId);
+
+		// Every provided buffer was in use, they have been recycled by now so just re-arm. Or the recv was
+		// cancelled by PauseReading, and has to be armed again if the pause is already over.
+		if (result == -ENOBUFS || result == -ECANCELED)
+		{
+			if (connection.relaying)
+			{
+				m_RelaysToPump.push_back(socket);
+			}
+			else if (!connection.readPaused)
+			{
+				ArmRecv(socket, connection);
+			}
+			return;
+		}
+
+		// The end of a body may still be in the held bytes, the relay sees the end of the stream itself
+		if (result == 0 && connection.relaying)
+		{
+			m_RelaysToPump.push_back(socket);
+			return;
+		}
+
+		if (result < 0)
+		{
+			printf("Client disconnected.\n"); // user left ungracefully
+		}
+
+		Disconnect(socket);
+	}
+
+	void HandleSend(SOCKET socket, uint32_t generation, int result)
+	{
+		auto it = m_Connections.find(socket);
+		if (it == m_Connections.end() || (it->second.generation & 0xFFFFFF) != generation)
+			return;
+
+		Connection& connection = it->second;
+		connection.sendInFlight = false;
+		connection.outbound.m_InFlightFrames = 0;
+
+		if (result < 0)
+		{
+			Disconnect(socket);
+			return;
+		}
+
+		// Retire the frames the kernel took, a short send leaves an offset into the front frame
+		connection.outbound.Consume((size_t)result, m_Limits);
+		m_Metrics.bytesOut.Add(result);
+		m_Metrics.queuedBytes.Add(-(int64_t)result);
+
+		// Everything queued before the body has gone, the header and the body are next
+		SpliceRelay* relay = RelayTo(connection);
+		if (relay != nullptr && connection.outbound.Empty())
+		{
+			relay->SetReady(connection.relayTarget, m_RelayFinished, m_RelayFailed);
+			m_RelaysToPump.push_back(connection.receivingFrom);
+			SettleRelayTargets();
+			ArmRelayPolls(socket, connection);
+			return;
+		}
+
+		if (!connection.outbound.Empty() && !connection.queuedForFlush)
+		{
+			connection.queuedForFlush = true;
+			m_SocketsToFlush.push_back(socket);
+		}
+	}
+
+	int Run(SOCKET listenSocket, ServerEvents& events) override
+	{
+		m_ListenSocket = listenSocket;
+		m_Events = &events;
+
+		ArmAccept();
+		ArmWake();
+
+		while (true)
+		{
+			PumpRelays();
+			FlushSends();
+
+			// Submits everything queued since the last pass and waits for at least one completion, or the next
+			// timer. Relays that had more to move carry on right away.
+			uint64_t waitStart = metricsNow();
+			bool moreToDo = !m_RelaysYielded.empty();
+			int result = m_Ring.SubmitAndWait(moreToDo ? 0 : 1, moreToDo ? 0 : m_Timers.TimeoutMs(-1));
+			uint64_t handleStart = metricsNow();
+			m_Metrics.waitNs.Record(handleStart - waitStart);
+
+			// Whatever came due while we waited, it also brings the wheel's clock up to date for the completions.
+			// What the timers send is submitted with the rest at the top of the loop.
+			m_Timers.Advance();
+			DisconnectSlowConsumers();
+
+			m_RelaysToPump.insert(m_RelaysToPump.end(), m_RelaysYielded.begin(), m_RelaysYielded.end());
+			m_RelaysYielded.clear();
+
+			if (result == -EBUSY || result == -EAGAIN)
+			{
+				// Completion queue is full or the kernel is short on memory, reap what is there and retry
+				result = 0;
+			}
+			else if (result < 0)
+			{
+				printf("io_uring_enter failed with error %d\n", -result);
+				return -result;
+			}
+
+			// A backlog of completions is handled in slices so queued sends reach the kernel between them,
+			// otherwise every client's queue would grow by the whole backlog before any of it is written
+			io_uring_cqe* cqe;
+			int handled = 0;
+			while (handled++ < MAX_COMPLETIONS_PER_TICK && (cqe = m_Ring.PeekCqe()) != nullptr)
+			{
+				uint64_t userData = cqe->user_data;
+				int cqeResult = cqe->res;
+				uint32_t cqeFlags = cqe->flags;
+				m_Ring.CqeSeen();
+
+				Operation operation = (Operation)(userData >> 56);
+				uint32_t generation = (uint32_t)(userData >> 32) & 0xFFFFFF;
+				SOCKET socket = (SOCKET)(uint32_t)userData;
+
+				switch (operation)
+				{
+				case OP_ACCEPT:
+					HandleAccept(cqeResult, cqeFlags);
+					break;
+				case OP_RECV:
+					HandleRecv(socket, generation, cqeResult, cqeFlags);
+					break;
+				case OP_SEND:
+					HandleSend(socket, generation, cqeResult);
+					break;
+				case OP_WAKE:
+					m_Wakeup.Drain();
+					m_Events->OnWake();
+					if (!(cqeFlags & IORING_CQE_F_MORE))
+					{
+						ArmWake();
+					}
+					break;
+				case OP_CANCEL:
+					// The cancelled recv's own completion is what counts
+					break;
+				case OP_RELAY_READABLE:
+				case OP_RELAY_WRITABLE:
+					HandleRelayPoll(socket, generation, operation);
+					break;
+				}
+
+				PumpRelays();
+				DisconnectSlowConsumers();
+			}
+
+			m_Metrics.handleNs.Record(metricsNow() - handleStart);
+		}
+
+		return 0;
+	}
+};
+
+#endif
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "buffer_pool.h"
+
+// The wire format is little endian. Loads and stores go through memcpy, which compilers turn into a single
+// unaligned mov, and big endian targets add one byte swap.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+
+inline uint16_t littleEndian16(uint16_t value) { return __builtin_bswap16(value); }
+inline uint32_t littleEndian32(uint32_t value) { return __builtin_bswap32(value); }
+inline uint64_t littleEndian64(uint64_t value) { return __builtin_bswap64(value); }
+
+#else
+
+inline uint16_t littleEndian16(uint16_t value) { return value; }
+inline uint32_t littleEndian32(uint32_t value) { return value; }
+inline uint64_t littleEndian64(uint64_t value) { return value; }
+
+#endif
+
+inline uint16_t loadUInt16LE(const uint8_t* data)
+{
+	uint16_t value;
+	memcpy(&value, data, sizeof(value));
+	return littleEndian16(value);
+}
+
+inline uint32_t loadUInt32LE(const uint8_t* data)
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return littleEndian32(value);
+}
+
+inline uint64_t loadUInt64LE(const uint8_t* data)
+{
+	uint64_t value;
+	memcpy(&value, data, sizeof(value));
+	return littleEndian64(value);
+}
+
+inline void storeUInt16LE(uint8_t* data, uint16_t value)
+{
+	value = littleEndian16(value);
+	memcpy(data, &value, sizeof(value));
+}
+
+inline void storeUInt32LE(uint8_t* data, uint32_t value)
+{
+	value = littleEndian32(value);
+	memcpy(data, &value, sizeof(value));
+}
+
+inline void storeUInt64LE(uint8_t* data, uint64_t value)
+{
+	value = littleEndian64(value);
+	memcpy(data, &value, sizeof(value));
+}
+
+// LEB128 varints for the compact wire format: 7 bits a byte, low bits first, the high bit set on all but the last.
+// A chat line's length fits in one byte, a whole frame's in three.
+const size_t MAX_VARINT_SIZE = 10;
+
+inline size_t varintSize(uint64_t value)
+{
+	size_t size = 1;
+	while (value >= 0x80)
+	{
+		value >>= 7;
+		size++;
+	}
+	return size;
+}
+
+inline uint8_t* storeVarint(uint8_t* out, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		*out++ = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	*out++ = (uint8_t)value;
+	return out;
+}
+
+// Returns false if the varint runs past end or is longer than a uint64 can be
+inline bool loadVarint(const uint8_t*& in, const uint8_t* end, uint64_t& value)
+{
+	value = 0;
+	for (int shift = 0; shift < 64 && in < end; shift += 7)
+	{
+		uint8_t byte = *in++;
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+// Bytes inside a Buffer, only valid until the buffer is written to or destroyed
+struct ByteSpan
+{
+	const uint8_t* data;
+	size_t size;
+};
+
+// Serializes messages for every project. Writes append at m_WriteIndex and grow the storage,
+// reads consume from m_ReadIndex and throw std::out_of_range instead of running past what was written.
+// The storage comes from the thread's BufferPool, so a Buffer per message costs no heap allocation once warm.
+class Buffer
+{
+public:
+
+	std::vector<uint8_t, PoolAllocator<uint8_t>> m_BufferData;
+	size_t m_WriteIndex;
+	size_t m_ReadIndex;
+
+	Buffer(size_t size = 512)
+	{
+		m_BufferData.resize(size);
+		m_WriteIndex = 0;
+		m_ReadIndex = 0;
+	}
+
+	// Wraps a received frame for reading, one bulk copy
+	Buffer(const uint8_t* data, size_t length)
+	{
+		m_BufferData.assign(data, data + length);
+		m_WriteIndex = length;
+		m_ReadIndex = 0;
+	}
+
+	~Buffer() {}
+
+	// The bytes written so far
+	const uint8_t* Data() const
+	{
+		return m_BufferData.data();
+	}
+
+	size_t Size() const
+	{
+		return m_WriteIndex;
+	}
+
+	size_t Remaining() const
+	{
+		return m_WriteIndex - m_ReadIndex;
+	}
+
+	// Starts over but keeps the allocation
+	void Clear()
+	{
+		m_WriteIndex = 0;
+		m_ReadIndex = 0;
+	}
+
+	void GrowIfNeeded(size_t requiredSize)
+	{
+		size_t needed = m_WriteIndex + requiredSize;
+		if (needed > m_BufferData.size())
+		{
+			// Doubling keeps appends amortized O(1), growing by only what was asked made big messages quadratic
+			size_t newSize = m_BufferData.size() * 2;
+			if (newSize < needed)
+				newSize = needed;
+
+			m_BufferData.resize(newSize);
+		}
+	}
+
+	// For filling the buffer from outside, e.g. recv straight into it, then CommitWrite what arrived
+	uint8_t* PrepareWrite(size_t length)
+	{
+		GrowIfNeeded(length);
+		return &m_BufferData[m_WriteIndex];
+	}
+
+	void CommitWrite(size_t length)
+	{
+		m_WriteIndex += length;
+	}
+
+	// Gives the storage back to the pool, e.g. a connection with nothing pending. The next write allocates again.
+	void Release()
+	{
+		std::vector<uint8_t, PoolAllocator<uint8_t>>().swap(m_BufferData);
+		m_WriteIndex = 0;
+		m_ReadIndex = 0;
+	}
+
+	// Drops everything written after the first size bytes, e.g. an encoding that turned out not to be worth it
+	void Truncate(size_t size)
+	{
+		if (size < m_WriteIndex)
+			m_WriteIndex = size;
+		if (m_ReadIndex > m_WriteIndex)
+			m_ReadIndex = m_WriteIndex;
+	}
+
+	// Moves what hasn't been read yet to the front, e.g. the start of a frame before receiving the rest of it
+	void Compact()
+	{
+		if (m_ReadIndex == 0)
+			return;
+
+		memmove(m_BufferData.data(), m_BufferData.data() + m_ReadIndex, m_WriteIndex - m_ReadIndex);
+		m_WriteIndex -= m_ReadIndex;
+		m_ReadIndex = 0;
+	}
+
+	void WriteBytes(const void* data, size_t length)
+	{
+		if (length == 0)
+			return;
+
+		memcpy(PrepareWrite(length), data, length);
+		m_WriteIndex += length;
+	}
+
+	void WriteUInt16LE(uint16_t value)
+	{
+		storeUInt16LE(PrepareWrite(2), value);
+		m_WriteIndex += 2;
+	}
+
+	void WriteUInt32LE(uint32_t value)
+	{
+		storeUInt32LE(PrepareWrite(4), value);
+		m_WriteIndex += 4;
+	}
+
+	void WriteUInt64LE(uint64_t value)
+	{
+		storeUInt64LE(PrepareWrite(8), value);
+		m_WriteIndex += 8;
+	}
+
+	void WriteString(std::string_view str)
+	{
+		WriteBytes(str.data(), str.length());
+	}
+
+	uint16_t ReadUInt16LE()
+	{
+		return loadUInt16LE(Consume(2));
+	}
+
+	uint32_t ReadUInt32LE()
+	{
+		return loadUInt32LE(Consume(4));
+	}
+
+	uint64_t ReadUInt64LE()
+	{
+		return loadUInt64LE(Consume(8));
+	}
+
+	std::string ReadString(size_t length)
+	{
+		return std::string((const char*)Consume(length), length);
+	}
+
+	// Same as ReadString without the allocation, the view points into the buffer
+	std::string_view ReadStringView(size_t length)
+	{
+		return std::string_view((const char*)Consume(length), length);
+	}
+
+	ByteSpan ReadBytes(size_t length)
+	{
+		return ByteSpan{ Consume(length), length };
+	}
+
+private:
+
+	// Returns where the next length bytes start and moves past them
+	const uint8_t* Consume(size_t length)
+	{
+		if (length > m_WriteIndex - m_ReadIndex)
+			throw std::out_of_range("Read past buffer end");
+
+		const uint8_t* data = m_BufferData.data() + m_ReadIndex;
+		m_ReadIndex += length;
+		return data;
+	}
+};
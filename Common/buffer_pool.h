@@ -0,0 +1,195 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Recycles message sized blocks so the per message Buffers and frames don't go to the heap.
+//
+// Requests are rounded up to one of three size classes and freed blocks go on a freelist owned by the
+// thread that freed them, so neither side ever takes a lock. Once a thread has seen its peak number of
+// messages in flight every allocation is a freelist pop. Each list keeps a bounded number of blocks,
+// anything past that (and anything bigger than the largest class) goes back to the heap.
+class BufferPool
+{
+public:
+
+	static const int SIZE_CLASS_COUNT = 3;
+
+	static size_t ClassSize(int sizeClass)
+	{
+		static const size_t sizes[SIZE_CLASS_COUNT] = { 512, 4 * 1024, 64 * 1024 };
+		return sizes[sizeClass];
+	}
+
+	// Blocks kept per thread, 2 MB per class at most. Enough to absorb the backlog of a burst of
+	// broadcasts, with fewer the blocks freed as the queues drain go back to the heap and the next burst misses.
+	static size_t MaxCachedBlocks(int sizeClass)
+	{
+		static const size_t counts[SIZE_CLASS_COUNT] = { 4096, 512, 32 };
+		return counts[sizeClass];
+	}
+
+	// -1 if the size is too big to pool
+	static int SizeClassFor(size_t size)
+	{
+		for (int i = 0; i < SIZE_CLASS_COUNT; i++)
+		{
+			if (size <= ClassSize(i))
+				return i;
+		}
+		return -1;
+	}
+
+	// Free must be given the same size
+	static void* Allocate(size_t size)
+	{
+		int sizeClass = SizeClassFor(size);
+		ThreadCache* cache = LocalCache();
+		if (sizeClass >= 0 && cache != nullptr && !cache->freeBlocks[sizeClass].empty())
+		{
+			void* block = cache->freeBlocks[sizeClass].back();
+			cache->freeBlocks[sizeClass].pop_back();
+			cache->reused++;
+			return block;
+		}
+
+		HeapAllocationCount().fetch_add(1, std::memory_order_relaxed);
+		return ::operator new(sizeClass >= 0 ? ClassSize(sizeClass) : size);
+	}
+
+	// Any thread can free a block, it goes on that thread's freelist
+	static void Free(void* block, size_t size)
+	{
+		if (block == nullptr)
+			return;
+
+		int sizeClass = SizeClassFor(size);
+		ThreadCache* cache = LocalCache();
+		if (sizeClass >= 0 && cache != nullptr && cache->freeBlocks[sizeClass].size() < MaxCachedBlocks(sizeClass))
+		{
+			cache->freeBlocks[sizeClass].push_back(block);
+			return;
+		}
+
+		::operator delete(block);
+	}
+
+	// Blocks that had to come from the heap, across all threads. Flat in steady state.
+	static uint64_t HeapAllocations()
+	{
+		return HeapAllocationCount().load(std::memory_order_relaxed);
+	}
+
+	// Allocations this thread served from its freelists
+	static uint64_t ThreadReuses()
+	{
+		ThreadCache* cache = LocalCache();
+		return cache != nullptr ? cache->reused : 0;
+	}
+
+private:
+
+	struct ThreadCache
+	{
+		std::vector<void*> freeBlocks[SIZE_CLASS_COUNT];
+		uint64_t reused;
+
+		ThreadCache()
+		{
+			// Reserved up front so returning a block never allocates
+			for (int i = 0; i < SIZE_CLASS_COUNT; i++)
+			{
+				freeBlocks[i].reserve(MaxCachedBlocks(i));
+			}
+			reused = 0;
+		}
+
+		~ThreadCache()
+		{
+			for (int i = 0; i < SIZE_CLASS_COUNT; i++)
+			{
+				for (void* block : freeBlocks[i])
+				{
+					::operator delete(block);
+				}
+			}
+
+			// Frames released later on during thread exit go straight back to the heap
+			CacheDestroyed() = true;
+		}
+	};
+
+	static ThreadCache* LocalCache()
+	{
+		if (CacheDestroyed())
+			return nullptr;
+
+		thread_local ThreadCache cache;
+		return &cache;
+	}
+
+	static bool& CacheDestroyed()
+	{
+		thread_local bool destroyed = false;
+		return destroyed;
+	}
+
+	static std::atomic<uint64_t>& HeapAllocationCount()
+	{
+		static std::atomic<uint64_t> count(0);
+		return count;
+	}
+};
+
+// Lets standard containers take their storage from the BufferPool.
+// Also leaves elements uninitialized on resize, so growing a byte buffer doesn't zero fill what is about to be written.
+template <typename T>
+class PoolAllocator
+{
+public:
+
+	typedef T value_type;
+
+	PoolAllocator() noexcept {}
+
+	template <typename U>
+	PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+	T* allocate(size_t count)
+	{
+		return (T*)BufferPool::Allocate(count * sizeof(T));
+	}
+
+	void deallocate(T* data, size_t count) noexcept
+	{
+		BufferPool::Free(data, count * sizeof(T));
+	}
+
+	template <typename U>
+	void construct(U* pointer)
+	{
+		::new ((void*)pointer) U;
+	}
+
+	template <typename U, typename... Args>
+	void construct(U* pointer, Args&&... args)
+	{
+		::new ((void*)pointer) U(std::forward<Args>(args)...);
+	}
+
+	template <typename U>
+	bool operator==(const PoolAllocator<U>&) const noexcept
+	{
+		return true;
+	}
+
+	template <typename U>
+	bool operator!=(const PoolAllocator<U>&) const noexcept
+	{
+		return false;
+	}
+};
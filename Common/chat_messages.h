@@ -0,0 +1,380 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <string_view>
+#include <tuple>
+
+#include "message_schema.h"
+
+// Every message the chat projects send, each declared once. The encoders and decoders come from MessageSchema.
+
+enum MessageType : uint32_t
+{
+	MESSAGE_TYPE_CHAT = 1,
+	MESSAGE_TYPE_CHAT_BATCH = 2,
+	MESSAGE_TYPE_JOIN_ROOM = 3,
+	MESSAGE_TYPE_LEAVE_ROOM = 4,
+	MESSAGE_TYPE_ROOM_CHAT = 5,
+	MESSAGE_TYPE_HELLO = 6,
+	MESSAGE_TYPE_PING = 7,
+	MESSAGE_TYPE_PONG = 8,
+	MESSAGE_TYPE_FILE = 9,
+	MESSAGE_TYPE_STREAM_OPEN = 10,
+	MESSAGE_TYPE_STREAM_CHUNK = 11,
+	MESSAGE_TYPE_STREAM_CLOSE = 12,
+	MESSAGE_TYPE_STREAM_CREDIT = 13,
+};
+
+// What a HelloMessage can ask for, a bit each
+enum HelloFeature : uint32_t
+{
+	HELLO_FEATURE_COMPRESSION = 1,		// frames of MESSAGE_FLAG_COMPRESSED, see frame_compression.h
+	HELLO_FEATURE_WIRE_V2 = 2,			// the compact frames of WIRE_V2, see frame_reassembler.h
+	HELLO_FEATURE_HEARTBEAT = 4,		// answers every PingMessage with a PongMessage
+	HELLO_FEATURE_FILES = 8,			// takes the raw body after a FileMessage, only those clients are sent files
+	HELLO_FEATURE_STREAMS = 16,			// sends and takes streams, see StreamOpenMessage
+};
+
+// A line of chat text, also used for the server's welcome and the join and leave notices
+struct ChatMessage
+{
+	static constexpr uint32_t TYPE = MESSAGE_TYPE_CHAT;
+
+	std::string_view message;
+
+	static constexpr auto Fields()
+	{
+		return std::make_tuple(&ChatMessage::message);
+	}
+};
+
+static_assert(MessageSchema<ChatMessage>::FIXED_SIZE == 12, "packetSize, messageType and messageLength");
+
+// Rooms are numbered by the clients, a room exists while anyone is in it.
+// Plain chat messages still go to everyone, room chat only to the room's other members.
+struct JoinRoomMessage
+{
+	static constexpr uint32_t TYPE = MESSAGE_TYPE_JOIN_ROOM;
+
+	uint32_t room;
+
+	static constexpr auto Fields()
+	{
+		return std::make_tuple(&JoinRoomMessage::room);
+	}
+};
+
+struct LeaveRoomMessage
+{
+	static constexpr uint32_t TYPE = MESSAGE_TYPE_LEAVE_ROOM;
+
+	uint32_t room;
+
+	static constexpr auto Fields()
+	{
+		return std::make_tuple(&LeaveRoomMessage::room);
+	}
+};
+
+// Sent by a member and passed on unchanged, so receivers see which room it was said in
+struct RoomChatMessage
+{
+	static constexpr uint32_t TYPE = MESSAGE_TYPE_ROOM_CHAT;
+
+	uint32_t room;
+	std::string_view message;
+
+	static constexpr auto Fields()
+	{
+		return std::make_tuple(&RoomChatMessage::room, &RoomChatMessage::message);
+	}
+};
+
+// Sent by a client right after connecting with the features it can handle, the server answers with the ones it
+// agreed to. Compression is only agreed to when dictionaryId matches the server's own, 0 being no dictionary.
+// A client that never says hello gets the plain protocol it always had.
+//
+// The hellos themselves are always v1. A client asking for HELLO_FEATURE_WIRE_V2 sends v2 from the frame after
+// its hello, the server sends v2 from the frame after its answer, everything before that is v1.
+struct HelloMessage
+{
+	static constexpr uint32_t TYPE = MESSAGE_TYPE_HELLO;
+
+	uint32_t features;
+	uint32_t dictionaryId;
+
+	static constexpr auto Fields()
+	{
+		return std::make_tuple(&HelloMessage::features, &HelloMessage::dictionaryId);
+	}
+};
+
+// Sent by the server to a client that agreed to heartbeats once it has been quiet for a while, the client answers
+// with a PongMessage carrying the same sequence. A client that answers nothing is taken for gone.
+struct PingMessage
+{
+	static constexpr uint32_t TYPE = MESSAGE_TYPE_PING;
+
+	uint32_t sequence;
+
+	static constexpr auto Fields()
+	{
+		return std::make_tuple(&PingMessage::sequence);
+	}
+};
+
+struct PongMessage
+{
+	static constexpr uint32_t TYPE = MESSAGE_TYPE_PONG;
+
+	uint32_t sequence;
+
+	static constexpr auto Fields()
+	{
+		return std::make_tuple(&PongMessage::sequence);
+	}
+};
+
+// A file shared with a room, or everyone for room 0. The frame is followed on the stream by exactly size bytes of
+// the file that aren't a frame, then the sender's frames carry on. The server passes the body from socket to
+// socket without looking at it, to the clients on its shard that agreed to HELLO_FEATURE_FILES. name is only what
+// the sender called it, receivers mustn't take it for a path.
+struct FileMessage
+{
+	static constexpr uint32_t TYPE = MESSAGE_TYPE_FILE;
+
+	uint32_t room;
+	uint64_t size;
+	std::string_view name;
+
+	static constexpr auto Fields()
+	{
+		return std::make_tuple(&FileMessage::room, &FileMessage::size, &FileMessage::name);
+	}
+};
+
+// Streams carry a file in chunk frames, so any number of them go over a connection at once with chat in between,
+// instead of one body holding up everything behind it. Only between clients that agreed to HELLO_FEATURE_STREAMS.
+//
+// The sender opens a stream under an id of its own, sends its chunks and closes it. Readers get it under an id
+// the server gives it, so ids only have to be unique per sender. Neither side may send more chunk bytes than it
+// has credit for: STREAM_WINDOW to start with, plus whatever StreamCreditMessages came for the stream since. A
+// reader gives credit back as it gets through what it was sent, the server gives the sender what every reader has.
+// A sender that goes over its credit is disconnected.
+const uint32_t STREAM_WINDOW = 256 * 1024;
+
+// The most data in one chunk, so a chunk frame fits a 64 KB pool buffer and chat waits behind no more than that
+const uint32_t STREAM_CHUNK_SIZE = 32 * 1024;
+
+// How a StreamCloseMessage says the stream ended
+enum StreamStatus : uint32_t
+{
+	STREAM_DONE = 0,		// all size bytes came
+	STREAM_ABORTED = 1,		// the sender stopped or went away first
+	STREAM_REFUSED = 2,		// the server wouldn't open it, only ever sent to its sender under the sender's id
+};
+
+// size is what the chunks add up to, name is only what the sender called it, see FileMessage. room 0 is everyone.
+struct StreamOpenMessage
+{
+	static constexpr uint32_t TYPE = MESSAGE_TYPE_STREAM_OPEN;
+
+	uint32_t stream;
+	uint32_t room;
+	uint64_t size;
+	std::string_view name;
+
+	static constexpr auto Fields()
+	{
+		return std::make_tuple(&StreamOpenMessage::stream, &StreamOpenMessage::room, &StreamOpenMessage::size, &StreamOpenMessage::name);
+	}
+};
+
+// The next bytes of a stream, at most STREAM_CHUNK_SIZE of them
+struct StreamChunkMessage
+{
+	static constexpr uint32_t TYPE = MESSAGE_TYPE_STREAM_CHUNK;
+
+	uint32_t stream;
+	std::string_view data;
+
+	static constexpr auto Fields()
+	{
+		return std::make_tuple(&StreamChunkMessage::stream, &StreamChunkMessage::data);
+	}
+};
+
+// The stream id sits right after the header in v1, where the server patches in its own
+static_assert(MessageSchema<StreamChunkMessage>::FIXED_SIZE == 16, "packetSize, messageType, stream and dataLength");
+
+struct StreamCloseMessage
+{
+	static constexpr uint32_t TYPE = MESSAGE_TYPE_STREAM_CLOSE;
+
+	uint32_t stream;
+	uint32_t status;
+
+	static constexpr auto Fields()
+	{
+		return std::make_tuple(&StreamCloseMessage::stream, &StreamCloseMessage::status);
+	}
+};
+
+// bytes more of the stream may be sent, on top of the credit so far
+struct StreamCreditMessage
+{
+	static constexpr uint32_t TYPE = MESSAGE_TYPE_STREAM_CREDIT;
+
+	uint32_t stream;
+	uint64_t bytes;
+
+	static constexpr auto Fields()
+	{
+		return std::make_tuple(&StreamCreditMessage::stream, &StreamCreditMessage::bytes);
+	}
+};
+
+// Several chat lines from one sender in one frame, so a burst costs one write and one header check.
+// frames is count ChatMessage frames back to back, byte for byte what each would be on its own,
+// so the server passes them on as they are and receivers only ever see plain chat frames.
+struct ChatBatchMessage
+{
+	static constexpr uint32_t TYPE = MESSAGE_TYPE_CHAT_BATCH;
+
+	uint32_t count;
+	std::string_view frames;
+
+	static constexpr auto Fields()
+	{
+		return std::make_tuple(&ChatBatchMessage::count, &ChatBatchMessage::frames);
+	}
+};
+
+static_assert(MessageSchema<ChatBatchMessage>::FIXED_SIZE == 16, "packetSize, messageType, count and framesLength");
+
+// Calls onMessage(const uint8_t* frame, uint32_t packetSize, const ChatMessage&) for every line in a batch.
+// Returns false as soon as one isn't a whole chat frame, or if there are more or fewer than count of them.
+// The lines are in the same wire version as the batch.
+template <typename OnMessage>
+bool forEachBatchedChat(const ChatBatchMessage& batch, OnMessage onMessage, WireVersion version = WIRE_V1)
+{
+	const uint8_t* frame = (const uint8_t*)batch.frames.data();
+	size_t remaining = batch.frames.length();
+
+	for (uint32_t i = 0; i < batch.count; i++)
+	{
+		uint32_t packetSize;
+		ChatMessage chatMessage;
+		if (peekFrameSize(version, frame, remaining, packetSize) != FRAME_SIZE_KNOWN || packetSize > remaining
+			|| !decodeMessage(frame, packetSize, chatMessage, version))
+			return false;
+
+		onMessage(frame, packetSize, chatMessage);
+		frame += packetSize;
+		remaining -= packetSize;
+	}
+
+	return remaining == 0;
+}
+
+// Appends message to out unless it comes out larger than MAX_FRAME_SIZE, which no reader takes. A v2 frame near
+// the limit is over it once it has v1's larger header and lengths.
+template <typename Message>
+bool encodeWithinFrameSize(const Message& message, Buffer& out, WireVersion version)
+{
+	size_t start = out.Size();
+	encodeMessage(message, out, version);
+	if (out.Size() - start > MAX_FRAME_SIZE)
+	{
+		out.Truncate(start);
+		return false;
+	}
+	return true;
+}
+
+// Re-encodes one frame in another wire version, appending it to out. Returns false for a frame that doesn't
+// decode, isn't a known message or would be too large, compressed frames have to be unpacked first.
+template <typename Message>
+bool convertMessage(WireVersion from, WireVersion to, const uint8_t* frame, uint32_t packetSize, Buffer& out)
+{
+	Message message;
+	if (!decodeMessage(frame, packetSize, message, from))
+		return false;
+
+	return encodeWithinFrameSize(message, out, to);
+}
+
+inline bool convertFrame(WireVersion from, WireVersion to, const uint8_t* frame, uint32_t packetSize, Buffer& out)
+{
+	if (from == to)
+	{
+		out.WriteBytes(frame, packetSize);
+		return true;
+	}
+
+	switch (peekMessageType(frame, from))
+	{
+	case MESSAGE_TYPE_CHAT:
+		return convertMessage<ChatMessage>(from, to, frame, packetSize, out);
+	case MESSAGE_TYPE_JOIN_ROOM:
+		return convertMessage<JoinRoomMessage>(from, to, frame, packetSize, out);
+	case MESSAGE_TYPE_LEAVE_ROOM:
+		return convertMessage<LeaveRoomMessage>(from, to, frame, packetSize, out);
+	case MESSAGE_TYPE_ROOM_CHAT:
+		return convertMessage<RoomChatMessage>(from, to, frame, packetSize, out);
+	case MESSAGE_TYPE_HELLO:
+		return convertMessage<HelloMessage>(from, to, frame, packetSize, out);
+	case MESSAGE_TYPE_PING:
+		return convertMessage<PingMessage>(from, to, frame, packetSize, out);
+	case MESSAGE_TYPE_PONG:
+		return convertMessage<PongMessage>(from, to, frame, packetSize, out);
+	case MESSAGE_TYPE_FILE:
+		return convertMessage<FileMessage>(from, to, frame, packetSize, out);
+	case MESSAGE_TYPE_STREAM_OPEN:
+		return convertMessage<StreamOpenMessage>(from, to, frame, packetSize, out);
+	case MESSAGE_TYPE_STREAM_CHUNK:
+		return convertMessage<StreamChunkMessage>(from, to, frame, packetSize, out);
+	case MESSAGE_TYPE_STREAM_CLOSE:
+		return convertMessage<StreamCloseMessage>(from, to, frame, packetSize, out);
+	case MESSAGE_TYPE_STREAM_CREDIT:
+		return convertMessage<StreamCreditMessage>(from, to, frame, packetSize, out);
+	case MESSAGE_TYPE_CHAT_BATCH:
+	{
+		// The lines inside change version with it
+		ChatBatchMessage batch;
+		if (!decodeMessage(frame, packetSize, batch, from))
+			return false;
+
+		// count is whatever the sender says, more lines than the frames have room for would only size lines wrong
+		size_t smallestLine = from == WIRE_V1 ? FRAME_HEADER_SIZE : COMPACT_MIN_FRAME_SIZE;
+		if (batch.count > batch.frames.length() / smallestLine)
+			return false;
+
+		Buffer lines(std::min<size_t>(batch.frames.length() + (size_t)batch.count * 8, MAX_FRAME_SIZE));
+		bool converted = true;
+		bool whole = forEachBatchedChat(batch, [&](const uint8_t* line, uint32_t lineSize, const ChatMessage&)
+		{
+			converted = converted && convertFrame(from, to, line, lineSize, lines);
+		}, from);
+		if (!whole || !converted)
+			return false;
+
+		batch.frames = std::string_view((const char*)lines.Data(), lines.Size());
+		return encodeWithinFrameSize(batch, out, to);
+	}
+	default:
+		return false;
+	}
+}
+
+// convertFrame for every one of the whole frames back to back in frames
+inline bool convertFrames(WireVersion from, WireVersion to, const uint8_t* frames, size_t length, Buffer& out)
+{
+	bool converted = true;
+	bool whole = forEachFrame(from, frames, length, [&](const uint8_t* frame, uint32_t packetSize)
+	{
+		converted = converted && convertFrame(from, to, frame, packetSize, out);
+	});
+	return whole && converted;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "socket_platform.h"
+#include "event_loop.h"
+#include "frame_stream.h"
+
+#include <stdio.h>
+#include <exception>
+#include <functional>
+
+// Accepts connections on an EventLoop and runs a handler coroutine for each one, so a handler reads like the
+// blocking loop in TCPServer, co_await ReadFrame, decode, co_await WriteFrame, yet one thread serves every
+// connection. While a handler waits for its next frame the connection costs its coroutine frames and one
+// registration with the reactor, its FrameStream gives its buffers back to the pool in the meantime.
+//
+// Use an edge triggered reactor for many connections, a wait on one is then free and a wakeup only costs the
+// sockets that are ready. On POSIX every connection is a descriptor, raise ulimit -n to serve more than ~1000.
+class CoroutineServer
+{
+public:
+
+	// Returns once it is done with the connection, which is closed then
+	typedef std::function<Task<>(FrameStream& connection)> Handler;
+
+	static const int ACCEPT_BUDGET = 128;
+
+	EventLoop& m_Loop;
+	SOCKET m_ListenSocket;
+	Handler m_Handler;
+	size_t m_ConnectionCount;	// handlers running right now
+
+	// The socket must be listening already, closing it stays with the caller
+	CoroutineServer(EventLoop& loop, SOCKET listenSocket, Handler handler)
+		: m_Loop(loop), m_Handler(std::move(handler))
+	{
+		m_ListenSocket = listenSocket;
+		m_ConnectionCount = 0;
+	}
+
+	CoroutineServer(const CoroutineServer&) = delete;
+	CoroutineServer& operator=(const CoroutineServer&) = delete;
+
+	// Spawn it on the loop, it accepts for as long as the loop runs. A storm of connections is taken
+	// ACCEPT_BUDGET at a time, yielding in between so the connections already there keep being served.
+	Task<> Serve()
+	{
+		setNonBlocking(m_ListenSocket);
+
+		int accepted = 0;
+		while (true)
+		{
+			SOCKET socket = acceptNonBlocking(m_ListenSocket);
+			if (socket != INVALID_SOCKET)
+			{
+				m_ConnectionCount++;
+				m_Loop.Spawn(Handle(socket));
+				if (++accepted == ACCEPT_BUDGET)
+				{
+					accepted = 0;
+					co_await m_Loop.Yield();
+				}
+				continue;
+			}
+
+			// Out of descriptors leaves the connection in the backlog until the next one arrives
+			int error = WSAGetLastError();
+			if (!isWouldBlock(error))
+			{
+				printf("accept failed with error %d\n", error);
+			}
+
+			accepted = 0;
+			co_await m_Loop.Readable(m_ListenSocket);
+		}
+	}
+
+private:
+
+	// The connection lives in this frame for as long as the handler runs. A handler that throws only loses
+	// its own connection.
+	Task<> Handle(SOCKET socket)
+	{
+		FrameStream connection(m_Loop, socket);
+		try
+		{
+			co_await m_Handler(connection);
+		}
+		catch (const std::exception& e)
+		{
+			printf("a connection's handler failed: %s\n", e.what());
+		}
+		m_ConnectionCount--;
+	}
+};
@@ -0,0 +1,465 @@
+#pragma once
+
+#include "socket_platform.h"
+#include "reactor.h"
+
+#include <stdio.h>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <conio.h>
+#endif
+
+// Coroutines on one thread, woken by a Reactor. Needs C++20, only the projects that use it build with /std:c++20.
+//
+// A Task is a coroutine that doesn't start until it is awaited or spawned. Awaiting one runs it to the end and
+// gives back what it co_returns, spawning one hands it to the loop, which runs it alongside the others until it
+// finishes. Anything that would block is a co_await on the loop instead: Readable and Writable for sockets,
+// ConsoleReadable for the keyboard. The loop resumes whoever waited once the reactor says it is ready, so every
+// session in the process shares one thread and one wait.
+
+class EventLoop;
+
+// What every Task's promise has, whatever it returns
+class TaskPromiseBase
+{
+public:
+
+	std::coroutine_handle<> m_Continuation;	// the coroutine awaiting this one, none for a spawned one
+	EventLoop* m_Loop;						// the loop a spawned one belongs to, it frees the frame when it is done
+	std::exception_ptr m_Exception;
+
+	TaskPromiseBase()
+	{
+		m_Loop = nullptr;
+	}
+
+	// Started by whoever awaits or spawns it, not by calling it
+	std::suspend_always initial_suspend() noexcept
+	{
+		return {};
+	}
+
+	struct FinalAwaiter
+	{
+		bool await_ready() noexcept
+		{
+			return false;
+		}
+
+		template <typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept;
+
+		void await_resume() noexcept {}
+	};
+
+	FinalAwaiter final_suspend() noexcept
+	{
+		return {};
+	}
+
+	// Given to whoever awaits it, a spawned one's goes out of EventLoop::Run
+	void unhandled_exception()
+	{
+		m_Exception = std::current_exception();
+	}
+};
+
+template <typename T>
+class TaskResult
+{
+public:
+
+	std::optional<T> m_Value;
+
+	void return_value(T value)
+	{
+		m_Value = std::move(value);
+	}
+
+	T Take()
+	{
+		return std::move(*m_Value);
+	}
+};
+
+template <>
+class TaskResult<void>
+{
+public:
+
+	void return_void() {}
+
+	void Take() {}
+};
+
+template <typename T = void>
+class Task
+{
+public:
+
+	class promise_type : public TaskPromiseBase, public TaskResult<T>
+	{
+	public:
+
+		Task get_return_object()
+		{
+			return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+	};
+
+	std::coroutine_handle<promise_type> m_Handle;
+
+	explicit Task(std::coroutine_handle<promise_type> handle)
+	{
+		m_Handle = handle;
+	}
+
+	Task(Task&& other) noexcept
+	{
+		m_Handle = std::exchange(other.m_Handle, nullptr);
+	}
+
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	// A task that never finished, e.g. a session still waiting when its loop goes away, is freed with its awaiter
+	~Task()
+	{
+		if (m_Handle)
+			m_Handle.destroy();
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	// Runs it straight away on this thread, we carry on where it finishes
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		m_Handle.promise().m_Continuation = awaiting;
+		return m_Handle;
+	}
+
+	T await_resume()
+	{
+		if (m_Handle.promise().m_Exception)
+			std::rethrow_exception(m_Handle.promise().m_Exception);
+		return m_Handle.promise().Take();
+	}
+
+	// For the loop, which owns a spawned task's frame from then on
+	std::coroutine_handle<promise_type> Release()
+	{
+		return std::exchange(m_Handle, nullptr);
+	}
+};
+
+// Owns the coroutines spawned on it and the reactor they wait on
+class EventLoop
+{
+public:
+
+	// How often the keyboard is looked at while someone waits for it, only on Windows where select can't wait on it
+	static const int CONSOLE_POLL_MS = 10;
+
+	struct Waiters
+	{
+		std::coroutine_handle<> reader;
+		std::coroutine_handle<> writer;
+		bool added = false;		// registered with the reactor, it stays so until Forget
+		uint32_t interest = 0;	// what the reactor is watching it for
+	};
+
+	std::unique_ptr<Reactor> m_Reactor;
+	std::unordered_map<SOCKET, Waiters> m_Waiters;
+	std::unordered_set<void*> m_Spawned;				// the frames of every spawned task not yet finished
+	std::vector<std::coroutine_handle<>> m_Finished;	// spawned tasks that finished during this wakeup
+	std::exception_ptr m_Failure;						// the first exception one of them threw
+	std::vector<ReactorEvent> m_ReadyEvents;
+	std::vector<std::coroutine_handle<>> m_Yielded;		// resumed after the next wait, which doesn't block for them
+	std::vector<std::coroutine_handle<>> m_Resuming;
+	std::coroutine_handle<> m_ConsoleWaiter;
+	bool m_Stopped;
+
+	// The select reactor unless told otherwise, a client has a handful of sockets and stdin may be a pipe or a
+	// file, which epoll refuses
+	EventLoop(std::unique_ptr<Reactor> reactor = createReactor("select"))
+		: m_Reactor(std::move(reactor))
+	{
+		m_Stopped = false;
+	}
+
+	EventLoop(const EventLoop&) = delete;
+	EventLoop& operator=(const EventLoop&) = delete;
+
+	// Whatever is still waiting is freed without running any further
+	~EventLoop()
+	{
+		for (void* frame : m_Spawned)
+		{
+			std::coroutine_handle<>::from_address(frame).destroy();
+		}
+	}
+
+	// Runs the task until it first waits, the loop carries it on from there
+	template <typename T>
+	void Spawn(Task<T> task)
+	{
+		std::coroutine_handle<typename Task<T>::promise_type> handle = task.Release();
+		handle.promise().m_Loop = this;
+		m_Spawned.insert(handle.address());
+		handle.resume();
+	}
+
+	// Makes Run return once it is done with the current wakeup
+	void Stop()
+	{
+		m_Stopped = true;
+	}
+
+	// Until every spawned task has finished or Stop was called. Returns false if the reactor failed.
+	// A spawned task that threw has its exception rethrown here.
+	bool Run()
+	{
+		while (!m_Stopped)
+		{
+			Reap();
+			if (m_Spawned.empty())
+				break;
+
+			int timeoutMs = -1;
+#ifdef _WIN32
+			if (m_ConsoleWaiter)
+				timeoutMs = CONSOLE_POLL_MS;
+#endif
+			if (!m_Yielded.empty())
+				timeoutMs = 0;
+
+			int count = m_Reactor->Wait(m_ReadyEvents, timeoutMs);
+			if (count == SOCKET_ERROR)
+			{
+				printf("the event loop's wait failed with error %d\n", WSAGetLastError());
+				return false;
+			}
+
+			for (int i = 0; i < count; i++)
+			{
+				Dispatch(m_ReadyEvents[i]);
+			}
+
+			// Only the ones that yielded before this wait, one that yields again waits for the next
+			m_Resuming.swap(m_Yielded);
+			for (std::coroutine_handle<> handle : m_Resuming)
+			{
+				handle.resume();
+			}
+			m_Resuming.clear();
+
+#ifdef _WIN32
+			if (m_ConsoleWaiter && _kbhit())
+				std::exchange(m_ConsoleWaiter, nullptr).resume();
+#endif
+		}
+
+		Reap();
+		return true;
+	}
+
+	struct SocketAwaiter
+	{
+		EventLoop& loop;
+		SOCKET socket;
+		uint32_t events;
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		bool await_suspend(std::coroutine_handle<> waiting)
+		{
+			return loop.Wait(socket, events, waiting);
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+	// Lets everything that is ready run first, e.g. after a batch of work that mustn't starve the rest.
+	// Resumes after the next wait, which doesn't block.
+	auto Yield()
+	{
+		struct YieldAwaiter
+		{
+			EventLoop& loop;
+
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+
+			void await_suspend(std::coroutine_handle<> waiting)
+			{
+				loop.m_Yielded.push_back(waiting);
+			}
+
+			void await_resume() const noexcept {}
+		};
+		return YieldAwaiter{ *this };
+	}
+
+	// Resumes once the socket has something to read, or the peer closed it. Only one reader per socket at a time.
+	SocketAwaiter Readable(SOCKET socket)
+	{
+		return SocketAwaiter{ *this, socket, REACTOR_READ };
+	}
+
+	// Resumes once the socket can take more. Only one writer per socket at a time.
+	SocketAwaiter Writable(SOCKET socket)
+	{
+		return SocketAwaiter{ *this, socket, REACTOR_WRITE };
+	}
+
+	// Resumes once a key can be read without blocking, stdin on POSIX and the console on Windows
+	auto ConsoleReadable()
+	{
+#ifdef _WIN32
+		struct ConsoleAwaiter
+		{
+			EventLoop& loop;
+
+			bool await_ready() const
+			{
+				return _kbhit() != 0;
+			}
+
+			void await_suspend(std::coroutine_handle<> waiting)
+			{
+				loop.m_ConsoleWaiter = waiting;
+			}
+
+			void await_resume() const noexcept {}
+		};
+		return ConsoleAwaiter{ *this };
+#else
+		return Readable(STDIN_FILENO);
+#endif
+	}
+
+	// Before closing a socket. Nobody may be waiting on it.
+	void Forget(SOCKET socket)
+	{
+		auto it = m_Waiters.find(socket);
+		if (it == m_Waiters.end())
+			return;
+
+		if (it->second.added)
+			m_Reactor->Remove(socket);
+		m_Waiters.erase(it);
+	}
+
+	// Called by a spawned task's final suspend
+	void OnFinished(std::coroutine_handle<> handle, std::exception_ptr exception)
+	{
+		m_Finished.push_back(handle);
+		if (exception && !m_Failure)
+			m_Failure = exception;
+	}
+
+private:
+
+	// Returns false, resuming the caller at once, if the reactor won't take the socket
+	bool Wait(SOCKET socket, uint32_t events, std::coroutine_handle<> waiting)
+	{
+		Waiters& waiters = m_Waiters[socket];
+		if (events == REACTOR_READ)
+			waiters.reader = waiting;
+		else
+			waiters.writer = waiting;
+
+		return UpdateInterest(socket, waiters);
+	}
+
+	// Nobody waiting means no interest, poll would keep reporting a ready socket nobody reads otherwise.
+	// An edge triggered reactor watches for both from the first wait on, so waiting costs no syscall: an edge
+	// nobody waits for is dropped, which is fine as everyone tries the socket before they wait on it.
+	bool UpdateInterest(SOCKET socket, Waiters& waiters)
+	{
+		uint32_t wanted = (waiters.reader ? (uint32_t)REACTOR_READ : 0) | (waiters.writer ? (uint32_t)REACTOR_WRITE : 0);
+		if (m_Reactor->IsEdgeTriggered())
+			wanted = REACTOR_READ | REACTOR_WRITE;
+
+		if (waiters.added && wanted == waiters.interest)
+			return true;
+
+		bool updated = waiters.added ? m_Reactor->Modify(socket, wanted) : m_Reactor->Add(socket, wanted);
+		if (!updated)
+		{
+			printf("the reactor wouldn't watch socket %d\n", (int)socket);
+			waiters.reader = nullptr;
+			waiters.writer = nullptr;
+			return false;
+		}
+
+		waiters.added = true;
+		waiters.interest = wanted;
+		return true;
+	}
+
+	// A hangup wakes both, their next read or write finds out what happened
+	void Dispatch(const ReactorEvent& event)
+	{
+		auto it = m_Waiters.find(event.socket);
+		if (it == m_Waiters.end())
+			return;
+
+		Waiters& waiters = it->second;
+		std::coroutine_handle<> reader;
+		std::coroutine_handle<> writer;
+		if (event.events & (REACTOR_READ | REACTOR_HANGUP))
+			reader = std::exchange(waiters.reader, nullptr);
+		if (event.events & (REACTOR_WRITE | REACTOR_HANGUP))
+			writer = std::exchange(waiters.writer, nullptr);
+
+		UpdateInterest(event.socket, waiters);
+
+		// Either may close the socket and Forget it, the other is still safe to resume from the local copy
+		if (reader)
+			reader.resume();
+		if (writer)
+			writer.resume();
+	}
+
+	void Reap()
+	{
+		for (std::coroutine_handle<> handle : m_Finished)
+		{
+			m_Spawned.erase(handle.address());
+			handle.destroy();
+		}
+		m_Finished.clear();
+
+		if (m_Failure)
+			std::rethrow_exception(std::exchange(m_Failure, nullptr));
+	}
+};
+
+template <typename Promise>
+std::coroutine_handle<> TaskPromiseBase::FinalAwaiter::await_suspend(std::coroutine_handle<Promise> finished) noexcept
+{
+	TaskPromiseBase& promise = finished.promise();
+	if (promise.m_Continuation)
+		return promise.m_Continuation;
+
+	if (promise.m_Loop != nullptr)
+		promise.m_Loop->OnFinished(finished, promise.m_Exception);
+	return std::noop_coroutine();
+}
@@ -0,0 +1,360 @@
+#pragma once
+
+#include "lz_codec.h"
+#include "buffer.h"
+#include "frame_reassembler.h"
+#include "message_schema.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Compressed frames, for peers that agreed to them with a HelloMessage.
+//
+// A compressed frame has the high bit of messageType set and wraps one or more ordinary frames of the same
+// wire version:
+//   v1: [packetSize][messageType of the first inner frame | MESSAGE_FLAG_COMPRESSED][originalSize][dictionaryId][LZ stream]
+//   v2: [varint bodySize][type byte of the first inner frame | COMPACT_FLAG_COMPRESSED][varint originalSize][dictionaryId][LZ stream]
+// Unpacking gives back the inner frames byte for byte, so everything after the reassembler works as before.
+// Only frames of COMPRESSION_MIN_BYTES or more are worth trying, a short chat line has too little to match
+// against and the header would eat what it saved.
+
+const uint32_t MESSAGE_FLAG_COMPRESSED = 0x80000000;
+const uint8_t COMPACT_FLAG_COMPRESSED = 0x80;
+const uint32_t COMPRESSED_HEADER_SIZE = 16;
+const size_t COMPRESSION_MIN_BYTES = 256;
+
+inline bool isCompressedFrame(const uint8_t* frame, WireVersion version = WIRE_V1)
+{
+	if (version == WIRE_V2)
+		return (*compactFrameType(frame) & COMPACT_FLAG_COMPRESSED) != 0;
+	return (peekMessageType(frame) & MESSAGE_FLAG_COMPRESSED) != 0;
+}
+
+// How much a compressed frame unpacks to, from its header, and where its dictionaryId starts.
+// Returns false if the header is cut short. Cheap enough to size a frame up before deciding to unpack it.
+inline bool peekCompressedHeader(const uint8_t* frame, uint32_t packetSize, WireVersion version, uint64_t& originalSize, const uint8_t*& dictionaryId)
+{
+	if (version == WIRE_V1)
+	{
+		if (packetSize < COMPRESSED_HEADER_SIZE)
+			return false;
+		originalSize = loadUInt32LE(frame + 8);
+		dictionaryId = frame + 12;
+		return true;
+	}
+
+	const uint8_t* in = compactFrameType(frame) + 1;
+	if (!loadVarint(in, frame + packetSize, originalSize))
+		return false;
+	dictionaryId = in;
+	return true;
+}
+
+// What chat traffic looks like, both ends have it built in so even one line has something to match against.
+// The most common strings are near the end, where the last copy of each is the one that gets found.
+const char BUILT_IN_CHAT_DICTIONARY[] =
+	"https://www. http://github.com/ .com/ .org/ .png .jpg :) :( :D ;) lol haha thanks thank you please sorry okay "
+	"yeah yes no maybe probably actually really pretty much anyone anything everyone everything something nothing "
+	"because about after again against already also always another around before being between both could would "
+	"should doesn't don't didn't isn't wasn't can't won't I'm I've I'll you're you've we're they're it's that's "
+	"there's what's let's here there where when which while with without within from into over under than then "
+	"them they this that these those have has had having just like know think want need make made take going "
+	"good great nice cool sure right well still even only very much more most some other time today tomorrow "
+	"yesterday tonight morning night week weekend anyone around? does anyone know how to is there a way to "
+	"what do you think about has anyone tried I don't think so I think it's I'm not sure if you can just "
+	"Welcome! There are currently  user(s) in the chat.\nType '/exit' to leave the chat. "
+	" has left the chat 00:00:00 - 01:02:03 - 12:34:56 - 23:59:59 - "
+	" has joined the chat ]: the and to of a in is it you I for on that ";
+
+class CompressionDictionary
+{
+public:
+
+	std::string m_Text;
+	uint32_t m_Id;		// what the HelloMessage and every compressed frame carry, 0 for no dictionary
+	std::unique_ptr<LzDictionary> m_Lz;
+
+	CompressionDictionary()
+	{
+		m_Id = 0;
+	}
+
+	CompressionDictionary(const CompressionDictionary&) = delete;
+	CompressionDictionary& operator=(const CompressionDictionary&) = delete;
+
+	void Set(const std::string& text)
+	{
+		m_Text = text.size() > LzDictionary::MAX_SIZE ? text.substr(text.size() - LzDictionary::MAX_SIZE) : text;
+		m_Id = IdOf(m_Text);
+		m_Lz.reset(m_Text.empty() ? nullptr : new LzDictionary((const uint8_t*)m_Text.data(), m_Text.size()));
+	}
+
+	void SetBuiltIn()
+	{
+		Set(std::string(BUILT_IN_CHAT_DICTIONARY, sizeof(BUILT_IN_CHAT_DICTIONARY) - 1));
+	}
+
+	// A dictionary file is the raw text, e.g. one Save wrote after Train. Both ends need the same file.
+	bool Load(const std::string& path)
+	{
+		FILE* file = fopen(path.c_str(), "rb");
+		if (file == nullptr)
+		{
+			printf("could not open the dictionary %s\n", path.c_str());
+			return false;
+		}
+
+		std::string text;
+		char chunk[4096];
+		size_t read;
+		while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		{
+			text.append(chunk, read);
+		}
+		fclose(file);
+
+		Set(text);
+		return true;
+	}
+
+	bool Save(const std::string& path) const
+	{
+		FILE* file = fopen(path.c_str(), "wb");
+		if (file == nullptr)
+		{
+			printf("could not create the dictionary %s\n", path.c_str());
+			return false;
+		}
+
+		bool written = fwrite(m_Text.data(), 1, m_Text.size(), file) == m_Text.size();
+		if (fclose(file) != 0 || !written)
+		{
+			printf("could not write the dictionary %s\n", path.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	const LzDictionary* Lz() const
+	{
+		return m_Lz.get();
+	}
+
+	// FNV-1a of the text, never 0 for a dictionary that has any
+	static uint32_t IdOf(const std::string& text)
+	{
+		if (text.empty())
+			return 0;
+
+		uint32_t hash = 2166136261u;
+		for (unsigned char c : text)
+		{
+			hash = (hash ^ c) * 16777619u;
+		}
+		return hash != 0 ? hash : 1;
+	}
+
+	// Builds a dictionary of up to maxSize bytes out of sample messages, e.g. a server's history.
+	//
+	// Every 8 byte string is counted across the samples, then the samples are cut into 64 byte pieces and the
+	// piece covering the most frequent strings not yet covered is taken, again and again until it is full.
+	// Taking a piece zeroes the counts of what it covers, so the next one adds something new. The best pieces
+	// end up last.
+	static std::string Train(const std::vector<std::string>& samples, size_t maxSize)
+	{
+		const size_t K = 8;
+		const size_t PIECE = 64;
+
+		std::unordered_map<uint64_t, uint32_t> counts;
+		for (const std::string& sample : samples)
+		{
+			for (size_t i = 0; i + K <= sample.size(); i++)
+			{
+				counts[loadUInt64LE((const uint8_t*)sample.data() + i)]++;
+			}
+		}
+
+		struct Piece
+		{
+			uint64_t score;
+			const std::string* sample;
+			size_t offset;
+			size_t length;
+
+			bool operator<(const Piece& other) const
+			{
+				return score < other.score;
+			}
+		};
+
+		auto scoreOf = [&](const Piece& piece)
+		{
+			uint64_t score = 0;
+			for (size_t i = 0; i + K <= piece.length; i++)
+			{
+				auto found = counts.find(loadUInt64LE((const uint8_t*)piece.sample->data() + piece.offset + i));
+				// A string seen once is no help to any other message
+				if (found != counts.end() && found->second > 1)
+					score += found->second;
+			}
+			return score;
+		};
+
+		std::priority_queue<Piece> pieces;
+		for (const std::string& sample : samples)
+		{
+			for (size_t offset = 0; offset < sample.size(); offset += PIECE)
+			{
+				Piece piece{ 0, &sample, offset, std::min(PIECE, sample.size() - offset) };
+				piece.score = scoreOf(piece);
+				if (piece.score > 0)
+					pieces.push(piece);
+			}
+		}
+
+		// Scores only ever go down, so a piece whose fresh score still beats the next best one is the best
+		std::vector<Piece> chosen;
+		size_t size = 0;
+		while (!pieces.empty() && size < maxSize)
+		{
+			Piece piece = pieces.top();
+			pieces.pop();
+
+			piece.score = scoreOf(piece);
+			if (piece.score == 0)
+				continue;
+			if (!pieces.empty() && piece.score < pieces.top().score)
+			{
+				pieces.push(piece);
+				continue;
+			}
+
+			piece.length = std::min(piece.length, maxSize - size);
+			for (size_t i = 0; i + K <= piece.length; i++)
+			{
+				counts.erase(loadUInt64LE((const uint8_t*)piece.sample->data() + piece.offset + i));
+			}
+			chosen.push_back(piece);
+			size += piece.length;
+		}
+
+		std::string text;
+		for (size_t i = chosen.size(); i > 0; i--)
+		{
+			text.append(*chosen[i - 1].sample, chosen[i - 1].offset, chosen[i - 1].length);
+		}
+		return text;
+	}
+};
+
+// Packs frames into compressed frames and back, one per connection or shard, it keeps its buffer between calls.
+// Both ends must use the same dictionary, or none.
+class FrameCompressor
+{
+public:
+
+	const CompressionDictionary* m_Dictionary;	// nullptr for none
+	Buffer m_Unpacked;
+
+	FrameCompressor(const CompressionDictionary* dictionary = nullptr)
+	{
+		m_Dictionary = dictionary;
+	}
+
+	uint32_t DictionaryId() const
+	{
+		return m_Dictionary != nullptr ? m_Dictionary->m_Id : 0;
+	}
+
+	// Appends a compressed frame holding these whole frames to out. Returns false and leaves out as it was
+	// when they are too small to bother with or didn't shrink by at least an eighth.
+	bool Compress(const uint8_t* frames, size_t length, Buffer& out, WireVersion version = WIRE_V1)
+	{
+		if (length < COMPRESSION_MIN_BYTES || length > MAX_FRAME_SIZE)
+			return false;
+
+		// Room for the worst case up front so nothing moves while the codec writes. The v2 size isn't known
+		// until the codec is done, so its varint is written padded to full width, which is still a valid varint.
+		size_t headerSize = version == WIRE_V1 ? COMPRESSED_HEADER_SIZE : COMPACT_MAX_SIZE_BYTES + 1 + varintSize(length) + 4;
+		size_t start = out.Size();
+		out.PrepareWrite(headerSize + LzCodec::MaxCompressedSize(length));
+		out.CommitWrite(headerSize);
+
+		size_t compressedSize = LzCodec::Compress(frames, length, out, m_Dictionary != nullptr ? m_Dictionary->Lz() : nullptr);
+		size_t packetSize = headerSize + compressedSize;
+		if (packetSize > length - length / 8 || packetSize > MAX_FRAME_SIZE)
+		{
+			out.Truncate(start);
+			return false;
+		}
+
+		uint8_t* header = out.m_BufferData.data() + start;
+		if (version == WIRE_V1)
+		{
+			storeUInt32LE(header, (uint32_t)packetSize);
+			storeUInt32LE(header + 4, peekMessageType(frames) | MESSAGE_FLAG_COMPRESSED);
+			storeUInt32LE(header + 8, (uint32_t)length);
+			storeUInt32LE(header + 12, DictionaryId());
+			return true;
+		}
+
+		size_t bodySize = packetSize - COMPACT_MAX_SIZE_BYTES;
+		for (size_t i = 0; i < COMPACT_MAX_SIZE_BYTES; i++)
+		{
+			*header++ = (uint8_t)(((bodySize >> (7 * i)) & 0x7F) | (i + 1 < COMPACT_MAX_SIZE_BYTES ? 0x80 : 0));
+		}
+		*header++ = *compactFrameType(frames) | COMPACT_FLAG_COMPRESSED;
+		header = storeVarint(header, length);
+		storeUInt32LE(header, DictionaryId());
+		return true;
+	}
+
+	// Calls onFrame(const uint8_t* frame, uint32_t packetSize) for the frame itself, or for every frame packed
+	// into it if it is compressed. Returns false if it doesn't unpack into whole, uncompressed frames or was
+	// packed with another dictionary. The unpacked frames are only valid during the call.
+	template <typename OnFrame>
+	bool Unpack(const uint8_t* frame, uint32_t packetSize, OnFrame onFrame, WireVersion version = WIRE_V1)
+	{
+		if (!isCompressedFrame(frame, version))
+		{
+			onFrame(frame, packetSize);
+			return true;
+		}
+
+		// Where the LZ stream starts and how much it unpacks to
+		const uint8_t* in;
+		const uint8_t* end = frame + packetSize;
+		uint64_t originalSize;
+		if (!peekCompressedHeader(frame, packetSize, version, originalSize, in))
+			return false;
+
+		if (end - in < 4 || originalSize < 1 || originalSize > MAX_FRAME_SIZE || loadUInt32LE(in) != DictionaryId())
+			return false;
+		in += 4;
+
+		m_Unpacked.Clear();
+		uint8_t* unpacked = m_Unpacked.PrepareWrite((size_t)originalSize);
+		if (!LzCodec::Decompress(in, end - in, unpacked, (size_t)originalSize, m_Dictionary != nullptr ? m_Dictionary->Lz() : nullptr))
+			return false;
+		m_Unpacked.CommitWrite((size_t)originalSize);
+
+		// Checked before any of it is handed out, a bad frame is dropped whole
+		bool nested = false;
+		bool whole = forEachFrame(version, unpacked, (size_t)originalSize, [&](const uint8_t* innerFrame, uint32_t)
+		{
+			nested = nested || isCompressedFrame(innerFrame, version);
+		});
+		if (!whole || nested)
+			return false;
+
+		forEachFrame(version, unpacked, (size_t)originalSize, onFrame);
+		return true;
+	}
+};
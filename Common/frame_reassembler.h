@@ -0,0 +1,259 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "buffer.h"
+
+// Every frame starts with a PacketHeader, packetSize counts the whole frame including the header
+const uint32_t FRAME_HEADER_SIZE = 8;		// packetSize + messageType
+const uint32_t MAX_FRAME_SIZE = 1 << 20;	// anything larger is a corrupt or hostile stream
+
+// How a connection's frames are laid out. Every connection starts on v1, a HelloMessage can move it to v2.
+//   v1: [uint32 packetSize][uint32 messageType] then the fields, packetSize counts the whole frame
+//   v2: [varint bodySize][uint8 messageType] then the fields, bodySize counts the type byte and the fields
+// v2 is for small chat lines, where v1's twelve bytes of header and string length are a large part of the frame.
+enum WireVersion : uint8_t
+{
+	WIRE_V1 = 1,
+	WIRE_V2 = 2,
+};
+
+const size_t COMPACT_MAX_SIZE_BYTES = 3;	// a varint of up to MAX_FRAME_SIZE
+const size_t COMPACT_MIN_FRAME_SIZE = 2;	// a one byte bodySize and the type
+
+enum FrameSizeResult
+{
+	FRAME_SIZE_KNOWN,
+	FRAME_SIZE_INCOMPLETE,	// not enough of the header yet
+	FRAME_SIZE_INVALID,		// out of range, the stream is corrupt
+};
+
+// The size of the whole frame that starts at data, from however much of it has arrived
+inline FrameSizeResult peekFrameSize(WireVersion version, const uint8_t* data, size_t available, uint32_t& frameSize)
+{
+	if (version == WIRE_V1)
+	{
+		if (available < sizeof(uint32_t))
+			return FRAME_SIZE_INCOMPLETE;
+
+		frameSize = loadUInt32LE(data);
+		return frameSize >= FRAME_HEADER_SIZE && frameSize <= MAX_FRAME_SIZE ? FRAME_SIZE_KNOWN : FRAME_SIZE_INVALID;
+	}
+
+	const uint8_t* in = data;
+	uint64_t bodySize;
+	if (!loadVarint(in, data + (available < COMPACT_MAX_SIZE_BYTES ? available : COMPACT_MAX_SIZE_BYTES), bodySize))
+		return available < COMPACT_MAX_SIZE_BYTES ? FRAME_SIZE_INCOMPLETE : FRAME_SIZE_INVALID;
+	if (bodySize < 1 || bodySize > MAX_FRAME_SIZE)
+		return FRAME_SIZE_INVALID;
+
+	frameSize = (uint32_t)(in - data + bodySize);
+	return FRAME_SIZE_KNOWN;
+}
+
+// Calls onFrame(const uint8_t* frame, uint32_t frameSize) for each of the whole frames back to back in data.
+// Returns false, before calling it at all, if they aren't exactly that.
+template <typename OnFrame>
+bool forEachFrame(WireVersion version, const uint8_t* data, size_t length, OnFrame onFrame)
+{
+	for (size_t offset = 0; offset < length; )
+	{
+		uint32_t frameSize;
+		if (peekFrameSize(version, data + offset, length - offset, frameSize) != FRAME_SIZE_KNOWN || frameSize > length - offset)
+			return false;
+		offset += frameSize;
+	}
+
+	for (size_t offset = 0; offset < length; )
+	{
+		uint32_t frameSize = 0;
+		peekFrameSize(version, data + offset, length - offset, frameSize);
+		onFrame(data + offset, frameSize);
+		offset += frameSize;
+	}
+	return true;
+}
+
+// Read size for sockets, one recv can drain dozens of chat frames
+const int RECV_CHUNK_SIZE = 64 * 1024;
+
+// Turns the TCP byte stream back into frames.
+//
+// TCP gives no message boundaries, one recv can hold several frames and a frame can be split across recvs.
+// Complete frames are handed out straight from the recv buffer, only the unfinished tail of a read is copied
+// and kept here until the rest of it arrives, so an idle connection costs an empty vector.
+class FrameReassembler
+{
+public:
+
+	std::vector<uint8_t> m_Partial;	// start of a frame whose remaining bytes haven't arrived yet, or everything held
+	WireVersion m_Version;			// looked at again for every frame, an onFrame that changes it changes the next one
+	bool m_Holding;					// see Hold
+	bool m_HoldingFrame;			// the frame Hold was called for is held too, see HoldAfter
+
+	FrameReassembler()
+	{
+		m_Version = WIRE_V1;
+		m_Holding = false;
+		m_HoldingFrame = false;
+	}
+
+	// Stops handing out frames until Release, e.g. for a client that is over its rate limit. Called from inside
+	// onFrame, Feed keeps that frame and everything after it. Whatever is fed meanwhile is only appended, the
+	// owner is expected to stop reading so that stays small.
+	void Hold()
+	{
+		m_Holding = true;
+		m_HoldingFrame = true;
+	}
+
+	// Hold, but the frame onFrame is on counts as handed out and only what follows it is kept. For a frame that
+	// announces bytes that aren't frames, the owner takes them from the front of m_Partial before it releases.
+	void HoldAfter()
+	{
+		m_Holding = true;
+		m_HoldingFrame = false;
+	}
+
+	bool IsHolding() const
+	{
+		return m_Holding;
+	}
+
+	static uint32_t PeekPacketSize(const uint8_t* data)
+	{
+		return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+	}
+
+	static bool IsValidPacketSize(uint32_t packetSize)
+	{
+		return packetSize >= FRAME_HEADER_SIZE && packetSize <= MAX_FRAME_SIZE;
+	}
+
+	bool HasPartialFrame() const
+	{
+		return !m_Partial.empty();
+	}
+
+	// Calls onFrame(const uint8_t* frame, uint32_t packetSize) for every frame completed by these bytes.
+	// onFrame returns false to stop, e.g. when it closed the connection, and the rest of the data is dropped.
+	// The reassembler must stay alive until Feed returns, so owners defer freeing it if onFrame disconnects.
+	// Returns false if the stream is corrupt (a packetSize out of range), the connection should be closed.
+	template <typename OnFrame>
+	bool Feed(const uint8_t* data, size_t length, OnFrame onFrame)
+	{
+		if (m_Holding)
+		{
+			m_Partial.insert(m_Partial.end(), data, data + length);
+			return true;
+		}
+
+		// Finish the frame left over from the previous read first
+		while (!m_Partial.empty() && length > 0)
+		{
+			uint32_t frameSize;
+			FrameSizeResult result = peekFrameSize(m_Version, m_Partial.data(), m_Partial.size(), frameSize);
+			if (result == FRAME_SIZE_INVALID)
+				return false;
+
+			// Header bytes one at a time, it is only split like this when a read ends in the middle of one
+			size_t needed = result == FRAME_SIZE_KNOWN ? frameSize - m_Partial.size() : 1;
+
+			size_t take = needed < length ? needed : length;
+			m_Partial.insert(m_Partial.end(), data, data + take);
+			data += take;
+			length -= take;
+
+			if (peekFrameSize(m_Version, m_Partial.data(), m_Partial.size(), frameSize) == FRAME_SIZE_KNOWN && m_Partial.size() == frameSize)
+			{
+				bool keepGoing = onFrame((const uint8_t*)m_Partial.data(), (uint32_t)m_Partial.size());
+				if (keepGoing && m_Holding)
+				{
+					if (!m_HoldingFrame)
+						m_Partial.clear();
+					m_Partial.insert(m_Partial.end(), data, data + length);
+					return true;
+				}
+
+				m_Partial.clear();
+
+				// Keep the allocation for the next split chat line, but don't pin a large one per connection
+				if (m_Partial.capacity() > (size_t)RECV_CHUNK_SIZE)
+				{
+					std::vector<uint8_t>().swap(m_Partial);
+				}
+
+				if (!keepGoing)
+					return true;
+			}
+		}
+
+		// Whole frames are delivered in place without copying
+		while (length > 0)
+		{
+			uint32_t packetSize;
+			FrameSizeResult result = peekFrameSize(m_Version, data, length, packetSize);
+			if (result == FRAME_SIZE_INVALID)
+				return false;
+
+			if (result == FRAME_SIZE_INCOMPLETE || length < packetSize)
+				break;
+
+			if (!onFrame(data, packetSize))
+				return true;
+
+			if (m_Holding && m_HoldingFrame)
+				break;
+
+			data += packetSize;
+			length -= packetSize;
+
+			if (m_Holding)
+				break;
+		}
+
+		if (length > 0)
+		{
+			m_Partial.insert(m_Partial.end(), data, data + length);
+		}
+
+		return true;
+	}
+
+	// Hands out what was held, the same way Feed would have, and goes back to normal unless onFrame holds again.
+	// Returns false if the held bytes are corrupt.
+	template <typename OnFrame>
+	bool Release(OnFrame onFrame)
+	{
+		m_Holding = false;
+
+		size_t offset = 0;
+		while (offset < m_Partial.size())
+		{
+			uint32_t packetSize;
+			FrameSizeResult result = peekFrameSize(m_Version, m_Partial.data() + offset, m_Partial.size() - offset, packetSize);
+			if (result == FRAME_SIZE_INVALID)
+				return false;
+
+			if (result == FRAME_SIZE_INCOMPLETE || m_Partial.size() - offset < packetSize)
+				break;
+
+			if (!onFrame((const uint8_t*)m_Partial.data() + offset, packetSize))
+				return true;
+
+			if (m_Holding && m_HoldingFrame)
+				break;
+
+			offset += packetSize;
+
+			if (m_Holding)
+				break;
+		}
+
+		// What is left is the held frame or what came after it, or the start of the next frame
+		m_Partial.erase(m_Partial.begin(), m_Partial.begin() + offset);
+		return true;
+	}
+};
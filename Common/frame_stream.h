@@ -0,0 +1,214 @@
+#pragma once
+
+#include "socket_platform.h"
+#include "event_loop.h"
+#include "buffer.h"
+#include "frame_reassembler.h"
+#include "message_schema.h"
+
+#include <stdio.h>
+
+// One connection's frames for coroutines on an EventLoop, co_await ReadFrame for the next whole frame and
+// co_await WriteFrame to send one. The socket is non-blocking and both wait on the loop rather than the socket,
+// so any number of streams share one thread.
+//
+// Received bytes go into one buffer, a frame is handed out in place and only the unfinished tail is moved to the
+// front before the next recv. Written frames are encoded into the outgoing buffer and sent as far as the socket
+// takes them. A writer that finds another one already waiting for the socket leaves its bytes to it and returns,
+// so frames still go out in the order they were written. Both buffers go back to the pool whenever they are
+// empty, a connection that is only waiting for its next frame holds no memory for it.
+class FrameStream
+{
+public:
+
+	EventLoop& m_Loop;
+	SOCKET m_Socket;
+	WireVersion m_ReadVersion;
+	WireVersion m_WriteVersion;
+	Buffer m_In;			// received bytes, the next frame starts at m_In.m_ReadIndex
+	Buffer m_Out;			// encoded frames the socket hasn't taken yet
+	size_t m_OutOffset;
+	bool m_Flushing;		// a writer is waiting for the socket to take the rest of m_Out
+	bool m_Failed;
+
+	// Takes ownership of a connected socket
+	FrameStream(EventLoop& loop, SOCKET socket)
+		: m_Loop(loop), m_In(0), m_Out(0)
+	{
+		m_Socket = socket;
+		m_ReadVersion = WIRE_V1;
+		m_WriteVersion = WIRE_V1;
+		m_OutOffset = 0;
+		m_Flushing = false;
+		m_Failed = false;
+
+		setNonBlocking(m_Socket);
+
+		// Frames are written whole, Nagle would only hold a chat line back waiting for the last one's ACK
+		int noDelay = 1;
+		setsockopt(m_Socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+	}
+
+	FrameStream(const FrameStream&) = delete;
+	FrameStream& operator=(const FrameStream&) = delete;
+
+	// Nobody may still be waiting on it
+	~FrameStream()
+	{
+		m_Loop.Forget(m_Socket);
+		closesocket(m_Socket);
+	}
+
+	// The next whole frame, in place until the next ReadFrame. Returns false once the peer has closed the
+	// connection, it failed or the stream stopped being frames.
+	Task<bool> ReadFrame(ByteSpan& frame)
+	{
+		while (!m_Failed)
+		{
+			const uint8_t* data = m_In.Data() + m_In.m_ReadIndex;
+			uint32_t frameSize;
+			FrameSizeResult result = peekFrameSize(m_ReadVersion, data, m_In.Remaining(), frameSize);
+			if (result == FRAME_SIZE_INVALID)
+			{
+				printf("received a malformed frame\n");
+				m_Failed = true;
+				break;
+			}
+
+			if (result == FRAME_SIZE_KNOWN && frameSize <= m_In.Remaining())
+			{
+				frame = m_In.ReadBytes(frameSize);
+				co_return true;
+			}
+
+			m_In.Compact();
+			int received = recv(m_Socket, (char*)m_In.PrepareWrite(RECV_CHUNK_SIZE), RECV_CHUNK_SIZE, 0);
+			if (received > 0)
+			{
+				m_In.CommitWrite(received);
+				continue;
+			}
+
+			if (received == SOCKET_ERROR && isWouldBlock(WSAGetLastError()))
+			{
+				if (m_In.Remaining() == 0)
+					m_In.Release();
+
+				co_await m_Loop.Readable(m_Socket);
+				continue;
+			}
+
+			// 0 is the peer closing, anything else is an error. Either way there is nothing more to read.
+			if (received == SOCKET_ERROR)
+			{
+				printf("recv failed with error %d\n", WSAGetLastError());
+			}
+			m_Failed = true;
+		}
+
+		co_return false;
+	}
+
+	// The next size bytes, for a body that follows a frame on the stream and isn't frames itself. They are handed
+	// to onBytes(const uint8_t* data, size_t length) in pieces as they come. Returns false if the connection ended
+	// or failed first.
+	template <typename OnBytes>
+	Task<bool> ReadBody(uint64_t size, OnBytes onBytes)
+	{
+		while (size > 0 && !m_Failed)
+		{
+			if (m_In.Remaining() > 0)
+			{
+				size_t take = m_In.Remaining() < size ? m_In.Remaining() : (size_t)size;
+				ByteSpan bytes = m_In.ReadBytes(take);
+				onBytes(bytes.data, bytes.size);
+				size -= take;
+				continue;
+			}
+
+			m_In.Compact();
+			int received = recv(m_Socket, (char*)m_In.PrepareWrite(RECV_CHUNK_SIZE), RECV_CHUNK_SIZE, 0);
+			if (received > 0)
+			{
+				m_In.CommitWrite(received);
+				continue;
+			}
+
+			if (received == SOCKET_ERROR && isWouldBlock(WSAGetLastError()))
+			{
+				m_In.Release();
+				co_await m_Loop.Readable(m_Socket);
+				continue;
+			}
+
+			if (received == SOCKET_ERROR)
+			{
+				printf("recv failed with error %d\n", WSAGetLastError());
+			}
+			m_Failed = true;
+		}
+
+		co_return size == 0;
+	}
+
+	// Encodes the frame now, the task only sends it. Returns false if the connection failed.
+	template <typename Message>
+	Task<bool> WriteFrame(const Message& message)
+	{
+		Queue(message);
+		return Flush();
+	}
+
+	// Encodes the frame to go out with the next Flush, for several that belong together
+	template <typename Message>
+	void Queue(const Message& message)
+	{
+		encodeMessage(message, m_Out, m_WriteVersion);
+	}
+
+	// Already encoded frames, copied now
+	Task<bool> WriteBytes(const uint8_t* data, size_t length)
+	{
+		m_Out.WriteBytes(data, length);
+		return Flush();
+	}
+
+	// Sends everything written so far, or leaves it to the writer already waiting for the socket
+	Task<bool> Flush()
+	{
+		if (m_Flushing || m_Failed)
+			co_return !m_Failed;
+
+		m_Flushing = true;
+		while (m_OutOffset < m_Out.Size())
+		{
+			int sent = send(m_Socket, (const char*)m_Out.Data() + m_OutOffset, (int)(m_Out.Size() - m_OutOffset), 0);
+			if (sent > 0)
+			{
+				m_OutOffset += sent;
+				continue;
+			}
+
+			if (sent == SOCKET_ERROR && isWouldBlock(WSAGetLastError()))
+			{
+				co_await m_Loop.Writable(m_Socket);
+				continue;
+			}
+
+			printf("send failed with error %d\n", WSAGetLastError());
+			m_Failed = true;
+			break;
+		}
+
+		m_Out.Release();
+		m_OutOffset = 0;
+		m_Flushing = false;
+		co_return !m_Failed;
+	}
+
+	// Ends the connection both ways, a ReadFrame waiting on it wakes up and returns false
+	void Shutdown()
+	{
+		shutdown(m_Socket, SD_BOTH);
+	}
+};
@@ -0,0 +1,302 @@
+#pragma once
+
+// Minimal io_uring wrapper on the raw syscalls so we don't need liburing to build.
+// Only what the servers use: submission/completion rings and provided buffer rings.
+
+#ifdef __linux__
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+class IoUring
+{
+public:
+
+	int m_RingFd;
+	unsigned m_Features;
+
+	// Submission queue
+	unsigned* m_SqHead;
+	unsigned* m_SqTail;
+	unsigned m_SqMask;
+	unsigned m_SqEntries;
+	unsigned* m_SqArray;
+	io_uring_sqe* m_Sqes;
+	unsigned m_SqLocalTail;		// SQEs handed out but not yet published to the kernel
+	unsigned m_SqSubmitted;		// tail the kernel has been told about
+
+	// Completion queue
+	unsigned* m_CqHead;
+	unsigned* m_CqTail;
+	unsigned m_CqMask;
+	io_uring_cqe* m_Cqes;
+
+	void* m_SqRingPtr;
+	size_t m_SqRingSize;
+	void* m_CqRingPtr;
+	size_t m_CqRingSize;
+	size_t m_SqesSize;
+
+	IoUring()
+	{
+		m_RingFd = -1;
+		m_SqRingPtr = MAP_FAILED;
+		m_CqRingPtr = MAP_FAILED;
+		m_Sqes = (io_uring_sqe*)MAP_FAILED;
+	}
+
+	~IoUring()
+	{
+		if (m_Sqes != MAP_FAILED)
+			munmap(m_Sqes, m_SqesSize);
+		if (m_CqRingPtr != MAP_FAILED && m_CqRingPtr != m_SqRingPtr)
+			munmap(m_CqRingPtr, m_CqRingSize);
+		if (m_SqRingPtr != MAP_FAILED)
+			munmap(m_SqRingPtr, m_SqRingSize);
+		if (m_RingFd != -1)
+			close(m_RingFd);
+	}
+
+	// Returns 0 or a negative errno
+	int Init(unsigned entries, unsigned completionEntries)
+	{
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+		params.cq_entries = completionEntries;
+
+		m_RingFd = (int)syscall(__NR_io_uring_setup, entries, &params);
+		if (m_RingFd < 0)
+		{
+			// Older kernels don't know the single issuer flags, they're only an optimization
+			memset(&params, 0, sizeof(params));
+			params.flags = IORING_SETUP_CQSIZE;
+			params.cq_entries = completionEntries;
+			m_RingFd = (int)syscall(__NR_io_uring_setup, entries, &params);
+			if (m_RingFd < 0)
+				return -errno;
+		}
+
+		m_Features = params.features;
+
+		m_SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		if (m_Features & IORING_FEAT_SINGLE_MMAP)
+		{
+			if (m_CqRingSize > m_SqRingSize)
+				m_SqRingSize = m_CqRingSize;
+			m_CqRingSize = m_SqRingSize;
+		}
+
+		m_SqRingPtr = mmap(0, m_SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd, IORING_OFF_SQ_RING);
+		if (m_SqRingPtr == MAP_FAILED)
+			return -errno;
+
+		if (m_Features & IORING_FEAT_SINGLE_MMAP)
+		{
+			m_CqRingPtr = m_SqRingPtr;
+		}
+		else
+		{
+			m_CqRingPtr = mmap(0, m_CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd, IORING_OFF_CQ_RING);
+			if (m_CqRingPtr == MAP_FAILED)
+				return -errno;
+		}
+
+		m_SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		m_Sqes = (io_uring_sqe*)mmap(0, m_SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd, IORING_OFF_SQES);
+		if (m_Sqes == MAP_FAILED)
+			return -errno;
+
+		uint8_t* sq = (uint8_t*)m_SqRingPtr;
+		m_SqHead = (unsigned*)(sq + params.sq_off.head);
+		m_SqTail = (unsigned*)(sq + params.sq_off.tail);
+		m_SqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+		m_SqEntries = *(unsigned*)(sq + params.sq_off.ring_entries);
+		m_SqArray = (unsigned*)(sq + params.sq_off.array);
+		m_SqLocalTail = *m_SqTail;
+		m_SqSubmitted = m_SqLocalTail;
+
+		uint8_t* cq = (uint8_t*)m_CqRingPtr;
+		m_CqHead = (unsigned*)(cq + params.cq_off.head);
+		m_CqTail = (unsigned*)(cq + params.cq_off.tail);
+		m_CqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+		m_Cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+		return 0;
+	}
+
+	// Returns nullptr when the submission queue is full, Submit() and try again
+	io_uring_sqe* GetSqe()
+	{
+		unsigned head = __atomic_load_n(m_SqHead, __ATOMIC_ACQUIRE);
+		if (m_SqLocalTail - head >= m_SqEntries)
+			return nullptr;
+
+		unsigned index = m_SqLocalTail & m_SqMask;
+		m_SqArray[index] = index;
+		m_SqLocalTail++;
+
+		io_uring_sqe* sqe = &m_Sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		return sqe;
+	}
+
+	unsigned PendingSubmissions() const
+	{
+		return m_SqLocalTail - m_SqSubmitted;
+	}
+
+	// Publishes every SQE handed out since the last call and optionally waits for completions.
+	// One call here is one kernel transition no matter how many operations were queued.
+	int SubmitAndWait(unsigned waitCount, int timeoutMs)
+	{
+		unsigned toSubmit = m_SqLocalTail - m_SqSubmitted;
+		__atomic_store_n(m_SqTail, m_SqLocalTail, __ATOMIC_RELEASE);
+		m_SqSubmitted = m_SqLocalTail;
+
+		unsigned flags = waitCount > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+		if (waitCount > 0 && timeoutMs >= 0 && (m_Features & IORING_FEAT_EXT_ARG))
+		{
+			__kernel_timespec ts;
+			ts.tv_sec = timeoutMs / 1000;
+			ts.tv_nsec = (long long)(timeoutMs % 1000) * 1000000;
+
+			io_uring_getevents_arg arg;
+			memset(&arg, 0, sizeof(arg));
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+
+			int result = (int)syscall(__NR_io_uring_enter, m_RingFd, toSubmit, waitCount, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+			if (result < 0 && errno != ETIME && errno != EINTR)
+				return -errno;
+			return result < 0 ? 0 : result;
+		}
+
+		int result = (int)syscall(__NR_io_uring_enter, m_RingFd, toSubmit, waitCount, flags, NULL, 0);
+		if (result < 0 && errno != EINTR)
+			return -errno;
+		return result < 0 ? 0 : result;
+	}
+
+	io_uring_cqe* PeekCqe()
+	{
+		unsigned head = *m_CqHead;
+		unsigned tail = __atomic_load_n(m_CqTail, __ATOMIC_ACQUIRE);
+		if (head == tail)
+			return nullptr;
+
+		return &m_Cqes[head & m_CqMask];
+	}
+
+	void CqeSeen()
+	{
+		__atomic_store_n(m_CqHead, *m_CqHead + 1, __ATOMIC_RELEASE);
+	}
+
+	int Register(unsigned opcode, void* arg, unsigned count)
+	{
+		int result = (int)syscall(__NR_io_uring_register, m_RingFd, opcode, arg, count);
+		return result < 0 ? -errno : result;
+	}
+};
+
+// A ring of fixed size buffers the kernel picks from when a recv completes,
+// so multishot recv never needs a buffer pinned per idle connection.
+class ProvidedBufferRing
+{
+public:
+
+	io_uring_buf_ring* m_Ring;
+	size_t m_RingSize;
+	uint8_t* m_Storage;
+	size_t m_StorageSize;
+	unsigned m_Entries;
+	unsigned m_BufferSize;
+	uint16_t m_GroupId;
+
+	ProvidedBufferRing()
+	{
+		m_Ring = (io_uring_buf_ring*)MAP_FAILED;
+		m_Storage = (uint8_t*)MAP_FAILED;
+	}
+
+	~ProvidedBufferRing()
+	{
+		if (m_Storage != MAP_FAILED)
+			munmap(m_Storage, m_StorageSize);
+		if (m_Ring != MAP_FAILED)
+			munmap(m_Ring, m_RingSize);
+	}
+
+	// entries must be a power of two
+	int Init(IoUring& ring, uint16_t groupId, unsigned entries, unsigned bufferSize)
+	{
+		m_GroupId = groupId;
+		m_Entries = entries;
+		m_BufferSize = bufferSize;
+
+		m_RingSize = entries * sizeof(io_uring_buf);
+		m_Ring = (io_uring_buf_ring*)mmap(NULL, m_RingSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+		if (m_Ring == MAP_FAILED)
+			return -errno;
+
+		m_StorageSize = (size_t)entries * bufferSize;
+		m_Storage = (uint8_t*)mmap(NULL, m_StorageSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+		if (m_Storage == MAP_FAILED)
+			return -errno;
+
+		io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = (uint64_t)(uintptr_t)m_Ring;
+		reg.ring_entries = entries;
+		reg.bgid = groupId;
+
+		int result = ring.Register(IORING_REGISTER_PBUF_RING, &reg, 1);
+		if (result < 0)
+			return result;
+
+		m_Ring->tail = 0;
+		for (unsigned i = 0; i < entries; i++)
+		{
+			Provide((uint16_t)i, i);
+		}
+		Publish(entries);
+
+		return 0;
+	}
+
+	uint8_t* Data(uint16_t bufferId)
+	{
+		return m_Storage + (size_t)bufferId * m_BufferSize;
+	}
+
+	// Stage a buffer at tail + offset, Publish makes staged buffers visible to the kernel
+	void Provide(uint16_t bufferId, unsigned offset)
+	{
+		// Not m_Ring->bufs: in C++ the header's flexible array sits 8 bytes in, the kernel expects it at the start
+		io_uring_buf* buf = (io_uring_buf*)m_Ring + ((m_Ring->tail + offset) & (m_Entries - 1));
+		buf->addr = (uint64_t)(uintptr_t)Data(bufferId);
+		buf->len = m_BufferSize;
+		buf->bid = bufferId;
+	}
+
+	void Publish(unsigned count)
+	{
+		__atomic_store_n(&m_Ring->tail, (uint16_t)(m_Ring->tail + count), __ATOMIC_RELEASE);
+	}
+
+	void Recycle(uint16_t bufferId)
+	{
+		Provide(bufferId, 0);
+		Publish(1);
+	}
+};
+
+#endif
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Counts values, e.g. latencies in nanoseconds, into log-linear buckets for percentiles.
+//
+// Values below 64 get a bucket each, above that every power of two is split into 32 buckets, so a percentile
+// is within about 3% of the real value at any scale. Recording is one index computation and an increment,
+// with no allocation. Not thread safe, give each thread its own and Merge them.
+class LatencyHistogram
+{
+public:
+
+	static const int SUB_BUCKET_BITS = 6;
+	static const uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	static const uint64_t HALF_SUB_BUCKETS = SUB_BUCKETS / 2;
+	static const int BUCKET_COUNT = (int)(SUB_BUCKETS + (64 - SUB_BUCKET_BITS) * HALF_SUB_BUCKETS);
+
+	uint64_t m_Counts[BUCKET_COUNT];
+	uint64_t m_TotalCount;
+	uint64_t m_Sum;
+	uint64_t m_Max;
+
+	LatencyHistogram()
+	{
+		Clear();
+	}
+
+	void Clear()
+	{
+		memset(m_Counts, 0, sizeof(m_Counts));
+		m_TotalCount = 0;
+		m_Sum = 0;
+		m_Max = 0;
+	}
+
+	void Record(uint64_t value)
+	{
+		m_Counts[BucketFor(value)]++;
+		m_TotalCount++;
+		m_Sum += value;
+		if (value > m_Max)
+			m_Max = value;
+	}
+
+	void Merge(const LatencyHistogram& other)
+	{
+		for (int i = 0; i < BUCKET_COUNT; i++)
+		{
+			m_Counts[i] += other.m_Counts[i];
+		}
+		m_TotalCount += other.m_TotalCount;
+		m_Sum += other.m_Sum;
+		if (other.m_Max > m_Max)
+			m_Max = other.m_Max;
+	}
+
+	uint64_t Count() const
+	{
+		return m_TotalCount;
+	}
+
+	uint64_t Max() const
+	{
+		return m_Max;
+	}
+
+	double Mean() const
+	{
+		return m_TotalCount > 0 ? (double)m_Sum / m_TotalCount : 0.0;
+	}
+
+	// The value below which percentile (0 to 100) of the recorded values fall, 0 if nothing was recorded
+	uint64_t Percentile(double percentile) const
+	{
+		if (m_TotalCount == 0)
+			return 0;
+
+		uint64_t rank = (uint64_t)(percentile / 100.0 * m_TotalCount + 0.5);
+		if (rank < 1)
+			rank = 1;
+		if (rank > m_TotalCount)
+			rank = m_TotalCount;
+
+		uint64_t seen = 0;
+		for (int i = 0; i < BUCKET_COUNT; i++)
+		{
+			seen += m_Counts[i];
+			if (seen >= rank)
+			{
+				uint64_t value = BucketMidpoint(i);
+				return value < m_Max ? value : m_Max;
+			}
+		}
+		return m_Max;
+	}
+
+	static int BucketFor(uint64_t value)
+	{
+		if (value < SUB_BUCKETS)
+			return (int)value;
+
+		// value >> shift lands in [32, 64), its low five bits pick the sub bucket
+		int shift = HighestBit(value) - (SUB_BUCKET_BITS - 1);
+		uint64_t top = value >> shift;
+		return (int)(SUB_BUCKETS + (shift - 1) * HALF_SUB_BUCKETS + (top - HALF_SUB_BUCKETS));
+	}
+
+	static uint64_t BucketMidpoint(int bucket)
+	{
+		if (bucket < (int)SUB_BUCKETS)
+			return bucket;
+
+		uint64_t offset = bucket - SUB_BUCKETS;
+		int shift = (int)(offset / HALF_SUB_BUCKETS) + 1;
+		uint64_t top = offset % HALF_SUB_BUCKETS + HALF_SUB_BUCKETS;
+		return (top << shift) + ((uint64_t)1 << (shift - 1));
+	}
+
+private:
+
+	static int HighestBit(uint64_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return (int)index;
+#else
+		return 63 - __builtin_clzll(value);
+#endif
+	}
+};
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+#include "buffer.h"
+
+// A small LZ77 codec in the LZ4 block format, fast enough to run on every large chat frame.
+//
+// The stream is sequences of a token (literal count and match length in two nibbles, each extended with 255
+// bytes when it overflows), the literals, and a two byte little endian offset back to where the match is.
+// The last sequence is literals only. Matching is greedy on a hash of the next four bytes, no chains, so
+// compression is a single pass and decompression is a loop of copies. Copies go 8 bytes at a time wherever the
+// buffers have room to spill over, a call to memcpy per short literal run cost more than the copying.
+//
+// A dictionary is text both sides already have, matches may reach back into it as though it came right before
+// the input, which is what makes a line of a few hundred bytes compressible at all. Its hash table is built once.
+
+class LzDictionary
+{
+public:
+
+	static const int HASH_BITS = 12;
+	static const size_t MAX_SIZE = 65535 - 1024;	// leaves room for offsets that reach into it from the input
+
+	const uint8_t* m_Data;
+	size_t m_Size;
+	uint32_t m_Table[1 << HASH_BITS];	// position + 1 of the last dictionary string with each hash, 0 for none
+
+	// data must outlive the dictionary, anything past MAX_SIZE is cut from the front
+	LzDictionary(const uint8_t* data, size_t size)
+	{
+		if (size > MAX_SIZE)
+		{
+			data += size - MAX_SIZE;
+			size = MAX_SIZE;
+		}
+
+		m_Data = data;
+		m_Size = size;
+		memset(m_Table, 0, sizeof(m_Table));
+		for (size_t i = 0; i + 4 <= size; i++)
+		{
+			m_Table[Hash(loadUInt32LE(data + i), HASH_BITS)] = (uint32_t)i + 1;
+		}
+	}
+
+	static uint32_t Hash(uint32_t sequence, int bits)
+	{
+		return (sequence * 2654435761u) >> (32 - bits);
+	}
+};
+
+class LzCodec
+{
+public:
+
+	static const int MIN_MATCH = 4;
+	static const size_t MAX_OFFSET = 65535;
+	static const size_t LAST_LITERALS = 5;		// the format ends on literals, a match never runs into the last bytes
+	static const size_t MATCH_SEARCH_LIMIT = 12;
+	static const int MAX_HASH_BITS = 12;
+	static const size_t COPY_SLACK = 16;		// what a chunked copy may write past the end of what it copies
+	static const int SKIP_TRIGGER = 6;			// after 2^this misses in a row start skipping ahead, text that doesn't compress goes fast
+
+	// Largest output Compress can produce for length bytes
+	static size_t MaxCompressedSize(size_t length)
+	{
+		return length + length / 255 + 16 + COPY_SLACK;
+	}
+
+	// Appends the compressed form of input to out and returns its size
+	static size_t Compress(const uint8_t* input, size_t length, Buffer& out, const LzDictionary* dictionary = nullptr)
+	{
+		uint8_t* start = out.PrepareWrite(MaxCompressedSize(length));
+		uint8_t* op = start;
+
+		// Small inputs get a small table, clearing it is most of the setup cost
+		int hashBits = 8;
+		while (hashBits < MAX_HASH_BITS && ((size_t)1 << hashBits) < length)
+		{
+			hashBits++;
+		}
+		uint32_t table[1 << MAX_HASH_BITS];
+		memset(table, 0, sizeof(uint32_t) << hashBits);
+
+		const uint8_t* ip = input;
+		const uint8_t* anchor = input;
+		const uint8_t* end = input + length;
+		const uint8_t* matchLimit = end - LAST_LITERALS;
+
+		if (length >= MATCH_SEARCH_LIMIT)
+		{
+			const uint8_t* searchEnd = end - MATCH_SEARCH_LIMIT;
+			uint32_t misses = 1 << SKIP_TRIGGER;
+			while (ip <= searchEnd)
+			{
+				uint32_t sequence = loadUInt32LE(ip);
+				uint32_t hash = LzDictionary::Hash(sequence, hashBits);
+				size_t position = ip - input;
+
+				const uint8_t* match = nullptr;
+				const uint8_t* matchEnd = nullptr;
+				size_t offset = 0;
+
+				// This input first, then the dictionary
+				// An empty slot says 0, the start of the input, which is as good a guess as any
+				uint32_t candidate = table[hash];
+				table[hash] = (uint32_t)position;
+				if (position - candidate - 1 < MAX_OFFSET && loadUInt32LE(input + candidate) == sequence)
+				{
+					match = input + candidate;
+					matchEnd = ip;
+					offset = position - candidate;
+				}
+				else if (dictionary != nullptr)
+				{
+					uint32_t dictionaryCandidate = dictionary->m_Table[LzDictionary::Hash(sequence, LzDictionary::HASH_BITS)];
+					if (dictionaryCandidate != 0)
+					{
+						size_t dictionaryPosition = dictionaryCandidate - 1;
+						offset = position + dictionary->m_Size - dictionaryPosition;
+						if (offset <= MAX_OFFSET && dictionaryPosition + 4 <= dictionary->m_Size
+							&& loadUInt32LE(dictionary->m_Data + dictionaryPosition) == sequence)
+						{
+							match = dictionary->m_Data + dictionaryPosition;
+							matchEnd = dictionary->m_Data + dictionary->m_Size;
+						}
+					}
+				}
+
+				if (match == nullptr)
+				{
+					ip += misses++ >> SKIP_TRIGGER;
+					continue;
+				}
+				misses = 1 << SKIP_TRIGGER;
+
+				// Extend it as far as it goes, a dictionary match stops at the end of the dictionary
+				size_t matchLength = MIN_MATCH;
+				size_t longest = std::min((size_t)(matchLimit - ip), (size_t)(matchEnd - match));
+				while (matchLength + 8 <= longest && loadUInt64LE(ip + matchLength) == loadUInt64LE(match + matchLength))
+				{
+					matchLength += 8;
+				}
+				while (matchLength < longest && ip[matchLength] == match[matchLength])
+				{
+					matchLength++;
+				}
+
+				op = WriteSequence(op, anchor, ip - anchor, offset, matchLength);
+				ip += matchLength;
+				anchor = ip;
+			}
+		}
+
+		op = WriteLiterals(op, anchor, end - anchor);
+
+		size_t written = op - start;
+		out.CommitWrite(written);
+		return written;
+	}
+
+	// Decompresses exactly outputLength bytes into output. Returns false on anything malformed,
+	// a corrupt or hostile stream can never read or write outside its buffers.
+	static bool Decompress(const uint8_t* input, size_t length, uint8_t* output, size_t outputLength, const LzDictionary* dictionary = nullptr)
+	{
+		const uint8_t* ip = input;
+		const uint8_t* inputEnd = input + length;
+		uint8_t* op = output;
+		uint8_t* outputEnd = output + outputLength;
+		size_t dictionarySize = dictionary != nullptr ? dictionary->m_Size : 0;
+
+		while (ip < inputEnd)
+		{
+			uint8_t token = *ip++;
+
+			size_t literalLength = token >> 4;
+			if (literalLength == 15 && !ReadLength(ip, inputEnd, literalLength))
+				return false;
+
+			if (literalLength > (size_t)(inputEnd - ip) || literalLength > (size_t)(outputEnd - op))
+				return false;
+			if ((size_t)(inputEnd - ip) >= literalLength + COPY_SLACK && (size_t)(outputEnd - op) >= literalLength + COPY_SLACK)
+			{
+				copyChunks(op, ip, literalLength);
+			}
+			else
+			{
+				memcpy(op, ip, literalLength);
+			}
+			ip += literalLength;
+			op += literalLength;
+
+			// The last sequence has no match
+			if (ip == inputEnd)
+				break;
+
+			if (inputEnd - ip < 2)
+				return false;
+			size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+			ip += 2;
+
+			size_t matchLength = token & 15;
+			if (matchLength == 15 && !ReadLength(ip, inputEnd, matchLength))
+				return false;
+			matchLength += MIN_MATCH;
+
+			size_t produced = op - output;
+			if (offset == 0 || offset > produced + dictionarySize || matchLength > (size_t)(outputEnd - op))
+				return false;
+
+			// The part of the match that lies in the dictionary, then the rest from what was already decoded
+			if (offset > produced)
+			{
+				const uint8_t* from = dictionary->m_Data + dictionarySize - (offset - produced);
+				size_t fromDictionary = offset - produced;
+				if (fromDictionary > matchLength)
+					fromDictionary = matchLength;
+				memcpy(op, from, fromDictionary);
+				op += fromDictionary;
+				matchLength -= fromDictionary;
+				if (matchLength > 0)
+				{
+					memmove(op, output, matchLength);
+					op += matchLength;
+				}
+				continue;
+			}
+
+			// Overlapping copies repeat the pattern, so they go a byte at a time
+			const uint8_t* match = op - offset;
+			if (offset >= 8 && (size_t)(outputEnd - op) >= matchLength + COPY_SLACK)
+			{
+				copyChunks(op, match, matchLength);
+				op += matchLength;
+			}
+			else if (offset >= matchLength)
+			{
+				memcpy(op, match, matchLength);
+				op += matchLength;
+			}
+			else
+			{
+				for (size_t i = 0; i < matchLength; i++)
+				{
+					*op++ = *match++;
+				}
+			}
+		}
+
+		return op == outputEnd;
+	}
+
+private:
+
+	// Copies length bytes 8 at a time, writing up to 7 past the end. Fine for a source 8 or more bytes behind.
+	static void copyChunks(uint8_t* to, const uint8_t* from, size_t length)
+	{
+		uint8_t* end = to + length;
+		do
+		{
+			memcpy(to, from, 8);
+			to += 8;
+			from += 8;
+		} while (to < end);
+	}
+
+	static uint8_t* WriteLength(uint8_t* op, size_t length)
+	{
+		while (length >= 255)
+		{
+			*op++ = 255;
+			length -= 255;
+		}
+		*op++ = (uint8_t)length;
+		return op;
+	}
+
+	static bool ReadLength(const uint8_t*& ip, const uint8_t* end, size_t& length)
+	{
+		uint8_t byte;
+		do
+		{
+			if (ip == end)
+				return false;
+			byte = *ip++;
+			length += byte;
+		} while (byte == 255);
+		return true;
+	}
+
+	static uint8_t* WriteSequence(uint8_t* op, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength)
+	{
+		size_t extraMatch = matchLength - MIN_MATCH;
+		uint8_t* token = op++;
+		*token = (uint8_t)(((literalLength < 15 ? literalLength : 15) << 4) | (extraMatch < 15 ? extraMatch : 15));
+
+		if (literalLength >= 15)
+			op = WriteLength(op, literalLength - 15);
+		copyChunks(op, literals, literalLength);
+		op += literalLength;
+
+		*op++ = (uint8_t)offset;
+		*op++ = (uint8_t)(offset >> 8);
+
+		if (extraMatch >= 15)
+			op = WriteLength(op, extraMatch - 15);
+		return op;
+	}
+
+	static uint8_t* WriteLiterals(uint8_t* op, const uint8_t* literals, size_t literalLength)
+	{
+		*op++ = (uint8_t)((literalLength < 15 ? literalLength : 15) << 4);
+		if (literalLength >= 15)
+			op = WriteLength(op, literalLength - 15);
+		memcpy(op, literals, literalLength);
+		return op + literalLength;
+	}
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "socket_platform.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// A file mapped read/write into memory, grown to a fixed size when it is opened.
+//
+// The size is reserved up front so the mapping never has to move, pages the file never wrote to cost no
+// disk on filesystems with sparse files. Writes land in the page cache as ordinary memory stores and
+// survive the process crashing, Sync asks the kernel to start writing them out without waiting for it.
+// Windows uses a file mapping object, POSIX mmap.
+class MappedFile
+{
+public:
+
+	uint8_t* m_Data;
+	size_t m_Size;
+	bool m_Created;		// the file didn't exist before Open, its contents are all zero
+#ifdef _WIN32
+	HANDLE m_File;
+	HANDLE m_Mapping;
+#else
+	int m_Fd;
+#endif
+
+	MappedFile()
+	{
+		m_Data = nullptr;
+		m_Size = 0;
+		m_Created = false;
+#ifdef _WIN32
+		m_File = INVALID_HANDLE_VALUE;
+		m_Mapping = NULL;
+#else
+		m_Fd = -1;
+#endif
+	}
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Opens or creates path and maps size bytes of it, a shorter file is extended with zeros
+	bool Open(const std::string& path, size_t size)
+	{
+		Close();
+
+#ifdef _WIN32
+		m_File = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (m_File == INVALID_HANDLE_VALUE)
+			return false;
+		m_Created = GetLastError() != ERROR_ALREADY_EXISTS;
+
+		// The mapping object extends the file to its size
+		m_Mapping = CreateFileMappingA(m_File, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL);
+		if (m_Mapping == NULL)
+		{
+			Close();
+			return false;
+		}
+
+		m_Data = (uint8_t*)MapViewOfFile(m_Mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+		if (m_Data == nullptr)
+		{
+			Close();
+			return false;
+		}
+#else
+		m_Fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (m_Fd < 0)
+			return false;
+
+		struct stat status;
+		if (fstat(m_Fd, &status) != 0)
+		{
+			Close();
+			return false;
+		}
+		m_Created = status.st_size == 0;
+
+		if ((size_t)status.st_size < size && ftruncate(m_Fd, (off_t)size) != 0)
+		{
+			Close();
+			return false;
+		}
+
+		void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_Fd, 0);
+		if (data == MAP_FAILED)
+		{
+			Close();
+			return false;
+		}
+		m_Data = (uint8_t*)data;
+#endif
+
+		m_Size = size;
+		return true;
+	}
+
+	// Starts writing the dirty pages back, doesn't wait for the disk
+	void Sync()
+	{
+		if (m_Data == nullptr)
+			return;
+
+#ifdef _WIN32
+		FlushViewOfFile(m_Data, m_Size);
+#else
+		msync(m_Data, m_Size, MS_ASYNC);
+#endif
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (m_Data != nullptr)
+			UnmapViewOfFile(m_Data);
+		if (m_Mapping != NULL)
+			CloseHandle(m_Mapping);
+		if (m_File != INVALID_HANDLE_VALUE)
+			CloseHandle(m_File);
+		m_Mapping = NULL;
+		m_File = INVALID_HANDLE_VALUE;
+#else
+		if (m_Data != nullptr)
+			munmap(m_Data, m_Size);
+		if (m_Fd >= 0)
+			close(m_Fd);
+		m_Fd = -1;
+#endif
+		m_Data = nullptr;
+		m_Size = 0;
+	}
+};
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "buffer.h"
+#include "frame_reassembler.h"
+
+// Encoders and decoders generated from one declaration per message.
+//
+// A message is a struct with a TYPE and a static Fields() listing its members in wire order, e.g.
+//
+//   struct ChatMessage
+//   {
+//       static constexpr uint32_t TYPE = MESSAGE_TYPE_CHAT;
+//       std::string_view message;
+//       static constexpr auto Fields() { return std::make_tuple(&ChatMessage::message); }
+//   };
+//
+// On the wire it is the packetSize and messageType header followed by each field. The fixed part of that
+// layout, the header plus every integer and every string's length prefix, is summed at compile time, so
+// encoding checks the buffer size once and then stores every field unchecked. Decoding checks the fixed part
+// once, after that only strings, whose lengths come off the wire, need their own check.
+//
+// CompactSchema is the same messages in the v2 layout: a varint size and a one byte type, integers and string
+// lengths as varints, and no length at all on a string that is the last field, it runs to the end of the frame.
+// A chat line costs three bytes of overhead there instead of twelve.
+
+// How one field type goes on the wire. FIXED_SIZE is what it always takes, DynamicSize what it adds on top.
+template <typename T>
+struct WireField;
+
+template <>
+struct WireField<uint32_t>
+{
+	static constexpr size_t FIXED_SIZE = 4;
+
+	static size_t DynamicSize(uint32_t)
+	{
+		return 0;
+	}
+
+	static uint8_t* Encode(uint8_t* out, uint32_t value)
+	{
+		storeUInt32LE(out, value);
+		return out + 4;
+	}
+
+	static bool Decode(const uint8_t*& in, size_t&, uint32_t& value)
+	{
+		value = loadUInt32LE(in);
+		in += 4;
+		return true;
+	}
+
+	static size_t CompactSize(uint32_t value, bool)
+	{
+		return varintSize(value);
+	}
+
+	static uint8_t* EncodeCompact(uint8_t* out, uint32_t value, bool)
+	{
+		return storeVarint(out, value);
+	}
+
+	static bool DecodeCompact(const uint8_t*& in, const uint8_t* end, uint32_t& value, bool)
+	{
+		uint64_t wide;
+		if (!loadVarint(in, end, wide) || wide > UINT32_MAX)
+			return false;
+		value = (uint32_t)wide;
+		return true;
+	}
+};
+
+template <>
+struct WireField<uint64_t>
+{
+	static constexpr size_t FIXED_SIZE = 8;
+
+	static size_t DynamicSize(uint64_t)
+	{
+		return 0;
+	}
+
+	static uint8_t* Encode(uint8_t* out, uint64_t value)
+	{
+		storeUInt64LE(out, value);
+		return out + 8;
+	}
+
+	static bool Decode(const uint8_t*& in, size_t&, uint64_t& value)
+	{
+		value = loadUInt64LE(in);
+		in += 8;
+		return true;
+	}
+
+	static size_t CompactSize(uint64_t value, bool)
+	{
+		return varintSize(value);
+	}
+
+	static uint8_t* EncodeCompact(uint8_t* out, uint64_t value, bool)
+	{
+		return storeVarint(out, value);
+	}
+
+	static bool DecodeCompact(const uint8_t*& in, const uint8_t* end, uint64_t& value, bool)
+	{
+		return loadVarint(in, end, value);
+	}
+};
+
+// uint32 length then the bytes. Decoded views point into the frame, so they live as long as it does.
+template <>
+struct WireField<std::string_view>
+{
+	static constexpr size_t FIXED_SIZE = 4;
+
+	static size_t DynamicSize(std::string_view value)
+	{
+		return value.length();
+	}
+
+	static uint8_t* Encode(uint8_t* out, std::string_view value)
+	{
+		storeUInt32LE(out, (uint32_t)value.length());
+		if (!value.empty())
+		{
+			memcpy(out + 4, value.data(), value.length());
+		}
+		return out + 4 + value.length();
+	}
+
+	static bool Decode(const uint8_t*& in, size_t& dynamicBytesLeft, std::string_view& value)
+	{
+		uint32_t length = loadUInt32LE(in);
+		if (length > dynamicBytesLeft)
+			return false;
+
+		value = std::string_view((const char*)in + 4, length);
+		in += 4 + length;
+		dynamicBytesLeft -= length;
+		return true;
+	}
+
+	// The last field's length is wherever the frame ends
+	static size_t CompactSize(std::string_view value, bool last)
+	{
+		return (last ? 0 : varintSize(value.length())) + value.length();
+	}
+
+	static uint8_t* EncodeCompact(uint8_t* out, std::string_view value, bool last)
+	{
+		if (!last)
+		{
+			out = storeVarint(out, value.length());
+		}
+		if (!value.empty())
+		{
+			memcpy(out, value.data(), value.length());
+		}
+		return out + value.length();
+	}
+
+	static bool DecodeCompact(const uint8_t*& in, const uint8_t* end, std::string_view& value, bool last)
+	{
+		uint64_t length = (uint64_t)(end - in);
+		if (!last && (!loadVarint(in, end, length) || length > (uint64_t)(end - in)))
+			return false;
+
+		value = std::string_view((const char*)in, (size_t)length);
+		in += length;
+		return true;
+	}
+};
+
+// The WireField for a pointer to member, e.g. &ChatMessage::message
+template <typename Member>
+struct WireFieldOfMember;
+
+template <typename Message, typename Field>
+struct WireFieldOfMember<Field Message::*>
+{
+	typedef WireField<typename std::remove_cv<Field>::type> Type;
+};
+
+template <typename Member>
+using WireFieldOf = typename WireFieldOfMember<Member>::Type;
+
+template <typename FieldList, size_t... Index>
+constexpr size_t fixedFieldsSize(std::index_sequence<Index...>)
+{
+	return (size_t(0) + ... + WireFieldOf<typename std::tuple_element<Index, FieldList>::type>::FIXED_SIZE);
+}
+
+template <typename Message>
+class MessageSchema
+{
+public:
+
+	typedef decltype(Message::Fields()) FieldList;
+
+	// Header plus the fixed part of every field, known at compile time
+	static constexpr size_t FIXED_SIZE = FRAME_HEADER_SIZE + fixedFieldsSize<FieldList>(std::make_index_sequence<std::tuple_size<FieldList>::value>());
+
+	static size_t EncodedSize(const Message& message)
+	{
+		size_t size = FIXED_SIZE;
+		std::apply([&](auto... members)
+		{
+			((size += WireFieldOf<decltype(members)>::DynamicSize(message.*members)), ...);
+		}, Message::Fields());
+		return size;
+	}
+
+	// Writes the whole frame to out, which must have EncodedSize bytes. Returns the end of the frame.
+	static uint8_t* EncodeTo(const Message& message, uint32_t packetSize, uint8_t* out)
+	{
+		storeUInt32LE(out, packetSize);
+		storeUInt32LE(out + 4, Message::TYPE);
+		out += FRAME_HEADER_SIZE;
+
+		std::apply([&](auto... members)
+		{
+			((out = WireFieldOf<decltype(members)>::Encode(out, message.*members)), ...);
+		}, Message::Fields());
+		return out;
+	}
+
+	// Appends the frame to the buffer with one size check, returns its packetSize
+	static uint32_t Encode(const Message& message, Buffer& buffer)
+	{
+		uint32_t packetSize = (uint32_t)EncodedSize(message);
+		EncodeTo(message, packetSize, buffer.PrepareWrite(packetSize));
+		buffer.CommitWrite(packetSize);
+		return packetSize;
+	}
+
+	// Fills message from one complete frame. Returns false if the frame isn't this type or its fields don't fit in it.
+	static bool Decode(const uint8_t* frame, uint32_t packetSize, Message& message)
+	{
+		if (packetSize < FIXED_SIZE || loadUInt32LE(frame + 4) != Message::TYPE)
+			return false;
+
+		const uint8_t* in = frame + FRAME_HEADER_SIZE;
+		size_t dynamicBytesLeft = packetSize - FIXED_SIZE;
+		bool valid = true;
+
+		std::apply([&](auto... members)
+		{
+			valid = (WireFieldOf<decltype(members)>::Decode(in, dynamicBytesLeft, message.*members) && ...);
+		}, Message::Fields());
+		return valid;
+	}
+};
+
+// The type byte of a complete v2 frame, right after its size
+inline const uint8_t* compactFrameType(const uint8_t* frame)
+{
+	while (*frame & 0x80)
+	{
+		frame++;
+	}
+	return frame + 1;
+}
+
+template <typename Message>
+class CompactSchema
+{
+public:
+
+	typedef decltype(Message::Fields()) FieldList;
+	static constexpr size_t FIELD_COUNT = std::tuple_size<FieldList>::value;
+
+	static_assert(Message::TYPE < 0x80, "a v2 type is one byte and its high bit marks a compressed frame");
+
+	// The type byte and the fields, what the size varint counts
+	static size_t BodySize(const Message& message)
+	{
+		size_t size = 1;
+		AllFields([&](auto member, bool last)
+		{
+			size += WireFieldOf<decltype(member)>::CompactSize(message.*member, last);
+			return true;
+		});
+		return size;
+	}
+
+	// Appends the frame to the buffer with one size check, returns its size
+	static uint32_t Encode(const Message& message, Buffer& buffer)
+	{
+		size_t bodySize = BodySize(message);
+		size_t frameSize = varintSize(bodySize) + bodySize;
+
+		uint8_t* out = storeVarint(buffer.PrepareWrite(frameSize), bodySize);
+		*out++ = (uint8_t)Message::TYPE;
+		AllFields([&](auto member, bool last)
+		{
+			out = WireFieldOf<decltype(member)>::EncodeCompact(out, message.*member, last);
+			return true;
+		});
+
+		buffer.CommitWrite(frameSize);
+		return (uint32_t)frameSize;
+	}
+
+	// Fills message from one complete frame. Returns false if the frame isn't this type or its fields don't fit in it.
+	static bool Decode(const uint8_t* frame, uint32_t frameSize, Message& message)
+	{
+		const uint8_t* in = frame;
+		const uint8_t* end = frame + frameSize;
+		uint64_t bodySize;
+		if (!loadVarint(in, end, bodySize) || bodySize != (uint64_t)(end - in) || bodySize < 1 || *in != Message::TYPE)
+			return false;
+		in++;
+
+		return AllFields([&](auto member, bool last)
+		{
+			return WireFieldOf<decltype(member)>::DecodeCompact(in, end, message.*member, last);
+		});
+	}
+
+private:
+
+	// Calls visit(member, bool last) for each field in order until one returns false
+	template <typename Visit>
+	static bool AllFields(Visit visit)
+	{
+		return AllFields(visit, std::make_index_sequence<FIELD_COUNT>());
+	}
+
+	template <typename Visit, size_t... Index>
+	static bool AllFields(Visit visit, std::index_sequence<Index...>)
+	{
+		return (true && ... && visit(std::get<Index>(Message::Fields()), Index + 1 == FIELD_COUNT));
+	}
+};
+
+// Reads the messageType of a complete frame so the caller can pick what to decode it as
+inline uint32_t peekMessageType(const uint8_t* frame, WireVersion version = WIRE_V1)
+{
+	return version == WIRE_V1 ? loadUInt32LE(frame + 4) : *compactFrameType(frame);
+}
+
+template <typename Message>
+uint32_t encodeMessage(const Message& message, Buffer& buffer, WireVersion version = WIRE_V1)
+{
+	if (version == WIRE_V2)
+		return CompactSchema<Message>::Encode(message, buffer);
+	return MessageSchema<Message>::Encode(message, buffer);
+}
+
+template <typename Message>
+bool decodeMessage(const uint8_t* frame, uint32_t packetSize, Message& message, WireVersion version = WIRE_V1)
+{
+	if (version == WIRE_V2)
+		return CompactSchema<Message>::Decode(frame, packetSize, message);
+	return MessageSchema<Message>::Decode(frame, packetSize, message);
+}
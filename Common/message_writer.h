@@ -0,0 +1,181 @@
+#pragma once
+
+#include "socket_platform.h"
+#include "buffer.h"
+#include "chat_messages.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Collects chat lines into what goes on the wire for them: a plain chat frame for one line,
+// a ChatBatchMessage for more. Works on Buffers only, so blocking and non-blocking senders can share it.
+class ChatBatcher
+{
+public:
+
+	// The batch frame has to stay under MAX_FRAME_SIZE or the server drops the connection
+	static const size_t MAX_FRAMES_BYTES = MAX_FRAME_SIZE - MessageSchema<ChatBatchMessage>::FIXED_SIZE;
+
+	Buffer m_Frames;	// encoded chat frames not yet finished into wire bytes
+	uint32_t m_Count;
+	WireVersion m_Version;	// what the lines and the batch frame are encoded in, change it only while Empty
+
+	ChatBatcher()
+	{
+		m_Count = 0;
+		m_Version = WIRE_V1;
+	}
+
+	bool Empty() const
+	{
+		return m_Count == 0;
+	}
+
+	uint32_t Count() const
+	{
+		return m_Count;
+	}
+
+	size_t Size() const
+	{
+		return m_Frames.Size();
+	}
+
+	// False if the line would push the batch over the frame limit, finish what is there first.
+	// Sized as v1, which is never smaller than v2.
+	bool Fits(const ChatMessage& chatMessage) const
+	{
+		return m_Frames.Size() + MessageSchema<ChatMessage>::EncodedSize(chatMessage) <= MAX_FRAMES_BYTES;
+	}
+
+	void Add(const ChatMessage& chatMessage)
+	{
+		encodeMessage(chatMessage, m_Frames, m_Version);
+		m_Count++;
+	}
+
+	// Appends the wire bytes for everything added so far to out and starts over
+	void FinishInto(Buffer& out)
+	{
+		if (m_Count == 1)
+		{
+			// A single line goes as it is, a batch header would only cost bytes
+			out.WriteBytes(m_Frames.Data(), m_Frames.Size());
+		}
+		else if (m_Count > 1)
+		{
+			ChatBatchMessage batch;
+			batch.count = m_Count;
+			batch.frames = std::string_view((const char*)m_Frames.Data(), m_Frames.Size());
+			encodeMessage(batch, out, m_Version);
+		}
+
+		m_Frames.Clear();
+		m_Count = 0;
+	}
+};
+
+enum FlushPolicy
+{
+	FLUSH_EVERY_MESSAGE,	// interactive, each line is written as soon as it is queued
+	FLUSH_CORKED,			// bulk, lines wait for Flush or for the cork limit and go out as one batch frame
+};
+
+// The send side of a client on a blocking socket.
+//
+// Corked, a burst of lines costs one send and one frame header instead of one of each per line, the caller
+// decides when the burst ends by calling Flush. Uncorked, every line is written on its own straight away.
+// Either way we coalesce in user space, so Nagle has nothing left to add and TCP_NODELAY is on by default:
+// an interactive line goes out now instead of waiting for the ACK of the previous one.
+class MessageWriter
+{
+public:
+
+	static const size_t DEFAULT_CORK_LIMIT = 16 * 1024;
+
+	SOCKET m_Socket;
+	FlushPolicy m_Policy;
+	size_t m_CorkLimit;		// corked lines are flushed once this many bytes are waiting
+	ChatBatcher m_Batcher;
+	Buffer m_Wire;
+
+	MessageWriter(SOCKET socket, FlushPolicy policy, size_t corkLimit = DEFAULT_CORK_LIMIT)
+		: m_Wire(4096)
+	{
+		m_Socket = socket;
+		m_Policy = policy;
+		m_CorkLimit = corkLimit;
+		SetNoDelay(true);
+	}
+
+	bool SetNoDelay(bool noDelay)
+	{
+		int value = noDelay ? 1 : 0;
+		if (setsockopt(m_Socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&value, sizeof(value)) == SOCKET_ERROR)
+		{
+			printf("TCP_NODELAY failed with error %d\n", WSAGetLastError());
+			return false;
+		}
+		return true;
+	}
+
+	void SetPolicy(FlushPolicy policy)
+	{
+		m_Policy = policy;
+	}
+
+	// Queues one line. Returns false if a write it triggered failed, the connection is gone.
+	bool Write(const ChatMessage& chatMessage)
+	{
+		if (!m_Batcher.Empty() && !m_Batcher.Fits(chatMessage) && !Flush())
+			return false;
+
+		m_Batcher.Add(chatMessage);
+
+		if (m_Policy == FLUSH_EVERY_MESSAGE || m_Batcher.Size() >= m_CorkLimit)
+			return Flush();
+		return true;
+	}
+
+	// Anything other than a chat line goes out on its own straight away, after the lines queued before it
+	template <typename Message>
+	bool WriteNow(const Message& message)
+	{
+		if (!Flush())
+			return false;
+
+		encodeMessage(message, m_Wire);
+		return SendWire();
+	}
+
+	// Writes everything queued in one send. Returns false if the socket failed.
+	bool Flush()
+	{
+		if (m_Batcher.Empty())
+			return true;
+
+		m_Batcher.FinishInto(m_Wire);
+		return SendWire();
+	}
+
+private:
+
+	bool SendWire()
+	{
+		size_t sent = 0;
+		while (sent < m_Wire.Size())
+		{
+			int result = send(m_Socket, (const char*)m_Wire.Data() + sent, (int)(m_Wire.Size() - sent), 0);
+			if (result == SOCKET_ERROR)
+			{
+				printf("send failed with error %d\n", WSAGetLastError());
+				m_Wire.Clear();
+				return false;
+			}
+			sent += result;
+		}
+
+		m_Wire.Clear();
+		return true;
+	}
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "latency_histogram.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+// Counters, gauges and histograms cheap enough to leave on in the hot path.
+//
+// Each one has a single writer, the thread that owns it, and any number of readers on other threads. The writer
+// does a relaxed load and store instead of a locked read-modify-write, so an update costs what a plain increment
+// does, and a reader always sees a whole value that is at most a moment old. Don't update one from two threads.
+
+class MetricCounter
+{
+public:
+
+	std::atomic<uint64_t> m_Value;
+
+	MetricCounter()
+		: m_Value(0)
+	{
+	}
+
+	void Add(uint64_t amount = 1)
+	{
+		m_Value.store(m_Value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	uint64_t Value() const
+	{
+		return m_Value.load(std::memory_order_relaxed);
+	}
+};
+
+// A level that goes up and down, e.g. bytes waiting in queues
+class MetricGauge
+{
+public:
+
+	std::atomic<int64_t> m_Value;
+
+	MetricGauge()
+		: m_Value(0)
+	{
+	}
+
+	void Add(int64_t amount)
+	{
+		m_Value.store(m_Value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	int64_t Value() const
+	{
+		return m_Value.load(std::memory_order_relaxed);
+	}
+};
+
+// A LatencyHistogram other threads can read while the owner records into it.
+// The buckets are the same, a reader takes a Snapshot and asks that for percentiles.
+class MetricHistogram
+{
+public:
+
+	std::atomic<uint64_t> m_Counts[LatencyHistogram::BUCKET_COUNT];
+	MetricCounter m_TotalCount;
+	MetricCounter m_Sum;
+	std::atomic<uint64_t> m_Max;
+
+	MetricHistogram()
+		: m_Max(0)
+	{
+		for (std::atomic<uint64_t>& count : m_Counts)
+		{
+			count.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	void Record(uint64_t value)
+	{
+		std::atomic<uint64_t>& count = m_Counts[LatencyHistogram::BucketFor(value)];
+		count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		m_TotalCount.Add();
+		m_Sum.Add(value);
+		if (value > m_Max.load(std::memory_order_relaxed))
+			m_Max.store(value, std::memory_order_relaxed);
+	}
+
+	// Copies the buckets out, the total is recounted from them so it matches what was copied
+	void Snapshot(LatencyHistogram& histogram) const
+	{
+		histogram.Clear();
+		for (int i = 0; i < LatencyHistogram::BUCKET_COUNT; i++)
+		{
+			histogram.m_Counts[i] = m_Counts[i].load(std::memory_order_relaxed);
+			histogram.m_TotalCount += histogram.m_Counts[i];
+		}
+		histogram.m_Sum = m_Sum.Value();
+		histogram.m_Max = m_Max.load(std::memory_order_relaxed);
+	}
+};
+
+// Nanoseconds on the steady clock, what every timing metric records differences of
+inline uint64_t metricsNow()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <new>
+#include <utility>
+
+#include "buffer_pool.h"
+
+// Lock-free multi producer, single consumer queue for handing work to another thread.
+//
+// Producers push onto an atomic singly linked stack with one CAS. The consumer takes the whole stack with
+// one exchange and reverses it, so it never contends with the producers item by item, and every
+// producer's items come out in the order it pushed them.
+//
+// Nodes come from a free list the inbox keeps itself, the consumer hands them back once it is done with them
+// and the next Push takes them again, so a steady stream of items allocates nothing whichever threads push.
+// Many producers take from the list at once, so its head carries a count of the takes next to the index, a
+// producer that read a node which was taken and given back in the meantime fails its CAS instead of handing
+// out a node twice. Only past POOLED_NODES items waiting at once do nodes come from the BufferPool.
+template <typename T>
+class MpscInbox
+{
+public:
+
+	static const uint32_t POOLED_NODES = 4096;
+
+	struct Node
+	{
+		Node* next;
+		T value;
+	};
+
+	std::atomic<Node*> m_Head;
+
+	MpscInbox()
+	{
+		m_Head = nullptr;
+
+		// Indexes are kept one up, 0 ends the list
+		for (uint32_t i = 0; i < POOLED_NODES; i++)
+		{
+			m_PooledNext[i].store(i + 2 <= POOLED_NODES ? i + 2 : 0, std::memory_order_relaxed);
+		}
+		m_FreeHead = 1;
+	}
+
+	~MpscInbox()
+	{
+		Free(m_Head.exchange(nullptr));
+	}
+
+	MpscInbox(const MpscInbox&) = delete;
+	MpscInbox& operator=(const MpscInbox&) = delete;
+
+	// Safe from any thread
+	void Push(T value)
+	{
+		Node* node = new (TakeNode()) Node{ nullptr, std::move(value) };
+
+		Node* head = m_Head.load(std::memory_order_relaxed);
+		do
+		{
+			node->next = head;
+		} while (!m_Head.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	// Consumer thread only. Calls onItem(T&) for everything pushed so far, oldest first, returns the count.
+	template <typename OnItem>
+	int Drain(OnItem onItem)
+	{
+		Node* newestFirst = m_Head.exchange(nullptr, std::memory_order_acquire);
+
+		Node* oldestFirst = nullptr;
+		while (newestFirst != nullptr)
+		{
+			Node* next = newestFirst->next;
+			newestFirst->next = oldestFirst;
+			oldestFirst = newestFirst;
+			newestFirst = next;
+		}
+
+		int count = 0;
+		while (oldestFirst != nullptr)
+		{
+			Node* next = oldestFirst->next;
+			onItem(oldestFirst->value);
+			Destroy(oldestFirst);
+			oldestFirst = next;
+			count++;
+		}
+		return count;
+	}
+
+private:
+
+	struct alignas(Node) NodeStorage
+	{
+		unsigned char bytes[sizeof(Node)];
+	};
+
+	NodeStorage m_Pooled[POOLED_NODES];
+	std::atomic<uint32_t> m_PooledNext[POOLED_NODES];
+	std::atomic<uint64_t> m_FreeHead;	// takes so far in the high half, the first free index in the low half
+
+	// Any producer
+	void* TakeNode()
+	{
+		uint64_t head = m_FreeHead.load(std::memory_order_acquire);
+		while ((uint32_t)head != 0)
+		{
+			uint32_t index = (uint32_t)head - 1;
+			uint64_t next = (((head >> 32) + 1) << 32) | m_PooledNext[index].load(std::memory_order_relaxed);
+			if (m_FreeHead.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire))
+				return &m_Pooled[index];
+		}
+
+		return BufferPool::Allocate(sizeof(Node));
+	}
+
+	// Consumer only, or the destructor
+	void Destroy(Node* node)
+	{
+		node->~Node();
+
+		NodeStorage* storage = (NodeStorage*)node;
+		if (storage < m_Pooled || storage >= m_Pooled + POOLED_NODES)
+		{
+			BufferPool::Free(node, sizeof(Node));
+			return;
+		}
+
+		uint32_t index = (uint32_t)(storage - m_Pooled);
+		uint64_t head = m_FreeHead.load(std::memory_order_relaxed);
+		uint64_t freed;
+		do
+		{
+			m_PooledNext[index].store((uint32_t)head, std::memory_order_relaxed);
+			freed = (head & 0xFFFFFFFF00000000ull) | (index + 1);
+		} while (!m_FreeHead.compare_exchange_weak(head, freed, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	void Free(Node* node)
+	{
+		while (node != nullptr)
+		{
+			Node* next = node->next;
+			Destroy(node);
+			node = next;
+		}
+	}
+};
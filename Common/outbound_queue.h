@@ -0,0 +1,256 @@
+#pragma once
+
+#include "socket_platform.h"
+#include "shared_frame.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+// What to do with a client whose outbound queue went over the high watermark
+enum SlowConsumerPolicy
+{
+	SLOW_CONSUMER_DROP_OLDEST,	// throw away the oldest unsent frames, the client misses part of the backlog
+	SLOW_CONSUMER_DROP_NEWEST,	// stop queueing new frames until it has caught up
+	SLOW_CONSUMER_DISCONNECT,	// close the connection
+};
+
+struct OutboundLimits
+{
+	size_t highWatermark;	// queued bytes at which a client counts as slow
+	size_t lowWatermark;	// a slow client has to drain below this before it counts as healthy again
+	SlowConsumerPolicy policy;
+};
+
+inline OutboundLimits defaultOutboundLimits()
+{
+	OutboundLimits limits;
+	limits.highWatermark = 4 * 1024 * 1024;
+	limits.lowWatermark = 1024 * 1024;
+	limits.policy = SLOW_CONSUMER_DROP_OLDEST;
+	return limits;
+}
+
+// Accepts drop-oldest, drop-newest or disconnect
+inline bool parseSlowConsumerPolicy(const std::string& name, SlowConsumerPolicy& policy)
+{
+	if (name == "drop-oldest")
+		policy = SLOW_CONSUMER_DROP_OLDEST;
+	else if (name == "drop-newest")
+		policy = SLOW_CONSUMER_DROP_NEWEST;
+	else if (name == "disconnect")
+		policy = SLOW_CONSUMER_DISCONNECT;
+	else
+		return false;
+
+	return true;
+}
+
+inline const char* slowConsumerPolicyName(SlowConsumerPolicy policy)
+{
+	switch (policy)
+	{
+	case SLOW_CONSUMER_DROP_OLDEST: return "drop-oldest";
+	case SLOW_CONSUMER_DROP_NEWEST: return "drop-newest";
+	case SLOW_CONSUMER_DISCONNECT: return "disconnect";
+	}
+	return "unknown";
+}
+
+// Frames waiting to be written to one client.
+//
+// The server never blocks on a client, whatever the socket won't take right now waits here until it is writable.
+// Only whole frames are ever dropped so the stream stays framed, never one the writer has started on and never
+// an undroppable one, see FrameRef::MarkUndroppable. Those still count towards the watermarks.
+class OutboundQueue
+{
+public:
+
+	enum PushResult
+	{
+		PUSH_QUEUED,
+		PUSH_DROPPED,		// the frame wasn't queued, the client is over its limit
+		PUSH_DISCONNECT,	// the client is over its limit and the policy says to close it
+	};
+
+	static const int MAX_FRAMES_PER_WRITE = 64;
+
+	std::deque<FrameRef, PoolAllocator<FrameRef>> m_Frames;	// shared with every other recipient of a broadcast, chunks come from the BufferPool
+	size_t m_HeadOffset;			// bytes of the front frame already written
+	size_t m_QueuedBytes;			// bytes not yet written, across all frames
+	size_t m_InFlightFrames;		// front frames handed to the kernel by an async writer, they can't be dropped
+	bool m_OverLimit;				// went over the high watermark and hasn't drained below the low one yet
+	bool m_Disconnecting;			// over the limit under the disconnect policy, waiting to be closed
+	uint64_t m_DroppedFrames;
+
+	OutboundQueue()
+	{
+		m_HeadOffset = 0;
+		m_QueuedBytes = 0;
+		m_InFlightFrames = 0;
+		m_OverLimit = false;
+		m_Disconnecting = false;
+		m_DroppedFrames = 0;
+	}
+
+	bool Empty() const
+	{
+		return m_Frames.empty();
+	}
+
+	PushResult Push(const FrameRef& frame, const OutboundLimits& limits)
+	{
+		// An empty queue always takes the frame, otherwise a frame bigger than the limit could never be sent
+		if (!m_Frames.empty() && m_QueuedBytes + frame.Size() > limits.highWatermark)
+		{
+			m_OverLimit = true;
+		}
+
+		if (m_OverLimit)
+		{
+			switch (limits.policy)
+			{
+			case SLOW_CONSUMER_DISCONNECT:
+				// Only reported once, the engine closes the connection when it is safe to
+				if (m_Disconnecting)
+					return PUSH_DROPPED;
+				m_Disconnecting = true;
+				return PUSH_DISCONNECT;
+
+			case SLOW_CONSUMER_DROP_NEWEST:
+				if (frame.Undroppable())
+					break;
+				m_DroppedFrames++;
+				return PUSH_DROPPED;
+
+			case SLOW_CONSUMER_DROP_OLDEST:
+				DropOldest(limits.lowWatermark > frame.Size() ? limits.lowWatermark - frame.Size() : 0);
+				m_OverLimit = m_QueuedBytes + frame.Size() > limits.lowWatermark;
+				break;
+			}
+		}
+
+		m_Frames.push_back(frame);
+		m_QueuedBytes += frame.Size();
+		return PUSH_QUEUED;
+	}
+
+	// Retires bytes the socket took, the last recipient to finish a frame frees it
+	void Consume(size_t bytes, const OutboundLimits& limits)
+	{
+		m_QueuedBytes -= bytes;
+
+		while (bytes > 0)
+		{
+			size_t remaining = m_Frames.front().Size() - m_HeadOffset;
+			if (bytes < remaining)
+			{
+				m_HeadOffset += bytes;
+				break;
+			}
+
+			bytes -= remaining;
+			m_HeadOffset = 0;
+			m_Frames.pop_front();
+		}
+
+		if (m_OverLimit && m_QueuedBytes <= limits.lowWatermark)
+		{
+			m_OverLimit = false;
+		}
+	}
+
+	// Describes up to maxCount of the unwritten bytes for a gather write, returns how many entries it filled
+	template <typename IoVec>
+	int Gather(IoVec* vectors, int maxCount, void (*fill)(IoVec&, const uint8_t*, size_t)) const
+	{
+		int count = 0;
+		for (const FrameRef& frame : m_Frames)
+		{
+			if (count == maxCount)
+				break;
+
+			size_t offset = count == 0 ? m_HeadOffset : 0;
+			fill(vectors[count], frame.Data() + offset, frame.Size() - offset);
+			count++;
+		}
+		return count;
+	}
+
+	// Writes as much as the non-blocking socket takes.
+	// Returns false on a socket error, true if the queue drained or the socket would block.
+	bool WriteTo(SOCKET socket, const OutboundLimits& limits)
+	{
+		while (!m_Frames.empty())
+		{
+#ifdef _WIN32
+			WSABUF buffers[MAX_FRAMES_PER_WRITE];
+			int count = Gather<WSABUF>(buffers, MAX_FRAMES_PER_WRITE, [](WSABUF& buffer, const uint8_t* data, size_t length)
+			{
+				buffer.buf = (CHAR*)data;
+				buffer.len = (ULONG)length;
+			});
+
+			DWORD sent = 0;
+			if (WSASend(socket, buffers, count, &sent, 0, NULL, NULL) == SOCKET_ERROR)
+			{
+				return isWouldBlock(WSAGetLastError());
+			}
+#else
+			iovec vectors[MAX_FRAMES_PER_WRITE];
+			int count = Gather<iovec>(vectors, MAX_FRAMES_PER_WRITE, [](iovec& vector, const uint8_t* data, size_t length)
+			{
+				vector.iov_base = (void*)data;
+				vector.iov_len = length;
+			});
+
+			msghdr message;
+			memset(&message, 0, sizeof(message));
+			message.msg_iov = vectors;
+			message.msg_iovlen = count;
+
+			ssize_t sent = sendmsg(socket, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (sent < 0)
+			{
+				return isWouldBlock(errno) || errno == EINTR;
+			}
+#endif
+
+			Consume((size_t)sent, limits);
+		}
+
+		return true;
+	}
+
+private:
+
+	// Drops whole frames from the front until at most targetBytes are queued, skipping the ones the writer is on
+	// and undroppable ones
+	void DropOldest(size_t targetBytes)
+	{
+		size_t pinned = m_InFlightFrames;
+		if (pinned == 0 && m_HeadOffset > 0)
+		{
+			pinned = 1;
+		}
+
+		auto oldest = m_Frames.begin() + (pinned < m_Frames.size() ? pinned : m_Frames.size());
+		while (m_QueuedBytes > targetBytes && oldest != m_Frames.end())
+		{
+			if (oldest->Undroppable())
+			{
+				++oldest;
+				continue;
+			}
+
+			m_QueuedBytes -= oldest->Size();
+			oldest = m_Frames.erase(oldest);
+			m_DroppedFrames++;
+		}
+	}
+};
@@ -0,0 +1,299 @@
+#pragma once
+
+#include "socket_platform.h"
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+// Readiness flags shared by every backend
+enum ReactorEventFlags : uint32_t
+{
+	REACTOR_READ = 1,
+	REACTOR_WRITE = 2,
+	REACTOR_HANGUP = 4,		// peer closed or the socket has an error, a read will tell us which
+};
+
+struct ReactorEvent
+{
+	SOCKET socket;
+	uint32_t events;
+};
+
+// Waits for sockets to become ready. Sockets are registered once and stay registered until removed.
+class Reactor
+{
+public:
+
+	virtual ~Reactor() {}
+
+	virtual const char* Name() const = 0;
+
+	// Edge triggered backends only report a socket again after new data arrives,
+	// so the caller must drain it until the read would block
+	virtual bool IsEdgeTriggered() const = 0;
+
+	virtual bool Add(SOCKET socket, uint32_t events) = 0;
+	virtual bool Modify(SOCKET socket, uint32_t events) = 0;
+	virtual void Remove(SOCKET socket) = 0;
+
+	// Fills readyEvents with the ready sockets, returns the count, 0 on timeout or SOCKET_ERROR
+	virtual int Wait(std::vector<ReactorEvent>& readyEvents, int timeoutMs) = 0;
+};
+
+// The original loop: every wait rebuilds the whole interest set, so each wakeup costs O(registered sockets).
+// Windows uses select() and is capped at FD_SETSIZE sockets. POSIX uses poll(), which has the same
+// per wakeup cost but no descriptor ceiling, so the two paths can be compared at any size.
+class SelectReactor : public Reactor
+{
+public:
+
+	struct Registration
+	{
+		SOCKET socket;
+		uint32_t events;
+	};
+
+	std::vector<Registration> m_Registrations;
+
+#ifndef _WIN32
+	std::vector<pollfd> m_PollFds;
+#endif
+
+	const char* Name() const override { return "select"; }
+	bool IsEdgeTriggered() const override { return false; }
+
+	bool Add(SOCKET socket, uint32_t events) override
+	{
+#ifdef _WIN32
+		if (m_Registrations.size() >= FD_SETSIZE)
+			return false;
+#endif
+		m_Registrations.push_back({ socket, events });
+		return true;
+	}
+
+	bool Modify(SOCKET socket, uint32_t events) override
+	{
+		for (Registration& registration : m_Registrations)
+		{
+			if (registration.socket == socket)
+			{
+				registration.events = events;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void Remove(SOCKET socket) override
+	{
+		for (size_t i = 0; i < m_Registrations.size(); i++)
+		{
+			if (m_Registrations[i].socket == socket)
+			{
+				m_Registrations[i] = m_Registrations.back();
+				m_Registrations.pop_back();
+				return;
+			}
+		}
+	}
+
+	int Wait(std::vector<ReactorEvent>& readyEvents, int timeoutMs) override
+	{
+		readyEvents.clear();
+
+#ifdef _WIN32
+		fd_set socketsReadyForReading;
+		fd_set socketsReadyForWriting;
+		FD_ZERO(&socketsReadyForReading);
+		FD_ZERO(&socketsReadyForWriting);
+
+		for (const Registration& registration : m_Registrations)
+		{
+			if (registration.events & REACTOR_READ)
+				FD_SET(registration.socket, &socketsReadyForReading);
+			if (registration.events & REACTOR_WRITE)
+				FD_SET(registration.socket, &socketsReadyForWriting);
+		}
+
+		timeval tv;
+		tv.tv_sec = timeoutMs / 1000;
+		tv.tv_usec = (timeoutMs % 1000) * 1000;
+
+		int count = select(0, &socketsReadyForReading, &socketsReadyForWriting, NULL, timeoutMs < 0 ? NULL : &tv);
+		if (count <= 0)
+			return count;
+
+		for (const Registration& registration : m_Registrations)
+		{
+			uint32_t events = 0;
+			if (FD_ISSET(registration.socket, &socketsReadyForReading))
+				events |= REACTOR_READ;
+			if (FD_ISSET(registration.socket, &socketsReadyForWriting))
+				events |= REACTOR_WRITE;
+
+			if (events != 0)
+				readyEvents.push_back({ registration.socket, events });
+		}
+#else
+		m_PollFds.resize(m_Registrations.size());
+		for (size_t i = 0; i < m_Registrations.size(); i++)
+		{
+			m_PollFds[i].fd = m_Registrations[i].socket;
+			m_PollFds[i].events = 0;
+			m_PollFds[i].revents = 0;
+			if (m_Registrations[i].events & REACTOR_READ)
+				m_PollFds[i].events |= POLLIN;
+			if (m_Registrations[i].events & REACTOR_WRITE)
+				m_PollFds[i].events |= POLLOUT;
+		}
+
+		int count = poll(m_PollFds.data(), m_PollFds.size(), timeoutMs);
+		if (count <= 0)
+			return count;
+
+		for (const pollfd& pfd : m_PollFds)
+		{
+			uint32_t events = 0;
+			if (pfd.revents & POLLIN)
+				events |= REACTOR_READ;
+			if (pfd.revents & POLLOUT)
+				events |= REACTOR_WRITE;
+			if (pfd.revents & (POLLHUP | POLLERR))
+				events |= REACTOR_HANGUP;
+
+			if (events != 0)
+				readyEvents.push_back({ pfd.fd, events });
+		}
+#endif
+
+		return (int)readyEvents.size();
+	}
+};
+
+#ifdef __linux__
+
+// Edge triggered epoll. Each socket is registered once at accept and a wait only returns sockets
+// that actually became ready, so a wakeup costs O(ready sockets) no matter how many are connected.
+class EpollReactor : public Reactor
+{
+public:
+
+	int m_EpollFd;
+	std::vector<epoll_event> m_Events;
+
+	EpollReactor(int maxEventsPerWait = 1024)
+	{
+		m_EpollFd = epoll_create1(EPOLL_CLOEXEC);
+		m_Events.resize(maxEventsPerWait);
+	}
+
+	~EpollReactor()
+	{
+		if (m_EpollFd != -1)
+			close(m_EpollFd);
+	}
+
+	const char* Name() const override { return "epoll"; }
+	bool IsEdgeTriggered() const override { return true; }
+
+	static uint32_t ToEpollEvents(uint32_t events)
+	{
+		uint32_t epollEvents = EPOLLET | EPOLLRDHUP;
+		if (events & REACTOR_READ)
+			epollEvents |= EPOLLIN;
+		if (events & REACTOR_WRITE)
+			epollEvents |= EPOLLOUT;
+		return epollEvents;
+	}
+
+	bool Add(SOCKET socket, uint32_t events) override
+	{
+		epoll_event ev;
+		ev.events = ToEpollEvents(events);
+		ev.data.u64 = 0;
+		ev.data.fd = socket;
+		return epoll_ctl(m_EpollFd, EPOLL_CTL_ADD, socket, &ev) == 0;
+	}
+
+	bool Modify(SOCKET socket, uint32_t events) override
+	{
+		epoll_event ev;
+		ev.events = ToEpollEvents(events);
+		ev.data.u64 = 0;
+		ev.data.fd = socket;
+		return epoll_ctl(m_EpollFd, EPOLL_CTL_MOD, socket, &ev) == 0;
+	}
+
+	void Remove(SOCKET socket) override
+	{
+		epoll_ctl(m_EpollFd, EPOLL_CTL_DEL, socket, NULL);
+	}
+
+	int Wait(std::vector<ReactorEvent>& readyEvents, int timeoutMs) override
+	{
+		readyEvents.clear();
+
+		int count = epoll_wait(m_EpollFd, m_Events.data(), (int)m_Events.size(), timeoutMs);
+		if (count < 0)
+			return errno == EINTR ? 0 : SOCKET_ERROR;
+
+		for (int i = 0; i < count; i++)
+		{
+			uint32_t events = 0;
+			if (m_Events[i].events & EPOLLIN)
+				events |= REACTOR_READ;
+			if (m_Events[i].events & EPOLLOUT)
+				events |= REACTOR_WRITE;
+			if (m_Events[i].events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR))
+				events |= REACTOR_HANGUP;
+
+			readyEvents.push_back({ m_Events[i].data.fd, events });
+		}
+
+		return count;
+	}
+};
+
+#endif
+
+inline const char* defaultReactorName()
+{
+#ifdef __linux__
+	return "epoll";
+#else
+	return "select";
+#endif
+}
+
+// Returns nullptr if the backend is unknown or unavailable on this platform
+inline std::unique_ptr<Reactor> createReactor(const std::string& name)
+{
+	if (name == "select")
+		return std::unique_ptr<Reactor>(new SelectReactor());
+
+#ifdef __linux__
+	if (name == "epoll")
+	{
+		EpollReactor* reactor = new EpollReactor();
+		if (reactor->m_EpollFd == -1)
+		{
+			delete reactor;
+			return nullptr;
+		}
+		return std::unique_ptr<Reactor>(reactor);
+	}
+#endif
+
+	return nullptr;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+
+#include "buffer_pool.h"
+
+// An encoded frame that many outbound queues can point at.
+//
+// The header and the bytes live in one allocation and never change once shared, so a broadcast encodes once and
+// every recipient just holds a reference. The memory goes back to the BufferPool when the last recipient has written it.
+// The count is atomic so references can be handed to other threads.
+class SharedFrame
+{
+public:
+
+	std::atomic<uint32_t> m_RefCount;
+	uint32_t m_Size;
+	bool m_Undroppable;		// queued even for a slow consumer whose policy drops frames, see OutboundQueue
+
+	// The frame bytes follow the object in the same allocation
+	const uint8_t* Data() const
+	{
+		return (const uint8_t*)(this + 1);
+	}
+
+	uint32_t Size() const
+	{
+		return m_Size;
+	}
+
+	// Starts with one reference owned by the caller, returns nullptr if out of memory
+	static SharedFrame* Create(const uint8_t* data, uint32_t size)
+	{
+		void* memory = BufferPool::Allocate(sizeof(SharedFrame) + size);
+		if (memory == nullptr)
+			return nullptr;
+
+		SharedFrame* frame = new (memory) SharedFrame(size);
+		memcpy((uint8_t*)(frame + 1), data, size);
+		return frame;
+	}
+
+	void AddRef()
+	{
+		m_RefCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void Release()
+	{
+		if (m_RefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			size_t size = sizeof(SharedFrame) + m_Size;
+			this->~SharedFrame();
+			BufferPool::Free(this, size);
+		}
+	}
+
+private:
+
+	SharedFrame(uint32_t size)
+		: m_RefCount(1)
+	{
+		m_Size = size;
+		m_Undroppable = false;
+	}
+};
+
+// Owning handle to a SharedFrame, copying it adds a reference instead of copying bytes
+class FrameRef
+{
+public:
+
+	SharedFrame* m_Frame;
+
+	FrameRef()
+	{
+		m_Frame = nullptr;
+	}
+
+	// Encodes a new frame, the only copy of the bytes a broadcast makes
+	FrameRef(const uint8_t* data, uint32_t size)
+	{
+		m_Frame = SharedFrame::Create(data, size);
+	}
+
+	FrameRef(const FrameRef& other)
+	{
+		m_Frame = other.m_Frame;
+		if (m_Frame != nullptr)
+			m_Frame->AddRef();
+	}
+
+	FrameRef(FrameRef&& other) noexcept
+	{
+		m_Frame = other.m_Frame;
+		other.m_Frame = nullptr;
+	}
+
+	~FrameRef()
+	{
+		if (m_Frame != nullptr)
+			m_Frame->Release();
+	}
+
+	FrameRef& operator=(FrameRef other) noexcept
+	{
+		SharedFrame* previous = m_Frame;
+		m_Frame = other.m_Frame;
+		other.m_Frame = previous;
+		return *this;
+	}
+
+	explicit operator bool() const
+	{
+		return m_Frame != nullptr;
+	}
+
+	const uint8_t* Data() const
+	{
+		return m_Frame->Data();
+	}
+
+	uint32_t Size() const
+	{
+		return m_Frame->Size();
+	}
+
+	// Only while this is the one reference, e.g. to patch a field before the frame is sent anywhere
+	uint8_t* MutableData()
+	{
+		return (uint8_t*)m_Frame->Data();
+	}
+
+	bool Undroppable() const
+	{
+		return m_Frame->m_Undroppable;
+	}
+
+	// For frames a client can't do without and whose volume something else bounds, like a stream's, which only
+	// come as fast as the client gives credit. Only while this is the one reference, like MutableData.
+	void MarkUndroppable()
+	{
+		m_Frame->m_Undroppable = true;
+	}
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+// A table of records, e.g. one per connection, with O(1) insert, lookup and remove and handles that stay safe to
+// hold on to after the record is gone.
+//
+// The records themselves sit back to back in one array in no particular order, so walking all of them, as a
+// broadcast does, is a straight pass over memory. Removing one moves the last record into its place instead of
+// shifting everything after it, which is why nobody gets to keep a pointer or an index into the array.
+// Instead Insert hands out a Handle: a slot in a second table that always knows where its record is now, and the
+// slot's generation when the handle was made. Removing a record bumps its slot's generation before the slot is
+// reused, so an old handle finds nothing rather than whoever came next.
+//
+// Records are moved around, anything in them that others point at has to follow its own moves. Not thread safe.
+template <typename T>
+class SlotMap
+{
+public:
+
+	struct Handle
+	{
+		uint32_t slot;
+		uint32_t generation;	// never 0 for a handle Insert made, so a zeroed one is never valid
+
+		bool operator==(const Handle& other) const
+		{
+			return slot == other.slot && generation == other.generation;
+		}
+
+		bool operator!=(const Handle& other) const
+		{
+			return !(*this == other);
+		}
+	};
+
+	SlotMap()
+	{
+		m_FreeSlot = NO_SLOT;
+	}
+
+	size_t Size() const
+	{
+		return m_Values.size();
+	}
+
+	bool Empty() const
+	{
+		return m_Values.empty();
+	}
+
+	void Reserve(size_t count)
+	{
+		m_Values.reserve(count);
+		m_Owners.reserve(count);
+		m_Slots.reserve(count);
+	}
+
+	Handle Insert(T value)
+	{
+		uint32_t slot = m_FreeSlot;
+		if (slot != NO_SLOT)
+		{
+			m_FreeSlot = m_Slots[slot].index;
+		}
+		else
+		{
+			slot = (uint32_t)m_Slots.size();
+			m_Slots.push_back(Slot{ 0, 1 });
+		}
+
+		m_Slots[slot].index = (uint32_t)m_Values.size();
+		m_Values.push_back(std::move(value));
+		m_Owners.push_back(slot);
+		return Handle{ slot, m_Slots[slot].generation };
+	}
+
+	// nullptr once the record was removed. Only good until the next Insert or Remove.
+	T* Get(Handle handle)
+	{
+		if (handle.slot >= m_Slots.size() || m_Slots[handle.slot].generation != handle.generation)
+			return nullptr;
+		return &m_Values[m_Slots[handle.slot].index];
+	}
+
+	bool Contains(Handle handle) const
+	{
+		return handle.slot < m_Slots.size() && m_Slots[handle.slot].generation == handle.generation;
+	}
+
+	// Returns false if it was already gone. The last record moves into the hole.
+	bool Remove(Handle handle)
+	{
+		if (!Contains(handle))
+			return false;
+
+		Slot& slot = m_Slots[handle.slot];
+		uint32_t index = slot.index;
+		uint32_t last = (uint32_t)m_Values.size() - 1;
+		if (index != last)
+		{
+			m_Values[index] = std::move(m_Values[last]);
+			m_Owners[index] = m_Owners[last];
+			m_Slots[m_Owners[index]].index = index;
+		}
+		m_Values.pop_back();
+		m_Owners.pop_back();
+
+		// 0 is skipped when the generation wraps, after four billion reuses of the same slot
+		if (++slot.generation == 0)
+			slot.generation = 1;
+		slot.index = m_FreeSlot;
+		m_FreeSlot = handle.slot;
+		return true;
+	}
+
+	// Where the record at index of the array is, e.g. to remove it while walking them
+	Handle HandleAt(size_t index) const
+	{
+		uint32_t slot = m_Owners[index];
+		return Handle{ slot, m_Slots[slot].generation };
+	}
+
+	T& operator[](size_t index)
+	{
+		return m_Values[index];
+	}
+
+	// Walks the records in array order. Don't Insert or Remove while doing it.
+	T* begin()
+	{
+		return m_Values.data();
+	}
+
+	T* end()
+	{
+		return m_Values.data() + m_Values.size();
+	}
+
+	const T* begin() const
+	{
+		return m_Values.data();
+	}
+
+	const T* end() const
+	{
+		return m_Values.data() + m_Values.size();
+	}
+
+private:
+
+	static const uint32_t NO_SLOT = UINT32_MAX;
+
+	struct Slot
+	{
+		uint32_t index;			// the record's place in m_Values, or the next free slot while this one is free
+		uint32_t generation;
+	};
+
+	std::vector<T> m_Values;
+	std::vector<uint32_t> m_Owners;		// the slot of each record, same index
+	std::vector<Slot> m_Slots;
+	uint32_t m_FreeSlot;
+};
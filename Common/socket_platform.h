@@ -0,0 +1,139 @@
+#pragma once
+
+// Lets the same socket code build against Winsock on Windows and BSD sockets on Linux.
+// On POSIX we provide the handful of Winsock names the projects use so the call sites stay the same.
+
+#ifdef _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+
+#include <Windows.h>
+#include <WinSock2.h>
+#include <Ws2tcpip.h>
+
+// Need to link Ws2_32.lib
+#pragma comment(lib, "Ws2_32.lib")
+
+// Windows has no non-blocking recv flag, only edge triggered reactors drain with it and they are POSIX only
+#define RECV_DONTWAIT 0
+
+inline bool isWouldBlock(int error)
+{
+	return error == WSAEWOULDBLOCK;
+}
+
+inline bool setNonBlocking(SOCKET socket)
+{
+	u_long mode = 1;
+	return ioctlsocket(socket, FIONBIO, &mode) == 0;
+}
+
+// Windows has no load balancing SO_REUSEPORT, only one socket can listen on a port there
+inline bool setReusePort(SOCKET socket)
+{
+	return false;
+}
+
+#else
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <stdint.h>
+
+typedef int SOCKET;
+typedef uint16_t WORD;
+
+#define INVALID_SOCKET	(-1)
+#define SOCKET_ERROR	(-1)
+#define SD_BOTH			SHUT_RDWR
+#define MAKEWORD(a, b)	((WORD)(((a) & 0xff) | (((b) & 0xff) << 8)))
+#define ZeroMemory(dest, length) memset((dest), 0, (length))
+
+#define RECV_DONTWAIT MSG_DONTWAIT
+
+struct WSADATA
+{
+	WORD wVersion;
+};
+
+inline int WSAStartup(WORD version, WSADATA* data)
+{
+	data->wVersion = version;
+
+	// A peer closing mid send should be an error code, not a process kill
+	signal(SIGPIPE, SIG_IGN);
+	return 0;
+}
+
+inline int WSACleanup()
+{
+	return 0;
+}
+
+inline int WSAGetLastError()
+{
+	return errno;
+}
+
+inline int closesocket(SOCKET socket)
+{
+	return close(socket);
+}
+
+inline bool isWouldBlock(int error)
+{
+	return error == EAGAIN || error == EWOULDBLOCK;
+}
+
+inline bool setNonBlocking(SOCKET socket)
+{
+	int flags = fcntl(socket, F_GETFL, 0);
+	if (flags == -1)
+		return false;
+
+	return fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Lets several sockets listen on the same port, the kernel spreads incoming connections across them
+inline bool setReusePort(SOCKET socket)
+{
+#ifdef SO_REUSEPORT
+	int reusePort = 1;
+	return setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, &reusePort, sizeof(reusePort)) == 0;
+#else
+	return false;
+#endif
+}
+
+#endif
+
+// Accepts one waiting connection as a non-blocking socket that a child process doesn't inherit.
+// Returns INVALID_SOCKET with the error in WSAGetLastError, would block once the accept queue is empty.
+inline SOCKET acceptNonBlocking(SOCKET listenSocket)
+{
+#if defined(__linux__)
+	// One syscall for all three
+	return accept4(listenSocket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	SOCKET socket = accept(listenSocket, NULL, NULL);
+	if (socket == INVALID_SOCKET)
+		return INVALID_SOCKET;
+
+#ifdef _WIN32
+	SetHandleInformation((HANDLE)socket, HANDLE_FLAG_INHERIT, 0);
+#else
+	fcntl(socket, F_SETFD, FD_CLOEXEC);
+#endif
+	setNonBlocking(socket);
+	return socket;
+#endif
+}
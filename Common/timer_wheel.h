@@ -0,0 +1,377 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+inline uint64_t timerNowMs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Timers for one event loop's thread, e.g. a connection's idle deadline, a heartbeat or a task for later.
+//
+// A hierarchical timing wheel with a tick of one millisecond: six levels of 64 slots, each slot of a level as long
+// as the whole level below it. A timer goes into the slot its deadline falls in at the lowest level that reaches
+// it, and is moved down a level when its slot comes up, so it is touched at most once per level on its way out.
+// Arm and Cancel are a few pointer writes whatever the number of timers, and a bitmap per level finds the next
+// slot with anything in it, so neither the loop's wait timeout nor Advance ever looks at a timer that isn't due.
+//
+// The wheel's clock only moves in Advance, Arm counts from the time of the last one. Not thread safe.
+class TimerWheel
+{
+public:
+
+	typedef std::function<void()> Callback;
+
+	static const int LEVEL_BITS = 6;
+	static const int SLOTS = 1 << LEVEL_BITS;
+	static const uint64_t SLOT_MASK = SLOTS - 1;
+	static const int LEVELS = 6;
+
+	// Longer delays are cut to this, about two years. It keeps a timer out of the top level's current slot.
+	static const uint64_t MAX_DELAY_MS = (uint64_t)(SLOTS - 1) << (LEVEL_BITS * (LEVELS - 1));
+
+	// Lives wherever its owner keeps it, e.g. in a connection's state. Moving an armed timer moves it in the wheel
+	// too, so it can live in a vector or a SlotMap. Destroying an armed timer cancels it.
+	class Timer
+	{
+	public:
+
+		Callback m_Callback;
+
+		Timer()
+		{
+			m_Wheel = nullptr;
+			m_Prev = nullptr;
+			m_Next = nullptr;
+			m_Deadline = 0;
+			m_Slot = -1;
+			m_Owned = false;
+		}
+
+		Timer(Callback callback)
+			: Timer()
+		{
+			m_Callback = std::move(callback);
+		}
+
+		Timer(const Timer&) = delete;
+		Timer& operator=(const Timer&) = delete;
+
+		Timer(Timer&& other) noexcept
+			: Timer()
+		{
+			*this = std::move(other);
+		}
+
+		// Takes over the other's callback and, if it is armed, its place in the wheel. Not for Defer tasks.
+		Timer& operator=(Timer&& other) noexcept
+		{
+			if (this == &other)
+				return *this;
+
+			if (Armed())
+				m_Wheel->Cancel(*this);
+
+			m_Callback = std::move(other.m_Callback);
+			m_Wheel = other.m_Wheel;
+			m_Deadline = other.m_Deadline;
+			m_Slot = other.m_Slot;
+			m_Prev = other.m_Prev;
+			m_Next = other.m_Next;
+
+			if (Armed())
+			{
+				if (m_Prev != nullptr)
+					m_Prev->m_Next = this;
+				else
+					m_Wheel->m_Slots[m_Slot] = this;
+
+				if (m_Next != nullptr)
+					m_Next->m_Prev = this;
+			}
+
+			other.m_Prev = nullptr;
+			other.m_Next = nullptr;
+			other.m_Slot = -1;
+			return *this;
+		}
+
+		~Timer()
+		{
+			if (Armed())
+				m_Wheel->Cancel(*this);
+		}
+
+		bool Armed() const
+		{
+			return m_Slot >= 0;
+		}
+
+		uint64_t Deadline() const
+		{
+			return m_Deadline;
+		}
+
+	private:
+
+		friend class TimerWheel;
+
+		TimerWheel* m_Wheel;
+		Timer* m_Prev;
+		Timer* m_Next;
+		uint64_t m_Deadline;
+		int m_Slot;		// level * SLOTS + slot while armed, -1 otherwise
+		bool m_Owned;	// a Defer task, the wheel deletes it once it has run
+	};
+
+	TimerWheel()
+	{
+		m_Now = timerNowMs();
+		m_Elapsed = m_Now;
+		m_Count = 0;
+		for (int i = 0; i < LEVELS; i++)
+		{
+			m_Occupied[i] = 0;
+		}
+		for (int i = 0; i < LEVELS * SLOTS; i++)
+		{
+			m_Slots[i] = nullptr;
+		}
+	}
+
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator=(const TimerWheel&) = delete;
+
+	// Timers still armed are left unarmed, deferred tasks that never ran are dropped
+	~TimerWheel()
+	{
+		for (int i = 0; i < LEVELS * SLOTS; i++)
+		{
+			while (m_Slots[i] != nullptr)
+			{
+				Timer* timer = m_Slots[i];
+				Unlink(*timer);
+				if (timer->m_Owned)
+					delete timer;
+			}
+		}
+	}
+
+	// The wheel's idea of now, in milliseconds of timerNowMs
+	uint64_t Now() const
+	{
+		return m_Now;
+	}
+
+	size_t Count() const
+	{
+		return m_Count;
+	}
+
+	// Runs the timer's callback delayMs from now, at the first Advance after that. Arming an armed timer moves it.
+	void Arm(Timer& timer, uint64_t delayMs)
+	{
+		if (timer.Armed())
+			Unlink(timer);
+
+		if (delayMs > MAX_DELAY_MS)
+			delayMs = MAX_DELAY_MS;
+
+		// Never at or behind the slot being processed, even when Arm is called from a callback
+		uint64_t deadline = m_Now + delayMs;
+		if (deadline <= m_Elapsed)
+			deadline = m_Elapsed + 1;
+
+		timer.m_Wheel = this;
+		timer.m_Deadline = deadline;
+		Link(timer);
+	}
+
+	void Cancel(Timer& timer)
+	{
+		if (timer.Armed())
+			Unlink(timer);
+	}
+
+	// Runs callback once, delayMs from now. The wheel owns the task, there is nothing to cancel it with.
+	void Defer(uint64_t delayMs, Callback callback)
+	{
+		Timer* timer = new Timer(std::move(callback));
+		timer->m_Owned = true;
+		Arm(*timer, delayMs);
+	}
+
+	// How long the loop may wait before the next timer is due, at most maxMs. With no timer armed that is maxMs,
+	// so -1 waits for as long as it takes.
+	int TimeoutMs(int maxMs) const
+	{
+		uint64_t tick;
+		int slot;
+		if (!NextExpiration(tick, slot))
+			return maxMs;
+
+		uint64_t now = timerNowMs();
+		if (tick <= now)
+			return 0;
+
+		uint64_t wait = tick - now;
+		if (maxMs >= 0 && wait > (uint64_t)maxMs)
+			return maxMs;
+		return wait > INT32_MAX ? INT32_MAX : (int)wait;
+	}
+
+	// Brings the wheel up to now and runs the callback of every timer that is due, earliest first.
+	// A callback may arm, cancel or destroy any timer, its own included.
+	void Advance()
+	{
+		m_Now = timerNowMs();
+
+		uint64_t tick;
+		int slot;
+		while (NextExpiration(tick, slot) && tick <= m_Now)
+		{
+			m_Elapsed = tick;
+
+			// Everything in the slot is either due or moves down a level, taken one at a time because a
+			// callback may cancel the next one
+			while (m_Slots[slot] != nullptr)
+			{
+				Timer* timer = m_Slots[slot];
+				Unlink(*timer);
+
+				if (timer->m_Deadline > m_Elapsed)
+				{
+					Link(*timer);
+					continue;
+				}
+
+				// A copy, so the timer may be destroyed from inside its own callback
+				if (timer->m_Owned)
+				{
+					Callback callback = std::move(timer->m_Callback);
+					delete timer;
+					callback();
+				}
+				else
+				{
+					Callback callback = timer->m_Callback;
+					callback();
+				}
+			}
+		}
+
+		m_Elapsed = m_Now;
+	}
+
+private:
+
+	uint64_t m_Now;			// the time of the last Advance, what Arm counts from
+	uint64_t m_Elapsed;		// how far the wheel has turned, only behind m_Now in the middle of Advance
+	size_t m_Count;
+	uint64_t m_Occupied[LEVELS];	// a bit per slot that has timers in it
+	Timer* m_Slots[LEVELS * SLOTS];
+
+	// The highest bit where the deadline differs from where the wheel is picks the level
+	int LevelFor(uint64_t deadline) const
+	{
+		uint64_t differing = (m_Elapsed ^ deadline) | SLOT_MASK;
+		int level = HighestBit(differing) / LEVEL_BITS;
+		return level < LEVELS ? level : LEVELS - 1;
+	}
+
+	void Link(Timer& timer)
+	{
+		int level = LevelFor(timer.m_Deadline);
+		int slotInLevel = (int)((timer.m_Deadline >> (level * LEVEL_BITS)) & SLOT_MASK);
+		int slot = level * SLOTS + slotInLevel;
+
+		timer.m_Slot = slot;
+		timer.m_Prev = nullptr;
+		timer.m_Next = m_Slots[slot];
+		if (timer.m_Next != nullptr)
+			timer.m_Next->m_Prev = &timer;
+		m_Slots[slot] = &timer;
+
+		m_Occupied[level] |= (uint64_t)1 << slotInLevel;
+		m_Count++;
+	}
+
+	void Unlink(Timer& timer)
+	{
+		int slot = timer.m_Slot;
+		if (timer.m_Prev != nullptr)
+			timer.m_Prev->m_Next = timer.m_Next;
+		else
+			m_Slots[slot] = timer.m_Next;
+
+		if (timer.m_Next != nullptr)
+			timer.m_Next->m_Prev = timer.m_Prev;
+
+		if (m_Slots[slot] == nullptr)
+			m_Occupied[slot / SLOTS] &= ~((uint64_t)1 << (slot % SLOTS));
+
+		timer.m_Prev = nullptr;
+		timer.m_Next = nullptr;
+		timer.m_Slot = -1;
+		m_Count--;
+	}
+
+	// The tick the next occupied slot starts at and which slot it is. Everything at a level comes due before
+	// anything at the levels above it, so the first level with a timer has the next one.
+	bool NextExpiration(uint64_t& tick, int& slot) const
+	{
+		for (int level = 0; level < LEVELS; level++)
+		{
+			if (m_Occupied[level] == 0)
+				continue;
+
+			int shift = level * LEVEL_BITS;
+			int current = (int)((m_Elapsed >> shift) & SLOT_MASK);
+			int next = (current + LowestBit(RotateRight(m_Occupied[level], current))) & (int)SLOT_MASK;
+
+			uint64_t levelSpan = (uint64_t)1 << (shift + LEVEL_BITS);
+			uint64_t start = (m_Elapsed & ~(levelSpan - 1)) + ((uint64_t)next << shift);
+			if (next < current)
+				start += levelSpan;
+
+			tick = start > m_Elapsed ? start : m_Elapsed;
+			slot = level * SLOTS + next;
+			return true;
+		}
+
+		return false;
+	}
+
+	static uint64_t RotateRight(uint64_t value, int count)
+	{
+		return count == 0 ? value : (value >> count) | (value << (64 - count));
+	}
+
+	static int LowestBit(uint64_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, value);
+		return (int)index;
+#else
+		return __builtin_ctzll(value);
+#endif
+	}
+
+	static int HighestBit(uint64_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return (int)index;
+#else
+		return 63 - __builtin_clzll(value);
+#endif
+	}
+};
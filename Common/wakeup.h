@@ -0,0 +1,124 @@
+#pragma once
+
+#include "socket_platform.h"
+
+#include <atomic>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+// Lets another thread interrupt a reactor or io_uring wait.
+//
+// Handle() is registered for reads like any socket. Signal() can be called from any thread and only
+// touches the kernel when the waiter hasn't been signalled since its last Drain(), so a burst of
+// cross thread messages costs one wakeup. Linux uses an eventfd, other POSIX systems a pipe, and
+// Windows a loopback UDP socket talking to itself because select() only takes sockets.
+class Wakeup
+{
+public:
+
+	SOCKET m_ReadHandle;
+	SOCKET m_WriteHandle;
+	std::atomic<bool> m_Pending;
+
+	Wakeup()
+	{
+		m_ReadHandle = INVALID_SOCKET;
+		m_WriteHandle = INVALID_SOCKET;
+		m_Pending = false;
+	}
+
+	~Wakeup()
+	{
+#ifdef _WIN32
+		if (m_ReadHandle != INVALID_SOCKET)
+			closesocket(m_ReadHandle);
+#else
+		if (m_WriteHandle != INVALID_SOCKET && m_WriteHandle != m_ReadHandle)
+			close(m_WriteHandle);
+		if (m_ReadHandle != INVALID_SOCKET)
+			close(m_ReadHandle);
+#endif
+	}
+
+	bool Init()
+	{
+#if defined(__linux__)
+		m_ReadHandle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		m_WriteHandle = m_ReadHandle;
+		return m_ReadHandle != -1;
+#elif defined(_WIN32)
+		m_ReadHandle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (m_ReadHandle == INVALID_SOCKET)
+			return false;
+
+		sockaddr_in address;
+		ZeroMemory(&address, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = 0;
+
+		int length = sizeof(address);
+		if (bind(m_ReadHandle, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR
+			|| getsockname(m_ReadHandle, (sockaddr*)&address, &length) == SOCKET_ERROR
+			|| connect(m_ReadHandle, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR)
+		{
+			return false;
+		}
+
+		m_WriteHandle = m_ReadHandle;
+		return setNonBlocking(m_ReadHandle);
+#else
+		int fds[2];
+		if (pipe(fds) != 0)
+			return false;
+
+		m_ReadHandle = fds[0];
+		m_WriteHandle = fds[1];
+		return setNonBlocking(m_ReadHandle) && setNonBlocking(m_WriteHandle);
+#endif
+	}
+
+	SOCKET Handle() const
+	{
+		return m_ReadHandle;
+	}
+
+	// Safe from any thread
+	void Signal()
+	{
+		if (m_Pending.exchange(true))
+			return;
+
+#if defined(__linux__)
+		uint64_t one = 1;
+		ssize_t result = write(m_WriteHandle, &one, sizeof(one));
+		(void)result;
+#elif defined(_WIN32)
+		char one = 1;
+		send(m_WriteHandle, &one, 1, 0);
+#else
+		char one = 1;
+		ssize_t result = write(m_WriteHandle, &one, 1);
+		(void)result;
+#endif
+	}
+
+	// Called by the waiting thread before it looks for work, a Signal that races with the look wakes it again
+	void Drain()
+	{
+		m_Pending = false;
+
+		char drain[64];
+#ifdef _WIN32
+		while (recv(m_ReadHandle, drain, sizeof(drain), 0) > 0)
+		{
+		}
+#else
+		while (read(m_ReadHandle, drain, sizeof(drain)) > 0)
+		{
+		}
+#endif
+	}
+};
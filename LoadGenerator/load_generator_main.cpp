@@ -0,0 +1,920 @@
+#pragma once
+
+#include "../Common/socket_platform.h"
+#include "../Common/reactor.h"
+#include "../Common/buffer.h"
+#include "../Common/frame_reassembler.h"
+#include "../Common/chat_messages.h"
+#include "../Common/message_writer.h"
+#include "../Common/frame_compression.h"
+#include "../Common/latency_histogram.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Headless load for ChatServer: thousands of chat clients from one process, all on loopback.
+//
+// Every client is an ordinary connection speaking the chat wire format. The senders among them post chat
+// messages at a fixed total rate, each one carrying the time it was due to be sent, and every client times
+// the broadcasts it receives against that. Using the due time rather than the time send() ran means a
+// server that stalls the sender is charged for the wait too. Clients are spread over a few threads, each
+// with its own reactor, and the report covers messages sent, broadcasts delivered, bytes and latency
+// percentiles after a warm up.
+
+#define DEFAULT_PORT "8412"
+
+// Chat text written by the generator starts with this and the due time, anything else (the welcome) isn't ours
+const char LOAD_MARKER[4] = { 'L', 'O', 'A', 'D' };
+const size_t LOAD_HEADER_SIZE = sizeof(LOAD_MARKER) + sizeof(uint64_t);
+
+// Stop queueing for a connection the server isn't reading from, the messages count as skipped
+const size_t MAX_PENDING_BYTES = 4 * 1024 * 1024;
+
+static std::chrono::steady_clock::time_point g_Epoch = std::chrono::steady_clock::now();
+
+static uint64_t nowNs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_Epoch).count();
+}
+
+// Chat text sizes, "N" for always N bytes, "MIN-MAX" for uniform, or "N:weight,N:weight,..." for a mix
+class SizeDistribution
+{
+public:
+
+	std::vector<size_t> m_Sizes;
+	std::vector<double> m_Weights;
+	size_t m_Min;
+	size_t m_Max;
+	bool m_Uniform;
+
+	SizeDistribution()
+	{
+		m_Sizes.push_back(64);
+		m_Weights.push_back(1.0);
+		m_Min = 64;
+		m_Max = 64;
+		m_Uniform = false;
+	}
+
+	bool Parse(const char* text)
+	{
+		m_Sizes.clear();
+		m_Weights.clear();
+		m_Uniform = false;
+
+		const char* dash = strchr(text, '-');
+		if (dash != nullptr)
+		{
+			m_Min = strtoul(text, NULL, 10);
+			m_Max = strtoul(dash + 1, NULL, 10);
+			m_Uniform = true;
+			return m_Min > 0 && m_Min <= m_Max;
+		}
+
+		std::string list = text;
+		size_t start = 0;
+		while (start < list.length())
+		{
+			size_t end = list.find(',', start);
+			if (end == std::string::npos)
+				end = list.length();
+
+			std::string entry = list.substr(start, end - start);
+			size_t colon = entry.find(':');
+			size_t size = strtoul(entry.c_str(), NULL, 10);
+			double weight = colon != std::string::npos ? atof(entry.c_str() + colon + 1) : 1.0;
+			if (size == 0 || weight <= 0.0)
+				return false;
+
+			m_Sizes.push_back(size);
+			m_Weights.push_back(weight);
+			start = end + 1;
+		}
+
+		if (m_Sizes.empty())
+			return false;
+
+		m_Min = m_Sizes[0];
+		m_Max = m_Sizes[0];
+		for (size_t size : m_Sizes)
+		{
+			m_Min = size < m_Min ? size : m_Min;
+			m_Max = size > m_Max ? size : m_Max;
+		}
+		return true;
+	}
+
+	std::discrete_distribution<int> Weighted() const
+	{
+		return std::discrete_distribution<int>(m_Weights.begin(), m_Weights.end());
+	}
+};
+
+struct LoadOptions
+{
+	std::string host;
+	std::string port;
+	int clients;
+	int senders;
+	int threads;
+	double rate;			// messages per second across all senders
+	int warmupSeconds;
+	int durationSeconds;
+	int batch;				// most chat lines a sender coalesces into one batch frame, 1 sends each on its own
+	int rooms;				// clients are dealt into this many rooms and talk only there, 0 for one global chat
+	bool compress;			// every client says hello asking for compression, and compresses its own batches once agreed
+	WireVersion version;	// v2 is asked for in the same hello and sent right after it
+	const CompressionDictionary* dictionary;
+	SizeDistribution sizes;
+};
+
+// What a worker has done so far. The counters are read by the main thread every second,
+// the histogram only once the worker has stopped.
+struct WorkerStats
+{
+	std::atomic<uint64_t> sent;
+	std::atomic<uint64_t> skipped;
+	std::atomic<uint64_t> received;
+	std::atomic<uint64_t> receivedBytes;
+	std::atomic<uint64_t> disconnects;
+	LatencyHistogram latency;
+
+	WorkerStats()
+	{
+		sent = 0;
+		skipped = 0;
+		received = 0;
+		receivedBytes = 0;
+		disconnects = 0;
+	}
+};
+
+// Shared between the main thread and the workers
+struct LoadControl
+{
+	std::atomic<int> connected;
+	std::atomic<int> failed;
+	std::atomic<bool> started;
+	std::atomic<bool> stopping;
+	std::atomic<uint64_t> startNs;
+	std::atomic<uint64_t> measureStartNs;
+
+	LoadControl()
+	{
+		connected = 0;
+		failed = 0;
+		started = false;
+		stopping = false;
+		startNs = 0;
+		measureStartNs = 0;
+	}
+};
+
+// One thread's share of the clients
+class LoadWorker
+{
+public:
+
+	struct Connection
+	{
+		SOCKET socket;
+		bool sender;
+		bool closed;
+		bool watchingWrites;
+		FrameReassembler reassembler;
+		Buffer pending;			// encoded messages the socket hasn't taken yet
+		size_t pendingOffset;
+		ChatBatcher batcher;	// lines that came due this pass, with --batch
+		uint32_t room;			// 0 without --rooms
+		bool compressing;		// the server agreed to compression in its hello
+		WireVersion version;	// what we send in, what we receive in is the reassembler's
+	};
+
+	const LoadOptions& m_Options;
+	LoadControl& m_Control;
+	WorkerStats& m_Stats;
+	int m_FirstClient;
+	int m_ClientCount;
+	double m_Rate;
+
+	std::unique_ptr<Reactor> m_Reactor;
+	std::vector<std::unique_ptr<Connection>> m_Connections;
+	std::unordered_map<SOCKET, Connection*> m_BySocket;
+	std::vector<Connection*> m_Senders;
+	std::vector<Connection*> m_Batching;	// senders with lines in their batcher
+	std::vector<ReactorEvent> m_ReadyEvents;
+	std::vector<uint8_t> m_RecvChunk;
+	std::string m_Text;			// chat-like words, each message is a slice of it so they aren't all the same
+	std::string m_Payload;
+	std::mt19937 m_Random;
+	FrameCompressor m_Compressor;
+	Buffer m_Packing;			// wire bytes on their way to being compressed
+
+	LoadWorker(const LoadOptions& options, LoadControl& control, WorkerStats& stats, int firstClient, int clientCount, double rate)
+		: m_Options(options), m_Control(control), m_Stats(stats), m_Random(firstClient + 1), m_Compressor(options.dictionary)
+	{
+		m_FirstClient = firstClient;
+		m_ClientCount = clientCount;
+		m_Rate = rate;
+		m_RecvChunk.resize(RECV_CHUNK_SIZE);
+		m_Payload.assign(options.sizes.m_Max > LOAD_HEADER_SIZE ? options.sizes.m_Max : LOAD_HEADER_SIZE, ' ');
+
+		// Words in a random order, so compression sees something like real text rather than one repeated byte
+		static const char* const WORDS[] = { "the", "and", "to", "of", "a", "in", "is", "it", "you", "that", "for", "on",
+			"was", "with", "this", "have", "but", "not", "what", "just", "like", "so", "know", "think", "anyone", "server",
+			"build", "works", "tonight", "yeah", "lol", "thanks", "does", "any", "idea", "why", "chat", "message", "today" };
+		while (m_Text.size() < m_Payload.size() + 4096)
+		{
+			m_Text += WORDS[m_Random() % (sizeof(WORDS) / sizeof(WORDS[0]))];
+			m_Text += m_Random() % 12 == 0 ? ". " : " ";
+		}
+	}
+
+	void Run(const addrinfo* info)
+	{
+		m_Reactor = createReactor(defaultReactorName());
+		if (!m_Reactor || !Connect(info))
+		{
+			m_Control.failed++;
+			return;
+		}
+
+		while (!m_Control.started.load())
+		{
+			if (m_Control.stopping.load())
+				return;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		Loop();
+
+		for (std::unique_ptr<Connection>& connection : m_Connections)
+		{
+			if (!connection->closed)
+			{
+				closesocket(connection->socket);
+			}
+		}
+	}
+
+private:
+
+	bool Connect(const addrinfo* info)
+	{
+		for (int i = 0; i < m_ClientCount; i++)
+		{
+			SOCKET clientSocket = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+			if (clientSocket == INVALID_SOCKET || connect(clientSocket, info->ai_addr, (int)info->ai_addrlen) == SOCKET_ERROR)
+			{
+				printf("connect failed with error %d after %d clients, raise the descriptor limit with ulimit -n\n", WSAGetLastError(), m_Control.connected.load());
+				if (clientSocket != INVALID_SOCKET)
+					closesocket(clientSocket);
+				return false;
+			}
+
+			// Chat lines are small, don't let Nagle hold them back
+			int noDelay = 1;
+			setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+			setNonBlocking(clientSocket);
+
+			if (!m_Reactor->Add(clientSocket, REACTOR_READ))
+			{
+				printf("the %s reactor can't take more than %d sockets, use more --threads\n", m_Reactor->Name(), i);
+				closesocket(clientSocket);
+				return false;
+			}
+
+			std::unique_ptr<Connection> connection(new Connection());
+			connection->socket = clientSocket;
+			connection->sender = m_FirstClient + i < m_Options.senders;
+			connection->closed = false;
+			connection->watchingWrites = false;
+			connection->pendingOffset = 0;
+			connection->room = 0;
+			connection->compressing = false;
+			connection->version = WIRE_V1;
+
+			if (m_Options.compress || m_Options.version == WIRE_V2)
+			{
+				HelloMessage hello;
+				hello.features = (m_Options.compress ? HELLO_FEATURE_COMPRESSION : 0) | (m_Options.version == WIRE_V2 ? HELLO_FEATURE_WIRE_V2 : 0);
+				hello.dictionaryId = m_Compressor.DictionaryId();
+				encodeMessage(hello, connection->pending);
+
+				connection->version = m_Options.version;
+				connection->batcher.m_Version = m_Options.version;
+			}
+
+			// Joined before any chat is sent
+			if (m_Options.rooms > 0)
+			{
+				JoinRoomMessage joinRoom;
+				joinRoom.room = connection->room = (uint32_t)((m_FirstClient + i) % m_Options.rooms) + 1;
+				encodeMessage(joinRoom, connection->pending, connection->version);
+			}
+
+			m_BySocket[clientSocket] = connection.get();
+			if (connection->sender)
+			{
+				m_Senders.push_back(connection.get());
+			}
+			m_Connections.push_back(std::move(connection));
+			Flush(*m_Connections.back());
+			m_Control.connected++;
+		}
+		return true;
+	}
+
+	void Loop()
+	{
+		std::discrete_distribution<int> weighted = m_Options.sizes.Weighted();
+		std::uniform_int_distribution<size_t> uniform(m_Options.sizes.m_Min, m_Options.sizes.m_Max);
+
+		uint64_t interval = m_Rate > 0.0 ? (uint64_t)(1e9 / m_Rate) : 0;
+		uint64_t nextSendNs = m_Control.startNs.load();
+		size_t nextSender = 0;
+
+		while (!m_Control.stopping.load(std::memory_order_relaxed))
+		{
+			// Send everything that has come due, stamped with when it was due
+			uint64_t now = nowNs();
+			while (interval > 0 && !m_Senders.empty() && nextSendNs <= now)
+			{
+				Connection* connection = m_Senders[nextSender];
+				nextSender = (nextSender + 1) % m_Senders.size();
+
+				size_t size = m_Options.sizes.m_Uniform ? uniform(m_Random) : m_Options.sizes.m_Sizes[weighted(m_Random)];
+				Send(*connection, nextSendNs, size);
+				nextSendNs += interval;
+			}
+
+			// Whatever came due together goes out together, a batch never waits for a later pass to fill up
+			for (Connection* connection : m_Batching)
+			{
+				FinishBatch(*connection);
+			}
+			m_Batching.clear();
+
+			int timeoutMs = 1;
+			if (interval > 0 && nextSendNs > now && nextSendNs - now > 1000000)
+			{
+				timeoutMs = (int)((nextSendNs - now) / 1000000);
+				timeoutMs = timeoutMs > 100 ? 100 : timeoutMs;
+			}
+			else if (interval > 0)
+			{
+				timeoutMs = 0;
+			}
+
+			int count = m_Reactor->Wait(m_ReadyEvents, timeoutMs);
+			for (int i = 0; i < count; i++)
+			{
+				auto found = m_BySocket.find(m_ReadyEvents[i].socket);
+				if (found == m_BySocket.end() || found->second->closed)
+					continue;
+
+				Connection& connection = *found->second;
+				if (m_ReadyEvents[i].events & REACTOR_WRITE)
+				{
+					Flush(connection);
+				}
+				if (!connection.closed && (m_ReadyEvents[i].events & (REACTOR_READ | REACTOR_HANGUP)))
+				{
+					Receive(connection);
+				}
+			}
+		}
+	}
+
+	void Send(Connection& connection, uint64_t dueNs, size_t size)
+	{
+		if (connection.closed)
+			return;
+
+		if (connection.pending.Size() - connection.pendingOffset > MAX_PENDING_BYTES)
+		{
+			m_Stats.skipped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		if (size < LOAD_HEADER_SIZE)
+			size = LOAD_HEADER_SIZE;
+
+		memcpy(&m_Payload[0], LOAD_MARKER, sizeof(LOAD_MARKER));
+		storeUInt64LE((uint8_t*)&m_Payload[sizeof(LOAD_MARKER)], dueNs);
+		size_t textLength = size - LOAD_HEADER_SIZE;
+		memcpy(&m_Payload[LOAD_HEADER_SIZE], m_Text.data() + m_Random() % (m_Text.size() - textLength), textLength);
+
+		ChatMessage chatMessage;
+		chatMessage.message = std::string_view(m_Payload.data(), size);
+		m_Stats.sent.fetch_add(1, std::memory_order_relaxed);
+
+		if (connection.room != 0)
+		{
+			RoomChatMessage roomChat;
+			roomChat.room = connection.room;
+			roomChat.message = chatMessage.message;
+			Encode(connection, roomChat);
+		}
+		else if (m_Options.batch > 1)
+		{
+			if (!connection.batcher.Fits(chatMessage))
+			{
+				FinishBatch(connection);
+			}
+
+			if (connection.batcher.Empty())
+			{
+				m_Batching.push_back(&connection);
+			}
+
+			connection.batcher.Add(chatMessage);
+			if ((int)connection.batcher.Count() >= m_Options.batch)
+			{
+				FinishBatch(connection);
+			}
+			return;
+		}
+		else
+		{
+			Encode(connection, chatMessage);
+		}
+
+		if (!connection.watchingWrites)
+		{
+			Flush(connection);
+		}
+	}
+
+	// Moves the batched lines into the connection's pending bytes, as one frame, and writes them
+	void FinishBatch(Connection& connection)
+	{
+		if (connection.closed || connection.batcher.Empty())
+			return;
+
+		if (connection.compressing)
+		{
+			connection.batcher.FinishInto(m_Packing);
+			AppendPacked(connection);
+		}
+		else
+		{
+			connection.batcher.FinishInto(connection.pending);
+		}
+
+		if (!connection.watchingWrites)
+		{
+			Flush(connection);
+		}
+	}
+
+	// Onto the connection's pending bytes, compressed first if the server agreed to it
+	template <typename Message>
+	void Encode(Connection& connection, const Message& message)
+	{
+		if (!connection.compressing)
+		{
+			encodeMessage(message, connection.pending, connection.version);
+			return;
+		}
+
+		encodeMessage(message, m_Packing, connection.version);
+		AppendPacked(connection);
+	}
+
+	// Moves m_Packing onto the pending bytes, compressed when that makes it smaller
+	void AppendPacked(Connection& connection)
+	{
+		if (!m_Compressor.Compress(m_Packing.Data(), m_Packing.Size(), connection.pending, connection.version))
+		{
+			connection.pending.WriteBytes(m_Packing.Data(), m_Packing.Size());
+		}
+		m_Packing.Clear();
+	}
+
+	void Flush(Connection& connection)
+	{
+		while (connection.pendingOffset < connection.pending.Size())
+		{
+			int result = send(connection.socket, (const char*)connection.pending.Data() + connection.pendingOffset,
+				(int)(connection.pending.Size() - connection.pendingOffset), 0);
+			if (result > 0)
+			{
+				connection.pendingOffset += result;
+				continue;
+			}
+
+			if (result == SOCKET_ERROR && isWouldBlock(WSAGetLastError()))
+			{
+				if (!connection.watchingWrites)
+				{
+					m_Reactor->Modify(connection.socket, REACTOR_READ | REACTOR_WRITE);
+					connection.watchingWrites = true;
+				}
+				return;
+			}
+
+			Close(connection);
+			return;
+		}
+
+		connection.pending.Clear();
+		connection.pendingOffset = 0;
+		if (connection.watchingWrites)
+		{
+			m_Reactor->Modify(connection.socket, REACTOR_READ);
+			connection.watchingWrites = false;
+		}
+	}
+
+	void Receive(Connection& connection)
+	{
+		while (true)
+		{
+			int result = recv(connection.socket, (char*)m_RecvChunk.data(), RECV_CHUNK_SIZE, RECV_DONTWAIT);
+			if (result > 0)
+			{
+				// One clock read per chunk, every frame in it arrived at the same time
+				uint64_t now = nowNs();
+				uint64_t measureStart = m_Control.measureStartNs.load(std::memory_order_relaxed);
+				bool valid = connection.reassembler.Feed(m_RecvChunk.data(), result, [&](const uint8_t* wireFrame, uint32_t wireSize)
+				{
+					// Bytes are counted as they came over the wire, so compression and v2 show up in MB/s
+					uint32_t uncountedBytes = wireSize;
+					WireVersion version = connection.reassembler.m_Version;
+					return m_Compressor.Unpack(wireFrame, wireSize, [&](const uint8_t* frame, uint32_t packetSize)
+					{
+						ChatMessage chatMessage;
+						RoomChatMessage roomChat;
+						HelloMessage hello;
+						std::string_view text;
+						if (decodeMessage(frame, packetSize, chatMessage, version))
+						{
+							text = chatMessage.message;
+						}
+						else if (decodeMessage(frame, packetSize, roomChat, version))
+						{
+							text = roomChat.message;
+						}
+						else if (decodeMessage(frame, packetSize, hello, version))
+						{
+							// Everything after the server's hello is in what it agreed to
+							connection.compressing = (hello.features & HELLO_FEATURE_COMPRESSION) != 0;
+							if (hello.features & HELLO_FEATURE_WIRE_V2)
+							{
+								connection.reassembler.m_Version = WIRE_V2;
+							}
+						}
+
+						if (text.length() < LOAD_HEADER_SIZE || memcmp(text.data(), LOAD_MARKER, sizeof(LOAD_MARKER)) != 0)
+						{
+							return;
+						}
+
+						uint64_t dueNs = loadUInt64LE((const uint8_t*)text.data() + sizeof(LOAD_MARKER));
+						if (dueNs >= measureStart)
+						{
+							m_Stats.latency.Record(now > dueNs ? now - dueNs : 0);
+						}
+
+						m_Stats.received.fetch_add(1, std::memory_order_relaxed);
+						m_Stats.receivedBytes.fetch_add(uncountedBytes, std::memory_order_relaxed);
+						uncountedBytes = 0;
+					}, version);
+				});
+
+				if (!valid)
+				{
+					printf("server sent a malformed frame, closing the client\n");
+					Close(connection);
+					return;
+				}
+
+				if (!m_Reactor->IsEdgeTriggered())
+					return;
+				continue;
+			}
+
+			if (result == SOCKET_ERROR && isWouldBlock(WSAGetLastError()))
+				return;
+
+			Close(connection);
+			return;
+		}
+	}
+
+	void Close(Connection& connection)
+	{
+		if (m_Stats.disconnects.fetch_add(1) == 0 && !m_Control.stopping.load())
+		{
+			printf("the server closed a client connection (error %d)\n", WSAGetLastError());
+		}
+
+		m_Reactor->Remove(connection.socket);
+		closesocket(connection.socket);
+		connection.closed = true;
+	}
+};
+
+static void printUsage()
+{
+	printf("usage: LoadGenerator [--host 127.0.0.1] [--port %s] [--clients 100] [--senders N] [--threads N]\n", DEFAULT_PORT);
+	printf("                     [--rate 1000] [--size 64 | MIN-MAX | N:weight,...] [--warmup 2] [--duration 10] [--batch 1] [--rooms 0]\n");
+	printf("                     [--compress] [--dictionary FILE] [--protocol 1]\n");
+	printf("--rate is messages per second across all senders, every message is broadcast to the other clients.\n");
+	printf("--batch N lets a sender put up to N lines that come due together into one batch frame.\n");
+	printf("--rooms N deals the clients into N rooms, each message then goes to its sender's room only (no batching).\n");
+	printf("--compress asks the server for compressed broadcasts and compresses batches once it agrees, with the built in\n");
+	printf("chat dictionary or the one in --dictionary FILE, which the server has to be using too.\n");
+	printf("--protocol 2 has every client ask for the compact v2 wire format, which the server always agrees to.\n");
+	printf("--senders defaults to every client.\n");
+}
+
+int main(int arg, char** argv)
+{
+	LoadOptions options;
+	options.host = "127.0.0.1";
+	options.port = DEFAULT_PORT;
+	options.clients = 100;
+	options.senders = -1;
+	options.threads = (int)std::thread::hardware_concurrency();
+	options.threads = options.threads < 1 ? 1 : (options.threads > 4 ? 4 : options.threads);
+	options.rate = 1000.0;
+	options.warmupSeconds = 2;
+	options.durationSeconds = 10;
+	options.batch = 1;
+	options.rooms = 0;
+	options.compress = false;
+	options.version = WIRE_V1;
+	std::string dictionaryPath;
+
+	for (int i = 1; i < arg; i++)
+	{
+		if (strcmp(argv[i], "--host") == 0 && i + 1 < arg)
+		{
+			options.host = argv[++i];
+		}
+		else if (strcmp(argv[i], "--port") == 0 && i + 1 < arg)
+		{
+			options.port = argv[++i];
+		}
+		else if (strcmp(argv[i], "--clients") == 0 && i + 1 < arg)
+		{
+			options.clients = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--senders") == 0 && i + 1 < arg)
+		{
+			options.senders = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < arg)
+		{
+			options.threads = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--rate") == 0 && i + 1 < arg)
+		{
+			options.rate = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--size") == 0 && i + 1 < arg)
+		{
+			if (!options.sizes.Parse(argv[++i]))
+			{
+				printf("bad --size '%s'\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < arg)
+		{
+			options.warmupSeconds = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--duration") == 0 && i + 1 < arg)
+		{
+			options.durationSeconds = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--batch") == 0 && i + 1 < arg)
+		{
+			options.batch = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--rooms") == 0 && i + 1 < arg)
+		{
+			options.rooms = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--compress") == 0)
+		{
+			options.compress = true;
+		}
+		else if (strcmp(argv[i], "--dictionary") == 0 && i + 1 < arg)
+		{
+			dictionaryPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--protocol") == 0 && i + 1 < arg)
+		{
+			int protocol = atoi(argv[++i]);
+			if (protocol != WIRE_V1 && protocol != WIRE_V2)
+			{
+				printf("unknown --protocol %s, 1 or 2\n", argv[i]);
+				return 1;
+			}
+			options.version = (WireVersion)protocol;
+		}
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (options.clients < 1 || options.threads < 1 || options.rate < 0.0 || options.warmupSeconds < 0 || options.durationSeconds < 1 || options.batch < 1 || options.rooms < 0)
+	{
+		printUsage();
+		return 1;
+	}
+
+	CompressionDictionary dictionary;
+	if (dictionaryPath.empty())
+	{
+		dictionary.SetBuiltIn();
+	}
+	else if (!dictionary.Load(dictionaryPath))
+	{
+		return 1;
+	}
+	options.dictionary = &dictionary;
+
+	if (options.senders < 0 || options.senders > options.clients)
+	{
+		options.senders = options.clients;
+	}
+	if (options.threads > options.clients)
+	{
+		options.threads = options.clients;
+	}
+
+	WSADATA wsaData;
+	int result = WSAStartup(MAKEWORD(2, 2), &wsaData);
+	if (result != 0)
+	{
+		printf("WSAStartup failed with error %d\n", result);
+		return 1;
+	}
+
+	struct addrinfo* info = nullptr;
+	struct addrinfo hints;
+	ZeroMemory(&hints, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	result = getaddrinfo(options.host.c_str(), options.port.c_str(), &hints, &info);
+	if (result != 0)
+	{
+		printf("getaddrinfo failed with error %d\n", result);
+		WSACleanup();
+		return 1;
+	}
+
+	printf("%d clients (%d sending) on %d threads, %.0f msgs/s total, chat text %zu-%zu bytes\n",
+		options.clients, options.senders, options.threads, options.rate, options.sizes.m_Min, options.sizes.m_Max);
+	if (options.rooms > 0)
+	{
+		printf("in %d rooms of about %d clients\n", options.rooms, options.clients / options.rooms);
+	}
+	if (options.compress)
+	{
+		printf("asking for compression with dictionary %08x\n", dictionary.m_Id);
+	}
+	if (options.version == WIRE_V2)
+	{
+		printf("asking for the v2 wire format\n");
+	}
+
+	// Clients and the send rate are split evenly, each worker's share of the rate follows its share of senders
+	LoadControl control;
+	std::vector<std::unique_ptr<WorkerStats>> stats;
+	std::vector<std::unique_ptr<LoadWorker>> workers;
+	std::vector<std::thread> threads;
+	int firstClient = 0;
+	for (int t = 0; t < options.threads; t++)
+	{
+		int clientCount = options.clients / options.threads + (t < options.clients % options.threads ? 1 : 0);
+
+		int workerSenders = 0;
+		for (int c = firstClient; c < firstClient + clientCount; c++)
+		{
+			workerSenders += c < options.senders ? 1 : 0;
+		}
+
+		stats.emplace_back(new WorkerStats());
+		workers.emplace_back(new LoadWorker(options, control, *stats.back(), firstClient, clientCount,
+			options.senders > 0 ? options.rate * workerSenders / options.senders : 0.0));
+		firstClient += clientCount;
+	}
+
+	for (std::unique_ptr<LoadWorker>& worker : workers)
+	{
+		threads.emplace_back(&LoadWorker::Run, worker.get(), info);
+	}
+
+	while (control.connected.load() < options.clients && control.failed.load() == 0)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	if (control.failed.load() > 0)
+	{
+		control.stopping = true;
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+		freeaddrinfo(info);
+		WSACleanup();
+		return 1;
+	}
+
+	printf("all %d clients connected\n", options.clients);
+
+	uint64_t startNs = nowNs();
+	control.startNs = startNs;
+	control.measureStartNs = startNs + (uint64_t)options.warmupSeconds * 1000000000;
+	control.started = true;
+
+	// Once a second, what happened in that second
+	uint64_t lastSent = 0;
+	uint64_t lastReceived = 0;
+	uint64_t lastBytes = 0;
+	uint64_t measuredSent = 0;
+	uint64_t measuredReceived = 0;
+	uint64_t measuredBytes = 0;
+	printf("%6s %12s %14s %10s\n", "second", "sent/s", "delivered/s", "MB/s");
+
+	for (int second = 1; second <= options.warmupSeconds + options.durationSeconds; second++)
+	{
+		std::this_thread::sleep_until(g_Epoch + std::chrono::nanoseconds(startNs) + std::chrono::seconds(second));
+
+		uint64_t sent = 0;
+		uint64_t received = 0;
+		uint64_t bytes = 0;
+		for (std::unique_ptr<WorkerStats>& workerStats : stats)
+		{
+			sent += workerStats->sent.load();
+			received += workerStats->received.load();
+			bytes += workerStats->receivedBytes.load();
+		}
+
+		printf("%6d %12llu %14llu %10.1f%s\n", second, (unsigned long long)(sent - lastSent), (unsigned long long)(received - lastReceived),
+			(bytes - lastBytes) / 1e6, second <= options.warmupSeconds ? "  (warm up)" : "");
+
+		if (second == options.warmupSeconds)
+		{
+			measuredSent = sent;
+			measuredReceived = received;
+			measuredBytes = bytes;
+		}
+
+		lastSent = sent;
+		lastReceived = received;
+		lastBytes = bytes;
+	}
+
+	control.stopping = true;
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	LatencyHistogram latency;
+	uint64_t skipped = 0;
+	uint64_t disconnects = 0;
+	for (std::unique_ptr<WorkerStats>& workerStats : stats)
+	{
+		latency.Merge(workerStats->latency);
+		skipped += workerStats->skipped.load();
+		disconnects += workerStats->disconnects.load();
+	}
+
+	double seconds = options.durationSeconds;
+	printf("\nover %d seconds after warm up:\n", options.durationSeconds);
+	printf("  sent        %12.0f msgs/s\n", (lastSent - measuredSent) / seconds);
+	printf("  delivered   %12.0f msgs/s, %.1f MB/s\n", (lastReceived - measuredReceived) / seconds, (lastBytes - measuredBytes) / seconds / 1e6);
+	printf("  latency     p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms (%llu samples)\n",
+		latency.Percentile(50.0) / 1e6, latency.Percentile(99.0) / 1e6, latency.Percentile(99.9) / 1e6, latency.Max() / 1e6,
+		(unsigned long long)latency.Count());
+	if (skipped > 0 || disconnects > 0)
+	{
+		printf("  %llu messages skipped because the server stopped reading, %llu clients disconnected\n",
+			(unsigned long long)skipped, (unsigned long long)disconnects);
+	}
+
+	freeaddrinfo(info);
+	WSACleanup();
+
+	return 0;
+}
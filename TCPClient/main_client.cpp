@@ -11,46 +11,43 @@
 #include <iostream>
 
 #include "string"
-#include "buffer.h"
+#include "../Common/buffer.h"
+#include "../Common/frame_reassembler.h"
+#include "../Common/chat_messages.h"
+#include "../Common/message_writer.h"
 
 // Need to link Ws2_32.lib
 #pragma comment(lib, "Ws2_32.lib")
 
 #define DEFAULT_PORT "8412"
 
-struct PacketHeader
-{
-	uint32_t packetSize;
-	uint32_t messageType;
-};
-
-struct ChatMessage
-{
-	PacketHeader header;
-	uint32_t messageLength;
-	std::string message;
-};
-
 void receiveMessage(SOCKET socket)
 {
-	const int bufSize = 512;
-	Buffer buffer(bufSize);
+	// One large read can hold many messages, the reassembler cuts them apart and keeps any partial one
+	std::vector<uint8_t> chunk(RECV_CHUNK_SIZE);
+	FrameReassembler reassembler;
 
 	while (true)
 	{
-		int result = recv(socket, (char*)(&buffer.m_BufferData[0]), bufSize, 0);
+		int result = recv(socket, (char*)chunk.data(), RECV_CHUNK_SIZE, 0);
 		if (result > 0) 
 		{
-			uint32_t packetSize = buffer.ReadUInt32LE();
-			uint32_t messageType = buffer.ReadUInt32LE();
-
-			// handle the message
-			uint32_t messageLength = buffer.ReadUInt32LE();
-			std::string msg = buffer.ReadString(messageLength);
-
-			std::cout << msg << "\n";
-			
-
+			bool valid = reassembler.Feed(chunk.data(), result, [](const uint8_t* frame, uint32_t packetSize)
+			{
+				// handle the message
+				ChatMessage message;
+				if (decodeMessage(frame, packetSize, message))
+				{
+					std::cout << message.message << "\n";
+				}
+				return true;
+			});
+
+			if (!valid)
+			{
+				std::cout << "Server sent a malformed message.\n";
+				break;
+			}
 		}
 		else if (result == 0)
 		{
@@ -127,29 +124,14 @@ int main(int arg, char** argv)
 
 	ChatMessage message;
 	message.message = "hello";
-	message.messageLength = message.message.length();
-	message.header.messageType = 1; // can use an enum 
-	message.header.packetSize =
-		message.message.length()				// 5 'hello' has 5 bytes in it
-		+ sizeof(message.messageLength)			// 4 , uint32_t  is 4 bytes
-		+ sizeof(message.header.messageType)	// 4 , uint32_t  is 4 bytes
-		+ sizeof(message.header.packetSize);	// 4 , uint32_t  is 4 bytes
-
-	// 5 + 4 + 4 + 4 = 17
-
-	const int bufferSize = 512;
-	Buffer buffer(bufferSize);
-
-	// write our packet to the buffer
-	buffer.WriteUInt32LE(message.header.packetSize); // should be 17
-	buffer.WriteUInt32LE(message.header.messageType); // should be 1
-	buffer.WriteUInt32LE(message.messageLength); // should be 5
-	buffer.WriteString(message.message); // should be hello
-
-	result = send(serverSocket, (const char*)(&buffer.m_BufferData[0]), message.header.packetSize, 0);
-	if (result == SOCKET_ERROR)
+
+	// 4 packetSize + 4 messageType + 4 messageLength + 5 'hello' = 17.
+	// Corked, everything written before the Flush goes out in one send, as one batch frame if there is more than one line
+	MessageWriter writer(serverSocket, FLUSH_CORKED);
+	writer.Write(message);
+
+	if (!writer.Flush())
 	{
-		printf("send failed with error %d\n", WSAGetLastError());
 		closesocket(serverSocket);
 		freeaddrinfo(info);
 		WSACleanup();
@@ -10,7 +10,8 @@
 
 #include <vector>
 #include <string>
-#include "buffer.h"
+#include "../Common/buffer.h"
+#include "../Common/chat_messages.h"
 
 // Need to link Ws2_32.lib
 #pragma comment(lib, "Ws2_32.lib")
@@ -109,7 +110,7 @@ int main(int arg, char** argv)
 		const int bufferSize = 512;
 		Buffer buffer(bufferSize);
 
-		result = recv(newClientSocket, (char*)(&buffer.m_BufferData[0]), bufferSize, 0);
+		result = recv(newClientSocket, (char*)buffer.PrepareWrite(bufferSize), bufferSize, 0);
 		if (result == SOCKET_ERROR)
 		{
 			printf("recv failed with error %d\n", WSAGetLastError());
@@ -119,18 +120,15 @@ int main(int arg, char** argv)
 			return 1;
 		}
 
-		printf("Received %d bytes from the client!\n", result);
+		buffer.CommitWrite(result);
 
-		uint32_t packetSize = buffer.ReadUInt32LE();
-		uint32_t messageType = buffer.ReadUInt32LE();
+		printf("Received %d bytes from the client!\n", result);
 
-		if (messageType == 1)
+		ChatMessage message;
+		if (decodeMessage(buffer.Data(), (uint32_t)buffer.Size(), message))
 		{
 			// handle the message
-			uint32_t messageLength = buffer.ReadUInt32LE();
-			std::string msg = buffer.ReadString(messageLength);
-			
-			printf("PacketSize:%d\nMessageType:%d\nMessageLength:%d\nMessage:%s\n", packetSize, messageType, messageLength, msg.c_str());
+			printf("PacketSize:%d\nMessageType:%d\nMessageLength:%d\nMessage:%.*s\n", (int)buffer.Size(), MESSAGE_TYPE_CHAT, (int)message.message.length(), (int)message.message.length(), message.message.data());
 		}
 	}
 	freeaddrinfo(info);
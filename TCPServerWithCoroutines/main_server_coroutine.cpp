@@ -0,0 +1,164 @@
+#include "../Common/socket_platform.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include "../Common/buffer.h"
+#include "../Common/chat_messages.h"
+#include "../Common/reactor.h"
+#include "../Common/event_loop.h"
+#include "../Common/frame_stream.h"
+#include "../Common/coroutine_server.h"
+
+#define DEFAULT_PORT "8412"
+
+bool g_Quiet = false;
+
+// The same loop TCPServer runs for its one client, here it runs once per client and they all share one thread.
+// Every co_await hands the thread to another client until this one has something to do.
+Task<> handleClient(FrameStream& connection)
+{
+	if (!g_Quiet)
+		printf("Client connected on Socket: %d\n", (int)connection.m_Socket);
+
+	ByteSpan frame;
+	while (co_await connection.ReadFrame(frame))
+	{
+		ChatMessage message;
+		if (!decodeMessage(frame.data, (uint32_t)frame.size, message))
+			continue;
+
+		// handle the message
+		if (!g_Quiet)
+			printf("PacketSize:%d\nMessageType:%d\nMessageLength:%d\nMessage:%.*s\n", (int)frame.size, MESSAGE_TYPE_CHAT, (int)message.message.length(), (int)message.message.length(), message.message.data());
+
+		ChatMessage reply;
+		reply.message = "Server received message from client";
+		bool sent = co_await connection.WriteFrame(reply);
+		if (!sent)
+			break;
+	}
+
+	if (!g_Quiet)
+		printf("Client disconnected from Socket: %d\n", (int)connection.m_Socket);
+}
+
+int main(int arg, char** argv)
+{
+	// --backend select|epoll picks the reactor, --quiet stops the per client logging
+	std::string backend = defaultReactorName();
+	for (int i = 1; i < arg; i++)
+	{
+		if (strcmp(argv[i], "--backend") == 0 && i + 1 < arg)
+		{
+			backend = argv[++i];
+		}
+		else if (strcmp(argv[i], "--quiet") == 0)
+		{
+			g_Quiet = true;
+		}
+	}
+
+	// Initiliaze Winsock
+	WSADATA wsaData;
+	int result;
+
+	// Set version 2.2 with MAKEWORD(2,2)
+	result = WSAStartup(MAKEWORD(2, 2), &wsaData);
+	if (result != 0)
+	{
+		printf("WSAStartup failed with error %d\n", result);
+		return 1;
+	}
+
+	printf("WSAStartup successfully!\n");
+
+	struct addrinfo* info = nullptr;
+	struct addrinfo hints;
+	ZeroMemory(&hints, sizeof(hints));  // ensure we dont have garbage data
+	hints.ai_family = AF_INET;			// IPv4
+	hints.ai_socktype = SOCK_STREAM;	// Stream
+	hints.ai_protocol = IPPROTO_TCP;	// TCP
+	hints.ai_flags = AI_PASSIVE;
+
+	result = getaddrinfo(NULL, DEFAULT_PORT, &hints, &info);
+	if (result != 0)
+	{
+		printf("getaddrinfo failed with error %d\n", result);
+		WSACleanup();
+		return 1;
+	}
+
+	printf("getaddrinfo was successful!\n");
+
+	// Create the socket
+	SOCKET listenSocket = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+	if (listenSocket == INVALID_SOCKET)
+	{
+		printf("socket failed with error %d\n", WSAGetLastError());
+		freeaddrinfo(info);
+		WSACleanup();
+		return 1;
+	}
+
+	printf("socket created successfully!\n");
+
+#ifndef _WIN32
+	// Let a restarted server bind while old connections sit in TIME_WAIT
+	int reuseAddress = 1;
+	setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuseAddress, sizeof(reuseAddress));
+#endif
+
+	// Bind
+	result = bind(listenSocket, info->ai_addr, (int)info->ai_addrlen);
+	if (result == SOCKET_ERROR)
+	{
+		printf("bind failed with error %d\n", WSAGetLastError());
+		closesocket(listenSocket);
+		freeaddrinfo(info);
+		WSACleanup();
+		return 1;
+	}
+
+	printf("bind was successful!\n");
+
+	// listen
+	result = listen(listenSocket, SOMAXCONN);
+	if (result == SOCKET_ERROR)
+	{
+		printf("listen failed with error %d\n", WSAGetLastError());
+		closesocket(listenSocket);
+		freeaddrinfo(info);
+		WSACleanup();
+		return 1;
+	}
+
+	printf("listen was successful!\n");
+
+	std::unique_ptr<Reactor> reactor = createReactor(backend);
+	if (!reactor)
+	{
+		printf("the %s reactor isn't available here\n", backend.c_str());
+		closesocket(listenSocket);
+		freeaddrinfo(info);
+		WSACleanup();
+		return 1;
+	}
+
+	printf("Serving with the %s reactor\n", reactor->Name());
+
+	{
+		EventLoop loop(std::move(reactor));
+		CoroutineServer server(loop, listenSocket, handleClient);
+		loop.Spawn(server.Serve());
+		loop.Run();
+	}
+
+	freeaddrinfo(info);
+	closesocket(listenSocket);
+
+	WSACleanup();
+
+	return 0;
+}
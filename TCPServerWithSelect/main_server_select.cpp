@@ -10,24 +10,29 @@
 
 #include <vector>
 #include <string>
-#include "buffer.h"
+#include "../Common/buffer.h"
+#include "../Common/frame_reassembler.h"
+#include "../Common/chat_messages.h"
+#include "../Common/timer_wheel.h"
+#include "../Common/slot_map.h"
 
 // Need to link Ws2_32.lib
 #pragma comment(lib, "Ws2_32.lib")
 
 #define DEFAULT_PORT "8412"
 
-struct PacketHeader
-{
-	uint32_t packetSize;
-	uint32_t messageType;
-};
+// Most connections taken per wakeup, enough to drain a reconnect storm quickly without starving the clients already here
+#define ACCEPT_BUDGET 128
 
-struct ChatMessage
+// A client that sends nothing for this long is taken for gone and disconnected
+#define IDLE_TIMEOUT_MS (5 * 60 * 1000)
+
+// Everything we keep per client, the idle deadline is moved on every receive
+struct Connection
 {
-	PacketHeader header;
-	uint32_t messageLength;
-	std::string message;
+	SOCKET socket;
+	FrameReassembler reassembler;	// one large read can hold many messages, this cuts them apart and keeps any partial one
+	TimerWheel::Timer idleTimer;
 };
 
 int main(int arg, char** argv)
@@ -103,9 +108,16 @@ int main(int arg, char** argv)
 
 	printf("listen was successful!\n");
 
+	// Non-blocking so we can accept until the backlog is empty without getting stuck on the last one
+	u_long nonBlocking = 1;
+	ioctlsocket(listenSocket, FIONBIO, &nonBlocking);
+
 	// create our sets
 
-	std::vector<SOCKET> activeConnections;
+	// Dropping a client swaps the last one into its place, so a thousand leaving at once doesn't shift the rest a thousand times
+	SlotMap<Connection> connections;
+
+	std::vector<uint8_t> chunk(RECV_CHUNK_SIZE);
 
 	FD_SET activeSockets;				// list of all the clients connections
 	FD_SET socketsReadyForReading;		// list of all the clients ready to ready
@@ -113,10 +125,16 @@ int main(int arg, char** argv)
 	FD_ZERO(&activeSockets);              // Intializze the sets
 	FD_ZERO(&socketsReadyForReading);
 
-	// use a timeval to prevent select from waiting forever
-	timeval tv;
-	tv.tv_sec = 1;
-	tv.tv_usec = 0;
+	// Finding the idle deadlines that ran out never looks at the others
+	TimerWheel timers;
+
+	auto disconnect = [&](SlotMap<Connection>::Handle handle)
+	{
+		SOCKET socket = connections.Get(handle)->socket;
+		closesocket(socket);
+		FD_CLR(socket, &activeSockets);
+		connections.Remove(handle);
+	};
 
 	while (true)
 	{
@@ -126,12 +144,21 @@ int main(int arg, char** argv)
 		FD_SET(listenSocket, &socketsReadyForReading);
 
 		// Add all our active connections to our ready to read
-		for (int i = 0; i < activeConnections.size(); i++)
+		for (Connection& connection : connections)
 		{
-			FD_SET(activeConnections[i], &socketsReadyForReading);
+			FD_SET(connection.socket, &socketsReadyForReading);
 		}
 
-		int count = select(0, &socketsReadyForReading, NULL, NULL, &tv);
+		// Wait until a socket is ready or the next idle deadline, with no clients that is for as long as it takes
+		int timeoutMs = timers.TimeoutMs(-1);
+		timeval tv;
+		tv.tv_sec = timeoutMs / 1000;
+		tv.tv_usec = (timeoutMs % 1000) * 1000;
+
+		int count = select(0, &socketsReadyForReading, NULL, NULL, timeoutMs < 0 ? NULL : &tv);
+
+		// Disconnects whoever has been silent for too long
+		timers.Advance();
 
 		if (count == 0)
 		{
@@ -144,82 +171,67 @@ int main(int arg, char** argv)
 			continue;
 		}
 
-		// Loop through 
-		for (int i = 0; i < activeConnections.size(); i++)
+		// Loop through, a client that is dropped has the last one moved into its place, which is looked at next
+		for (size_t i = 0; i < connections.Size();)
 		{
-			SOCKET socket = activeConnections[i];
+			Connection& connection = connections[i];
+			SOCKET socket = connection.socket;
 
 			if (FD_ISSET(socket, &socketsReadyForReading))
 			{
 				// handle receiving data
-				const int bufSize = 512;
-				Buffer buffer(bufSize);
-
-				int result = recv(socket, (char*)(&buffer.m_BufferData[0]), bufSize, 0);
+				int result = recv(socket, (char*)chunk.data(), RECV_CHUNK_SIZE, 0);
 
 				if (result == SOCKET_ERROR)
 				{
 					printf("recv failed with error %d\n", WSAGetLastError());
-					closesocket(socket);
-					FD_CLR(socket, &activeSockets);
-					activeConnections.erase(activeConnections.begin() + i);
-					i--;
+					disconnect(connections.HandleAt(i));
 					continue;
 				}
 				else if (result == 0)
 				{
 					printf("Client disconnect");
-					closesocket(socket);
-					FD_CLR(socket, &activeSockets);
-					activeConnections.erase(activeConnections.begin() + i);
-					i--;
+					disconnect(connections.HandleAt(i));
 					continue;
 				}
 
-				uint32_t packetSize = buffer.ReadUInt32LE();
-				uint32_t messageType = buffer.ReadUInt32LE();
+				timers.Arm(connection.idleTimer, IDLE_TIMEOUT_MS);
 
-				if (messageType == 1)
+				bool valid = connection.reassembler.Feed(chunk.data(), result, [&](const uint8_t* frame, uint32_t packetSize)
 				{
-					// handle the message
-					uint32_t messageLength = buffer.ReadUInt32LE();
-					std::string msg = buffer.ReadString(messageLength);
-
-					printf("PacketSize:%d\nMessageType:%d\nMessageLength:%d\nMessage:%s\n", packetSize, messageType, messageLength, msg.c_str());
-
-					ChatMessage message;
-					message.message = "Server received message from client";
-					message.messageLength = message.message.length();
-					message.header.messageType = 1; // can use an enum 
-					message.header.packetSize =
-						message.message.length()				// 5 'hello' has 5 bytes in it
-						+ sizeof(message.messageLength)			// 4 , uint32_t  is 4 bytes
-						+ sizeof(message.header.messageType)	// 4 , uint32_t  is 4 bytes
-						+ sizeof(message.header.packetSize);	// 4 , uint32_t  is 4 bytes
-
-					// 5 + 4 + 4 + 4 = 17
-					Buffer bufferSend(bufSize);
-
-					// write our packet to the buffer
-					bufferSend.WriteUInt32LE(message.header.packetSize); // should be 17
-					bufferSend.WriteUInt32LE(message.header.messageType); // should be 1
-					bufferSend.WriteUInt32LE(message.messageLength); // should be 5
-					bufferSend.WriteString(message.message); // should be hello
-
-					for (int j = 0; j < activeConnections.size(); j++)
+					ChatMessage received;
+					if (decodeMessage(frame, packetSize, received))
 					{
-						SOCKET outSocket = activeConnections[j];
+						// handle the message
+						std::string_view msg = received.message;
+
+						printf("PacketSize:%d\nMessageType:%d\nMessageLength:%d\nMessage:%.*s\n", packetSize, MESSAGE_TYPE_CHAT, (int)msg.length(), (int)msg.length(), msg.data());
+
+						ChatMessage message;
+						message.message = "Server received message from client";
+
+						Buffer bufferSend;
+						uint32_t sendSize = encodeMessage(message, bufferSend);
 
-						if (outSocket != listenSocket)
+						for (Connection& outConnection : connections)
 						{
-							send(outSocket, (const char*)(&bufferSend.m_BufferData[0]), message.header.packetSize, 0);
+							send(outConnection.socket, (const char*)bufferSend.Data(), sendSize, 0);
 						}
 					}
+					return true;
+				});
+
+				if (!valid)
+				{
+					printf("Client sent a malformed message, disconnecting\n");
+					disconnect(connections.HandleAt(i));
+					continue;
 				}
 
 				FD_CLR(socket, &socketsReadyForReading);
 				count--;
 			}
+			i++;
 		}
 
 		// Handle any new connections
@@ -228,19 +240,42 @@ int main(int arg, char** argv)
 		{
 			if (FD_ISSET(listenSocket, &socketsReadyForReading))
 			{
-				SOCKET newConnection = accept(listenSocket, NULL, NULL);
-				if (newConnection == INVALID_SOCKET)
+				// Take everything waiting, up to the budget. Whatever is left keeps the listen socket readable
+				// so the next select comes straight back for it.
+				for (int accepted = 0; accepted < ACCEPT_BUDGET; accepted++)
 				{
-					printf("accept failed with error %d\n", WSAGetLastError());
-				}
-				else
-				{
-					activeConnections.push_back(newConnection);
-					FD_SET(newConnection, &activeConnections);
-					FD_CLR(listenSocket, &socketsReadyForReading);
+					SOCKET newConnection = accept(listenSocket, NULL, NULL);
+					if (newConnection == INVALID_SOCKET)
+					{
+						int error = WSAGetLastError();
+						if (error != WSAEWOULDBLOCK)
+						{
+							printf("accept failed with error %d\n", error);
+						}
+						break;
+					}
+
+					// Accepted sockets inherit non-blocking from the listen socket, our sends expect blocking ones.
+					// And a child process shouldn't keep a client's connection open.
+					u_long blocking = 0;
+					ioctlsocket(newConnection, FIONBIO, &blocking);
+					SetHandleInformation((HANDLE)newConnection, HANDLE_FLAG_INHERIT, 0);
+
+					SlotMap<Connection>::Handle handle = connections.Insert(Connection());
+					FD_SET(newConnection, &activeSockets);
+
+					Connection& connection = *connections.Get(handle);
+					connection.socket = newConnection;
+					connection.idleTimer.m_Callback = [&, handle]()
+					{
+						printf("Client on socket %d was idle for too long, disconnecting\n", (int)connections.Get(handle)->socket);
+						disconnect(handle);
+					};
+					timers.Arm(connection.idleTimer, IDLE_TIMEOUT_MS);
 
 					printf("Client connect with socket: %d\n", (int)newConnection);
 				}
+				FD_CLR(listenSocket, &socketsReadyForReading);
 			}
 		}
 	}
@@ -248,9 +283,9 @@ int main(int arg, char** argv)
 	freeaddrinfo(info);
 	closesocket(listenSocket);
 	
-	for (int i = 0; i < activeConnections.size(); i++)
+	for (Connection& connection : connections)
 	{
-		closesocket(activeConnections[i]);
+		closesocket(connection.socket);
 	}
 
 	WSACleanup();
@@ -0,0 +1,72 @@
+// Chat batches converted between wire versions, the way the server converts every frame from a v2 client.
+//
+// A batch's count comes off the wire as it is. One claiming far more lines than its frames could hold must be
+// rejected before anything is sized from it, and real batches of the smallest lines must still convert.
+//
+// Build and run from the repository root, exits with 1 if any check fails:
+//   g++ -O2 -std=c++17 -o chat_batch_test Tests/chat_batch_test.cpp
+//   ./chat_batch_test
+
+#include "../Common/chat_messages.h"
+
+#include <stdio.h>
+
+static int failures = 0;
+
+static void check(bool condition, const char* what)
+{
+	printf("%s: %s\n", condition ? "ok" : "FAILED", what);
+	failures += !condition;
+}
+
+// A batch of count lines whose frames are the given bytes, in version
+static Buffer batchFrame(WireVersion version, uint32_t count, const uint8_t* frames, size_t length)
+{
+	ChatBatchMessage batch;
+	batch.count = count;
+	batch.frames = std::string_view((const char*)frames, length);
+
+	Buffer frame;
+	encodeMessage(batch, frame, version);
+	return frame;
+}
+
+int main()
+{
+	// Eight bytes of frames claiming four billion lines
+	uint8_t junk[8] = { 0 };
+	for (WireVersion version : { WIRE_V1, WIRE_V2 })
+	{
+		Buffer frame = batchFrame(version, 0xFFFFFFFF, junk, sizeof(junk));
+		Buffer out;
+		bool converted = convertFrame(version, version == WIRE_V1 ? WIRE_V2 : WIRE_V1, frame.Data(), (uint32_t)frame.Size(), out);
+		check(!converted && out.Size() == 0, version == WIRE_V1 ? "v1 batch with an oversized count is rejected" : "v2 batch with an oversized count is rejected");
+	}
+
+	// As many empty lines as v2 fits, each as small as a frame gets
+	Buffer lines;
+	uint32_t count = 100;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		ChatMessage empty;
+		encodeMessage(empty, lines, WIRE_V2);
+	}
+	Buffer compact = batchFrame(WIRE_V2, count, lines.Data(), lines.Size());
+
+	Buffer plain;
+	bool converted = convertFrame(WIRE_V2, WIRE_V1, compact.Data(), (uint32_t)compact.Size(), plain);
+	check(converted, "v2 batch of empty lines converts to v1");
+
+	ChatBatchMessage batch;
+	uint32_t seen = 0;
+	bool whole = converted && decodeMessage(plain.Data(), (uint32_t)plain.Size(), batch)
+		&& forEachBatchedChat(batch, [&](const uint8_t*, uint32_t, const ChatMessage& line) { seen += line.message.empty(); });
+	check(whole && seen == count, "every line comes through");
+
+	// One line short of what the count says
+	Buffer shortBatch = batchFrame(WIRE_V2, count + 1, lines.Data(), lines.Size());
+	Buffer out;
+	check(!convertFrame(WIRE_V2, WIRE_V1, shortBatch.Data(), (uint32_t)shortBatch.Size(), out), "batch with fewer lines than its count is rejected");
+
+	return failures == 0 ? 0 : 1;
+}
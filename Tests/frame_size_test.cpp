@@ -0,0 +1,113 @@
+// Frames at the edge of MAX_FRAME_SIZE, the way the server converts them from v2 clients and keeps them in history.
+//
+// v2 frames are smaller than the same message in v1, so one just under the limit can come out over it once
+// converted. Such a frame must not convert, every v1 reader would drop the connection at it, and the history
+// must not keep one either or it would be replayed to every client that joins.
+//
+// Build and run from the repository root, exits with 1 if any check fails:
+//   g++ -O2 -std=c++17 -o frame_size_test Tests/frame_size_test.cpp
+//   ./frame_size_test
+
+#include "../Common/chat_messages.h"
+#include "../ChatServer/history_log.h"
+
+#include <stdio.h>
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+static int failures = 0;
+
+static void check(bool condition, const char* what)
+{
+	printf("%s: %s\n", condition ? "ok" : "FAILED", what);
+	failures += !condition;
+}
+
+// A chat frame of exactly frameSize bytes in version
+static Buffer chatFrameOfSize(WireVersion version, uint32_t frameSize)
+{
+	std::string text(frameSize, 'x');
+	ChatMessage chat;
+	chat.message = text;
+
+	Buffer frame;
+	encodeMessage(chat, frame, version);
+	chat.message = chat.message.substr(0, text.size() - (frame.Size() - frameSize));
+
+	frame.Clear();
+	encodeMessage(chat, frame, version);
+	return frame;
+}
+
+static bool isWholeFrame(WireVersion version, const Buffer& frame)
+{
+	uint32_t frameSize;
+	return peekFrameSize(version, frame.Data(), frame.Size(), frameSize) == FRAME_SIZE_KNOWN && frameSize == frame.Size();
+}
+
+int main()
+{
+	// The largest v2 chat frame there is, 3 bytes of bodySize and MAX_FRAME_SIZE of body
+	Buffer largest = chatFrameOfSize(WIRE_V2, (uint32_t)COMPACT_MAX_SIZE_BYTES + MAX_FRAME_SIZE);
+	check(isWholeFrame(WIRE_V2, largest), "largest v2 chat frame is valid");
+
+	Buffer out;
+	out.WriteUInt32LE(0xCAFE);
+	bool converted = convertFrame(WIRE_V2, WIRE_V1, largest.Data(), (uint32_t)largest.Size(), out);
+	check(!converted && out.Size() == 4, "it doesn't convert to v1, and nothing is left in out");
+
+	// One that comes out at exactly the limit
+	Buffer fits = chatFrameOfSize(WIRE_V1, MAX_FRAME_SIZE);
+	Buffer compact;
+	convertFrame(WIRE_V1, WIRE_V2, fits.Data(), (uint32_t)fits.Size(), compact);
+	Buffer back;
+	converted = convertFrame(WIRE_V2, WIRE_V1, compact.Data(), (uint32_t)compact.Size(), back);
+	check(converted && back.Size() == MAX_FRAME_SIZE && isWholeFrame(WIRE_V1, back), "v2 chat frame of a v1 MAX_FRAME_SIZE converts");
+
+	// A v2 batch under the limit whose lines each convert, but not all of them in one v1 frame
+	std::string text(100, 'y');
+	ChatMessage line;
+	line.message = text;
+
+	Buffer lines;
+	uint32_t count = 10000;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		encodeMessage(line, lines, WIRE_V2);
+	}
+	ChatBatchMessage batch;
+	batch.count = count;
+	batch.frames = std::string_view((const char*)lines.Data(), lines.Size());
+	Buffer batchFrame;
+	encodeMessage(batch, batchFrame, WIRE_V2);
+	check(isWholeFrame(WIRE_V2, batchFrame), "v2 batch of 100 byte lines is valid");
+
+	Buffer batchOut;
+	converted = convertFrame(WIRE_V2, WIRE_V1, batchFrame.Data(), (uint32_t)batchFrame.Size(), batchOut);
+	check(!converted && batchOut.Size() == 0, "it doesn't convert to v1");
+
+	// The history takes frames up to the limit and nothing larger
+	uint64_t now = (uint64_t)std::chrono::system_clock::now().time_since_epoch().count();
+	std::string directory = (std::filesystem::temp_directory_path() / ("frame_size_test." + std::to_string(now))).string();
+	{
+		HistoryLog history;
+		if (!history.Open(directory, defaultHistoryRetention()))
+			return 1;
+
+		// Eight bytes over, the way the largest v2 chat frame came out in v1
+		Buffer tooLarge = chatFrameOfSize(WIRE_V1, MAX_FRAME_SIZE);
+		tooLarge.WriteUInt64LE(0);
+		storeUInt32LE((uint8_t*)tooLarge.Data(), (uint32_t)tooLarge.Size());
+		history.Append(tooLarge.Data(), tooLarge.Size());
+		check(history.Count() == 0, "history doesn't keep a frame over MAX_FRAME_SIZE");
+
+		history.Append(fits.Data(), fits.Size());
+		check(history.Count() == 1, "history keeps one of MAX_FRAME_SIZE");
+	}
+
+	std::error_code error;
+	std::filesystem::remove_all(directory, error);
+
+	return failures == 0 ? 0 : 1;
+}